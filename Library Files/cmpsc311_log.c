@@ -238,7 +238,7 @@ int vlogMessage( unsigned long lvl, const char *fmt, va_list args ) {
 
     // Add header with descriptor names
     time(&tm);
-    strncpy(tbuf, ctime((const time_t *)&tm), MAX_LOG_MESSAGE_SIZE);
+    ctime_r(&tm, tbuf);
     tbuf[strlen(tbuf)-1] = 0x0;
     strncat(tbuf, " [", MAX_LOG_MESSAGE_SIZE);
     for ( i=0; i<MAX_LOG_LEVEL; i++ ) {
@@ -14,6 +14,7 @@
 
 // System include files
 #include <stdint.h>
+#include <pthread.h>
 #include <gcrypt.h>
 
 // Project Include Files
@@ -23,12 +24,49 @@
 //
 // Global data
 
-int gcrypt_initialized = 0;  // Flag indicating the library needs to be initialized
-gcry_md_hd_t *hfunc = NULL;  // A pointer to the gcrypt hash structure
+pthread_once_t gcrypt_once = PTHREAD_ONCE_INIT;  // Initializes the library once for all threads
+__thread int gcrypt_initialized = 0;  // Flag indicating the hash of this thread needs to be created
+__thread gcry_md_hd_t *hfunc = NULL;  // A pointer to the gcrypt hash structure (one per thread)
+pthread_key_t gcrypt_key;  // Closes the hash structure of each thread when it exits
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_gcrypt
+// Description  : Initialize the GCRYPT library, run once by the first thread
+//                that generates a signature
+//
+// Inputs       : none
+// Outputs      : none
+
+void init_gcrypt( void ) {
+
+	// Check the version, which initializes the library
+	gcry_check_version( GCRYPT_VERSION );
+
+	// Have each thread close its hash structure when it exits
+	if ( pthread_key_create( &gcrypt_key, close_gcrypt ) ) {
+		logMessage( LOG_ERROR_LEVEL, "Unable to create the hash key" );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : close_gcrypt
+// Description  : Close the hash structure of a thread, run when it exits
+//
+// Inputs       : hash - the hash structure of the thread
+// Outputs      : none
+
+void close_gcrypt( void *hash ) {
+
+	// Close the hash, then free the structure holding it
+	gcry_md_close( *(gcry_md_hd_t *)hash );
+	free( hash );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : generate_md5_signature
@@ -48,11 +86,11 @@ int generate_md5_signature( unsigned char *buf, uint32_t size,
 	gcry_error_t err;
 	unsigned char *hvalue;
 
-	// If the GCRYPT interface not initialized
+	// If the GCRYPT interface not initialized (for this thread)
 	if ( ! gcrypt_initialized ) {
 
 		// Initialize the library
-		gcry_check_version( GCRYPT_VERSION );
+		pthread_once( &gcrypt_once, init_gcrypt );
 
 		// Create the hash structure
 		hfunc = malloc( sizeof(gcry_md_hd_t) );
@@ -60,9 +98,14 @@ int generate_md5_signature( unsigned char *buf, uint32_t size,
 		err = gcry_md_open( hfunc, CMPSC311_HASH_TYPE, 0 );
 		if ( err != GPG_ERR_NO_ERROR  ) {
 			logMessage( LOG_ERROR_LEVEL, "Unable to init hash algorithm  [%s]", gcry_strerror(err) );
+			free( hfunc );
+			hfunc = NULL;
 			return( -1 );
 		}
 
+		// Close it when the thread exits
+		pthread_setspecific( gcrypt_key, hfunc );
+
 		// Set the initialized flag
 		gcrypt_initialized = 1;
 	}
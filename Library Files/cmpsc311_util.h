@@ -25,6 +25,12 @@
 
 // Functional prototypes
 
+void init_gcrypt( void );
+    // Initialize the GCRYPT library (run once, before the first signature)
+
+void close_gcrypt( void *hash );
+    // Close the hash structure of a thread (run when the thread exits)
+
 int generate_md5_signature( unsigned char *buf, uint32_t size,
 		                    unsigned char *sig, uint32_t *sigsz );
     // Generate MD5 signature from buffer
@@ -16,7 +16,13 @@
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <assert.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdio.h>
 
 // Project Include files
 #include <smsa.h>
@@ -29,22 +35,70 @@
 //#define SMSA_BLOCK_ADDRESS(drum,blk) ((smsa_disk_array[drum])+(blk*SMSA_BLOCK_SIZE))
 #define SMSA_BLOCK_ADDRESS(drum,blk) &smsa_disk_array[drum][blk*SMSA_BLOCK_SIZE]
 // #define SMSA_STORAGE_ENABLED
-#define SMSA_ROW(x) ((int)x/4)
-#define SMSA_COL(x) (x%4)
+#ifdef SMSA_STORAGE_ENABLED
+#define SMSA_DEFAULT_STORAGE SMSA_STORAGE_FILE
+#else
+#define SMSA_DEFAULT_STORAGE SMSA_STORAGE_MEMORY
+#endif
+#define SMSA_DEFAULT_SYNC SMSA_SYNC_UNMOUNT
 #define SMSA_DIFF(x,y) ((x>y) ? (x-y) : (y-x))
+#define SMSA_ARRAY_BLOCKS (SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID)
+#define SMSA_DIRTY_WORDS ((SMSA_ARRAY_BLOCKS+63)/64)
+#define SMSA_MAX_STORE_RUN (1<<30)
+#define SMSA_DIRTY_INDEX(drum,blk) ((drum)*SMSA_MAX_BLOCK_ID+(blk))
+#define SMSA_IS_DIRTY(idx) ((smsa_dirty_map[(idx)/64]>>((idx)%64))&1)
 
 //
 // Library global data
 
 static uint8_t				smsa_library_initialized = 0;	// Flag indicating the library init occurred
 static uint32_t				smsa_mount_state = 0;  			// Mount state (0=not mounted, 1=mounted)
-SMSA_ERROR_LEVEL			smsa_error_number = 0;			// This is the current error number
+__thread SMSA_ERROR_LEVEL		smsa_error_number = 0;			// This is the current error number (of the calling thread)
+SMSA_GEOMETRY				smsa_geometry = { SMSA_DEFAULT_DRUMS, SMSA_DEFAULT_BLOCKS, SMSA_DEFAULT_BLOCK_SIZE }; // The shape of the array
 
 // This is the disk array itself
 static uint8_t				smsa_drum_head; // The current drum under eval
 static uint32_t				smsa_read_head; // The current read position on the drum
-static unsigned char		       *smsa_disk_array[SMSA_DISK_ARRAY_SIZE]; // The disk memory
-static unsigned long                    smsa_cycle_count = 0; // This is the clock count for the SMSA
+static unsigned char		       *smsa_disk_array[SMSA_MAX_DISK_ARRAY_SIZE]; // The disk memory
+static unsigned char		       *smsa_array_base = NULL; // All of the drums, one after the other
+static uint64_t			       *smsa_dirty_map = NULL; // Blocks changed since the last load/store
+static unsigned long                    smsa_cycle_count = 0; // This is the clock count for the SMSA (only changed atomically)
+static uint32_t				smsa_block_heads[SMSA_MAX_DISK_ARRAY_SIZE]; // Where smsa_operation_at left the head of each drum (only changed atomically)
+static pthread_rwlock_t			smsa_drum_locks[SMSA_MAX_DISK_ARRAY_SIZE]; // Reads share a drum, writes and formats have it to themselves
+static pthread_once_t			smsa_locks_once = PTHREAD_ONCE_INIT; // Sets up the drum locks on first use
+static __thread unsigned long		smsa_owed_cycles; // Cycles the operation of this thread has cost so far
+
+// These are the device models, the first is the default
+static const SMSA_DEVICE_MODEL smsa_device_presets[] = {
+	// The original costs, a drum seek costs for both rows and columns
+	{ "classic", 10000, 10000, 4, 1000, 1000, SMSA_SEEK_LINEAR, 0, 10, 0, 50, 200, 0, NULL },
+	// A spinning disk, platters a short hop apart and an arm that accelerates
+	{ "hdd", 50000, 20000, 4, 2000, 500, SMSA_SEEK_SQRT, 100, 40, 800, 20, 25, 20000, NULL },
+	// Flash, no seeks, writes dearer than reads and erasing a drum dearer still
+	{ "ssd", 1000, 1000, SMSA_MAX_DISK_ARRAY_SIZE, 0, 0, SMSA_SEEK_LINEAR, 0, 0, 0, 25, 100, 2000, NULL },
+};
+
+// This is the device model the costs come from
+static SMSA_DEVICE_MODEL		smsa_device_model;     // The model set for the next mount
+static int				smsa_device_model_set = 0; // Flag indicating a model was set
+static SMSA_DEVICE_MODEL		smsa_mounted_device = { "classic", 10000, 10000, 4, 1000, 1000, SMSA_SEEK_LINEAR, 0, 10, 0, 50, 200, 0, NULL }; // The model of the mounted array (classic until the first mount)
+
+// This is the latency emulated on the wall clock
+static SMSA_LATENCY			smsa_latency = { 0, 0, 0 }; // The latency set for the next mount
+static SMSA_LATENCY			smsa_mounted_latency; // The latency of the mounted array
+static uint64_t				smsa_channel_free[SMSA_MAX_DISK_ARRAY_SIZE][SMSA_MAX_DRUM_CHANNELS]; // When each channel of a drum is next free (ns, only changed atomically)
+static uint64_t				smsa_delayed_ops = 0;    // Operations that were delayed
+static uint64_t				smsa_delayed_nanos = 0;  // Time they took to perform
+static uint64_t				smsa_queued_nanos = 0;   // Time they waited for a channel of their drum
+static __thread uint32_t		smsa_jitter_seed = 0;    // The random state of the jitter of this thread
+
+// This is where the array is kept between mounts
+static SMSA_STORAGE			smsa_storage = SMSA_STORAGE_DEFAULT; // The storage set for the next mount
+static SMSA_SYNC			smsa_sync = SMSA_SYNC_DEFAULT;       // The sync set for the next mount
+static char				smsa_disk_file[PATH_MAX] = SMSA_DISK_FILE; // The file the array is kept in
+static SMSA_STORAGE			smsa_mounted_storage;  // The storage of the mounted array
+static SMSA_SYNC			smsa_mounted_sync;     // The sync of the mounted array
+static long				smsa_page_size;        // The page size of the mapped array
 
 // This is the text associated with the SMSA operation (commands)
 static const char *smsa_op_text[] = {
@@ -89,7 +143,8 @@ static const char *smsa_error_text[] = {
 int smsa_operation( uint32_t op, unsigned char *block ) {
 
 	// Local variables
-	int retcode = 0;
+	int retcode = 0, exclusive;
+	SMSA_DRUM_ID first, last;
 	SMSA_OPERATION dop;
 
 	// Decode the command and log it if verbose
@@ -111,7 +166,19 @@ int smsa_operation( uint32_t op, unsigned char *block ) {
 	}
 
 	// Count the cycles the operation will take
-	smsa_cycle_count += operation_cycle_cost( dop.cmd, dop.did, dop.bid );
+	smsa_owed_cycles = 0;
+	charge_cycles( operation_cycle_cost(dop.cmd, dop.did, dop.bid) );
+
+	// Hold the drums the operation uses, so it can run alongside smsa_operation_at
+	first = last = smsa_drum_head;
+	exclusive = (dop.cmd != SMSA_DISK_READ) && (dop.cmd != SMSA_BLOCK_SIGN);
+	if ( (dop.cmd == SMSA_MOUNT) || (dop.cmd == SMSA_UNMOUNT) ) {
+		first = 0;
+		last = SMSA_MAX_DISK_ARRAY_SIZE-1;
+	} else if ( dop.cmd == SMSA_BLOCK_SIGN ) {
+		first = last = dop.did;
+	}
+	lock_drums( first, last, exclusive );
 
 	// Perform the disk operation
 	switch (dop.cmd) {
@@ -158,7 +225,84 @@ int smsa_operation( uint32_t op, unsigned char *block ) {
 			break;
 	}
 
-	// Return successfully
+	// Release the drums, take as long as the operation would and return
+	unlock_drums( first, last );
+	emulate_latency( first );
+	return( retcode );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_operation_at
+// Description  : This is the reentrant interface to the disk array. It works
+//                at the drum and block it is given rather than at the heads,
+//                so threads can call it at the same time. Reads and signatures
+//                share a drum, writes and formats have it to themselves, and
+//                operations on different drums never wait on each other.
+//
+// Inputs       : cmd - SMSA_DISK_READ, SMSA_DISK_WRITE, SMSA_FORMAT_DRUM or SMSA_BLOCK_SIGN
+//                did - the drum to operate on
+//                bid - the first block to operate on (ignored by a format)
+//                count - the number of blocks to read or write (ignored otherwise)
+//                blocks - the buffer of count blocks to read into or write from
+// Outputs      : 0 if successful test, -1 if failure
+
+int smsa_operation_at( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count, unsigned char *blocks ) {
+
+	// Local variables
+	int retcode;
+
+	// Check the command and drum before taking the drum lock
+	if ( cmd >= SMSA_MAX_COMMAND ) {
+		logMessage( LOG_ERROR_LEVEL, "OP Illegal disk command at [%u]", cmd );
+		smsa_error_number = SMSA_BAD_OPCODE;
+		return( -1 );
+	}
+	logMessage( LOG_INFO_LEVEL, "SMSA Array received operation at [%s/did=%d,blk=%d,count=%u]",
+			smsa_op_text[cmd], did, bid, count );
+	if ( did >= SMSA_MAX_DISK_ARRAY_SIZE ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal drum at [%u]", did );
+		smsa_error_number = SMSA_BAD_DRUM_ID;
+		return( -1 );
+	}
+
+	// Hold the drum, shared unless the operation changes it
+	smsa_owed_cycles = 0;
+	lock_drums( did, did, (cmd == SMSA_DISK_WRITE) || (cmd == SMSA_FORMAT_DRUM) );
+
+	// Perform the disk operation
+	switch (cmd) {
+
+		case SMSA_DISK_READ: // Read from the disk
+			retcode = SMSAReadBlocksAt( did, bid, count, blocks );
+			break;
+
+		case SMSA_DISK_WRITE: // Write to the disk
+			retcode = SMSAWriteBlocksAt( did, bid, count, blocks );
+			break;
+
+		case SMSA_FORMAT_DRUM: // Format the drum (zeros)
+			retcode = SMSAFormatDrumAt( did );
+			break;
+
+		case SMSA_BLOCK_SIGN: // Generate a signature for a block (and output to log)
+			if ( ! smsa_mount_state ) {
+				smsa_error_number = SMSA_UNMOUNTED_DISK;
+				retcode = -1;
+			} else {
+				retcode = SMSABlockSign( did, bid );
+			}
+			break;
+
+		default: logMessage( LOG_ERROR_LEVEL, "OP Disk command [%s] needs the heads", smsa_op_text[cmd] );
+			smsa_error_number = SMSA_BAD_OPCODE;
+			retcode = -1;
+			break;
+	}
+
+	// Release the drum, take as long as the operation would and return
+	unlock_drums( did, did );
+	emulate_latency( did );
 	return( retcode );
 }
 
@@ -203,7 +347,7 @@ int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block ) {
 		smsa_error_number =	SMSA_BAD_DRUM_ID;
 		return( -1 );
 	}
-	if ( block >= SMSA_DISK_SIZE ) {
+	if ( block >= SMSA_MAX_BLOCK_ID ) {
 		logMessage( LOG_ERROR_LEVEL, "Illegal signature block [%u/%u]",	smsa_drum_head, smsa_read_head );
 		smsa_error_number =	SMSA_BAD_BLOCK_ID;
 		return( -1 );
@@ -235,7 +379,148 @@ int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block ) {
 unsigned long smsa_get_cycle_count( void ) {
 
 	// Return the cycle count
-	return( smsa_cycle_count );
+	return( __sync_add_and_fetch(&smsa_cycle_count, 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_storage
+// Description  : Set where the array is kept, which takes effect on the next
+//                mount. The defaults leave it to the environment.
+//
+// Inputs       : storage - where the array is kept (SMSA_STORAGE_DEFAULT for default)
+//                sync - how a mapped array is synced (SMSA_SYNC_DEFAULT for default)
+//                file - the disk file (NULL for SMSA_DISK_FILE)
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_set_storage( SMSA_STORAGE storage, SMSA_SYNC sync, const char *file ) {
+
+	// Check the storage, sync and file
+	if ( (storage > SMSA_STORAGE_MMAP) || (sync > SMSA_SYNC_WRITE) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal array storage [%d/%d]", storage, sync );
+		return( -1 );
+	}
+	if ( (file != NULL) && ((*file == '\0') || (strlen(file) >= PATH_MAX)) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal array disk file [%s]", file );
+		return( -1 );
+	}
+
+	// Save them for the next mount and return successfully
+	smsa_storage = storage;
+	smsa_sync = sync;
+	strcpy( smsa_disk_file, (file != NULL) ? file : SMSA_DISK_FILE );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_geometry
+// Description  : Set the geometry of the array, which takes effect on the next
+//                mount. It can not change while the array is mounted.
+//
+// Inputs       : drums - the drums in the array (0 for SMSA_DEFAULT_DRUMS)
+//                blocks - the blocks on each drum (0 for SMSA_DEFAULT_BLOCKS)
+//                blockSize - the bytes in each block (0 for SMSA_DEFAULT_BLOCK_SIZE)
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_set_geometry( uint32_t drums, uint32_t blocks, uint32_t blockSize ) {
+
+	// Fill in the defaults
+	drums = (drums == 0) ? SMSA_DEFAULT_DRUMS : drums;
+	blocks = (blocks == 0) ? SMSA_DEFAULT_BLOCKS : blocks;
+	blockSize = (blockSize == 0) ? SMSA_DEFAULT_BLOCK_SIZE : blockSize;
+
+	// Check the geometry, it has to fit in the opcode
+	if ( smsa_mount_state ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to change the geometry of a mounted disk array." );
+		return( -1 );
+	}
+	if ( (drums > SMSA_MAX_DISK_ARRAY_SIZE) || (blocks < SMSA_MIN_DRUM_BLOCKS) || (blocks > SMSA_MAX_DRUM_BLOCKS) || (blocks & (blocks-1)) ||
+			(blockSize < SMSA_MIN_BLOCK_SIZE) || (blockSize > SMSA_MAX_BLOCK_SIZE) || (blockSize & (blockSize-1)) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal array geometry [%u drums, %u blocks, %u bytes]", drums, blocks, blockSize );
+		return( -1 );
+	}
+
+	// Save it for the next mount and return successfully
+	smsa_geometry.drums = drums;
+	smsa_geometry.blocks = blocks;
+	smsa_geometry.blockSize = blockSize;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_latency
+// Description  : Set the latency emulated on the wall clock, which takes effect
+//                on the next mount. No latency leaves it to the environment.
+//
+// Inputs       : nsPerCycle - nanoseconds for each cycle an operation costs (0 for default)
+//                jitter - percent the delay varies either way
+//                channels - operations a drum serves at once (0 for any number)
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_set_latency( uint32_t nsPerCycle, uint32_t jitter, uint32_t channels ) {
+
+	// Check the latency
+	if ( (jitter > 100) || (channels > SMSA_MAX_DRUM_CHANNELS) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal array latency [%u ns, %u%%, %u channels]", nsPerCycle, jitter, channels );
+		return( -1 );
+	}
+
+	// Save it for the next mount and return successfully
+	smsa_latency.nsPerCycle = nsPerCycle;
+	smsa_latency.jitter = jitter;
+	smsa_latency.channels = channels;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_device_preset
+// Description  : Find one of the device models that come with the library
+//
+// Inputs       : name - the name of the model
+// Outputs      : the model, or NULL if there is none of that name
+
+const SMSA_DEVICE_MODEL * smsa_device_preset( const char *name ) {
+
+	// Local variables
+	int i;
+
+	// Look for the name
+	for ( i=0; i<sizeof(smsa_device_presets)/sizeof(smsa_device_presets[0]); i++ ) {
+		if ( strcmp(smsa_device_presets[i].name, name) == 0 ) {
+			return( &smsa_device_presets[i] );
+		}
+	}
+
+	// Not found
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_set_device_model
+// Description  : Set the device model the costs come from, which takes effect
+//                on the next mount. No model leaves it to the environment.
+//
+// Inputs       : model - the model, copied (NULL for default)
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_set_device_model( const SMSA_DEVICE_MODEL *model ) {
+
+	// Check the model, the grid needs a column
+	if ( (model != NULL) && ((model->name == NULL) || (model->gridColumns == 0) || (model->seekCurve > SMSA_SEEK_SQRT)) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal device model [%s]", (model->name != NULL) ? model->name : "?" );
+		return( -1 );
+	}
+
+	// Save it for the next mount and return successfully
+	smsa_device_model_set = (model != NULL);
+	if ( model != NULL ) {
+		smsa_device_model = *model;
+	}
+	return( 0 );
 }
 
 //
@@ -261,23 +546,47 @@ int SMSAMountArray( void ) {
 	}
 
 	// Mounting operation begin
-	logMessage( LOG_INFO_LEVEL, "Mounting the disk array ..." );
+	smsa_mounted_device = device_model();
+	logMessage( LOG_INFO_LEVEL, "Mounting the disk array [%u drums, %u blocks, %u bytes, %s device] ...",
+			SMSA_DISK_ARRAY_SIZE, SMSA_MAX_BLOCK_ID, SMSA_BLOCK_SIZE, smsa_mounted_device.name );
+	smsa_mounted_storage = storage_mode();
+	smsa_mounted_sync = storage_sync();
+	smsa_mounted_latency = latency_model();
+	memset( smsa_channel_free, 0x0, sizeof(smsa_channel_free) );
+	smsa_delayed_ops = smsa_delayed_nanos = smsa_queued_nanos = 0;
+	if ( (smsa_dirty_map = calloc(SMSA_DIRTY_WORDS, sizeof(uint64_t))) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure allocating the dirty map of the disk array" );
+		smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
+		return( -1 );
+	}
 
-	// Allocate the data for the array, set pointer to the beginning of the array
+	// Map or allocate the data for the array, set pointers to each drum in it
+	if ( smsa_mounted_storage == SMSA_STORAGE_MMAP ) {
+		if ( SMSAMapArray() != 0 ) {
+			free( smsa_dirty_map );
+			smsa_dirty_map = NULL;
+			return( -1 );
+		}
+	} else if ( (smsa_array_base = calloc(SMSA_DISK_ARRAY_SIZE, SMSA_DISK_SIZE)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure allocating the disk array" );
+		free( smsa_dirty_map );
+		smsa_dirty_map = NULL;
+		smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
+		return( -1 );
+	}
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		smsa_disk_array[i] = malloc( SMSA_DISK_SIZE );
-		memset( smsa_disk_array[i], 0x0, SMSA_DISK_SIZE );
+		smsa_disk_array[i] = smsa_array_base + ((size_t)i*SMSA_DISK_SIZE);
 	}
 	smsa_drum_head = 0;
 	smsa_read_head = 0;
+	memset( smsa_block_heads, 0x0, sizeof(smsa_block_heads) );
 
 	// Mounting operation finished, set appropriate flag
 	logMessage( LOG_INFO_LEVEL, "Mounted the disk array successfully." );
 	smsa_mount_state  = 1;
 
-#if SMSA_STORAGE_ENABLED
 	// Try to load the disk array from disk file or format disks if not available
-	if ( SMSALoadArray() != 0 ) {
+	if ( (smsa_mounted_storage == SMSA_STORAGE_FILE) && (SMSALoadArray() != 0) ) {
 		logMessage( LOG_INFO_LEVEL, "No mount data or failed, resetting disk data." );
 
 		// Initialize the disk array data
@@ -286,7 +595,6 @@ int SMSAMountArray( void ) {
 			SMSAFormatDrum();
 		}
 	}
-#endif
 
 	// Return successfully
 	return( 0 );
@@ -303,7 +611,7 @@ int SMSAMountArray( void ) {
 int SMSAUnmountArray( void ) {
 
 	// Local variables
-	int i;
+	int i, retcode = 0;
 
 	// See if already mounted
 	if ( ! smsa_mount_state ) {
@@ -314,20 +622,34 @@ int SMSAUnmountArray( void ) {
 	// Mounting operation begin
 	logMessage( LOG_INFO_LEVEL, "Unmounting the disk array ..." );
 
-	// Store contents, deallocate the data from the array, reset disk heads
-#if SMSA_STORAGE_ENABLED
-	SMSAStoreArray();
-#endif
+	// Store or sync contents, release the data of the array, reset disk heads
+	if ( smsa_mounted_storage == SMSA_STORAGE_FILE ) {
+		retcode = SMSAStoreArray();
+	}
+	if ( smsa_mounted_storage == SMSA_STORAGE_MMAP ) {
+		retcode = SMSAUnmapArray();
+	} else {
+		free( smsa_array_base );
+	}
+	smsa_array_base = NULL;
 	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		free( smsa_disk_array[i] );
 		smsa_disk_array[i] = NULL;
 	}
+	free( smsa_dirty_map );
+	smsa_dirty_map = NULL;
 	smsa_drum_head = 0;
 	smsa_read_head = 0;
 	smsa_mount_state = 0;
 
-	// Return successfully
-	return( 0 );
+	// Log the latency emulated while it was mounted
+	if ( smsa_mounted_latency.nsPerCycle ) {
+		logMessage( LOG_OUTPUT_LEVEL, "Array delayed %llu operations by %llu ns, %llu ns of it queued for a drum",
+				(unsigned long long)smsa_delayed_ops, (unsigned long long)smsa_delayed_nanos,
+				(unsigned long long)smsa_queued_nanos );
+	}
+
+	// Return the result of the store
+	return( retcode );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -461,8 +783,12 @@ int SMSAWriteBlock( unsigned char *block ) {
 		return( -1 );
 	}
 
-	// Now do the read and return successfully
+	// Now do the write, sync it if needed and return successfully
 	memcpy( SMSA_BLOCK_ADDRESS(smsa_drum_head,smsa_read_head), block, SMSA_BLOCK_SIZE );
+	mark_dirty_blocks( smsa_drum_head, smsa_read_head, 1 );
+	if ( SMSASyncArray(SMSA_BLOCK_ADDRESS(smsa_drum_head,smsa_read_head), SMSA_BLOCK_SIZE) ) {
+		return( -1 );
+	}
 	smsa_read_head ++;
 	return( 0 );
 }
@@ -492,8 +818,12 @@ int SMSAFormatDrum( void ) {
 		return( -1 );
 	}
 
-	// Zero the disk contents, reset the read head
+	// Zero the disk contents, sync it if needed, reset the read head
 	memset( smsa_disk_array[smsa_drum_head], 0x0, SMSA_DISK_SIZE );
+	mark_dirty_blocks( smsa_drum_head, 0, SMSA_MAX_BLOCK_ID );
+	if ( SMSASyncArray(smsa_disk_array[smsa_drum_head], SMSA_DISK_SIZE) ) {
+		return( -1 );
+	}
 	smsa_drum_head = 0;
 	smsa_read_head = 0;
 
@@ -504,13 +834,121 @@ int SMSAFormatDrum( void ) {
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAReadBlocksAt
+// Description  : Read blocks at a drum/block position without using the heads
+//
+// Inputs       : did - the drum to read from
+//                bid - the first block to read
+//                count - the number of blocks to read
+//                blocks - the buffer to place the data in
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAReadBlocksAt( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count, unsigned char *blocks ) {
+
+	// Log the read
+	logMessage( LOG_INFO_LEVEL, "Reading drum/blocks at [%u/%u+%u]", did, bid, count );
+
+	// Check to see if the disk array has been mounted
+	if ( ! smsa_mount_state ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to read on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check to make sure that this is a good read place
+	if ( (did >= SMSA_DISK_ARRAY_SIZE) || (bid >= SMSA_MAX_BLOCK_ID) || (count == 0) || (count > SMSA_MAX_BLOCK_ID-bid) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal read drum/blocks [%u/%u+%u]", did, bid, count );
+		smsa_error_number = SMSA_BAD_READ;
+		return( -1 );
+	}
+
+	// Count the cycles, do the read and return successfully
+	charge_cycles( operation_cycle_cost_at(SMSA_DISK_READ, did, bid, count) );
+	memcpy( blocks, SMSA_BLOCK_ADDRESS(did,bid), (size_t)count*SMSA_BLOCK_SIZE );
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAWriteBlocksAt
+// Description  : Write blocks at a drum/block position without using the heads
+//
+// Inputs       : did - the drum to write to
+//                bid - the first block to write
+//                count - the number of blocks to write
+//                blocks - the buffer to obtain data to write
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAWriteBlocksAt( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count, unsigned char *blocks ) {
+
+	// Log the write
+	logMessage( LOG_INFO_LEVEL, "Write drum/blocks at [%u/%u+%u]", did, bid, count );
+
+	// Check to see if the disk array has been mounted
+	if ( ! smsa_mount_state ) {
+		logMessage( LOG_ERROR_LEVEL, "Trying to write on unmounted array." );
+			smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check the write for sanity
+	if ( (did >= SMSA_DISK_ARRAY_SIZE) || (bid >= SMSA_MAX_BLOCK_ID) || (count == 0) || (count > SMSA_MAX_BLOCK_ID-bid) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal write drum/blocks [%u/%u+%u]", did, bid, count );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return( -1 );
+	}
+
+	// Count the cycles, do the write, sync it (once for all the blocks) if needed and return
+	charge_cycles( operation_cycle_cost_at(SMSA_DISK_WRITE, did, bid, count) );
+	memcpy( SMSA_BLOCK_ADDRESS(did,bid), blocks, (size_t)count*SMSA_BLOCK_SIZE );
+	mark_dirty_blocks( did, bid, count );
+	return( SMSASyncArray(SMSA_BLOCK_ADDRESS(did,bid), (size_t)count*SMSA_BLOCK_SIZE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAFormatDrumAt
+// Description  : Format a drum without using the heads
+//
+// Inputs       : did - the drum to format
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAFormatDrumAt( SMSA_DRUM_ID did ) {
+
+	// Log the format
+	logMessage( LOG_INFO_LEVEL, "Formatting drum at [%u] ...", did );
+
+	// Check if the drum array has been mounted
+	if ( ! smsa_mount_state ) {
+		smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return( -1 );
+	}
+
+	// Check if this is a legal drum
+	if ( did >= SMSA_DISK_ARRAY_SIZE ) {
+		smsa_error_number = SMSA_ILLEGAL_DRUM;
+		return( -1 );
+	}
+
+	// Zero the disk contents, sync it if needed and return
+	charge_cycles( operation_cycle_cost_at(SMSA_FORMAT_DRUM, did, 0, 0) );
+	memset( smsa_disk_array[did], 0x0, SMSA_DISK_SIZE );
+	mark_dirty_blocks( did, 0, SMSA_MAX_BLOCK_ID );
+	return( SMSASyncArray(smsa_disk_array[did], SMSA_DISK_SIZE) );
+}
+
 //
 // Utility functions
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : SMSAStoreArray
-// Description  : Push the contents of the array to disk file.
+// Description  : Push the blocks of the array changed since the last load or
+//                store to the disk file. Each run of changed blocks is one
+//                write, gathered from the drums it covers, and the file is
+//                synced before the blocks are marked clean.
 //
 // Inputs       : none
 // Outputs      : 0 if successful test, -1 if failure
@@ -518,35 +956,75 @@ int SMSAFormatDrum( void ) {
 int SMSAStoreArray( void ) {
 
 	// Local variables
-	int fh, bytes, i;
+	int fh, cnt, blocks = 0, writes = 0;
+	uint32_t idx = 0, start;
+	ssize_t bytes, len;
+	struct iovec iov[SMSA_MAX_DISK_ARRAY_SIZE];
 
 	// Storing operation begin
 	logMessage( LOG_INFO_LEVEL, "Storing the disk array contents ..." );
 
-	// Open the disk file, check for error
-	if ( (fh=open(SMSA_DISK_FILE, O_CREAT|O_WRONLY|O_TRUNC,S_IRWXU)) == -1 ) {
+	// Open the disk file, check for error (the unchanged blocks are kept)
+	if ( (fh=open(smsa_disk_file, O_CREAT|O_WRONLY,S_IRWXU)) == -1 ) {
 		logMessage( LOG_ERROR_LEVEL, "Failure opening array data for store [%s], error=[%s]",
-				SMSA_DISK_FILE, strerror(errno) );
+				smsa_disk_file, strerror(errno) );
 		smsa_error_number = SMSA_DISK_CACHEWRITE_FAIL;
 		return( -1 );
 	}
 
-	// Now read the disk data
-	for ( i=0; i<SMSA_DISK_ARRAY_SIZE; i++ ) {
-		// Keep reading disk by disk
-		bytes = write( fh, smsa_disk_array[i], SMSA_DISK_SIZE );
-		if ( bytes != SMSA_DISK_SIZE ) {
+	// Now write the dirty runs
+	while ( idx < SMSA_ARRAY_BLOCKS ) {
+
+		// Skip clean blocks, a whole word at a time when possible
+		if ( (idx%64 == 0) && (smsa_dirty_map[idx/64] == 0) ) {
+			idx += 64;
+			continue;
+		}
+		if ( ! SMSA_IS_DIRTY(idx) ) {
+			idx ++;
+			continue;
+		}
+
+		// Gather the run, a new piece for every drum it crosses into (cut
+		// at SMSA_MAX_STORE_RUN, so the kernel never writes only part of it)
+		start = idx;
+		cnt = 0;
+		len = 0;
+		while ( (idx < SMSA_ARRAY_BLOCKS) && SMSA_IS_DIRTY(idx) && (len < SMSA_MAX_STORE_RUN) ) {
+			if ( (cnt == 0) || (idx%SMSA_MAX_BLOCK_ID == 0) ) {
+				iov[cnt].iov_base = block_address( idx/SMSA_MAX_BLOCK_ID, idx%SMSA_MAX_BLOCK_ID );
+				iov[cnt].iov_len = 0;
+				cnt ++;
+			}
+			iov[cnt-1].iov_len += SMSA_BLOCK_SIZE;
+			len += SMSA_BLOCK_SIZE;
+			idx ++;
+		}
+
+		// Write the run where it lives in the file
+		bytes = pwritev( fh, iov, cnt, (off_t)start*SMSA_BLOCK_SIZE );
+		if ( bytes != len ) {
 			logMessage( LOG_ERROR_LEVEL, "Failure writing array data [%s], error=[%s]",
-							SMSA_DISK_FILE, strerror(errno) );
+							smsa_disk_file, strerror(errno) );
+			close( fh );
 			smsa_error_number = SMSA_DISK_CACHEWRITE_FAIL;
 			return( -1 );
 		}
-		logMessage( LOG_INFO_LEVEL, "Wrote disk (%d) contents successfully", i );
+		blocks += idx-start;
+		writes ++;
 	}
 
-	// Now close the file and log results
+	// Now sync and close the file, mark everything clean and log results
+	if ( (writes > 0) && (fdatasync(fh) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure syncing array data [%s], error=[%s]",
+						smsa_disk_file, strerror(errno) );
+		close( fh );
+		smsa_error_number = SMSA_DISK_CACHEWRITE_FAIL;
+		return( -1 );
+	}
 	close( fh );
-	logMessage( LOG_INFO_LEVEL, "Stored the disk array contents successfully." );
+	memset( smsa_dirty_map, 0x0, SMSA_DIRTY_WORDS*sizeof(uint64_t) );
+	logMessage( LOG_INFO_LEVEL, "Stored %d changed blocks of the disk array in %d writes.", blocks, writes );
 
 	// Return successfully
 	return( 0 );
@@ -569,9 +1047,9 @@ int SMSALoadArray( void ) {
 	logMessage( LOG_INFO_LEVEL, "Loading the disk array contents ..." );
 
 	// Open the disk file, check for error
-	if ( (fh=open(SMSA_DISK_FILE, O_RDONLY)) == -1 ) {
+	if ( (fh=open(smsa_disk_file, O_RDONLY)) == -1 ) {
 		logMessage( LOG_ERROR_LEVEL, "Failure opening array data for load [%s], error=[%s]",
-				SMSA_DISK_FILE, strerror(errno) );
+				smsa_disk_file, strerror(errno) );
 		smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
 		return( -1 );
 	}
@@ -582,7 +1060,7 @@ int SMSALoadArray( void ) {
 		bytes = read( fh, smsa_disk_array[i], SMSA_DISK_SIZE );
 		if ( bytes != SMSA_DISK_SIZE ) {
 			logMessage( LOG_ERROR_LEVEL, "Failure reading array data [%s], error=[%s]",
-							SMSA_DISK_FILE, strerror(errno) );
+							smsa_disk_file, strerror(errno) );
 			smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
 			return( -1 );
 		}
@@ -597,6 +1075,409 @@ int SMSALoadArray( void ) {
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAMapArray
+// Description  : Map the disk file as the array, growing it to the size of
+//                the array first. Nothing is read until a block is touched.
+//
+// Inputs       : none
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAMapArray( void ) {
+
+	// Local variables
+	int fh;
+	struct stat st;
+	void *base;
+	off_t size = (off_t)SMSA_DISK_ARRAY_SIZE*SMSA_DISK_SIZE;
+
+	// Mapping operation begin
+	logMessage( LOG_INFO_LEVEL, "Mapping the disk array contents ..." );
+
+	// Open the disk file and make sure it covers the array, check for error
+	if ( (fh=open(smsa_disk_file, O_CREAT|O_RDWR, S_IRWXU)) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure opening array data for map [%s], error=[%s]",
+				smsa_disk_file, strerror(errno) );
+		smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
+		return( -1 );
+	}
+	if ( (fstat(fh, &st) == -1) || ((st.st_size < size) && (ftruncate(fh, size) == -1)) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure sizing array data [%s], error=[%s]",
+				smsa_disk_file, strerror(errno) );
+		close( fh );
+		smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
+		return( -1 );
+	}
+
+	// Now map the file, the mapping outlives the file handle
+	base = mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fh, 0 );
+	close( fh );
+	if ( base == MAP_FAILED ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure mapping array data [%s], error=[%s]",
+				smsa_disk_file, strerror(errno) );
+		smsa_error_number = SMSA_DISK_CACHELOAD_FAIL;
+		return( -1 );
+	}
+	smsa_array_base = base;
+	smsa_page_size = sysconf( _SC_PAGESIZE );
+	logMessage( LOG_INFO_LEVEL, "Mapped the disk array contents successfully." );
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSAUnmapArray
+// Description  : Unmap the array, first syncing its dirty pages to the disk
+//                file unless the sync leaves them to the kernel.
+//
+// Inputs       : none
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSAUnmapArray( void ) {
+
+	// Local variables
+	int retcode = 0;
+	size_t size = (size_t)SMSA_DISK_ARRAY_SIZE*SMSA_DISK_SIZE;
+
+	// Sync the dirty pages, check for error
+	if ( (smsa_mounted_sync != SMSA_SYNC_NONE) && (msync(smsa_array_base, size, MS_SYNC) == -1) ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure syncing array data [%s], error=[%s]",
+				smsa_disk_file, strerror(errno) );
+		smsa_error_number = SMSA_DISK_CACHEWRITE_FAIL;
+		retcode = -1;
+	}
+
+	// Now unmap the array
+	munmap( smsa_array_base, size );
+	logMessage( LOG_INFO_LEVEL, "Unmapped the disk array contents." );
+
+	// Return the result of the sync
+	return( retcode );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : SMSASyncArray
+// Description  : Sync the pages under part of the array to the disk file, if
+//                the array is mapped and every write is synced.
+//
+// Inputs       : ptr - the start of the part of the array
+//                len - the length of the part
+// Outputs      : 0 if successful test, -1 if failure
+
+int SMSASyncArray( unsigned char *ptr, size_t len ) {
+
+	// Local variables
+	size_t offset;
+
+	// Only a mapped array synced on every write has anything to do
+	if ( (smsa_mounted_storage != SMSA_STORAGE_MMAP) || (smsa_mounted_sync != SMSA_SYNC_WRITE) ) {
+		return( 0 );
+	}
+
+	// Sync from the start of the page, check for error
+	offset = (ptr-smsa_array_base) % smsa_page_size;
+	if ( msync(ptr-offset, len+offset, MS_SYNC) == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure syncing array data [%s], error=[%s]",
+				smsa_disk_file, strerror(errno) );
+		smsa_error_number = SMSA_DISK_CACHEWRITE_FAIL;
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mark_dirty_blocks
+// Description  : Mark blocks of a drum as changed since the last store. Each
+//                drum has words of the map of its own, but the marks are
+//                atomic anyway.
+//
+// Inputs       : did - the drum identifier
+//                bid - the first block
+//                count - the number of blocks
+// Outputs      : none
+
+void mark_dirty_blocks( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count ) {
+
+	// Local variables
+	uint32_t idx;
+
+	// Set the bit of each block
+	for ( idx=SMSA_DIRTY_INDEX(did,bid); idx<SMSA_DIRTY_INDEX(did,bid)+count; idx++ ) {
+		__sync_fetch_and_or( &smsa_dirty_map[idx/64], (uint64_t)1<<(idx%64) );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : init_drum_locks
+// Description  : Set up the lock of each drum, run once by lock_drums
+//
+// Inputs       : none
+// Outputs      : none
+
+void init_drum_locks( void ) {
+
+	// Local variables
+	int i;
+
+	// Initialize every lock the opcode can address
+	for ( i=0; i<SMSA_MAX_DISK_ARRAY_SIZE; i++ ) {
+		pthread_rwlock_init( &smsa_drum_locks[i], NULL );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lock_drums
+// Description  : Take the locks of a range of drums, in order so two callers
+//                never deadlock. A mount or unmount takes all of them.
+//
+// Inputs       : first - the first drum
+//                last - the last drum
+//                exclusive - true to have the drums to ourselves
+// Outputs      : none
+
+void lock_drums( SMSA_DRUM_ID first, SMSA_DRUM_ID last, int exclusive ) {
+
+	// Local variables
+	uint32_t i;
+
+	// Take each lock, setting them up the first time
+	pthread_once( &smsa_locks_once, init_drum_locks );
+	for ( i=first; i<=last; i++ ) {
+		if ( exclusive ) {
+			pthread_rwlock_wrlock( &smsa_drum_locks[i] );
+		} else {
+			pthread_rwlock_rdlock( &smsa_drum_locks[i] );
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlock_drums
+// Description  : Release the locks lock_drums took
+//
+// Inputs       : first - the first drum
+//                last - the last drum
+// Outputs      : none
+
+void unlock_drums( SMSA_DRUM_ID first, SMSA_DRUM_ID last ) {
+
+	// Local variables
+	uint32_t i;
+
+	// Release them in the reverse order
+	for ( i=last+1; i>first; i-- ) {
+		pthread_rwlock_unlock( &smsa_drum_locks[i-1] );
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : storage_mode
+// Description  : Work out where the array is kept. A storage set with
+//                smsa_set_storage wins, then the environment.
+//
+// Inputs       : none
+// Outputs      : the storage
+
+SMSA_STORAGE storage_mode( void ) {
+
+	// Local variables
+	char *env;
+
+	// Check the set storage, then the environment
+	if ( smsa_storage != SMSA_STORAGE_DEFAULT ) {
+		return( smsa_storage );
+	}
+	if ( (env = getenv(SMSA_STORAGE_ENV)) != NULL ) {
+		if ( strcmp(env, "memory") == 0 ) return( SMSA_STORAGE_MEMORY );
+		if ( strcmp(env, "file") == 0 ) return( SMSA_STORAGE_FILE );
+		if ( strcmp(env, "mmap") == 0 ) return( SMSA_STORAGE_MMAP );
+	}
+
+	// Return the default
+	return( SMSA_DEFAULT_STORAGE );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : storage_sync
+// Description  : Work out how a mapped array is synced. A sync set with
+//                smsa_set_storage wins, then the environment.
+//
+// Inputs       : none
+// Outputs      : the sync
+
+SMSA_SYNC storage_sync( void ) {
+
+	// Local variables
+	char *env;
+
+	// Check the set sync, then the environment
+	if ( smsa_sync != SMSA_SYNC_DEFAULT ) {
+		return( smsa_sync );
+	}
+	if ( (env = getenv(SMSA_SYNC_ENV)) != NULL ) {
+		if ( strcmp(env, "none") == 0 ) return( SMSA_SYNC_NONE );
+		if ( strcmp(env, "unmount") == 0 ) return( SMSA_SYNC_UNMOUNT );
+		if ( strcmp(env, "write") == 0 ) return( SMSA_SYNC_WRITE );
+	}
+
+	// Return the default
+	return( SMSA_DEFAULT_SYNC );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : latency_model
+// Description  : Work out the latency to emulate. A latency set with
+//                smsa_set_latency wins, then the environment, where the
+//                channels default to one.
+//
+// Inputs       : none
+// Outputs      : the latency
+
+SMSA_LATENCY latency_model( void ) {
+
+	// Local variables
+	SMSA_LATENCY latency = { 0, 0, 1 };
+	char *env;
+
+	// Check the set latency, then the environment
+	if ( smsa_latency.nsPerCycle != 0 ) {
+		return( smsa_latency );
+	}
+	if ( ((env = getenv(SMSA_LATENCY_ENV)) != NULL) &&
+			((sscanf(env, "%u:%u:%u", &latency.nsPerCycle, &latency.jitter, &latency.channels) < 1) ||
+			(latency.jitter > 100) || (latency.channels > SMSA_MAX_DRUM_CHANNELS)) ) {
+		logMessage( LOG_ERROR_LEVEL, "Illegal array latency [%s], ignoring", env );
+		latency.nsPerCycle = 0;
+	}
+
+	// Return the latency, if any
+	return( latency );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_model
+// Description  : Work out the device model. A model set with
+//                smsa_set_device_model wins, then the environment.
+//
+// Inputs       : none
+// Outputs      : the model
+
+SMSA_DEVICE_MODEL device_model( void ) {
+
+	// Local variables
+	const SMSA_DEVICE_MODEL *preset;
+	char *env;
+
+	// Check the set model, then the environment
+	if ( smsa_device_model_set ) {
+		return( smsa_device_model );
+	}
+	if ( (env = getenv(SMSA_DEVICE_ENV)) != NULL ) {
+		if ( (preset = smsa_device_preset(env)) != NULL ) {
+			return( *preset );
+		}
+		logMessage( LOG_ERROR_LEVEL, "Illegal device model [%s], ignoring", env );
+	}
+
+	// Return the default
+	return( *smsa_device_preset(SMSA_DEFAULT_DEVICE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : charge_cycles
+// Description  : Add the cycles an operation costs to the cycle count, and to
+//                what the operation of this thread owes on the wall clock
+//
+// Inputs       : cycles - the cycles the operation costs
+// Outputs      : none
+
+void charge_cycles( int cycles ) {
+
+	// Count them for everyone, and for the operation
+	__sync_fetch_and_add( &smsa_cycle_count, cycles );
+	smsa_owed_cycles += cycles;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : emulate_latency
+// Description  : Make the operation of this thread take as long as the cycles
+//                it owes, after it has released its drums. The operation takes
+//                the channel of its drum that is free first, and waits behind
+//                whatever that channel is doing; the channels only move
+//                forward with compare and swap.
+//
+// Inputs       : did - the drum the operation used
+// Outputs      : none
+
+void emulate_latency( SMSA_DRUM_ID did ) {
+
+	// Local variables
+	uint64_t delay, now, start, done, busy;
+	struct timespec ts;
+	uint32_t i, best;
+
+	// Nothing to do unless the mounted array is slow, and the operation cost something
+	if ( (smsa_mounted_latency.nsPerCycle == 0) || ((long)smsa_owed_cycles <= 0) ) {
+		return;
+	}
+
+	// Work out the delay, varied by the jitter
+	delay = (uint64_t)smsa_owed_cycles * smsa_mounted_latency.nsPerCycle;
+	smsa_owed_cycles = 0;
+	if ( smsa_mounted_latency.jitter ) {
+		if ( smsa_jitter_seed == 0 ) {
+			smsa_jitter_seed = (uint32_t)(uintptr_t)&smsa_jitter_seed | 1;
+		}
+		smsa_jitter_seed ^= smsa_jitter_seed << 13;
+		smsa_jitter_seed ^= smsa_jitter_seed >> 17;
+		smsa_jitter_seed ^= smsa_jitter_seed << 5;
+		delay = delay * (100 - smsa_mounted_latency.jitter + smsa_jitter_seed % (2*smsa_mounted_latency.jitter+1)) / 100;
+	}
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	now = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+
+	// Queue on the channel of the drum that is free first, if the drum has channels
+	start = now;
+	if ( smsa_mounted_latency.channels ) {
+		do {
+			best = 0;
+			busy = __atomic_load_n( &smsa_channel_free[did][0], __ATOMIC_RELAXED );
+			for ( i=1; i<smsa_mounted_latency.channels; i++ ) {
+				if ( __atomic_load_n(&smsa_channel_free[did][i], __ATOMIC_RELAXED) < busy ) {
+					best = i;
+					busy = __atomic_load_n( &smsa_channel_free[did][i], __ATOMIC_RELAXED );
+				}
+			}
+			start = (busy > now) ? busy : now;
+		} while ( ! __sync_bool_compare_and_swap(&smsa_channel_free[did][best], busy, start+delay) );
+	}
+	done = start + delay;
+
+	// Sleep until the operation is done, then count it
+	ts.tv_sec = done / 1000000000;
+	ts.tv_nsec = done % 1000000000;
+	while ( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR );
+	__sync_fetch_and_add( &smsa_delayed_ops, 1 );
+	__sync_fetch_and_add( &smsa_delayed_nanos, done - now );
+	__sync_fetch_and_add( &smsa_queued_nanos, start - now );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : decode_SMSA_operation
@@ -614,16 +1495,16 @@ int decode_SMSA_operation( SMSA_OPERATION *dop, uint32_t op, unsigned char *bloc
 	 * SMSA operation bit layout
 	 *
 	 * 	0-5		- command number (6-bits)
-	 * 	6-9		- drum identifier (4-bits)
-	 * 	10-23	- RESERVED (unused)
-	 * 	24-31	- block address (8-bits)
+	 * 	6-9		- drum identifier, low bits (4-bits)
+	 * 	10-13	- drum identifier, high bits (4-bits, were RESERVED)
+	 * 	14-31	- block address (18-bits, the top 10 were RESERVED)
 	 *
 	 */
 
 	// Do the bit manipulations
-	dop->cmd = (op>>26);		// The type of operation being performed
-	dop->did = (op>>22)&0xf;	// This is the drum to be written to/read from
-	dop->bid = (op&0xff);		// This is the block address to read/write
+	dop->cmd = SMSA_OPCODE(op);	// The type of operation being performed
+	dop->did = SMSA_DRUMID(op);	// This is the drum to be written to/read from
+	dop->bid = SMSA_BLOCKID(op);	// This is the block address to read/write
 
 	// Check for legal values
 	if ( dop->cmd >= SMSA_MAX_COMMAND ) {
@@ -696,7 +1577,8 @@ uint32_t encode_SMSA_operation( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BL
 	// Do the bit operations and return
 	uint32_t op = 0;
 	op |= (cmd<<26);
-	op |= (did<<22);
+	op |= ((uint32_t)did&0xf)<<22;
+	op |= ((uint32_t)did>>4)<<18;
 	op |= bid;
 	return( op );
 }
@@ -721,46 +1603,57 @@ unsigned char * block_address( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid ) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : opperation_cycle_cost
-// Description  : This function calculates the cycle cost of an operation
+// Function     : smsa_model_cost
+// Description  : This function calculates the cycle cost of a command on a
+//                device model, the cost function of the models that come with
+//                the library
 //
-// Inputs       : cmd - the operatio to perform
-//                did - the drum identifier
-//                bid - the block identifier
-// Outputs      : the pointer to the block in memory
-
-int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid ) {
+// Inputs       : model - the device model
+//                cmd - the operation to perform
+//                fromDrum - the drum the heads are on
+//                fromBlock - the block the head is at
+//                toDrum - the drum to seek to (or operate on)
+//                toBlock - the block to seek to (or read or write first)
+//                count - the number of blocks to read or write
+// Outputs      : the cycle cost of the command, -1 if it is illegal
+
+int smsa_model_cost( const SMSA_DEVICE_MODEL *model, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID fromDrum,
+		SMSA_BLOCK_ID fromBlock, SMSA_DRUM_ID toDrum, SMSA_BLOCK_ID toBlock, uint32_t count ) {
 
     // Local variables
+    uint32_t distance;
     int cost = 0;
 
     // Perform the disk operation
     switch (cmd) {
 
 	case SMSA_MOUNT: // Mount the disk array
-	    cost = 10000;
+	    cost = model->mountCost;
 	    break;
 
 	case SMSA_UNMOUNT: // Unmount the disk array
-	    cost = 10000;
+	    cost = model->unmountCost;
 	    break;
 
-	case SMSA_SEEK_DRUM: // See to a new drum
-	    cost = SMSA_DIFF(SMSA_ROW(smsa_drum_head),SMSA_ROW(did));
-            cost = SMSA_DIFF(SMSA_COL(smsa_drum_head),SMSA_COL(did));
-	    cost *= 1000;
+	case SMSA_SEEK_DRUM: // See to a new drum, across the rows and then the columns of the grid
+	    cost = SMSA_DIFF(fromDrum/model->gridColumns,toDrum/model->gridColumns)*model->drumSeekPerRow;
+	    cost += SMSA_DIFF(fromDrum%model->gridColumns,toDrum%model->gridColumns)*model->drumSeekPerColumn;
 	    break;
     
-	case SMSA_SEEK_BLOCK: // Seek to a disk address in the current drum
-	    cost = SMSA_DIFF(smsa_read_head,bid)*10;
+	case SMSA_SEEK_BLOCK: // Seek to a disk address in the current drum, then wait for it to come round
+	    distance = SMSA_DIFF(fromBlock,toBlock);
+	    if ( distance > 0 ) {
+		cost = model->seekBase + model->rotation/2;
+		cost += model->seekPerBlock * ((model->seekCurve == SMSA_SEEK_SQRT) ? integer_sqrt(distance) : distance);
+	    }
 	    break;
 
 	case SMSA_DISK_READ: // Read from the disk
-	    cost = 50;
+	    cost = model->readCost*count;
 	    break;
 
 	case SMSA_DISK_WRITE: // Write to the disk
-	    cost = 200;
+	    cost = model->writeCost*count;
 	    break;
 
 	case SMSA_GET_STATE: // Get the current disk state (unimplemented)
@@ -769,7 +1662,7 @@ int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID
 	    break;
 
 	case SMSA_FORMAT_DRUM: // Format the current drum (zeros)
-	    cost = 0;
+	    cost = model->formatCost;
 	    break;
 
 	case SMSA_BLOCK_SIGN: // Generate a signature for a block (and output to log)
@@ -785,3 +1678,107 @@ int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID
     return( cost );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_cost
+// Description  : This function calculates the cycle cost of a command on the
+//                model of the mounted array, with its own cost function if it
+//                has one
+//
+// Inputs       : cmd - the operation to perform
+//                fromDrum/fromBlock - where the heads are
+//                toDrum/toBlock - where the command goes
+//                count - the number of blocks to read or write
+// Outputs      : the cycle cost of the command
+
+int device_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID fromDrum, SMSA_BLOCK_ID fromBlock,
+		SMSA_DRUM_ID toDrum, SMSA_BLOCK_ID toBlock, uint32_t count ) {
+
+	// Use the cost function of the model, or ours
+	if ( smsa_mounted_device.cost != NULL ) {
+		return( smsa_mounted_device.cost(&smsa_mounted_device, cmd, fromDrum, fromBlock, toDrum, toBlock, count) );
+	}
+	return( smsa_model_cost(&smsa_mounted_device, cmd, fromDrum, fromBlock, toDrum, toBlock, count) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : opperation_cycle_cost
+// Description  : This function calculates the cycle cost of an operation
+//                through the heads
+//
+// Inputs       : cmd - the operatio to perform
+//                did - the drum identifier
+//                bid - the block identifier
+// Outputs      : the cycle cost of the operation
+
+int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid ) {
+
+	// Reads, writes and formats work where the heads are, the rest say where they go
+	if ( (cmd == SMSA_DISK_READ) || (cmd == SMSA_DISK_WRITE) || (cmd == SMSA_FORMAT_DRUM) ) {
+		did = smsa_drum_head;
+		bid = smsa_read_head;
+	}
+	return( device_cost(cmd, smsa_drum_head, smsa_read_head, did, bid, 1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : operation_cycle_cost_at
+// Description  : This function calculates the cycle cost of an operation at a
+//                drum/block, and moves the head of the drum. Each drum has a
+//                head of its own that only moves atomically, so readers
+//                sharing the drum never need more than its read lock. There
+//                is no drum seek, the drums do not share the heads.
+//
+// Inputs       : cmd - the operation to perform
+//                did - the drum identifier
+//                bid - the first block
+//                count - the number of blocks
+// Outputs      : the cycle cost of the operation
+
+int operation_cycle_cost_at( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count ) {
+
+	// Local variables
+	uint32_t head;
+
+	// A format leaves the head at the start of the drum
+	if ( cmd == SMSA_FORMAT_DRUM ) {
+		head = __sync_lock_test_and_set( &smsa_block_heads[did], 0 );
+		return( device_cost(cmd, did, head, did, 0, 0) );
+	}
+
+	// Otherwise the head seeks to the first block and is left after the last
+	head = __sync_lock_test_and_set( &smsa_block_heads[did], bid+count );
+	return( device_cost(SMSA_SEEK_BLOCK, did, head, did, bid, 0) + device_cost(cmd, did, bid, did, bid, count) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : integer_sqrt
+// Description  : This function calculates the square root of a distance,
+//                rounded down
+//
+// Inputs       : n - the distance
+// Outputs      : the square root
+
+uint32_t integer_sqrt( uint32_t n ) {
+
+	// Local variables
+	uint32_t root = 0, bit = 1u << 30;
+
+	// Work down from the highest power of four
+	while ( bit > n ) {
+		bit >>= 2;
+	}
+	while ( bit != 0 ) {
+		if ( n >= root + bit ) {
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	return( root );
+}
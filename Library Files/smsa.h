@@ -15,33 +15,56 @@
 #include <stdint.h>
 
 // Defines
-#define SMSA_DISK_ARRAY_SIZE	16
-#define SMSA_DISK_SIZE			65536
-#define SMSA_BLOCK_SIZE			256
-#define SMSA_MAX_BLOCK_ID		(SMSA_DISK_SIZE/SMSA_BLOCK_SIZE)
+#define SMSA_DEFAULT_DRUMS		16		// Geometry of the array unless smsa_set_geometry says otherwise
+#define SMSA_DEFAULT_BLOCKS		256
+#define SMSA_DEFAULT_BLOCK_SIZE		256
+#define SMSA_MAX_DISK_ARRAY_SIZE	256		// Most drums the opcode can address
+#define SMSA_MIN_DRUM_BLOCKS		64		// Fewest blocks on a drum (a whole batch of them over the network)
+#define SMSA_MAX_DRUM_BLOCKS		(1<<18)		// Most blocks on a drum the opcode can address
+#define SMSA_MIN_BLOCK_SIZE		256		// Block sizes are a power of two between these
+#define SMSA_MAX_BLOCK_SIZE		4096
+#define SMSA_DISK_ARRAY_SIZE	(smsa_geometry.drums)
+#define SMSA_BLOCK_SIZE			(smsa_geometry.blockSize)
+#define SMSA_MAX_BLOCK_ID		(smsa_geometry.blocks)
+#define SMSA_DISK_SIZE			(SMSA_MAX_BLOCK_ID*SMSA_BLOCK_SIZE)
 #define SMSA_DISK_FILE 			"smsa_data.dat"
+#define SMSA_STORAGE_ENV		"SMSA_STORAGE"	// Environment override of the storage ("memory", "file", "mmap")
+#define SMSA_SYNC_ENV			"SMSA_SYNC"	// Environment override of the sync ("none", "unmount", "write")
+#define SMSA_LATENCY_ENV		"SMSA_LATENCY"	// Environment override of the latency ("ns[:jitter[:channels]]")
+#define SMSA_MAX_DRUM_CHANNELS		16		// Most operations a drum serves at once when latency is emulated
+#define SMSA_DEVICE_ENV			"SMSA_DEVICE"	// Environment override of the device model ("classic", "hdd", "ssd")
+#define SMSA_DEFAULT_DEVICE		"classic"	// The device model unless set otherwise
 
 // Workload related defines
-#define MAX_SMSA_VIRTUAL_ADDRESS (SMSA_DISK_ARRAY_SIZE*SMSA_DISK_SIZE)
+#define MAX_SMSA_VIRTUAL_ADDRESS ((uint64_t)SMSA_DISK_ARRAY_SIZE*SMSA_DISK_SIZE)
 #define SMSA_WORKLOAD_READ	"READ"
 #define SMSA_WORKLOAD_WRITE	"WRITE"
 #define SMSA_WORKLOAD_MOUNT	"MOUNT"
 #define SMSA_WORKLOAD_UNMOUNT	"UNMOUNT"
 #define SMSA_WORKLOAD_SIGNALL	"SIGNALL"
-#define SMSA_MAXIMUM_RDWR_SIZE	1024
+#define SMSA_MAXIMUM_RDWR_SIZE	(16*1024*1024)	// Largest read or write a workload makes
 
-// Extracting op code definitions
+// Extracting op code definitions (the high bits of the drum follow the low ones)
 #define SMSA_OPCODE(op) (op >> 26)
-#define SMSA_DRUMID(op) ((op >> 22)&0xf)
-#define SMSA_BLOCKID(op) ((op & 0xff)
+#define SMSA_DRUMID(op) (((op >> 22)&0xf)|(((op >> 18)&0xf)<<4))
+#define SMSA_BLOCKID(op) (op & 0x3ffff)
 
 // Type definitions
 
-// The drum identifier (should be 0..15)
-typedef unsigned char SMSA_DRUM_ID;
+// The drum identifier (should be 0..drums-1)
+typedef unsigned short SMSA_DRUM_ID;
 
 // The drum address 
-typedef unsigned short SMSA_BLOCK_ID;
+typedef uint32_t SMSA_BLOCK_ID;
+
+// The shape of the array. The drums and blocks are only ever addressed through
+// SMSA_DISK_ARRAY_SIZE, SMSA_MAX_BLOCK_ID, SMSA_BLOCK_SIZE and SMSA_DISK_SIZE,
+// which read the geometry of the mounted array (or the one the next mount uses)
+typedef struct {
+	uint32_t drums;		// Drums in the array (1..SMSA_MAX_DISK_ARRAY_SIZE)
+	uint32_t blocks;	// Blocks on each drum, a power of two (SMSA_MIN_DRUM_BLOCKS..SMSA_MAX_DRUM_BLOCKS)
+	uint32_t blockSize;	// Bytes in each block, a power of two (SMSA_MIN_BLOCK_SIZE..SMSA_MAX_BLOCK_SIZE)
+} SMSA_GEOMETRY;
 
 // The operations the disk can perform
 typedef enum {
@@ -74,14 +97,75 @@ typedef enum {
 	SMSA_MAX_ERRNO			= 12	// The highest error level (not an error)
 } SMSA_ERROR_LEVEL;
 
+// Where the array is kept between mounts
+typedef enum {
+	SMSA_STORAGE_DEFAULT	= 0,  // Memory, unless SMSA_STORAGE_ENV says otherwise
+	SMSA_STORAGE_MEMORY	= 1,  // Memory only, the array is zeroed on every mount
+	SMSA_STORAGE_FILE	= 2,  // Loaded from the disk file on mount, stored on unmount
+	SMSA_STORAGE_MMAP	= 3,  // The disk file is mapped, pages go in and out on demand
+} SMSA_STORAGE;
+
+// How much of a mapped array survives a crash of the host
+typedef enum {
+	SMSA_SYNC_DEFAULT	= 0,  // Unmount, unless SMSA_SYNC_ENV says otherwise
+	SMSA_SYNC_NONE		= 1,  // Dirty pages are left to the kernel (survives a process crash)
+	SMSA_SYNC_UNMOUNT	= 2,  // Dirty pages are synced to the file on unmount
+	SMSA_SYNC_WRITE		= 3,  // Every write and format is synced before it completes
+} SMSA_SYNC;
+
+// How the seek cost grows with the number of blocks the head moves
+typedef enum {
+	SMSA_SEEK_LINEAR	= 0,  // In proportion to the distance
+	SMSA_SEEK_SQRT		= 1,  // In proportion to the square root of the distance (an arm that accelerates)
+} SMSA_SEEK_CURVE;
+
+// The costs of the device in cycles. The drums sit in a grid gridColumns wide,
+// and a drum seek costs for every row and column between the drums. A block
+// seek of a distance costs seekBase plus seekPerBlock for each unit of its curve,
+// plus half a rotation, since on average the block is half way round. The cost
+// function works them out for a command, and may be replaced by one of our own
+// (see smsa_model_cost for what it gets and returns)
+typedef struct smsa_device_model {
+	const char *name;		// The name of the model
+	uint32_t mountCost;		// Cycles to mount the array
+	uint32_t unmountCost;		// Cycles to unmount the array
+	uint32_t gridColumns;		// Drums in each row of the grid (1 or more)
+	uint32_t drumSeekPerRow;	// Cycles to seek one row of drums
+	uint32_t drumSeekPerColumn;	// Cycles to seek one column of drums
+	SMSA_SEEK_CURVE seekCurve;	// How a block seek grows with its distance
+	uint32_t seekBase;		// Cycles to start a block seek
+	uint32_t seekPerBlock;		// Cycles for each unit of the seek curve
+	uint32_t rotation;		// Cycles a drum takes to turn once (0 for none)
+	uint32_t readCost;		// Cycles to read a block
+	uint32_t writeCost;		// Cycles to write a block
+	uint32_t formatCost;		// Cycles to format a drum
+	int (*cost)( const struct smsa_device_model *model, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID fromDrum,
+			SMSA_BLOCK_ID fromBlock, SMSA_DRUM_ID toDrum, SMSA_BLOCK_ID toBlock, uint32_t count );
+					// Works out the cost of a command (NULL for smsa_model_cost)
+} SMSA_DEVICE_MODEL;
+
+// How long operations take on the wall clock. Every cycle an operation costs
+// becomes nsPerCycle nanoseconds, give or take up to jitter percent, and each
+// drum serves channels operations at a time while the rest queue behind them
+typedef struct {
+	uint32_t nsPerCycle;	// Nanoseconds per cycle (0 for none, operations complete at once)
+	uint32_t jitter;	// Percent the delay varies either way (0..100)
+	uint32_t channels;	// Operations a drum serves at once (1..SMSA_MAX_DRUM_CHANNELS, 0 for any number)
+} SMSA_LATENCY;
+
 //
 // Global data
-extern SMSA_ERROR_LEVEL smsa_error_number;
+extern __thread SMSA_ERROR_LEVEL smsa_error_number;
+extern SMSA_GEOMETRY smsa_geometry;
 //
 // Disk interface
 
 int smsa_operation( uint32_t op, unsigned char *block );
-	// This is the (*only*) interface to the disk array
+	// This is the interface to the disk array, through the heads (one thread at a time)
+
+int smsa_operation_at( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char *blocks );
+	// Read, write, format or sign at a drum/block rather than the heads (reentrant,
+	// operations on different drums run at the same time)
 
 int SMSABlockSign( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block );
 	// Generate a signature for a particular block
@@ -95,4 +179,24 @@ unsigned long smsa_get_cycle_count( void );
 const char * smsa_error_string( int eno );
 	// This returns a constant string detailing the meaning of an SMSA error
 
+int smsa_set_storage( SMSA_STORAGE storage, SMSA_SYNC sync, const char *file );
+	// Set where the array is kept on the next mount (NULL file for SMSA_DISK_FILE)
+
+int smsa_set_geometry( uint32_t drums, uint32_t blocks, uint32_t blockSize );
+	// Set the geometry of the array for the next mount (0s for the default)
+
+int smsa_set_latency( uint32_t nsPerCycle, uint32_t jitter, uint32_t channels );
+	// Set the latency emulated from the next mount (0 ns for SMSA_LATENCY_ENV, or none)
+
+const SMSA_DEVICE_MODEL * smsa_device_preset( const char *name );
+	// Find a device model by name, NULL if there is none
+
+int smsa_set_device_model( const SMSA_DEVICE_MODEL *model );
+	// Set the device model from the next mount (NULL for SMSA_DEVICE_ENV, or SMSA_DEFAULT_DEVICE)
+
+int smsa_model_cost( const SMSA_DEVICE_MODEL *model, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID fromDrum,
+		SMSA_BLOCK_ID fromBlock, SMSA_DRUM_ID toDrum, SMSA_BLOCK_ID toBlock, uint32_t count );
+	// The cycles a command costs with the heads at fromDrum/fromBlock, moving to
+	// (or reading or writing count blocks at) toDrum/toBlock, -1 for a bad command
+
 #endif
@@ -34,12 +34,36 @@ int SMSAReadBlock( unsigned char *block );
 int SMSAWriteBlock( unsigned char *block );
 int SMSAFormatDrum( void );
 
+// Positional command functions (do not use or move the heads, safe to call
+// from several threads as long as the caller serializes access to each drum,
+// which smsa_operation_at does with the drum locks)
+int SMSAReadBlocksAt( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count, unsigned char *blocks );
+int SMSAWriteBlocksAt( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count, unsigned char *blocks );
+int SMSAFormatDrumAt( SMSA_DRUM_ID did );
+
 // Utility functions
 int SMSAStoreArray( void );
 int SMSALoadArray( void );
+int SMSAMapArray( void );
+int SMSAUnmapArray( void );
+int SMSASyncArray( unsigned char *ptr, size_t len );
+void mark_dirty_blocks( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count );
+void init_drum_locks( void );
+void lock_drums( SMSA_DRUM_ID first, SMSA_DRUM_ID last, int exclusive );
+void unlock_drums( SMSA_DRUM_ID first, SMSA_DRUM_ID last );
+SMSA_STORAGE storage_mode( void );
+SMSA_SYNC storage_sync( void );
+SMSA_LATENCY latency_model( void );
+SMSA_DEVICE_MODEL device_model( void );
+void charge_cycles( int cycles );
+void emulate_latency( SMSA_DRUM_ID did );
 int decode_SMSA_operation( SMSA_OPERATION *dop, uint32_t op, unsigned char *block );
 uint32_t encode_SMSA_operation( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID addr );
 unsigned char * block_address( SMSA_DRUM_ID did, SMSA_BLOCK_ID bid );
+int device_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID fromDrum, SMSA_BLOCK_ID fromBlock,
+		SMSA_DRUM_ID toDrum, SMSA_BLOCK_ID toBlock, uint32_t count );
 int operation_cycle_cost( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid );
+int operation_cycle_cost_at( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID did, SMSA_BLOCK_ID bid, uint32_t count );
+uint32_t integer_sqrt( uint32_t n );
 
 #endif
@@ -248,7 +248,7 @@ int smsa_server_handle_connection( int sock ) {
 
     // Local variables
     int receiving = 1, blkbytes;
-    unsigned char block[SMSA_BLOCK_SIZE];
+    unsigned char block[SMSA_MAX_BLOCK_SIZE];
     uint32_t op;
     int16_t ret;
 
@@ -11,18 +11,211 @@
 //
 
 // Include Files
+#include <stdint.h>
 
 // Project Include Files
+#include <smsa.h>
 
 // Defines
-#define SMSA_MAX_BACKLOG 5
+#define SMSA_MAX_BACKLOG 128
 #define SMSA_NET_HEADER_SIZE (sizeof(uint16_t)+sizeof(uint32_t)+sizeof(uint16_t))
 #define SMSA_DEFAULT_IP "127.0.0.1"
 #define SMSA_DEFAULT_PORT 16784
+#define SMSA_ADDRESS_ENV "SMSA_SERVER_ADDRESS"  // Environment override of the server address
+#define SMSA_PORT_ENV "SMSA_SERVER_PORT"        // Environment override of the server port
+#define SMSA_TRANSPORT_ENV "SMSA_TRANSPORT"     // Environment override of the transport ("uring")
+#define SMSA_CONNECTIONS_ENV "SMSA_CONNECTIONS" // Environment override of the number of client connections
+#define SMSA_PROTOCOL_ENV "SMSA_PROTOCOL"       // Environment override of the highest protocol version
+#define SMSA_REPLICAS_ENV "SMSA_REPLICAS"       // Environment list of the replicas the client reads from
+#define SMSA_CONSISTENCY_ENV "SMSA_CONSISTENCY" // Environment override of the consistency of replica reads
+#define SMSA_SHARDS_ENV "SMSA_SHARDS"           // Environment shard map of the servers the drums are spread over
+#define SMSA_TIMEOUT_ENV "SMSA_TIMEOUT"         // Environment override of the msec the client waits for a response
+#define SMSA_DEFAULT_TIMEOUT 10000              // Msec the client waits for a response by default
+#define SMSA_NET_VERSION 2                      // Highest protocol version this code speaks
+#define SMSA_NET_V2_HEADER_SIZE 24              // Size of a v2 frame header
+#define SMSA_NET_MAX_BLOCKS 64                  // Most blocks a v2 frame carries
+#define SMSA_NET_MAX_PAYLOAD (SMSA_NET_MAX_BLOCKS*SMSA_MAX_BLOCK_SIZE)	// Most bytes of blocks in a frame, in any geometry
+#define SMSA_NET_MAX_FRAME_SIZE (SMSA_NET_V2_HEADER_SIZE+SMSA_NET_MAX_PAYLOAD)
+#define SMSA_NET_FRAME_SIZE (SMSA_NET_V2_HEADER_SIZE+SMSA_NET_MAX_BLOCKS*SMSA_BLOCK_SIZE)	// Most bytes of a frame in the geometry of the array
+#define SMSA_NET_GEOMETRY_FLAG 0x20000          // Block id bit of a mount response that carries the geometry
+#define SMSA_NET_MOVED (-2)                     // Return of an operation on a drum the server moved, or is moving, away
+
+// Encode an opcode, including the network only commands that encode_SMSA_operation rejects
+#define SMSA_NET_OPERATION(cmd,did,bid) ((((uint32_t)(cmd))<<26)|((((uint32_t)(did))&0xf)<<22)|((((uint32_t)(did))>>4)<<18)|((uint32_t)(bid)))
 
 //
 // Type Definitions
 
+// Commands that only exist on the network. They use the same opcode layout as
+// SMSA_DISK_COMMAND, but carry the drum and block they work on, so they do not
+// depend on (or move) the seek heads of the connection. The server handles them
+// itself and never passes them to smsa_operation
+typedef enum {
+	SMSA_NET_READ_AT	= 16,	// Read the drum/block in the opcode
+	SMSA_NET_WRITE_AT	= 17,	// Write the drum/block in the opcode
+	SMSA_NET_HELLO		= 18,	// Agree on a protocol version (see below)
+	SMSA_NET_CACHE_STATS	= 19,	// Read the stats of the server block cache (see below)
+	SMSA_NET_INVALIDATE	= 20,	// Sent by the server: drop the cached drum/blocks in the opcode (see below)
+	SMSA_NET_FOLLOW		= 21,	// Sent by a leader: this connection is its link to the follower (see below)
+	SMSA_NET_SNAPSHOT	= 22,	// Take an image of the array as it is now (see below)
+	SMSA_NET_SNAPSHOT_READ	= 23,	// Read the drum/block in the opcode from the image
+	SMSA_NET_SNAPSHOT_DROP	= 24,	// Drop the image the connection took
+	SMSA_NET_EXPORT		= 25,	// Write an image of the array to the export file of the server
+	SMSA_NET_MOVE_DRUM	= 26,	// Fence the drum in the opcode, or move it in or out (see below)
+	SMSA_NET_DRUM_HOME	= 27,	// Read where the drum in the opcode was moved to
+} SMSA_NET_COMMAND;
+
+// What SMSA_NET_MOVE_DRUM does, given in the block id of its opcode
+typedef enum {
+	SMSA_NET_MOVE_FENCE	= 0,	// Finish the operations on the drum, then only take them from this connection
+	SMSA_NET_MOVE_IN	= 1,	// The drum is here now, take its operations from everyone
+	SMSA_NET_MOVE_OUT	= 2,	// The drum is at the host:port in the payload, send everyone there
+	SMSA_NET_MOVE_ABORT	= 3,	// Drop the fence, leaving the drum where it was
+} SMSA_NET_MOVE_PHASE;
+
+// Protocol versions
+//
+// Version 1 frames are the original packet:
+//
+//  Bytes 0-1   : length - how many total bytes in packet
+//  Bytes 2-5   : opcode - the opcode for the command
+//  Bytes 6-7   : return - return code of command
+//  Bytes 8-    : block - as needed, SMSA_BLOCK_SIZE bytes
+//
+// The geometry of the array is set on the server. The response to SMSA_MOUNT
+// carries it in the opcode, with the drums less one in the drum id, and
+// SMSA_NET_GEOMETRY_FLAG, the log2 of the block size ( bits 5-8 ) and the log2
+// of the blocks on a drum ( bits 0-4 ) in the block id. A response without the
+// flag comes from a server that only has the default geometry. The client
+// takes the geometry of the first server it mounts, and fails the mount of any
+// other that has a different one
+//
+// Every connection starts out speaking version 1. A client that speaks more
+// sends SMSA_NET_HELLO as its first packet, with the highest version it speaks
+// in the block id of the opcode, and the SMSA_NET_FLAGS it would like to use in
+// the drum id. A server that only speaks version 1 fails it like any unknown
+// command, and both sides keep to version 1. Otherwise the response carries the
+// version and flags they agreed on the same way, and every frame after it uses
+// that version. Version 2 frames are:
+//
+//  Bytes 0-3   : length - how many total bytes in the frame
+//  Bytes 4-7   : request id - set by the client, returned in the response
+//  Bytes 8-11  : opcode - the opcode for the command
+//  Bytes 12-13 : return - return code of command
+//  Bytes 14-15 : flags - SMSA_NET_FLAGS that apply to the payload
+//  Bytes 16-17 : blocks - how many blocks the command covers
+//  Bytes 18-19 : reserved - zero
+//  Bytes 20-23 : checksum - CRC32 of the payload, with SMSA_NET_FLAG_CHECKSUM,
+//                or the sequence number of a frame without a payload
+//  Bytes 24-   : payload - the blocks, as needed
+//
+// SMSA_NET_READ_AT and SMSA_NET_WRITE_AT may cover up to SMSA_NET_MAX_BLOCKS
+// blocks of a drum, starting at the block in the opcode. With
+// SMSA_NET_FLAG_COMPRESSED the payload is the blocks compressed as described
+// in smsa_compress.c, and the length is shorter to match. With
+// SMSA_NET_FLAG_UNIFORM every block is a single byte value repeated, and the
+// payload is just those bytes, one per block. The checksum always covers the
+// blocks themselves
+//
+// With SMSA_NET_FLAG_INVALIDATE the server keeps track of the blocks the client
+// reads and writes over the connection, and when another connection writes one
+// of them, or formats its drum, it sends an SMSA_NET_INVALIDATE frame that no
+// request asked for. It has request id 0 and no payload, and covers the blocks
+// in its header, starting at the drum/block in the opcode, or the whole drum
+// if it covers none, as it does after a format. A client can get one
+// before a response, or on a connection that is idle, and drops those blocks
+// from its cache
+//
+// A server can be the leader of follower servers, which hold copies of its
+// array. The leader links to each follower with a version 2 connection that
+// sends SMSA_NET_FOLLOW and mounts, and forwards every write and format to it
+// over the link, in order, with the request id of each set to its sequence
+// number. The response to a write or format on the leader carries that
+// sequence number. A follower takes no writes but those of its link. A read
+// sent to a follower can carry a sequence number too, and the follower fails
+// it, with its own sequence number in the response, unless it has performed
+// that write. Otherwise it reads at whatever the follower holds
+//
+// A client can spread the drums of the array over a cluster of servers with a
+// shard map, a list of host:port[=first-last] that gives each server the drums
+// it holds. Each client keeps a map of its own, and each server only ever sees
+// the drums of its own shard. A client moves a drum to another server by
+// sending SMSA_NET_MOVE_DRUM with SMSA_NET_MOVE_FENCE to both, which answer once
+// the operations they took on the drum are done, and from then on fail the
+// operations of every other connection on it with SMSA_NET_MOVED. It copies the
+// drum over with SMSA_NET_READ_AT and SMSA_NET_WRITE_AT, then sends
+// SMSA_NET_MOVE_IN to the new server and SMSA_NET_MOVE_OUT to the old one, with
+// the new one as host:port in a one block payload. A client that gets
+// SMSA_NET_MOVED asks with SMSA_NET_DRUM_HOME, whose response carries that
+// host:port in one block, or an empty string while the drum is being moved or
+// is back on the server. It sends the operation there, or back to the same
+// server after a while. A fence is dropped when the connection that holds it
+// closes, and the moves are forgotten when the array is unmounted
+//
+// A client only waits so long for a response, and then fails the operation and
+// drops the connection. A version 2 read that is slower than most can be sent
+// again as an SMSA_NET_READ_AT over another connection to the array, a replica
+// or another connection to the server, and whichever response comes in first is
+// taken. The other is dropped, by its request id, when it comes in
+//
+// A client backs up the array with SMSA_NET_SNAPSHOT, which takes a point-in-
+// time image of it, then reads the image with SMSA_NET_SNAPSHOT_READ, which
+// covers up to SMSA_NET_MAX_BLOCKS blocks like SMSA_NET_READ_AT, while other
+// clients keep writing. It drops the image with SMSA_NET_SNAPSHOT_DROP, or by
+// closing the connection. The server keeps one image at a time, and fails
+// SMSA_NET_SNAPSHOT while there is one. Any connection can read the image.
+// SMSA_NET_EXPORT has the server write an image to its own export file, and
+// its response comes once the file holds all of it. With a shard map, each
+// server takes an image of its own drums
+typedef enum {
+	SMSA_NET_FLAG_CHECKSUM	= 0x1,	// The payload is covered by the checksum
+	SMSA_NET_FLAG_COMPRESSED = 0x2,	// The payload is compressed
+	SMSA_NET_FLAG_UNIFORM	= 0x4,	// Every block is one byte value, sent as that byte
+	SMSA_NET_FLAG_INVALIDATE = 0x8,	// The server sends SMSA_NET_INVALIDATE ( hello only )
+} SMSA_NET_FLAGS;
+
+// This is called by the client with the blocks of an SMSA_NET_INVALIDATE
+typedef void (*SMSA_INVALIDATE_HANDLER)( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count );
+
+// Where a client with replicas sends its reads
+typedef enum {
+	SMSA_CONSISTENCY_DEFAULT = 0,	// Read your writes, unless SMSA_CONSISTENCY_ENV says otherwise
+	SMSA_CONSISTENCY_LEADER	= 1,	// Every read goes to the leader ( "leader" )
+	SMSA_CONSISTENCY_SESSION = 2,	// A replica is read once it has the writes of the client ( "session" )
+	SMSA_CONSISTENCY_ANY	= 3,	// A replica is read at whatever it holds ( "any" )
+} SMSA_CONSISTENCY;
+
+// The position of the seek heads of a connection. The server keeps one for
+// every connection, and the client keeps a copy so it can tell where they are
+typedef struct {
+	SMSA_DRUM_ID	drum;		// drum head position
+	SMSA_BLOCK_ID	block;		// block head position
+} SMSA_HEAD;
+
+// The stats of the block cache the server keeps in front of the array. The
+// response to SMSA_NET_CACHE_STATS carries them in a single block, as 64 bit
+// numbers in network byte order in the order below. They are all 0 if the
+// server has no cache
+typedef struct {
+	uint64_t	lines;		// blocks the cache can hold
+	uint64_t	used;		// blocks it holds now
+	uint64_t	lookups;	// reads looked up in the cache
+	uint64_t	hits;		// reads the cache served
+	uint64_t	fills;		// blocks put in the cache after a miss
+	uint64_t	updates;	// cached blocks replaced by a write
+	uint64_t	evictions;	// cached blocks pushed out by a fill
+	uint64_t	invalidations;	// cached blocks dropped by a format, mount or unmount
+	uint64_t	hitNanos;	// time spent serving the hits
+	uint64_t	missNanos;	// time spent reading the misses from the array
+} SMSA_SERVER_CACHE_STATS;
+
+// How the client and server do their network I/O
+typedef enum {
+	SMSA_TRANSPORT_DEFAULT	= 0,	// Plain sockets, unless SMSA_TRANSPORT_ENV says otherwise
+	SMSA_TRANSPORT_SOCKETS	= 1,	// Plain socket system calls (epoll on the server)
+	SMSA_TRANSPORT_URING	= 2,	// io_uring, falling back to sockets if the kernel lacks it
+} SMSA_TRANSPORT;
+
 //
 // Funtional Prototypes
 
@@ -32,4 +225,73 @@ int smsa_client_operation( uint32_t op, unsigned char *block );
 int smsa_server( void );
     // This is the implementation of the server application
 
+int smsa_client_set_address( char *ip, uint16_t port );
+    // Set the server address/port the client connects to (NULL/0 for default)
+
+int smsa_server_set_address( char *ip, uint16_t port );
+    // Set the address/port the server listens on (NULL/0 for default)
+
+int smsa_server_set_workers( int workers );
+    // Set the number of worker threads the server uses (0 for none)
+
+int smsa_client_set_transport( SMSA_TRANSPORT transport );
+    // Set the transport the client uses on the next mount
+
+int smsa_server_set_transport( SMSA_TRANSPORT transport );
+    // Set the transport the server uses
+
+int smsa_client_set_connections( int connections );
+    // Set the number of connections the client spreads the drums over (0 for default)
+
+int smsa_client_set_protocol( int version, uint16_t flags );
+    // Set the highest protocol version (0 for default) and the SMSA_NET_FLAGS the client asks for
+
+int smsa_server_set_protocol( int version );
+    // Set the highest protocol version the server agrees to (0 for default)
+
+int smsa_server_set_cache( uint32_t lines );
+    // Set the number of blocks the server caches in front of the array (0 for none)
+
+int smsa_client_cache_stats( SMSA_SERVER_CACHE_STATS *stats );
+    // Get the stats of the server block cache with SMSA_NET_CACHE_STATS
+
+int smsa_client_operation_blocks( uint32_t op, uint16_t count, unsigned char *blocks );
+    // Perform an SMSA_NET_READ_AT or SMSA_NET_WRITE_AT that covers count blocks
+
+int smsa_client_set_invalidate( SMSA_INVALIDATE_HANDLER handler );
+    // Ask for SMSA_NET_INVALIDATE on the next mount, and set who is told ( NULL for none )
+
+int smsa_client_poll_invalidations( SMSA_DRUM_ID drum );
+    // Take the SMSA_NET_INVALIDATE frames waiting on the connection of a drum
+
+int smsa_client_set_replicas( char *replicas, SMSA_CONSISTENCY consistency );
+    // Set the followers the client spreads its reads over ( host:port,... ), and how
+
+int smsa_client_set_shards( char *shards );
+    // Set the servers the drums are spread over ( host:port[=first-last],... )
+
+int smsa_client_move_drum( SMSA_DRUM_ID drum, int server );
+    // Move a drum to another server of the shard map while the array is mounted
+
+int smsa_client_set_timeout( uint32_t timeout, int hedge );
+    // Set the msec the client waits for a response, and if slow reads are hedged
+
+int smsa_server_add_follower( char *follower );
+    // Add a follower ( host:port ) the server forwards its writes to
+
+int smsa_server_set_follower( int follower );
+    // Set the server to be a follower, which only takes writes from its leader
+
+int smsa_server_set_log( char *file );
+    // Set the write-ahead log the server syncs its writes to before it acknowledges them
+
+int smsa_server_set_export( char *file );
+    // Set the file the server exports images of the array to
+
+int smsa_client_snapshot( int take );
+    // Take a point-in-time image of the array on the server ( or drop it )
+
+int smsa_client_export( void );
+    // Have the server write an image of the array to its export file
+
 #endif
@@ -10,6 +10,8 @@
 // Include Files
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -27,15 +29,44 @@
 #include <cmpsc311_util.h>
 
 // Defines
-#define SMSA_ARGUMENTS "huvl:c:"
+#define SMSA_ARGUMENTS "huvikzsHxl:c:a:p:n:P:r:R:m:T:f:"
 #define USAGE \
-	"USAGE: smsa [-h] [-v] [-l <logfile>] [-c <sz>] <workload-file>\n" \
+	"USAGE: smsa [-h] [-v] [-l <logfile>] [-c <sz>] [-a <address>] [-p <port>] [-i]\n" \
+	"            [-n <connections>] [-P <protocol>] [-k] [-z] [-s] [-r <replicas>]\n" \
+	"            [-R <consistency>] [-m <shards>] [-T <msec>] [-H] [-f <snapshot>]\n" \
+	"            [-x] <workload-file>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"    -c - set cache size to <sz> lines\n" \
+	"    -a - connect to the server at <address> (IPv4, IPv6 or host name)\n" \
+	"    -p - connect to the server on <port>\n" \
+	"    -i - talk to the server with io_uring (if the kernel supports it)\n" \
+	"    -n - spread the drums over <connections> connections to the server\n" \
+	"    -P - speak at most version <protocol> of the network protocol\n" \
+	"    -k - checksum the blocks sent to and from the server (protocol 2)\n" \
+	"    -z - compress the blocks sent to and from the server (protocol 2)\n" \
+	"    -s - share the array, the server says when others write cached blocks (protocol 2)\n" \
+	"    -r - read from the followers in <replicas>, a list of host:port (protocol 2)\n" \
+	"    -R - what a read from a replica sees, <consistency> is leader, session\n" \
+	"         (the writes of this client, the default) or any\n" \
+	"    -m - spread the drums over the servers in <shards>, a list of\n" \
+	"         host:port[=first-last], instead of one server\n" \
+	"    -T - wait at most <msec> milliseconds for the server to answer\n" \
+	"    -H - never send a slow read again over another connection\n" \
+	"    -f - restore the array from the file <snapshot> on mount, and save it\n" \
+	"         there on unmount\n" \
+	"    -x - have the server write an image of the array to its export file\n" \
+	"         on unmount (see smsasrvr -x)\n" \
+	"\n" \
+	"    The server address and port may also be set with the SMSA_SERVER_ADDRESS\n" \
+	"    and SMSA_SERVER_PORT environment variables, io_uring with\n" \
+	"    SMSA_TRANSPORT=uring, the connections with SMSA_CONNECTIONS, the\n" \
+	"    protocol with SMSA_PROTOCOL, the replicas with SMSA_REPLICAS, the\n" \
+	"    consistency with SMSA_CONSISTENCY, the shards with SMSA_SHARDS and the\n" \
+	"    wait with SMSA_TIMEOUT (0 waits for ever).\n" \
 	"\n" \
 	"    <workload-file> - file contain the workload to simulate\n" \
 	"\n" \
@@ -47,7 +78,7 @@ int verbose;
 //
 // Functional Prototypes
 
-int simulate_SMSA( char *wload, int cache_size );
+int simulate_SMSA( char *wload, SMSA_MOUNT_OPTIONS *options );
 
 //
 // Functions
@@ -66,6 +97,11 @@ int main( int argc, char *argv[] )
 	// Local variables
 	int ch, verbose = 0, log_initialized = 0;
 	uint32_t cache_size = 1024; // Defaults to 1024 cache lines
+	unsigned int port;
+	SMSA_MOUNT_OPTIONS options;
+
+	// Default to the environment/default server address
+	memset( &options, 0x0, sizeof(options) );
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
@@ -90,6 +126,88 @@ int main( int argc, char *argv[] )
 			}
 			break;
 
+		case 'a': // Set the server address
+			options.server_ip = optarg;
+			break;
+
+		case 'p': // Set the server port
+			if ( (sscanf( optarg, "%u", &port ) != 1) || (port == 0) || (port > 65535) ) {
+			    fprintf( stderr, "Bad server port [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			options.server_port = port;
+			break;
+
+		case 'i': // Use io_uring
+			options.transport = SMSA_TRANSPORT_URING;
+			break;
+
+		case 'n': // Set the number of connections
+			if ( (sscanf( optarg, "%d", &options.connections ) != 1) || (options.connections < 1) ) {
+			    fprintf( stderr, "Bad number of connections [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'P': // Set the protocol version
+			if ( (sscanf( optarg, "%d", &options.protocol ) != 1) || (options.protocol < 1) || (options.protocol > SMSA_NET_VERSION) ) {
+			    fprintf( stderr, "Bad protocol version [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'k': // Checksum the blocks
+			options.checksums = 1;
+			break;
+
+		case 'z': // Compress the blocks
+			options.compression = 1;
+			break;
+
+		case 's': // Keep the cache coherent with other clients
+			options.coherent = 1;
+			break;
+
+		case 'r': // Set the replicas to read from
+			options.replicas = optarg;
+			break;
+
+		case 'm': // Set the shard map
+			options.shards = optarg;
+			break;
+
+		case 'T': // Set how long to wait for the server
+			if ( (sscanf( optarg, "%u", &options.timeout ) != 1) || (options.timeout == 0) ) {
+			    fprintf( stderr, "Bad timeout [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'H': // Do not hedge slow reads
+			options.no_hedging = 1;
+			break;
+
+		case 'f': // Set the snapshot file
+			options.snapshot = optarg;
+			break;
+
+		case 'x': // Have the server export the array
+			options.export = 1;
+			break;
+
+		case 'R': // Set the consistency of replica reads
+			if ( strcmp( optarg, "leader" ) == 0 ) {
+			    options.consistency = SMSA_CONSISTENCY_LEADER;
+			} else if ( strcmp( optarg, "session" ) == 0 ) {
+			    options.consistency = SMSA_CONSISTENCY_SESSION;
+			} else if ( strcmp( optarg, "any" ) == 0 ) {
+			    options.consistency = SMSA_CONSISTENCY_ANY;
+			} else {
+			    fprintf( stderr, "Bad consistency [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -114,7 +232,8 @@ int main( int argc, char *argv[] )
 	}
 
 	// Run the simulation
-	if ( simulate_SMSA(argv[optind], cache_size) == 0 ) {
+	options.cache_size = cache_size;
+	if ( simulate_SMSA(argv[optind], &options) == 0 ) {
 
 		// Program completed successfully
 		logMessage( LOG_INFO_LEVEL, "SMSA simulation completed successfully.\n\n" );
@@ -136,15 +255,17 @@ int main( int argc, char *argv[] )
 // Description  : The main control loop for the processing of the SMSA sim
 //
 // Inputs       : wload - the name of the workload file
+//                options - the options to mount the array with
 // Outputs      : 0 if successful test, -1 if failure
 
-int simulate_SMSA( char *wload, int cache_size ) {
+int simulate_SMSA( char *wload, SMSA_MOUNT_OPTIONS *options ) {
 
 	// Local variables
 	char line[256], cmd[32];
-	unsigned char buf[SMSA_MAXIMUM_RDWR_SIZE], sig[CMPSC311_HASH_LENGTH], sigstr[CMPSC311_HASH_LENGTH*4];
+	unsigned char *buf, sig[CMPSC311_HASH_LENGTH], sigstr[CMPSC311_HASH_LENGTH*4];
 	FILE *fhandle = NULL;
-	uint32_t addr, len, ch, slen, op;
+	uint64_t addr;
+	uint32_t len, ch, slen, op;
 	int i, j, err;
 
 	// Open the workload file
@@ -154,6 +275,13 @@ int simulate_SMSA( char *wload, int cache_size ) {
 		return( -1 );
 	}
 
+	// Get a buffer for the largest read or write
+	if ( (buf=malloc(SMSA_MAXIMUM_RDWR_SIZE)) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "Failure allocating the workload buffer." );
+		fclose( fhandle );
+		return( -1 );
+	}
+
 	// While file not done
 	while (!feof(fhandle)) {
 
@@ -163,7 +291,7 @@ int simulate_SMSA( char *wload, int cache_size ) {
 			// Check for mount
 			if ( strncmp(SMSA_WORKLOAD_MOUNT,line,strlen(SMSA_WORKLOAD_MOUNT)) == 0 ) {
 				logMessage( LOG_INFO_LEVEL, "Calling virtual driver mount ");
-				err = smsa_vmount( cache_size );
+				err = smsa_vmount_options( options );
 			}
 
 			// Check for mount
@@ -186,6 +314,7 @@ int simulate_SMSA( char *wload, int cache_size ) {
 					    // Error out 
 					    logMessage( LOG_ERROR_LEVEL, "Error signing block [%d,%d]", i, j );
 					    fclose( fhandle );
+					    free( buf );
 					    return( -1 );
 					}
 
@@ -200,28 +329,31 @@ int simulate_SMSA( char *wload, int cache_size ) {
 			else {
 
 				// Parse out the command
-				if ( sscanf( line, "%7s %7u %4u %3u", cmd, &addr, &len, &ch ) != 4 ) {
+				if ( (sscanf( line, "%7s %20" SCNu64 " %8u %3u", cmd, &addr, &len, &ch ) != 4) ||
+						(len > SMSA_MAXIMUM_RDWR_SIZE) ) {
 					logMessage( LOG_ERROR_LEVEL, "Error parsing virtual command [%s\n]", line );
 					fclose( fhandle );
+					free( buf );
 					return( -1 );
 				}
 
 				// Check for read
 				if ( strncmp(SMSA_WORKLOAD_READ, cmd, strlen(SMSA_WORKLOAD_READ)) == 0 ) {
-					logMessage( LOG_INFO_LEVEL, "Calling virtual driver read (addr=%x, len=%u)", addr, len);
+					logMessage( LOG_INFO_LEVEL, "Calling virtual driver read (addr=%" PRIx64 ", len=%u)", addr, len);
 
 					// Do the read, fingerprint the returned buffer so we can validate
 					if ( !(err = smsa_vread( addr, len, buf )) ) {
 						slen = CMPSC311_HASH_LENGTH;
 						if ( generate_md5_signature( buf, len, sig, &slen) ) {
-							logMessage( LOG_ERROR_LEVEL, "SIM Signature failed (%lu)", addr );
+							logMessage( LOG_ERROR_LEVEL, "SIM Signature failed (%" PRIu64 ")", addr );
+							free( buf );
 							return( -1 );
 						}
 						bufToString( sig, slen, sigstr, CMPSC311_HASH_LENGTH*4 );
-						logMessage( LOG_OUTPUT_LEVEL, "READ SIG : %lu len %lu - %s", addr, len, sigstr );
+						logMessage( LOG_OUTPUT_LEVEL, "READ SIG : %" PRIu64 " len %u - %s", addr, len, sigstr );
 					} else {
 						// Print out error
-						logMessage( LOG_ERROR_LEVEL, "Read failed (%lu,len=%lu)", addr, len );
+						logMessage( LOG_ERROR_LEVEL, "Read failed (%" PRIu64 ",len=%u)", addr, len );
 					}
 				}
 
@@ -229,7 +361,7 @@ int simulate_SMSA( char *wload, int cache_size ) {
 				else if ( strncmp(SMSA_WORKLOAD_WRITE, cmd, strlen(SMSA_WORKLOAD_WRITE)) == 0 ) {
 
 					// Now setup the buffer and make the call
-					logMessage( LOG_INFO_LEVEL, "Calling virtual driver write (addr=%x, len=%u, ch=%u)", addr, len, ch);
+					logMessage( LOG_INFO_LEVEL, "Calling virtual driver write (addr=%" PRIx64 ", len=%u, ch=%u)", addr, len, ch);
 					memset( buf, ch, len );
 					err = smsa_vwrite( addr, len, buf );
 				}
@@ -239,6 +371,7 @@ int simulate_SMSA( char *wload, int cache_size ) {
 					// WTF? I don't know what this is
 					logMessage( LOG_ERROR_LEVEL, "Unknown virtual command, aborting [%s]", cmd );
 					fclose( fhandle );
+					free( buf );
 					return( -1 );
 				}
 			}
@@ -247,6 +380,7 @@ int simulate_SMSA( char *wload, int cache_size ) {
 			if ( err ) {
 				logMessage( LOG_ERROR_LEVEL, "Virtual array failed, aborting [%d]", err );
 				fclose( fhandle );
+				free( buf );
 				return( -1 );
 			}
 		}
@@ -254,6 +388,7 @@ int simulate_SMSA( char *wload, int cache_size ) {
   
 	// Close the workload file
 	fclose( fhandle );
+	free( buf );
 
 	// Return successfully
 	return( 0 );
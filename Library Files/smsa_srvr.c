@@ -9,6 +9,8 @@
 
 // Include Files
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
 #include <getopt.h>
 
 // Project Includes
@@ -17,14 +19,51 @@
 #include <cmpsc311_log.h>
 
 // Defines
-#define SMSA_ARGUMENTS "vhl:"
+#define SMSA_ARGUMENTS "vhil:a:p:t:P:c:f:Fd:s:D:w:x:g:L:m:"
 #define USAGE \
-	"USAGE: smsasrvr [-h] [-v] [-l <logfile>]\n" \
+	"USAGE: smsasrvr [-h] [-v] [-l <logfile>] [-a <address>] [-p <port>]\n" \
+	"                [-t <workers>] [-i] [-P <protocol>] [-c <blocks>]\n" \
+	"                [-f <host:port>]... [-F] [-d <storage>] [-s <sync>]\n" \
+	"                [-D <file>] [-w <logfile>] [-x <file>]\n" \
+	"                [-g <drums:blocks:size>] [-L <ns:jitter:channels>]\n" \
+	"                [-m <model>]\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
+	"    -a - listen on <address> (IPv4, IPv6 or host name, default any)\n" \
+	"    -p - listen on <port>\n" \
+	"    -t - perform drum operations with <workers> worker threads\n" \
+	"    -i - serve clients with io_uring (if the kernel supports it)\n" \
+	"    -P - speak at most version <protocol> of the network protocol\n" \
+	"    -c - cache the <blocks> most recently read blocks for all clients\n" \
+	"    -f - forward every write to the follower at <host:port> (repeatable)\n" \
+	"    -F - be a follower, taking writes only from the leader that links\n" \
+	"         to it, and serving reads to clients\n" \
+	"    -d - keep the array in <storage>: memory (the default), file (load\n" \
+	"         it on mount and store it on unmount) or mmap (map the file)\n" \
+	"    -s - <sync> a mapped array: none (leave it to the kernel), unmount\n" \
+	"         (the default) or write (sync every write before answering)\n" \
+	"    -D - keep the array in <file> (default smsa_data.dat)\n" \
+	"    -w - log every write to <logfile> before answering it, and replay\n" \
+	"         the log on mount (needs file storage, the default with -w)\n" \
+	"    -x - write an image of the array to <file> when a client asks for\n" \
+	"         an export, while the other clients keep writing\n" \
+	"    -g - shape the array as <drums> drums of <blocks> blocks of <size>\n" \
+	"         bytes (default 16:256:256). The blocks and size are powers of\n" \
+	"         two, up to 256:262144:4096\n" \
+	"    -L - make each operation take <ns> nanoseconds for every cycle it\n" \
+	"         costs, give or take <jitter> percent, with each drum serving\n" \
+	"         <channels> operations at a time (default 1, 0 for any number)\n" \
+	"    -m - cost operations with the device <model>: classic (the default),\n" \
+	"         hdd (a spinning disk) or ssd (flash, with no seeks)\n" \
+	"\n" \
+	"    The address and port may also be set with the SMSA_SERVER_ADDRESS\n" \
+	"    and SMSA_SERVER_PORT environment variables, io_uring with\n" \
+	"    SMSA_TRANSPORT=uring, the protocol with SMSA_PROTOCOL, and the\n" \
+	"    storage and sync with SMSA_STORAGE and SMSA_SYNC, the latency with\n" \
+	"    SMSA_LATENCY and the device model with SMSA_DEVICE.\n" \
 	"\n" \
 
 //
@@ -49,6 +88,15 @@ int main( int argc, char *argv[] )
 {
 	// Local variables
 	int ch, verbose = 0, log_initialized = 0;
+	char *ip = NULL;
+	unsigned int port = 0;
+	int workers = 0, protocol = 0;
+	unsigned int cache = 0;
+	unsigned int drums, blocks, size;
+	unsigned int ns, jitter, channels;
+	SMSA_STORAGE storage = SMSA_STORAGE_DEFAULT;
+	SMSA_SYNC sync = SMSA_SYNC_DEFAULT;
+	char *file = NULL, *log = NULL;
 
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
@@ -67,6 +115,117 @@ int main( int argc, char *argv[] )
 			log_initialized = 1;
 			break;
 
+		case 'a': // Set the listen address
+			ip = optarg;
+			break;
+
+		case 'p': // Set the listen port
+			if ( (sscanf( optarg, "%u", &port ) != 1) || (port == 0) || (port > 65535) ) {
+			    fprintf( stderr, "Bad server port [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'i': // Use io_uring
+			smsa_server_set_transport( SMSA_TRANSPORT_URING );
+			break;
+
+		case 't': // Set the number of worker threads
+			if ( (sscanf( optarg, "%d", &workers ) != 1) || (workers < 0) ) {
+			    fprintf( stderr, "Bad number of workers [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'P': // Set the protocol version
+			if ( (sscanf( optarg, "%d", &protocol ) != 1) || (protocol < 1) || (protocol > SMSA_NET_VERSION) ) {
+			    fprintf( stderr, "Bad protocol version [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'c': // Set the blocks in the server cache
+			if ( (sscanf( optarg, "%u", &cache ) != 1) ) {
+			    fprintf( stderr, "Bad number of cache blocks [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'f': // Add a follower
+			if ( smsa_server_add_follower( optarg ) ) {
+			    fprintf( stderr, "Bad follower [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'F': // Be a follower
+			smsa_server_set_follower( 1 );
+			break;
+
+		case 'd': // Set the array storage
+			if ( strcmp( optarg, "memory" ) == 0 ) {
+			    storage = SMSA_STORAGE_MEMORY;
+			} else if ( strcmp( optarg, "file" ) == 0 ) {
+			    storage = SMSA_STORAGE_FILE;
+			} else if ( strcmp( optarg, "mmap" ) == 0 ) {
+			    storage = SMSA_STORAGE_MMAP;
+			} else {
+			    fprintf( stderr, "Bad array storage [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 's': // Set the array sync
+			if ( strcmp( optarg, "none" ) == 0 ) {
+			    sync = SMSA_SYNC_NONE;
+			} else if ( strcmp( optarg, "unmount" ) == 0 ) {
+			    sync = SMSA_SYNC_UNMOUNT;
+			} else if ( strcmp( optarg, "write" ) == 0 ) {
+			    sync = SMSA_SYNC_WRITE;
+			} else {
+			    fprintf( stderr, "Bad array sync [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'D': // Set the array disk file
+			file = optarg;
+			break;
+
+		case 'w': // Set the write-ahead log
+			log = optarg;
+			break;
+
+		case 'x': // Set the export file
+			if ( smsa_server_set_export( optarg ) ) {
+			    fprintf( stderr, "Bad export file [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'g': // Set the array geometry
+			if ( (sscanf( optarg, "%u:%u:%u", &drums, &blocks, &size ) != 3) || smsa_set_geometry( drums, blocks, size ) ) {
+			    fprintf( stderr, "Bad array geometry [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'L': // Set the latency emulated
+			jitter = 0;
+			channels = 1;
+			if ( (sscanf( optarg, "%u:%u:%u", &ns, &jitter, &channels ) < 1) || smsa_set_latency( ns, jitter, channels ) ) {
+			    fprintf( stderr, "Bad array latency [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'm': // Set the device model
+			if ( (smsa_device_preset( optarg ) == NULL) || smsa_set_device_model( smsa_device_preset( optarg ) ) ) {
+			    fprintf( stderr, "Bad device model [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
 		default:  // Default (unknown)
 			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
 			return( -1 );
@@ -82,6 +241,28 @@ int main( int argc, char *argv[] )
 	}
 
 	// Run the server
+	smsa_server_set_address( ip, port );
+	if ( smsa_server_set_workers( workers ) ) {
+	    fprintf( stderr, "Bad number of workers [%d], aborting.\n", workers );
+	    return( -1 );
+	}
+	smsa_server_set_protocol( protocol );
+	smsa_server_set_cache( cache );
+	if ( log != NULL ) {
+	    if ( (storage != SMSA_STORAGE_DEFAULT) && (storage != SMSA_STORAGE_FILE) ) {
+		fprintf( stderr, "The write-ahead log needs file storage, aborting.\n" );
+		return( -1 );
+	    }
+	    storage = SMSA_STORAGE_FILE;
+	    if ( smsa_server_set_log( log ) ) {
+		fprintf( stderr, "Bad write-ahead log [%s], aborting.\n", log );
+		return( -1 );
+	    }
+	}
+	if ( smsa_set_storage( storage, sync, file ) ) {
+	    fprintf( stderr, "Bad array disk file [%s], aborting.\n", file );
+	    return( -1 );
+	}
 	smsa_server();
 
 	// Return successfully
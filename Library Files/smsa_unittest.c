@@ -123,7 +123,8 @@ int smsa_unit_test( void ) {
 int smsa_vread_unit_test( void ) {
 
 	// Setup variables and do a linear random walk of the address space
-	uint32_t addr = 0, len;
+	uint64_t addr = 0;
+	uint32_t len;
 	while ( addr <= MAX_SMSA_VIRTUAL_ADDRESS ) {
 
 		// Get a random value, read bytes, and increment
@@ -0,0 +1,419 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_bench.c
+//  Description   : This is a benchmark of the SMSA client transports. It runs
+//                  the same stream of block reads and writes against a server
+//                  with plain sockets and with io_uring, and prints the two
+//                  side by side. Run it once against "smsasrvr" and once against
+//                  "smsasrvr -i" to compare the server transports as well.
+//
+//                  With -j the operations are split over that many threads,
+//                  each on its own drums, and with -c the client spreads the
+//                  drums over that many connections. Against "smsasrvr -t <n>"
+//                  this shows how the throughput grows with the connections.
+//                  With -b every operation covers that many blocks of a drum,
+//                  which protocol version 2 sends in a single frame, and with
+//                  -z the blocks are compressed. The benchmark blocks are
+//                  uniform, so they compress as well as blocks can. With -S
+//                  the stats of the server block cache ( "smsasrvr -c <blocks>" )
+//                  are printed after each run.
+//
+//                  With -m the drums are spread over a cluster of servers, by
+//                  the shard map, and with -M one of the drums is moved to the
+//                  next server every that many milliseconds during the runs.
+//
+//                  The benchmark writes over the blocks it uses, so do not run
+//                  it against a server whose array holds anything you need.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+// Project Includes
+#include <smsa.h>
+#include <smsa_internal.h>
+#include <smsa_network.h>
+#include <cmpsc311_log.h>
+
+// Defines
+#define SMSA_ARGUMENTS "hzSl:a:p:n:c:j:b:m:M:"
+#define USAGE \
+	"USAGE: smsabench [-h] [-l <logfile>] [-a <address>] [-p <port>] [-n <ops>]\n" \
+	"                 [-c <connections>] [-j <threads>] [-b <blocks>] [-z] [-S]\n" \
+	"                 [-m <shards>] [-M <msec>]\n" \
+	"\n" \
+	"where:\n" \
+	"    -h - help mode (display this message)\n" \
+	"    -l - write log messages to the filename <logfile>\n" \
+	"    -a - connect to the server at <address> (IPv4, IPv6 or host name)\n" \
+	"    -p - connect to the server on <port>\n" \
+	"    -n - perform <ops> block operations with each transport (default 100000)\n" \
+	"    -c - spread the drums over <connections> connections (default 1)\n" \
+	"    -j - split the operations over <threads> threads (default 1)\n" \
+	"    -b - read or write <blocks> blocks with each operation (default 1)\n" \
+	"    -z - compress the blocks sent to and from the server\n" \
+	"    -S - print the stats of the server block cache after each run\n" \
+	"    -m - spread the drums over the servers in <shards>, a list of\n" \
+	"         host:port[=first-last]\n" \
+	"    -M - move a drum to the next server every <msec> milliseconds (with -m)\n" \
+	"\n" \
+
+//
+// Type Definitions
+
+// The result of running the benchmark with one transport
+typedef struct {
+	int	ran;		// true if the run completed
+	double	seconds;	// wall clock time of the operations
+} SMSA_BENCH_RESULT;
+
+// The share of the operations one thread performs
+typedef struct {
+	int		thread;		// which thread this is
+	int		threads;	// number of threads
+	uint32_t	ops;		// number of operations this thread performs
+	uint16_t	blocks;		// number of blocks each operation covers
+	int		failed;		// true if an operation failed
+} SMSA_BENCH_THREAD;
+
+//
+// Global Data
+
+int server_stats = 0;	// true if the server cache stats are printed after each run
+int shard_servers = 0;	// number of servers in the shard map ( 0 without one )
+unsigned int move_msec = 0;	// milliseconds between drum moves ( 0 for none )
+volatile int moving;	// true while the drums are being moved
+
+//
+// Functional Prototypes
+
+int bench_transport( SMSA_TRANSPORT transport, uint32_t ops, int threads, uint16_t blocks, SMSA_BENCH_RESULT *result );
+void *bench_thread( void *arg );
+void *bench_mover( void *arg );
+void bench_server_stats( SMSA_TRANSPORT transport );
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the SMSA transport benchmark
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] )
+{
+	// Local variables
+	int ch, log_initialized = 0, compression = 0;
+	char *ip = NULL;
+	unsigned int port = 0, ops = 100000, connections = 1, threads = 1, blocks = 1;
+	char *shards = NULL, *c;
+	SMSA_BENCH_RESULT sockets, uring;
+
+	// Process the command line parameters
+	while ((ch = getopt(argc, argv, SMSA_ARGUMENTS)) != -1) {
+
+		switch (ch) {
+		case 'h': // Help, print usage
+			fprintf( stderr, USAGE );
+			return( -1 );
+
+		case 'l': // Set the log filename
+			initializeLogWithFilename( optarg );
+			log_initialized = 1;
+			break;
+
+		case 'a': // Set the server address
+			ip = optarg;
+			break;
+
+		case 'p': // Set the server port
+			if ( (sscanf( optarg, "%u", &port ) != 1) || (port == 0) || (port > 65535) ) {
+			    fprintf( stderr, "Bad server port [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'n': // Set the number of operations
+			if ( (sscanf( optarg, "%u", &ops ) != 1) || (ops == 0) ) {
+			    fprintf( stderr, "Bad number of operations [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'c': // Set the number of connections
+			if ( (sscanf( optarg, "%u", &connections ) != 1) || (connections == 0) ) {
+			    fprintf( stderr, "Bad number of connections [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'j': // Set the number of threads
+			if ( (sscanf( optarg, "%u", &threads ) != 1) || (threads == 0) || (threads > SMSA_DISK_ARRAY_SIZE) ) {
+			    fprintf( stderr, "Bad number of threads [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'z': // Compress the blocks
+			compression = 1;
+			break;
+
+		case 'S': // Print the server cache stats
+			server_stats = 1;
+			break;
+
+		case 'b': // Set the blocks in an operation
+			if ( (sscanf( optarg, "%u", &blocks ) != 1) || (blocks == 0) || (blocks > SMSA_NET_MAX_BLOCKS) ) {
+			    fprintf( stderr, "Bad number of blocks [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		case 'm': // Set the shard map
+			shards = optarg;
+			for ( shard_servers = 1, c = shards; *c != '\0'; c++ ) {
+				shard_servers += (*c == ',');
+			}
+			break;
+
+		case 'M': // Set the time between drum moves
+			if ( (sscanf( optarg, "%u", &move_msec ) != 1) || (move_msec == 0) ) {
+			    fprintf( stderr, "Bad time between moves [%s], aborting.\n", optarg );
+			    return( -1 );
+			}
+			break;
+
+		default:  // Default (unknown)
+			fprintf( stderr, "Unknown command line option (%c), aborting.\n", ch );
+			return( -1 );
+		}
+	}
+
+	// Setup the log as needed
+	if ( ! log_initialized ) {
+		initializeLogWithFilehandle( CMPSC311_LOG_STDERR );
+	}
+
+	// Run the benchmark with each transport
+	smsa_client_set_address( ip, port );
+	if ( smsa_client_set_connections( connections ) ) {
+		fprintf( stderr, "Bad number of connections [%u], aborting.\n", connections );
+		return( -1 );
+	}
+	smsa_client_set_protocol( 0, compression ? SMSA_NET_FLAG_COMPRESSED : 0 );
+	if ( smsa_client_set_shards( shards ) ) {
+		fprintf( stderr, "Bad shard map [%s], aborting.\n", shards );
+		return( -1 );
+	}
+	bench_transport( SMSA_TRANSPORT_SOCKETS, ops, threads, blocks, &sockets );
+	bench_transport( SMSA_TRANSPORT_URING, ops, threads, blocks, &uring );
+
+	// Print the results side by side
+	printf( "%u connection(s), %u thread(s), %u block(s) per operation\n", connections, threads, blocks );
+	printf( "%-12s %12s %12s\n", "", "sockets", "io_uring" );
+	printf( "%-12s %12u %12u\n", "operations", ops, ops );
+	if ( sockets.ran && uring.ran ) {
+		printf( "%-12s %12.3f %12.3f\n", "seconds", sockets.seconds, uring.seconds );
+		printf( "%-12s %12.2f %12.2f\n", "usec/op", sockets.seconds*1e6/ops, uring.seconds*1e6/ops );
+		printf( "%-12s %12.0f %12.0f\n", "ops/sec", ops/sockets.seconds, ops/uring.seconds );
+		printf( "%-12s %12s %11.2fx\n", "speedup", "", sockets.seconds/uring.seconds );
+	} else {
+		fprintf( stderr, "A benchmark run failed, see the log.\n" );
+		return( -1 );
+	}
+
+	// Return successfully
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_transport
+// Description  : Mount the array with a transport, time a stream of block
+//                writes and reads that walks every drum, then unmount
+//
+// Inputs       : transport - the client transport to use
+//                ops - the number of block operations to perform
+//                threads - the number of threads to split them over
+//                blocks - the number of blocks each operation covers
+//                result - where to put the time the operations took
+// Outputs      : 0 if successful, -1 if failure
+
+int bench_transport( SMSA_TRANSPORT transport, uint32_t ops, int threads, uint16_t blocks, SMSA_BENCH_RESULT *result ) {
+
+	// Local variables
+	SMSA_BENCH_THREAD work[SMSA_MAX_DISK_ARRAY_SIZE];
+	pthread_t tid[SMSA_MAX_DISK_ARRAY_SIZE], mover;
+	struct timespec start, end;
+	int i, failed = 0, moves = 0;
+
+	// Connect and mount
+	memset( result, 0x0, sizeof(SMSA_BENCH_RESULT) );
+	smsa_client_set_transport( transport );
+	if ( smsa_client_operation( encode_SMSA_operation(SMSA_MOUNT, 0, 0), NULL ) ) {
+		logMessage( LOG_ERROR_LEVEL, "Benchmark mount failed." );
+		return( -1 );
+	}
+
+	// Start every thread on its share of the operations, then wait for them
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	for ( i=0; i<threads; i++ ) {
+		work[i].thread = i;
+		work[i].threads = threads;
+		work[i].ops = ops/threads + ((i < ops%threads) ? 1 : 0);
+		work[i].blocks = blocks;
+		work[i].failed = 0;
+		if ( pthread_create( &tid[i], NULL, bench_thread, &work[i] ) ) {
+			logMessage( LOG_ERROR_LEVEL, "Benchmark could not start thread %d.", i );
+			return( -1 );
+		}
+	}
+	moving = ( move_msec > 0 && shard_servers > 1 );
+	if ( moving && pthread_create( &mover, NULL, bench_mover, &moves ) ) {
+		logMessage( LOG_ERROR_LEVEL, "Benchmark could not start the drum mover." );
+		moving = 0;
+	}
+	for ( i=0; i<threads; i++ ) {
+		pthread_join( tid[i], NULL );
+		failed |= work[i].failed;
+	}
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	if ( moving ) {
+		moving = 0;
+		pthread_join( mover, NULL );
+		printf( "%d drum move(s) during the %s run\n", moves, (transport == SMSA_TRANSPORT_URING) ? "io_uring" : "sockets" );
+	}
+	if ( server_stats ) {
+		bench_server_stats( transport );
+	}
+
+	// Unmount, which also closes the connections
+	if ( smsa_client_operation( encode_SMSA_operation(SMSA_UNMOUNT, 0, 0), NULL ) ) {
+		logMessage( LOG_ERROR_LEVEL, "Benchmark unmount failed." );
+		return( -1 );
+	}
+	if ( failed ) {
+		return( -1 );
+	}
+
+	result->ran = 1;
+	result->seconds = (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9;
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_thread
+// Description  : Write blocks, then read them back, walking across the drums
+//                that belong to this thread, so that a server with workers
+//                can spread the operations out
+//
+// Inputs       : arg - the share of the operations for this thread
+// Outputs      : NULL
+
+void *bench_thread( void *arg ) {
+
+	// Local variables
+	SMSA_BENCH_THREAD *work = arg;
+	unsigned char block[SMSA_NET_MAX_PAYLOAD];
+	int drums = (SMSA_DISK_ARRAY_SIZE - work->thread + work->threads - 1) / work->threads;
+	int runs = SMSA_MAX_BLOCK_ID / work->blocks;
+	SMSA_DRUM_ID drum;
+	SMSA_BLOCK_ID blk;
+	uint32_t i, op;
+
+	for ( i=0; i<work->ops; i++ ) {
+		drum = work->thread + ((i/2) % drums) * work->threads;
+		blk = (((i/2) / drums) % runs) * work->blocks;
+		if ( i % 2 == 0 ) {
+			memset( block, (unsigned char)i, work->blocks*SMSA_BLOCK_SIZE );
+			op = SMSA_NET_OPERATION( SMSA_NET_WRITE_AT, drum, blk );
+		} else {
+			op = SMSA_NET_OPERATION( SMSA_NET_READ_AT, drum, blk );
+		}
+		if ( smsa_client_operation_blocks( op, work->blocks, block ) ) {
+			logMessage( LOG_ERROR_LEVEL, "Benchmark operation %u failed.", i );
+			work->failed = 1;
+			return( NULL );
+		}
+	}
+
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_mover
+// Description  : Move the drums around the servers of the cluster while the
+//                benchmark threads run, one drum every move_msec milliseconds
+//
+// Inputs       : arg - where to count the moves
+// Outputs      : NULL
+
+void *bench_mover( void *arg ) {
+
+	// Local variables
+	int *moves = arg;
+	SMSA_DRUM_ID drum;
+	int server;
+
+	while ( moving ) {
+		usleep( move_msec*1000 );
+		drum = *moves % SMSA_DISK_ARRAY_SIZE;
+		server = (drum + 1 + *moves/SMSA_DISK_ARRAY_SIZE) % shard_servers;
+		if ( smsa_client_move_drum( drum, server ) ) {
+			logMessage( LOG_ERROR_LEVEL, "Benchmark could not move drum %u.", drum );
+			return( NULL );
+		}
+		(*moves)++;
+	}
+
+	return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bench_server_stats
+// Description  : Print the stats of the server block cache, which count every
+//                run since the server started
+//
+// Inputs       : transport - the transport of the run, for the heading
+// Outputs      : none
+
+void bench_server_stats( SMSA_TRANSPORT transport ) {
+
+	// Local variables
+	SMSA_SERVER_CACHE_STATS stats;
+	uint64_t misses;
+
+	if ( smsa_client_cache_stats( &stats ) ) {
+		logMessage( LOG_ERROR_LEVEL, "Benchmark could not get the server cache stats." );
+		return;
+	}
+	if ( stats.lines == 0 ) {
+		printf( "server cache after %s run: none\n", (transport == SMSA_TRANSPORT_URING) ? "io_uring" : "sockets" );
+		return;
+	}
+
+	misses = stats.lookups - stats.hits;
+	printf( "server cache after %s run: %llu of %llu reads hit (%.1f%%), %.0f ns/hit, %.0f ns/miss, %llu of %llu lines used\n",
+		(transport == SMSA_TRANSPORT_URING) ? "io_uring" : "sockets",
+		(unsigned long long)stats.hits, (unsigned long long)stats.lookups,
+		(stats.lookups > 0) ? 100.0*stats.hits/stats.lookups : 0.0,
+		(stats.hits > 0) ? (double)stats.hitNanos/stats.hits : 0.0,
+		(misses > 0) ? (double)stats.missNanos/misses : 0.0,
+		(unsigned long long)stats.used, (unsigned long long)stats.lines );
+}
@@ -13,6 +13,7 @@
 
 // Project Include Files
 #include <smsa_cache.h>
+#include <smsa_compress.h>
 #include <cmpsc311_log.h>
 
 /* DEBUG */
@@ -24,6 +25,9 @@ int currentIndex;			//Very important variable that tells how full the cache is
 int maxIndex;				//Determined by the lines parameter in smsa_init_cache
 int misses;
 int hits;
+int uniformLines;			//How many of the lines held are uniform blocks, without a line
+int invalidated;			//How many lines were dropped by smsa_invalidate_cache_lines
+unsigned char uniformBlock[SMSA_MAX_BLOCK_SIZE];	//Where smsa_get_cache_line expands a uniform block
 
 //
 // Functions
@@ -61,6 +65,8 @@ int smsa_init_cache( uint32_t lines ) {
 	// initialize data that will be used for efficiency checking
 	misses = 0;
 	hits = 0;
+	uniformLines = 0;
+	invalidated = 0;
 
 	logMessage ( LOG_INFO_LEVEL, "Cache Initialized To a Size Of [%d]", maxIndex );
 	return 0;
@@ -76,6 +82,11 @@ int smsa_init_cache( uint32_t lines ) {
 
 int smsa_close_cache( void ) {
 	
+	// The cache holds its own copy of every block that
+	// is not uniform, so free those first
+	for ( int i = 0; i < maxIndex; i++ )
+		free ( cache[i].line );
+
 	// Now that we no longer need the cache we will
 	// free it back to the operating system
 	free ( cache );
@@ -108,15 +119,17 @@ unsigned char *smsa_get_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
 	// proper drm and blk match. If this item exists 
 	// in the cache, then we return the line member
 	// of the struct.
+	// Entries that have never held a block are skipped, or else
+	// an empty cache would find drum 0, block 0 in its first entry
 	for ( int i = 0; i <= currentIndex; i++ ) {
-		if ( cache[i].block == blk && cache[i].drum == drm ) {
+		if ( cache[i].valid && cache[i].block == blk && cache[i].drum == drm ) {
 			
 			// If the item exists in the highest index, then it does not 
 			// need to be upddated to the newest spot in the cache because it is 
 			// already there. Therefore only update the position in the cache, if
 			// the item is not in the newest position already.
 			if ( i != currentIndex )
-				justUsedAdjust ( drm, blk, cache[i].line, i ); 		
+				justUsedAdjust ( i ); 		
 			
 			hits++; 	//monitor cache performance
 		
@@ -127,13 +140,13 @@ unsigned char *smsa_get_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk ) {
 			//into it. Therefore if the cache isn't full we return the line at the currentIndex-1.
 			//But if the cache is full, then we return the line at currentIndex, as the currentIndex
 			//will no longer be incremented thorughout the program	
-			if ( currentIndex == maxIndex -1 ) {
-				logMessage ( LOG_INFO_LEVEL, "Drum [%d], Block [%d], Found in the Cache With a Value of [%p] at Line [%d] Out of [%d] Cache Lines", cache[currentIndex].drum, cache[currentIndex].block, *cache[currentIndex].line, currentIndex, maxIndex-1);
-				return cache[currentIndex].line;
+			if ( cacheFull () ) {
+				logMessage ( LOG_INFO_LEVEL, "Drum [%d], Block [%d], Found in the Cache at Line [%d] Out of [%d] Cache Lines", cache[currentIndex].drum, cache[currentIndex].block, currentIndex, maxIndex-1);
+				return cacheLineBlock ( &cache[currentIndex] );
 			}
 			else { 
-				logMessage ( LOG_INFO_LEVEL, "Drum [%d], Block [%d], Found in the Cache With a Value of [%p] at Line [%d] Out of [%d] Cache Lines", cache[i].drum, cache[i].block, *cache[i].line, i, maxIndex-1);
-				return cache[currentIndex-1].line;
+				logMessage ( LOG_INFO_LEVEL, "Drum [%d], Block [%d], Found in the Cache at Line [%d] Out of [%d] Cache Lines", cache[i].drum, cache[i].block, i, maxIndex-1);
+				return cacheLineBlock ( &cache[currentIndex-1] );
 			}
 		}
 	}
@@ -173,12 +186,14 @@ int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf
 	// it is found, just change the line member of the struct, 
 	// and place in the newest spot of the cache ( highest index )
 	for ( int i = 0; i <= currentIndex; i++ ) {
-		if ( cache[i].block == blk && cache[i].drum == drm ) {
+		if ( cache[i].valid && cache[i].block == blk && cache[i].drum == drm ) {
 			if ( DEBUG )
 				logMessage ( LOG_INFO_LEVEL, "Drum [%d], Block [%d], Exists in the Cache. Overwriting Now...", drm, blk );
 
 
-			cache[i].line = buf;		//update the line member of the cache block	
+			//update the copy of the block the cache holds
+			if ( setCacheLine ( &cache[i], buf ) )
+				return 11;
 			
 			// If the item exists in the highest index, then it does not 
 			// need to be upddated to the newest spot in the cache because it is 
@@ -194,7 +209,7 @@ int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf
 
 			//update the already existent line in the cache to the newest
 			//postion in the cache, (currentIndex or currentIndex-1 )
-			err = justUsedAdjust ( drm, blk, cache[i].line, i );
+			err = justUsedAdjust ( i );
 			return 0;
 		}
 	}
@@ -218,24 +233,91 @@ int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_invalidate_cache_lines
+// Description  : Drops the lines of some blocks of a drum, because someone else
+//		  wrote them. The lines after each one that is dropped move down
+//		  to fill its place, so the cache stays in the order it was used,
+//		  with the free entries at the end.
+//
+// Inputs       : drm - the drum ID of the blocks
+//                blk - the first block ID
+//                count - the number of blocks
+// Outputs      : 0 if successful, -1 otherwise
+
+int smsa_invalidate_cache_lines( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t count ) {
+
+	int used;		//entries that hold a block
+	int kept = 0;		//entries that still hold one
+
+
+	if ( cache == NULL )
+		return 0;
+
+	used = cacheFull () ? maxIndex : currentIndex;
+	for ( int i = 0; i < used; i++ ) {
+		if ( cache[i].drum == drm && cache[i].block >= blk && cache[i].block < blk+count ) {
+			if ( DEBUG )
+				logMessage ( LOG_INFO_LEVEL, "Invalidating Drum [%d], Block [%d] at Cache Position [%d]", drm, cache[i].block, i );
+			if ( cache[i].line == NULL )
+				uniformLines--;
+			free ( cache[i].line );
+			invalidated++;
+			continue;
+		}
+		cache[kept++] = cache[i];
+	}
+
+	// Nothing was dropped
+	if ( kept == used )
+		return 0;
+
+	// The entries after the ones that were kept are free now, and the
+	// cache is no longer full
+	for ( int i = kept; i < used; i++ ) {
+		cache[i].valid = 0;
+		cache[i].fill = -1;
+		cache[i].line = NULL;
+	}
+	currentIndex = kept;
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheFull
+// Description  : Tells if every entry of the cache holds a block. Until then the
+//		  entries before currentIndex hold one, and the rest are free.
+//
+// Inputs       : none
+// Outputs      : 1 if the cache is full, 0 otherwise
+
+int cacheFull ( void ) {
+
+	return ( currentIndex == maxIndex-1 && cache[currentIndex].valid );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : justUsedAdjust
-// Description  : The contents at the given drm and block were just read/written, need to update
+// Description  : The contents at the given index were just read/written, need to update
 //		  the order of the array.
 //
-// Inputs       : drm - the drum ID to reorder
-//                blk - the block ID to reorder
+// Inputs       : index - the index of the entry to reorder
 // Outputs      : 0 if successful, -1 otherwise
 
-int justUsedAdjust ( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, int index ) {
+int justUsedAdjust ( int index ) {
 	
+	SMSA_CACHE_LINE used = cache[index];	//the entry that was just used
+
 	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Current Position in Cache [%d], with Drum [%d], Block = [%d]", index, currentIndex, drm, blk);	
+		logMessage ( LOG_INFO_LEVEL, "Current Position in Cache [%d], with Drum [%d], Block = [%d]", index, used.drum, used.block );	
 	
 	//if it is the newest item in the cache already, then we do not
 	//need to update it's postion
-	if ( index == currentIndex-1 && currentIndex != maxIndex-1 ) 
+	if ( index == currentIndex-1 && !cacheFull () ) 
 		return 0;
 		
 
@@ -255,10 +337,7 @@ int justUsedAdjust ( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, in
 		}
 
 		//make the current line equal to the one ahead of it
-		cache[i].drum = cache[i+1].drum;
-		cache[i].block = cache[i+1].block;
-		cache[i].used = cache[i+1].used;	
-		cache[i].line = cache[i+1].line;
+		cache[i] = cache[i+1];
 	}
 
 	//After the for loop, we have two conditions. Either the cache 
@@ -266,26 +345,19 @@ int justUsedAdjust ( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, in
 	//last block, and then put our just used block in the currentIndex position.
 	//Or, the cache is not full, and we just need to put our just used block
 	//in the currentIndex-1 position.
-	if ( currentIndex == maxIndex-1 ) {
-		cache[currentIndex-1].drum = cache[currentIndex].drum;
- 		cache[currentIndex-1].block = cache[currentIndex].block;  	
-		cache[currentIndex-1].line = cache[currentIndex].line;
-
-		 
-		cache[currentIndex]. drum = drm;
-		cache[currentIndex].block = blk;	
+	if ( cacheFull () ) {
+		cache[currentIndex-1] = cache[currentIndex];
+
+		cache[currentIndex] = used;
 		gettimeofday( &cache[currentIndex].used, NULL );
-		cache[currentIndex].line = buf;
 	
 		if ( DEBUG )
 			logMessage ( LOG_INFO_LEVEL, "New Postion in Cache Ss [%d] Out of [%d] Lines, With Drum [%d] and Block [%d]", currentIndex, maxIndex-1, cache[currentIndex].drum, cache[currentIndex].block );
 	}
 	else {
 		//place the item to be written at the newest point in the cache
-		cache[currentIndex-1]. drum = drm;
-		cache[currentIndex-1].block = blk;	
+		cache[currentIndex-1] = used;
 		gettimeofday( &cache[currentIndex-1].used, NULL );
-		cache[currentIndex-1].line = buf;
 
 		if ( DEBUG )
 			logMessage ( LOG_INFO_LEVEL, "New Postion In Cache is [%d] Out of [%d] Lines, With Drum [%d] and Block [%d]", currentIndex-1, maxIndex-1, cache[currentIndex-1].drum, cache[currentIndex-1].block );
@@ -321,15 +393,20 @@ int writeToCache ( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf ) {
 	// If the cache is full, an item will have to be ejected from the
 	// oldest index of the cache ( index 0 ). This will make room 
 	// at the end of the array for our new item.
-	if ( currentIndex == maxIndex-1 && cache[currentIndex].line != NULL) 
+	if ( cacheFull () ) 
 		err = evictLRU( );
 	
-	//since the newest spot in the cache is now available, put the memory there
+	//since the newest spot in the cache is now available, put the memory there.
+	//Its old line has moved down with the eviction, so the copy gets a new one
 	
 	cache[currentIndex].drum = drm;
 	cache[currentIndex].block = blk;
 	gettimeofday( &cache[currentIndex].used, NULL );
-	cache[currentIndex].line = buf;
+	cache[currentIndex].valid = 1;
+	cache[currentIndex].fill = -1;
+	cache[currentIndex].line = NULL;
+	if ( setCacheLine ( &cache[currentIndex], buf ) )
+		err = 1;
 
 
 	// If the array is already full, we don't want to increment the
@@ -371,6 +448,10 @@ int evictLRU ( ) {
 	// Need to evict the oldest item (index 0), so that 
 	// there is room at the end of the cache for a new item
 	// which will be written in the function that calls this one
+	if ( cache[0].line == NULL )
+		uniformLines--;
+	free ( cache[0].line );
+
 	for ( int i = 0; i < currentIndex-1; i++ ) {
 		if ( cache[i].drum == cache[i+1].drum && cache[i].block == cache[i+1].block ) {
 			logMessage( LOG_INFO_LEVEL, "_evictLRU: Error: identical blocks in cache at index %d, and %d. drum = %d, block = %d", i, i+1, cache[i].drum, cache[i].block );
@@ -380,19 +461,16 @@ int evictLRU ( ) {
 		}
 
 		//copy the current line in cache to the line above it
-		cache[i].drum = cache[i+1].drum;
-		cache[i].block = cache[i+1].block;
+		cache[i] = cache[i+1];
 		gettimeofday( &cache[i].used, NULL );
-		cache[i].line = cache[i+1].line;	
 
 	} 	
 
 	//if the cache is full the write the last cache line to the 
-	//second to last cache line.
-	if ( currentIndex == maxIndex-1 ) {
-		cache[currentIndex-1].drum = cache[currentIndex].drum;
- 		cache[currentIndex-1].block = cache[currentIndex].block;  	
-		cache[currentIndex-1].line = cache[currentIndex].line;
+	//second to last cache line. A cache of one line has nowhere
+	//to write it, the line is simply replaced
+	if ( currentIndex == maxIndex-1 && currentIndex > 0 ) {
+		cache[currentIndex-1] = cache[currentIndex];
 	}
 
 
@@ -401,6 +479,64 @@ int evictLRU ( ) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setCacheLine
+// Description  : Makes a cache entry hold a copy of a block. A block that is all
+//		  one byte value is held as just that byte, and the entry gives
+//		  up its line. Anything else gets a line, if it does not have one.
+//
+// Inputs       : entry - the cache entry
+//		  buf - the block
+// Outputs      : 0 if successful, 1 otherwise
+
+int setCacheLine ( SMSA_CACHE_LINE *entry, unsigned char *buf ) {
+
+	int fill = smsa_uniform_fill ( buf, SMSA_BLOCK_SIZE );
+
+	if ( fill != -1 ) {
+		if ( entry->line != NULL || entry->fill == -1 )
+			uniformLines++;
+		free ( entry->line );
+		entry->line = NULL;
+		entry->fill = fill;
+		return 0;
+	}
+
+	if ( entry->line == NULL ) {
+		if ( ( entry->line = (unsigned char *) malloc ( SMSA_BLOCK_SIZE ) ) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_setCacheLine:Failed to allocate a cache line" );
+			return 1;
+		}
+		if ( entry->fill != -1 )
+			uniformLines--;
+	}
+	memcpy ( entry->line, buf, SMSA_BLOCK_SIZE );
+	entry->fill = -1;
+
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheLineBlock
+// Description  : Gives the block a cache entry holds. A uniform block is filled
+//		  in to uniformBlock, so it is only good until the next call
+//
+// Inputs       : entry - the cache entry
+// Outputs      : the block
+
+unsigned char *cacheLineBlock ( SMSA_CACHE_LINE *entry ) {
+
+	if ( entry->line != NULL )
+		return entry->line;
+
+	memset ( uniformBlock, entry->fill, SMSA_BLOCK_SIZE );
+	return uniformBlock;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : printCache
@@ -414,9 +550,11 @@ int printCache ( int cacheHits, int diskReads) {
 
 	
 	for ( int i = 0; i <= currentIndex; i++ ) 	
-		logMessage ( LOG_INFO_LEVEL, "_printCache: index %d, drm = %d, blk = %d, line = %p, last used = .%6ld", i, cache[i].drum, cache[i].block, cache[i].line, cache[i].used.tv_usec );
+		logMessage ( LOG_INFO_LEVEL, "_printCache: index %d, drm = %d, blk = %d, line = %p, fill = %d, last used = .%6ld", i, cache[i].drum, cache[i].block, cache[i].line, cache[i].fill, cache[i].used.tv_usec );
 
 
+	logMessage( LOG_INFO_LEVEL, "Cache Uniform Lines: %d of %d held without a line", uniformLines, currentIndex );
+	logMessage( LOG_INFO_LEVEL, "Cache Invalidated Lines: %d dropped because someone else wrote them", invalidated );
 	logMessage( LOG_INFO_LEVEL, "Cache Performance: From Cache: Cache lines: %d. Cache lines used: %d. Cache Hits: %d. Cache Misses: %d. Total Cache Requests: %d. Percent Hit: %f. Percent Miss: %f\n\t\t\tFrom SMSA: Cache Hits: %d. Cache Misses: %d. Total Cache Requests: %d. Percent Hit: %f. Percent Miss %f", maxIndex, currentIndex, hits, misses, hits+misses, (float) hits/(hits+misses)*100,(float) misses/(hits+misses)*100, cacheHits, diskReads, cacheHits+diskReads, (float) cacheHits/(cacheHits+diskReads)*100, (float) diskReads/(cacheHits+diskReads)*100 ); 
 
 
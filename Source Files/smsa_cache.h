@@ -21,12 +21,15 @@
 //
 // Type Definitions
 
-// This is the structure for the cache line
+// This is the structure for the cache line. A block that is all one byte
+// value is held as that byte, without a line
 typedef struct {
     SMSA_DRUM_ID     drum;  // This is the drum for the cache line
     SMSA_BLOCK_ID    block; // This is the block ID for the cache line
     struct timeval   used;  // A timestamp of the last use of this entry
-    unsigned char   *line;  // This is cache entru itslef
+    int              valid; // True once the entry holds a block
+    int16_t          fill;  // The byte a uniform block is filled with ( -1 if not uniform )
+    unsigned char   *line;  // This is cache entru itslef ( NULL if uniform )
 } SMSA_CACHE_LINE;
 
 
@@ -41,14 +44,26 @@ int smsa_init_cache( uint32_t lines );
 // Clear cache and free associated memory
 int smsa_close_cache( void );
 
-// Check to see if the cache entry is available
+// Check to see if the cache entry is available ( the block is only good until the next call )
 unsigned char *smsa_get_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk );
 
-// Put a new line into the cache
+// Put a new line into the cache ( the cache keeps a copy of the block )
 int smsa_put_cache_line( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf );
 
+// Drop the lines of some blocks of a drum that someone else wrote
+int smsa_invalidate_cache_lines( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, uint32_t count );
+
+// Tell if every entry of the cache holds a block
+int cacheFull ( void );
+
+// Hold a block in a cache entry, as its fill byte if it is uniform
+int setCacheLine ( SMSA_CACHE_LINE *entry, unsigned char *buf );
+
+// Give the block a cache entry holds
+unsigned char *cacheLineBlock ( SMSA_CACHE_LINE *entry );
+
 // Memory was just used, so update it to the newest position in the cache
-int justUsedAdjust ( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf, int index );
+int justUsedAdjust ( int index );
 
 // Memory is not in the cache, write it to the newest position in the cache
 int writeToCache ( SMSA_DRUM_ID drm, SMSA_BLOCK_ID blk, unsigned char *buf );
@@ -12,15 +12,26 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
+#include <time.h>
 
 // Project Include Files
 #include <smsa.h>
 #include <smsa_network.h>
+#include <smsa_client.h>
+#include <smsa_protocol.h>
+#include <smsa_compress.h>
+#include <smsa_uring.h>
 #include <cmpsc311_log.h>
 
 /* DEBUG */
@@ -28,15 +39,70 @@
 
 // Global Variables
 int serverShutdown;
-int sock;                        //file handle for the socket
+char *serverIP = NULL;           //address of the server set by smsa_client_set_address ( NULL if not set )
+uint16_t serverPort = 0;         //port of the server set by smsa_client_set_address ( 0 if not set )
+SMSA_TRANSPORT clientTransport = SMSA_TRANSPORT_DEFAULT;  //transport set by smsa_client_set_transport
+int clientConnections = 0;       //connections set by smsa_client_set_connections ( 0 if not set )
+int clientProtocol = 0;          //highest protocol version set by smsa_client_set_protocol ( 0 if not set )
+uint16_t clientFeatures = 0;     //SMSA_NET_FLAGS set by smsa_client_set_protocol
+SMSA_INVALIDATE_HANDLER invalidateHandler = NULL;  //told about SMSA_NET_INVALIDATE, set by smsa_client_set_invalidate
+SMSA_CLIENT_CONNECTION pool[SMSA_MAX_CONNECTIONS];  //the connections to the server
+int poolSize = 0;                //number of connections in the pool while mounted
+char *clientShards = NULL;       //shard map set by smsa_client_set_shards ( NULL if not set )
+int shardMap[SMSA_MAX_DISK_ARRAY_SIZE];  //connection of the pool each drum goes over while mounted ( -1 for none )
+int sharded = 0;                 //true while the pool is connected to a cluster of servers
+uint32_t drumMoves = 0;          //drums smsa_client_move_drum moved while mounted
+SMSA_HEAD sessionHead;           //where the heads are as far as the caller knows
+pthread_mutex_t headLock = PTHREAD_MUTEX_INITIALIZER;  //held while an operation uses sessionHead
+char *clientReplicas = NULL;     //replicas set by smsa_client_set_replicas ( NULL if not set )
+SMSA_CONSISTENCY clientConsistency = SMSA_CONSISTENCY_DEFAULT;  //consistency set by smsa_client_set_replicas
+SMSA_CLIENT_CONNECTION replicas[SMSA_MAX_REPLICAS];  //the connections to the replicas
+int replicaCount = 0;            //number of replicas while mounted
+SMSA_CONSISTENCY consistency;    //consistency of the reads while mounted
+uint32_t lastWriteSeq = 0;       //sequence number of the last write the leader performed for us
+int nextReplica = 0;             //replica the next read looks at first
+uint64_t replicaReads = 0;       //blocks read from the replicas
+uint64_t replicaFallbacks = 0;   //reads a replica failed, that went to the leader
+pthread_mutex_t replicaLock = PTHREAD_MUTEX_INITIALIZER;  //held while the reads in flight and lastWriteSeq are used
+uint32_t clientTimeout = 0;      //msec set by smsa_client_set_timeout ( 0 if not set )
+int clientHedge = 1;             //false if smsa_client_set_timeout turned hedged reads off
+uint32_t responseTimeout = 0;    //msec a response is waited for while mounted ( 0 for ever )
+int hedging = 0;                 //true while mounted if reads can be hedged over another connection
+uint32_t readLatency[SMSA_HEDGE_SAMPLES];  //usec the latest reads took to be answered
+uint64_t readsTimed = 0;         //reads timed while mounted
+uint32_t hedgeDelay = 0;         //usec a read waits before it is hedged ( 0 until enough reads are timed )
+uint64_t hedgedReads = 0;        //reads that were hedged
+uint64_t hedgeWins = 0;          //hedged reads the other connection answered first
+pthread_mutex_t hedgeLock = PTHREAD_MUTEX_INITIALIZER;  //held while the read latencies and hedge counts are used
 
 //Functional Prototypes
-int setupConnection ( int *socket );
-int recievePacket ( int server, uint32_t *op, int16_t *ret, int *blkSize, unsigned char *block );
-int readBytes ( int server, uint32_t len, unsigned char *block );
-int sendPacket ( int server, uint32_t op, int16_t ret, unsigned char *block );
+int performOperation ( uint32_t op, unsigned char *blocks, uint16_t count );
+int usesHeads ( uint32_t cmd );
+int setupConnection ( int *socket, char *ip, uint16_t port );
+int setupShards ( void );
+int parseShard ( char *spec, int server, int *assigned );
+SMSA_CONSISTENCY getClientConsistency ( void );
+int getServerAddress ( char **ip, uint16_t *port );
+SMSA_TRANSPORT getClientTransport ( void );
+int getClientConnections ( void );
+int getClientProtocol ( void );
+uint32_t getClientTimeout ( void );
+uint64_t clientClock ( void );
+uint64_t clientDeadline ( void );
+void packRequest ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count, SMSA_FRAME *request );
+int takeResponse ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *request, unsigned char *blocks, uint16_t count, SMSA_FRAME *response );
+int readFrame ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *frame );
+int waitConnections ( SMSA_CLIENT_CONNECTION *conn, SMSA_CLIENT_CONNECTION *hedge, uint64_t until );
+void timeRead ( uint64_t usec );
+int compareLatency ( const void *a, const void *b );
+int setupUring ( SMSA_CLIENT_CONNECTION *conn );
+int socketTransfer ( SMSA_CLIENT_CONNECTION *conn, uint32_t sendLen, SMSA_FRAME *response );
+int uringTransfer ( SMSA_CLIENT_CONNECTION *conn, uint32_t sendLen, SMSA_FRAME *response );
+int takeInvalidation ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *frame );
+void invalidateConnection ( SMSA_CLIENT_CONNECTION *conn );
+int readBytes ( int server, uint32_t len, unsigned char *block, uint64_t deadline );
 int sendBytes ( int server, uint32_t len, unsigned char *block );
-int selectData ( int sock );
+int selectData ( int sock, uint64_t deadline );
 void signalHandler ( int signal );
 
 //
@@ -48,402 +114,2868 @@ void signalHandler ( int signal );
 // Description  : This the client operation that sends a reques to the SMSA
 //                server.   It will:
 //
-//                1) if mounting make a connection to the server 
-//                2) send any request to the server, returning results
-//                3) if unmounting, will close the connection
+//                1) if mounting make the connections to the server 
+//                2) send any request to the server over the connection of its
+//                   drum, returning results
+//                3) if unmounting, will close the connections
+//
+//                Operations that use the heads are done one at a time, since
+//                each starts where the one before it left the heads. Operations
+//                that carry their own drum and block ( SMSA_NET_READ_AT and
+//                SMSA_NET_WRITE_AT ) only wait for their own connection, so
+//                callers in different threads can have one in flight on every
+//                connection of the pool.
 //
 // Inputs       : op - the operation code for the command
 //                block - the block to be read/writen from (READ/WRITE)
 // Outputs      : 0 if successful, -1 if failure
 
-int smsa_client_operation( uint32_t op, unsigned char *block ) {
+int smsa_client_operation( uint32_t op, unsigned char *block ) {
+
+	return ( performOperation ( op, block, 1 ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_operation_blocks
+// Description  : Performs an SMSA_NET_READ_AT, SMSA_NET_WRITE_AT or
+//                SMSA_NET_SNAPSHOT_READ that covers more than one block of a
+//                drum, starting at the block in the opcode. Over a version 2 connection the blocks go in a single
+//                frame, and over a version 1 connection one packet per block.
+//
+// Inputs       : op - the operation code for the command
+//                count - the number of blocks, up to SMSA_NET_MAX_BLOCKS
+//                blocks - the blocks to be read/writen from
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_operation_blocks( uint32_t op, uint16_t count, unsigned char *blocks ) {
+
+	if ( ( SMSA_OPCODE(op) != SMSA_NET_READ_AT && SMSA_OPCODE(op) != SMSA_NET_WRITE_AT && SMSA_OPCODE(op) != SMSA_NET_SNAPSHOT_READ ) ||
+			count == 0 || count > SMSA_NET_MAX_BLOCKS || SMSA_BLOCKID(op)+count > SMSA_MAX_BLOCK_ID ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_operation_blocks:Bad operation [%x] of [%u] blocks", op, count );
+		return 1;
+	}
+
+	return ( performOperation ( op, blocks, count ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_cache_stats
+// Description  : Gets the stats of the block cache the server keeps in front of
+//                the array, with SMSA_NET_CACHE_STATS. The array has to be
+//                mounted. A server that does not know the command sends no
+//                block back, and the stats are left 0, as for a server that
+//                has no cache.
+//
+// Inputs       : stats - will hold the stats
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_cache_stats( SMSA_SERVER_CACHE_STATS *stats ) {
+
+	unsigned char block[SMSA_MAX_BLOCK_SIZE];	//the stats as the server sent them
+
+	memset ( block, 0, sizeof(block) );
+	if ( performOperation ( SMSA_NET_OPERATION ( SMSA_NET_CACHE_STATS, 0, 0 ), block, 1 ) )
+		return 1;
+	smsa_unpack_cache_stats ( block, stats );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_snapshot
+// Description  : Takes a point-in-time image of the array on the server, with
+//                SMSA_NET_SNAPSHOT, which is then read with SMSA_NET_SNAPSHOT_READ
+//                through smsa_client_operation_blocks, or drops it. With a
+//                shard map every server takes an image of its own drums, and
+//                if one of them can not, the others are dropped. The image
+//                is lost with the connection it was taken over.
+//
+// Inputs       : take - true to take the image, false to drop it
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_snapshot( int take ) {
+
+        uint32_t op;
+        int i;
+
+
+	if ( poolSize == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_snapshot:Not connected to the server" );
+		return 1;
+	}
+
+	op = SMSA_NET_OPERATION ( ( take ) ? SMSA_NET_SNAPSHOT : SMSA_NET_SNAPSHOT_DROP, 0, 0 );
+	for ( i = 0; i < serverCount (); i++ ) {
+		if ( serverOperation ( &pool[i], op ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_client_snapshot:Failed to %s the image over connection [%d]",
+					( take ) ? "take" : "drop", i );
+			while ( take && --i >= 0 )
+				serverOperation ( &pool[i], SMSA_NET_OPERATION ( SMSA_NET_SNAPSHOT_DROP, 0, 0 ) );
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_export
+// Description  : Has the server write an image of the array to its export file,
+//                with SMSA_NET_EXPORT, and waits until it is written. With a
+//                shard map every server writes its own drums to its own file.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_export( void ) {
+
+        int i;
+
+
+	if ( poolSize == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_export:Not connected to the server" );
+		return 1;
+	}
+
+	for ( i = 0; i < serverCount (); i++ ) {
+		if ( serverOperation ( &pool[i], SMSA_NET_OPERATION ( SMSA_NET_EXPORT, 0, 0 ) ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_client_export:Failed to export the array over connection [%d]", i );
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serverCount
+// Description  : Tells how many servers the pool is connected to. Without a
+//                shard map they are all connected to the same one.
+//
+// Inputs       : none
+// Outputs      : the number of servers, 0 if not mounted
+
+int serverCount ( void ) {
+
+	return ( ( sharded || poolSize == 0 ) ? poolSize : 1 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : serverOperation
+// Description  : Performs an operation on the server at the other end of a
+//                connection of the pool, rather than on a drum
+//
+// Inputs       : conn - the connection
+//                op - the opcode
+// Outputs      : 0 if successful, 1 if failure
+
+int serverOperation ( SMSA_CLIENT_CONNECTION *conn, uint32_t op ) {
+
+        int16_t ret;
+        int err;
+
+
+	pthread_mutex_lock ( &conn->lock );
+	err = poolOperation ( conn, op, &ret, NULL, 0 );
+	pthread_mutex_unlock ( &conn->lock );
+
+	return ( err || ret != 0 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_poll_invalidations
+// Description  : Takes the SMSA_NET_INVALIDATE frames the server sent on the
+//                connection of a drum while it was idle, and hands them to the
+//                invalidate handler, without waiting for more. Frames that come
+//                in while an operation is waiting for its response are taken
+//                by the operation. If the connection is lost, or sends anything
+//                else, it is closed and every block of its drums is dropped,
+//                since invalidations may have been lost with it. The next
+//                operation on it reconnects.
+//
+//                Every replica can have read any drum, so they are all polled
+//                as well.
+//
+// Inputs       : drum - the drum
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_poll_invalidations( SMSA_DRUM_ID drum ) {
+
+        int i, err;
+
+
+	if ( poolSize == 0 )
+		return 0;
+
+	err = pollConnection ( &pool[shardMap[drum % SMSA_DISK_ARRAY_SIZE]] );
+	for ( i = 0; i < replicaCount; i++ )
+		err |= pollConnection ( &replicas[i] );
+
+	return err;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pollConnection
+// Description  : Takes the SMSA_NET_INVALIDATE frames waiting on a connection,
+//                see smsa_client_poll_invalidations. The response to a request
+//                that was abandoned can come in with them, and is dropped.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, 1 if failure
+
+int pollConnection ( SMSA_CLIENT_CONNECTION *conn ) {
+
+        unsigned char header[SMSA_NET_V2_HEADER_SIZE];   //header of a frame
+        SMSA_FRAME frame;
+        int rb, err = 0;
+
+
+	pthread_mutex_lock ( &conn->lock );
+	while ( conn->sock != -1 && ( conn->features & SMSA_NET_FLAG_INVALIDATE ) ) {
+
+		if ( ( rb = recv ( conn->sock, header, sizeof(header), MSG_DONTWAIT ) ) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			if ( errno != EAGAIN && errno != EWOULDBLOCK ) {
+				logMessage ( LOG_ERROR_LEVEL, "_pollConnection:Failed to read connection [%d] [%s]", conn->index, strerror(errno) );
+				err = 1;
+			}
+			break;
+		}
+
+		//Once part of a frame is in, the rest is on its way
+		if ( rb == 0 || ( rb < sizeof(header) && readBytes ( conn->sock, sizeof(header)-rb, &header[rb], clientDeadline () ) ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_pollConnection:Connection [%d] was closed", conn->index );
+			err = 1;
+			break;
+		}
+		if ( smsa_unpack_frame ( conn->version, header, &frame ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_pollConnection:Bad frame length [%u] on connection [%d]", frame.len, conn->index );
+			err = 1;
+			break;
+		}
+		if ( takeInvalidation ( conn, &frame ) )
+			continue;
+
+		if ( conn->abandoned == 0 || frame.id != conn->abandoned ) {
+			logMessage ( LOG_ERROR_LEVEL, "_pollConnection:Unexpected frame [%x] on connection [%d]", frame.op, conn->index );
+			err = 1;
+			break;
+		}
+		if ( frame.len > sizeof(header) && readBytes ( conn->sock, frame.len-sizeof(header), conn->recvBuffer, clientDeadline () ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_pollConnection:Failed to read an abandoned response on connection [%d]", conn->index );
+			err = 1;
+			break;
+		}
+		conn->abandoned = 0;
+	}
+
+	if ( err ) {
+		invalidateConnection ( conn );
+		closeConnection ( conn );
+	}
+	pthread_mutex_unlock ( &conn->lock );
+
+	return err;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_set_invalidate
+// Description  : Sets the handler SMSA_NET_INVALIDATE frames are handed to. With
+//                a handler, the next mount asks the server for them, see
+//                smsa_network.h. It is called with the lock of the connection
+//                held, so it must not perform operations itself.
+//
+// Inputs       : handler - the handler ( NULL to not ask for invalidations )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_set_invalidate( SMSA_INVALIDATE_HANDLER handler ) {
+
+	invalidateHandler = handler;
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : performOperation
+// Description  : Performs an operation for smsa_client_operation and
+//                smsa_client_operation_blocks, see smsa_client_operation
+//
+// Inputs       : op - the operation code for the command
+//                blocks - the blocks to be read/writen from (READ/WRITE)
+//                count - the number of blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int performOperation ( uint32_t op, unsigned char *blocks, uint16_t count ) {
+
+
+        SMSA_CLIENT_CONNECTION *conn;      //connection the operation goes over
+        uint32_t cmd = SMSA_OPCODE(op);    //command in the opcode
+        uint64_t deadline;                 //when a drum that is being moved has to be found by
+        int16_t ret;                       //return of the operation on the server
+        int err, moved;
+
+
+	//If we recieve a MOUNT command, then the connections need to be established with
+	//the server, so that we may send the disk commands
+	if ( cmd == SMSA_MOUNT )
+		return ( mountPool ( op ) );
+
+	//If the incoming command was an unmount command, the array is unmounted over
+	//every connection and they are closed. They will not be used again until mount
+	//is recieved
+	if ( cmd == SMSA_UNMOUNT )
+		return ( unmountPool ( op ) );
+
+	if ( poolSize == 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_operation:Not connected to the server" );
+		return 1;
+	}
+
+	if ( usesHeads ( cmd ) )
+		pthread_mutex_lock ( &headLock );
+
+	//A read that a replica performs never goes to the leader
+	if ( ( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT ) && replicaRead ( op, blocks, count ) == 0 ) {
+		if ( usesHeads ( cmd ) ) {
+			followHeads ( &sessionHead, op, 0 );
+			pthread_mutex_unlock ( &headLock );
+		}
+		return 0;
+	}
+	conn = poolConnection ( op );
+
+	if ( replicaCount > 0 ) {
+		pthread_mutex_lock ( &replicaLock );
+		conn->outstanding++;
+		pthread_mutex_unlock ( &replicaLock );
+	}
+
+	pthread_mutex_lock ( &conn->lock );
+
+	//A drum that moved to another server while we waited is looked up again
+	while ( conn != poolConnection ( op ) ) {
+		pthread_mutex_unlock ( &conn->lock );
+		conn = poolConnection ( op );
+		pthread_mutex_lock ( &conn->lock );
+	}
+
+	err = poolOperation ( conn, op, &ret, blocks, count );
+
+	//Another client of the cluster moved the drum away, or is moving it. The
+	//operation goes where the server says it went, or is sent again once
+	//the move is done
+	deadline = clientDeadline ();
+	while ( err == 0 && ret == SMSA_NET_MOVED && sharded ) {
+		if ( ( moved = findDrum ( conn, operationDrum ( op ) ) ) == -1 || ( moved == 1 && deadline != 0 && clientClock () >= deadline ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_client_operation:Could not find where drum [%u] was moved", operationDrum ( op ) );
+			err = 1;
+			break;
+		}
+		pthread_mutex_unlock ( &conn->lock );
+		if ( moved == 1 )
+			usleep ( SMSA_MOVE_DELAY );
+		conn = poolConnection ( op );
+		pthread_mutex_lock ( &conn->lock );
+		while ( conn != poolConnection ( op ) ) {
+			pthread_mutex_unlock ( &conn->lock );
+			conn = poolConnection ( op );
+			pthread_mutex_lock ( &conn->lock );
+		}
+		err = poolOperation ( conn, op, &ret, blocks, count );
+	}
+
+	if ( err == 0 && usesHeads ( cmd ) )
+		followHeads ( &sessionHead, op, ret );
+
+	//A read of an image the server no longer has brings back nothing
+	if ( err == 0 && cmd == SMSA_NET_SNAPSHOT_READ && ret != 0 )
+		err = 1;
+
+	//Later reads from the replicas have to see what this changed
+	if ( replicaCount > 0 ) {
+		pthread_mutex_lock ( &replicaLock );
+		conn->outstanding--;
+		if ( err == 0 && ( cmd == SMSA_DISK_WRITE || cmd == SMSA_NET_WRITE_AT || cmd == SMSA_FORMAT_DRUM ) && conn->seq > lastWriteSeq )
+			lastWriteSeq = conn->seq;
+		pthread_mutex_unlock ( &replicaLock );
+	}
+	pthread_mutex_unlock ( &conn->lock );
+
+	if ( usesHeads ( cmd ) )
+		pthread_mutex_unlock ( &headLock );
+
+	if ( err ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_operation:Failed to perform the operation over connection [%d]", conn->index );
+		return 1;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Packet Successfully Processed" );
+       	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mountPool
+// Description  : Makes every connection of the pool, and mounts the array over
+//                each of them. The server only mounts the array for the first,
+//                and keeps it mounted until the last one unmounts, so one
+//                connection dropping does not unmount it under the others.
+//                With a shard map every connection goes to a server of its
+//                own, which mounts its own array. The replicas are connected
+//                after the pool. Once they are, reads are hedged if there is
+//                another connection to send them over.
+//
+// Inputs       : op - the mount opcode
+// Outputs      : 0 if successful, 1 if failure
+
+int mountPool ( uint32_t op ) {
+
+        int i;
+
+
+	if ( setupShards () ) {
+		logMessage ( LOG_ERROR_LEVEL, "_mountPool:Bad shard map" );
+		return 1;
+	}
+	sessionHead.drum = 0;
+	sessionHead.block = 0;
+	lastWriteSeq = 0;
+	drumMoves = 0;
+	responseTimeout = getClientTimeout ();
+	readsTimed = 0;
+	hedgeDelay = 0;
+	hedgedReads = 0;
+	hedgeWins = 0;
+	hedging = 0;
+
+	for ( i = 0; i < poolSize; i++ ) {
+
+		pool[i].index = i;
+		pool[i].sock = -1;
+		pool[i].uring = 0;
+		pool[i].replica = 0;
+		pool[i].outstanding = 0;
+		pool[i].wantSeq = 0;
+		pool[i].abandoned = 0;
+		pthread_mutex_init ( &pool[i].lock, NULL );
+
+		if ( openConnection ( &pool[i], op ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_mountPool:Failed to mount over connection [%d]", i );
+
+			//give back the mounts of the connections that did open
+			pthread_mutex_destroy ( &pool[i].lock );
+			poolSize = i;
+			unmountPool ( SMSA_NET_OPERATION ( SMSA_UNMOUNT, 0, 0 ) );
+			return 1;
+		}
+
+		//a mount that started the array out zeroed has to reach the
+		//replicas before they are read
+		if ( pool[i].seq > lastWriteSeq )
+			lastWriteSeq = pool[i].seq;
+	}
+
+	for ( i = 0; i < SMSA_DISK_ARRAY_SIZE; i++ ) {
+		if ( shardMap[i] == -1 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_mountPool:No server in the shard map has drum [%d]", i );
+			unmountPool ( SMSA_NET_OPERATION ( SMSA_UNMOUNT, 0, 0 ) );
+			return 1;
+		}
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Mounted the array over %d connection(s) to %d server(s)", poolSize, ( sharded ) ? poolSize : 1 );
+	mountReplicas ( op );
+
+	//A slow read can be sent again over a replica, or another connection
+	//to the same server
+	hedging = clientHedge && ( replicaCount > 0 || ( !sharded && poolSize > 1 ) );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupShards
+// Description  : Decides how many connections the pool has, where they go, and
+//                which drums go over each. Without a shard map every connection
+//                goes to the server, and drum d goes over connection d % size.
+//                A shard map is a list of servers, as host:port, with a comma
+//                between them. A server can be given its drums, as
+//                host:port=first-last, and the drums that are left are spread
+//                over the servers that were not given any. The pool then has a
+//                connection to every server.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int setupShards ( void ) {
+
+        char *list, *spec, *save;          //the shard map, and one server of it
+        int assigned[SMSA_MAX_DISK_ARRAY_SIZE]; //true once a drum is given to a server
+        int spread[SMSA_MAX_CONNECTIONS];  //servers that take the drums left over
+        int spreadCount = 0;
+        int i, drum, err = 0;
+
+
+	if ( ( list = clientShards ) == NULL )
+		list = getenv ( SMSA_SHARDS_ENV );
+
+	//Without one, the whole array is on the server
+	if ( list == NULL || *list == '\0' ) {
+		sharded = 0;
+		poolSize = getClientConnections ();
+		for ( i = 0; i < poolSize; i++ )
+			pool[i].host[0] = '\0';
+		for ( drum = 0; drum < SMSA_MAX_DISK_ARRAY_SIZE; drum++ )
+			shardMap[drum] = drum % poolSize;
+		return 0;
+	}
+
+	if ( ( list = strdup ( list ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupShards:Failed to copy the shard map [%s]", strerror(errno) );
+		return 1;
+	}
+
+	memset ( assigned, 0, sizeof(assigned) );
+	poolSize = 0;
+	for ( spec = strtok_r ( list, ",", &save ); spec != NULL && err == 0; spec = strtok_r ( NULL, ",", &save ) ) {
+		if ( poolSize == SMSA_MAX_CONNECTIONS ) {
+			logMessage ( LOG_ERROR_LEVEL, "_setupShards:More than %d servers in the shard map", SMSA_MAX_CONNECTIONS );
+			err = 1;
+		}
+		else if ( ( i = parseShard ( spec, poolSize, assigned ) ) == -1 )
+			err = 1;
+		else {
+			if ( i == 0 )
+				spread[spreadCount++] = poolSize;
+			poolSize++;
+		}
+	}
+	free ( list );
+
+	//Spread the drums that are left over the servers without drums. The
+	//geometry is not known until the servers are mounted, so that is when
+	//mountPool checks that every drum of the array has a server
+	for ( drum = 0, i = 0; drum < SMSA_MAX_DISK_ARRAY_SIZE && err == 0; drum++ ) {
+		if ( !assigned[drum] )
+			shardMap[drum] = ( spreadCount > 0 ) ? spread[i++ % spreadCount] : -1;
+	}
+
+	if ( err || poolSize == 0 ) {
+		poolSize = 0;
+		return 1;
+	}
+	sharded = 1;
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseShard
+// Description  : Takes one server of a shard map, host:port with the drums it
+//                is given after an '=', as one drum or a range first-last
+//
+// Inputs       : spec - the server
+//                server - the connection of the pool the server goes over
+//                assigned - which drums were already given to a server
+// Outputs      : the number of drums it was given, or -1 if it is bad
+
+int parseShard ( char *spec, int server, int *assigned ) {
+
+        char *drums;                       //the drums given to the server
+        unsigned int first, last;          //first and last of the drums
+        int drum;
+
+
+	if ( ( drums = strchr ( spec, '=' ) ) != NULL )
+		*drums++ = '\0';
+	if ( smsa_parse_address ( spec, pool[server].host, sizeof(pool[server].host), &pool[server].port ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseShard:Bad server [%s] in the shard map", spec );
+		return -1;
+	}
+	if ( drums == NULL )
+		return 0;
+
+	if ( sscanf ( drums, "%u-%u", &first, &last ) != 2 ) {
+		if ( sscanf ( drums, "%u", &first ) != 1 )
+			first = SMSA_MAX_DISK_ARRAY_SIZE;
+		last = first;
+	}
+	if ( first > last || last >= SMSA_MAX_DISK_ARRAY_SIZE ) {
+		logMessage ( LOG_ERROR_LEVEL, "_parseShard:Bad drums [%s] for server [%s]", drums, spec );
+		return -1;
+	}
+
+	for ( drum = first; drum <= last; drum++ ) {
+		if ( assigned[drum] ) {
+			logMessage ( LOG_ERROR_LEVEL, "_parseShard:Drum [%d] is given to two servers", drum );
+			return -1;
+		}
+		assigned[drum] = 1;
+		shardMap[drum] = server;
+	}
+
+	return ( last-first+1 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mountReplicas
+// Description  : Connects to every replica, and mounts the array on it. A
+//                replica is a follower of the server, and only the reads are
+//                sent to it, as SMSA_NET_READ_AT, so it has to speak version 2.
+//                A replica that can not be used is left out, and its reads go
+//                to the leader, as do all of them if the pool can not give
+//                read your writes its sequence numbers.
+//
+// Inputs       : op - the mount opcode
+// Outputs      : none
+
+void mountReplicas ( uint32_t op ) {
+
+        char *list, *spec, *save;          //the list of replicas, and one of them
+        int i;
+
+
+	replicaCount = 0;
+	replicaReads = 0;
+	replicaFallbacks = 0;
+	nextReplica = 0;
+	consistency = getClientConsistency ();
+	if ( ( list = clientReplicas ) == NULL )
+		list = getenv ( SMSA_REPLICAS_ENV );
+	if ( list == NULL || *list == '\0' || consistency == SMSA_CONSISTENCY_LEADER )
+		return;
+
+	//Each server of a cluster would need followers of its own
+	if ( sharded ) {
+		logMessage ( LOG_WARNING_LEVEL, "Replicas are not used with a shard map, reading from the servers" );
+		return;
+	}
+
+	if ( consistency == SMSA_CONSISTENCY_SESSION && pool[0].version < 2 ) {
+		logMessage ( LOG_WARNING_LEVEL, "The server speaks protocol version 1, reading from the leader" );
+		return;
+	}
+	if ( ( list = strdup ( list ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_mountReplicas:Failed to copy the replicas [%s]", strerror(errno) );
+		return;
+	}
+
+	for ( spec = strtok_r ( list, ",", &save ); spec != NULL && replicaCount < SMSA_MAX_REPLICAS; spec = strtok_r ( NULL, ",", &save ) ) {
+
+		i = replicaCount;
+		memset ( &replicas[i], 0, sizeof(SMSA_CLIENT_CONNECTION) );
+		replicas[i].index = poolSize+i;
+		replicas[i].sock = -1;
+		replicas[i].replica = 1;
+		if ( smsa_parse_address ( spec, replicas[i].host, sizeof(replicas[i].host), &replicas[i].port ) ) {
+			logMessage ( LOG_WARNING_LEVEL, "Bad replica [%s], leaving it out", spec );
+			continue;
+		}
+
+		pthread_mutex_init ( &replicas[i].lock, NULL );
+		if ( openConnection ( &replicas[i], op ) ) {
+			logMessage ( LOG_WARNING_LEVEL, "Failed to mount replica [%s/%u], leaving it out", replicas[i].host, replicas[i].port );
+			pthread_mutex_destroy ( &replicas[i].lock );
+			continue;
+		}
+		if ( replicas[i].version < 2 ) {
+			logMessage ( LOG_WARNING_LEVEL, "Replica [%s/%u] speaks protocol version 1, leaving it out", replicas[i].host, replicas[i].port );
+			closeConnection ( &replicas[i] );
+			pthread_mutex_destroy ( &replicas[i].lock );
+			continue;
+		}
+		replicaCount++;
+	}
+	free ( list );
+
+	logMessage ( LOG_INFO_LEVEL, "Reading from %d replica(s)", replicaCount );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmountPool
+// Description  : Unmounts the array over every connection of the pool and closes
+//                them. The server unmounts the array itself when the last one
+//                unmounts.
+//
+// Inputs       : op - the unmount opcode
+// Outputs      : 0 if successful, 1 if failure
+
+int unmountPool ( uint32_t op ) {
+
+        int16_t ret;
+        int i, err = 0;
+
+
+	for ( i = 0; i < poolSize; i++ ) {
+		if ( pool[i].sock != -1 && exchangePacket ( &pool[i], op, &ret, NULL, 0 ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_unmountPool:Failed to unmount over connection [%d]", i );
+			err = 1;
+		}
+		closeConnection ( &pool[i] );
+		pthread_mutex_destroy ( &pool[i].lock );
+	}
+	poolSize = 0;
+	if ( drumMoves > 0 )
+		logMessage ( LOG_OUTPUT_LEVEL, "Client moved %u drum(s) between the servers of the cluster", drumMoves );
+
+	//The replicas only ever read, so an unmount that fails on one is
+	//not an error
+	for ( i = 0; i < replicaCount; i++ ) {
+		if ( replicas[i].sock != -1 && exchangePacket ( &replicas[i], op, &ret, NULL, 0 ) )
+			logMessage ( LOG_WARNING_LEVEL, "Failed to unmount replica [%s/%u]", replicas[i].host, replicas[i].port );
+		closeConnection ( &replicas[i] );
+		pthread_mutex_destroy ( &replicas[i].lock );
+	}
+	if ( replicaCount > 0 )
+		logMessage ( LOG_OUTPUT_LEVEL, "Client read %llu blocks from replicas, %llu reads went back to the leader",
+				(unsigned long long)replicaReads, (unsigned long long)replicaFallbacks );
+	replicaCount = 0;
+
+	if ( hedgedReads > 0 )
+		logMessage ( LOG_OUTPUT_LEVEL, "Client hedged %llu reads after %u usec, the other connection answered %llu first",
+				(unsigned long long)hedgedReads, hedgeDelay, (unsigned long long)hedgeWins );
+	hedging = 0;
+
+	smsa_log_compress_stats ( "Client" );
+	logMessage ( LOG_INFO_LEVEL, "Sending UNMOUNT Command. Closing Connection with the Server");
+	return err;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replicaRead
+// Description  : Tries to perform a read on a replica. A read at the heads is
+//                sent as an SMSA_NET_READ_AT at the session heads, which it
+//                leaves for the caller to move. With read your writes the read
+//                asks for the sequence number of our last write, and a replica
+//                that has not performed it yet fails the read. A replica that
+//                is lost is closed, and not used again until the next mount.
+//
+// Inputs       : op - the opcode of the read
+//                blocks - will hold the blocks that were read
+//                count - the number of blocks
+// Outputs      : 0 if the replica read the blocks, 1 if the read has to go to
+//                the leader
+
+int replicaRead ( uint32_t op, unsigned char *blocks, uint16_t count ) {
+
+        SMSA_CLIENT_CONNECTION *conn;      //replica the read goes to
+        SMSA_FRAME response;               //header of the response
+        SMSA_DRUM_ID drum;                 //drum of the read
+        SMSA_BLOCK_ID block;               //first block of the read
+        uint32_t seq;                      //sequence number the replica has to have
+        int err = 1;
+
+
+	if ( replicaCount == 0 )
+		return 1;
+
+	if ( SMSA_OPCODE(op) == SMSA_DISK_READ ) {
+		drum = sessionHead.drum;
+		block = sessionHead.block;
+	}
+	else {
+		drum = SMSA_DRUMID(op);
+		block = SMSA_BLOCKID(op);
+	}
+	if ( drum >= SMSA_DISK_ARRAY_SIZE || block+count > SMSA_MAX_BLOCK_ID || ( conn = pickReader ( drum ) ) == NULL )
+		return 1;
+
+	pthread_mutex_lock ( &replicaLock );
+	seq = ( consistency == SMSA_CONSISTENCY_SESSION ) ? lastWriteSeq : 0;
+	pthread_mutex_unlock ( &replicaLock );
+
+	pthread_mutex_lock ( &conn->lock );
+	if ( conn->sock != -1 ) {
+		conn->wantSeq = seq;
+		if ( exchangeFrame ( conn, SMSA_NET_OPERATION ( SMSA_NET_READ_AT, drum, block ), blocks, count, &response ) ) {
+			logMessage ( LOG_WARNING_LEVEL, "Lost replica [%s/%u], reading from the leader", conn->host, conn->port );
+			invalidateConnection ( conn );
+			closeConnection ( conn );
+		}
+		else
+			err = ( response.ret != 0 );
+	}
+	pthread_mutex_unlock ( &conn->lock );
+
+	pthread_mutex_lock ( &replicaLock );
+	conn->outstanding--;
+	if ( err )
+		replicaFallbacks++;
+	else
+		replicaReads += count;
+	pthread_mutex_unlock ( &replicaLock );
+
+	return err;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : pickReader
+// Description  : Picks where a read goes. It is the replica with the fewest
+//                reads in flight, looking at them from the next one on each
+//                time so they share the reads evenly, unless the connection
+//                of the drum to the leader has fewer still. The replica gets
+//                the read counted as in flight.
+//
+// Inputs       : drum - the drum of the read
+// Outputs      : the replica, or NULL for the leader
+
+SMSA_CLIENT_CONNECTION *pickReader ( SMSA_DRUM_ID drum ) {
+
+        SMSA_CLIENT_CONNECTION *best = NULL;   //replica with the fewest reads in flight
+        SMSA_CLIENT_CONNECTION *conn;
+        int i;
+
+
+	pthread_mutex_lock ( &replicaLock );
+	for ( i = 0; i < replicaCount; i++ ) {
+		conn = &replicas[(nextReplica+i) % replicaCount];
+		if ( conn->sock != -1 && ( best == NULL || conn->outstanding < best->outstanding ) )
+			best = conn;
+	}
+	nextReplica = ( nextReplica+1 ) % replicaCount;
+
+	if ( best != NULL && pool[shardMap[drum]].outstanding < best->outstanding )
+		best = NULL;
+	if ( best != NULL )
+		best->outstanding++;
+	pthread_mutex_unlock ( &replicaLock );
+
+	return best;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : usesHeads
+// Description  : Tells if a command works where the heads are, or moves them
+//
+// Inputs       : cmd - the command
+// Outputs      : 1 if it does, 0 if not
+
+int usesHeads ( uint32_t cmd ) {
+
+	return ( cmd == SMSA_SEEK_DRUM || cmd == SMSA_SEEK_BLOCK || cmd == SMSA_DISK_READ ||
+			cmd == SMSA_DISK_WRITE || cmd == SMSA_FORMAT_DRUM );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : poolConnection
+// Description  : Picks the connection an operation goes over. Drums are spread
+//                over the pool by the shard map, see operationDrum.
+//
+// Inputs       : op - the opcode
+// Outputs      : the connection
+
+SMSA_CLIENT_CONNECTION *poolConnection ( uint32_t op ) {
+
+	return ( &pool[shardMap[operationDrum ( op )]] );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : operationDrum
+// Description  : Tells the drum an operation is on. A seek is on the drum it
+//                seeks to, the other operations that use the heads on the drum
+//                the session heads are on, and everything else on the drum in
+//                its opcode.
+//
+// Inputs       : op - the opcode
+// Outputs      : the drum
+
+SMSA_DRUM_ID operationDrum ( uint32_t op ) {
+
+        uint32_t cmd = SMSA_OPCODE(op);
+
+	if ( usesHeads ( cmd ) && cmd != SMSA_SEEK_DRUM )
+		return ( sessionHead.drum );
+	return ( SMSA_DRUMID(op) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : poolOperation
+// Description  : Performs an operation over a connection of the pool. If the
+//                connection has dropped, it backs off and connects again, which
+//                mounts the array over the new connection, then puts the heads
+//                of the new connection where the session heads are and tries
+//                the operation again. The session heads only move once the
+//                response is in, so an operation that was lost with the old
+//                connection is repeated at the same drum and block.
+//
+//                A reconnect restores the session, not the array. If the server
+//                itself went away, the array it had mounted went with it. The
+//                leases go with the connection, so with invalidations every
+//                block of its drums is dropped from the cache.
+//
+//                An operation has as long as a response is waited for, see
+//                smsa_client_set_timeout. Once that is up it is not tried
+//                again. It fails, and the connection is closed, so the next
+//                operation on it reconnects. The server may still perform it
+//                once it gets to it.
+//
+// Inputs       : conn - the connection
+//                op - the opcode
+//                ret - will hold the return of the operation on the server
+//                blocks - the blocks to be read/writen from (READ/WRITE)
+//                count - the number of blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int poolOperation ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, int16_t *ret, unsigned char *blocks, uint16_t count ) {
+
+        useconds_t delay = SMSA_RECONNECT_DELAY;   //how long to wait before the next reconnect
+        uint64_t deadline = clientDeadline ();     //when the operation has to be done by
+        int tries, err;
+
+
+	for ( tries = 0; ; tries++ ) {
+
+		if ( conn->sock != -1 ) {
+			if ( ( err = syncHeads ( conn, op ) ) == -1 )
+				return 1;
+			if ( err == 0 && exchangePacket ( conn, op, ret, blocks, count ) == 0 ) {
+				followHeads ( &conn->head, op, *ret );
+				return 0;
+			}
+		}
+
+		//An operation that is out of time is not tried again
+		if ( deadline != 0 && clientClock () >= deadline ) {
+			logMessage ( LOG_ERROR_LEVEL, "_poolOperation:No response over connection [%d] in %u msec", conn->index, responseTimeout );
+			invalidateConnection ( conn );
+			closeConnection ( conn );
+			return 1;
+		}
+
+		if ( tries == SMSA_RECONNECT_TRIES ) {
+			logMessage ( LOG_ERROR_LEVEL, "_poolOperation:Gave up on connection [%d] after %d reconnects", conn->index, tries );
+			return 1;
+		}
+
+		logMessage ( LOG_WARNING_LEVEL, "Lost connection [%d] to the server, reconnecting in %u usec", conn->index, delay );
+		invalidateConnection ( conn );
+		closeConnection ( conn );
+		usleep ( delay );
+		delay = ( delay*2 > SMSA_RECONNECT_MAX_DELAY ) ? SMSA_RECONNECT_MAX_DELAY : delay*2;
+		openConnection ( conn, SMSA_NET_OPERATION ( SMSA_MOUNT, 0, 0 ) );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : syncHeads
+// Description  : Seeks the heads of a connection to the session heads before an
+//                operation that uses them. They only differ after the session
+//                has moved over another connection ( a format puts the heads on
+//                drum 0 ), or after a reconnect, so with one connection this
+//                never sends anything.
+//
+// Inputs       : conn - the connection
+//                op - the opcode of the operation about to be sent
+// Outputs      : 0 if successful, 1 if the connection failed, -1 if the
+//                session heads can not be seeked to
+
+int syncHeads ( SMSA_CLIENT_CONNECTION *conn, uint32_t op ) {
+
+        uint32_t cmd = SMSA_OPCODE(op);
+        uint32_t seek;                     //opcode of a seek
+        int16_t ret;
+
+	if ( !usesHeads ( cmd ) || cmd == SMSA_SEEK_DRUM )
+		return 0;
+
+	if ( conn->head.drum != sessionHead.drum ) {
+		seek = SMSA_NET_OPERATION ( SMSA_SEEK_DRUM, sessionHead.drum, 0 );
+		if ( exchangePacket ( conn, seek, &ret, NULL, 0 ) )
+			return 1;
+		followHeads ( &conn->head, seek, ret );
+	}
+
+	if ( ( cmd == SMSA_DISK_READ || cmd == SMSA_DISK_WRITE ) && conn->head.block != sessionHead.block ) {
+
+		//a read or write of the last block leaves the head past the end of
+		//the drum, where a seek can not put it
+		if ( sessionHead.block >= SMSA_MAX_BLOCK_ID ) {
+			logMessage ( LOG_ERROR_LEVEL, "_syncHeads:Block head is past the end of drum [%u]", sessionHead.drum );
+			return -1;
+		}
+
+		seek = SMSA_NET_OPERATION ( SMSA_SEEK_BLOCK, 0, sessionHead.block );
+		if ( exchangePacket ( conn, seek, &ret, NULL, 0 ) )
+			return 1;
+		followHeads ( &conn->head, seek, ret );
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : followHeads
+// Description  : Moves a set of heads the way the server moves the heads of a
+//                connection when it performs an operation
+//
+// Inputs       : head - the heads
+//                op - the opcode of the operation
+//                ret - the return of the operation on the server
+// Outputs      : none
+
+void followHeads ( SMSA_HEAD *head, uint32_t op, int16_t ret ) {
+
+	//the server only moves the heads when the operation works
+	if ( ret != 0 )
+		return;
+
+	switch ( SMSA_OPCODE(op) ) {
+
+		case SMSA_MOUNT:
+		case SMSA_FORMAT_DRUM:
+			head->drum = 0;
+			head->block = 0;
+			break;
+
+		case SMSA_SEEK_DRUM:
+			head->drum = SMSA_DRUMID(op);
+			head->block = 0;
+			break;
+
+		case SMSA_SEEK_BLOCK:
+			head->block = SMSA_BLOCKID(op);
+			break;
+
+		case SMSA_DISK_READ:
+		case SMSA_DISK_WRITE:
+			head->block++;
+			break;
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openConnection
+// Description  : Connects a connection of the pool to the server, agrees on a
+//                protocol version, and mounts the array over it, which puts its
+//                heads at the start of the array
+//
+// Inputs       : conn - the connection
+//                op - the mount opcode
+// Outputs      : 0 if successful, 1 if failure
+
+int openConnection ( SMSA_CLIENT_CONNECTION *conn, uint32_t op ) {
+
+        char *ip;          //address of the server or replica
+        uint16_t port;     //port of the server or replica
+        SMSA_FRAME response;    //the response to the mount
+
+
+	if ( conn->host[0] != '\0' ) {
+		ip = conn->host;
+		port = conn->port;
+	}
+	else if ( getServerAddress ( &ip, &port ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openConnection:Failed to get the server address" );
+		return 1;
+	}
+
+	if ( setupConnection ( &conn->sock, ip, port ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openConnection:Failed to properly set up the connection" );
+		return 1;
+	}
+	logMessage ( LOG_INFO_LEVEL, "Socket Successfully initialized. Socket File Handle [%d]", conn->sock );
+
+	//Use io_uring if we were asked to, and plain system calls if the
+	//kernel does not have it
+	if ( getClientTransport () == SMSA_TRANSPORT_URING && setupUring ( conn ) )
+		logMessage ( LOG_WARNING_LEVEL, "io_uring is not supported, using plain sockets" );
+
+	//Every connection starts out in version 1
+	conn->version = 1;
+	conn->features = 0;
+	if ( getClientProtocol () >= 2 && helloConnection ( conn ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openConnection:Failed to agree on a protocol version over connection [%d]", conn->index );
+		closeConnection ( conn );
+		return 1;
+	}
+
+	if ( exchangeFrame ( conn, op, NULL, 0, &response ) || response.ret != 0 ||
+			takeGeometry ( conn, response.op ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_openConnection:Failed to mount over connection [%d]", conn->index );
+		closeConnection ( conn );
+		return 1;
+	}
+	conn->head.drum = 0;
+	conn->head.block = 0;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeGeometry
+// Description  : Takes the geometry of the array out of the response to a
+//                mount. The first connection of the pool gives the geometry
+//                the client uses, and every other server or replica has to
+//                have the same one.
+//
+// Inputs       : conn - the connection
+//                op - the opcode of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int takeGeometry ( SMSA_CLIENT_CONNECTION *conn, uint32_t op ) {
+
+        SMSA_GEOMETRY geometry;   //geometry of the array of the server
+
+
+	smsa_operation_geometry ( op, &geometry );
+	if ( conn->index == 0 ) {
+		if ( smsa_set_geometry ( geometry.drums, geometry.blocks, geometry.blockSize ) )
+			return 1;
+		logMessage ( LOG_INFO_LEVEL, "The array has %u drums of %u blocks of %u bytes", geometry.drums, geometry.blocks, geometry.blockSize );
+		return 0;
+	}
+
+	if ( memcmp ( &geometry, &smsa_geometry, sizeof(geometry) ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_takeGeometry:Connection [%d] has an array of [%u] drums of [%u] blocks of [%u] bytes",
+				conn->index, geometry.drums, geometry.blocks, geometry.blockSize );
+		return 1;
+	}
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeConnection
+// Description  : Closes a connection of the pool, and its ring if it has one
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void closeConnection ( SMSA_CLIENT_CONNECTION *conn ) {
+
+	if ( conn->uring ) {
+		smsa_uring_close ( &conn->ring );
+		conn->uring = 0;
+	}
+	if ( conn->sock != -1 ) {
+		close ( conn->sock );
+		conn->sock = -1;
+	}
+	conn->abandoned = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : helloConnection
+// Description  : Asks the server for the highest protocol version we speak,
+//                and for the features we want, see smsa_network.h. A server
+//                that only speaks version 1 fails the hello, and the connection
+//                stays in version 1.
+//
+// Inputs       : conn - the connection, still in version 1
+// Outputs      : 0 if successful, 1 if failure
+
+int helloConnection ( SMSA_CLIENT_CONNECTION *conn ) {
+
+        SMSA_FRAME response;    //the response to the hello
+        uint16_t features;      //SMSA_NET_FLAGS we ask for
+        uint32_t op;
+
+	//Uniform blocks cost nothing to look for, so they are always asked for.
+	//Invalidations are asked for when there is someone to tell about them
+	features = clientFeatures | SMSA_NET_FLAG_UNIFORM | ( ( invalidateHandler != NULL ) ? SMSA_NET_FLAG_INVALIDATE : 0 );
+	op = SMSA_NET_OPERATION ( SMSA_NET_HELLO, features, getClientProtocol () );
+	if ( exchangeFrame ( conn, op, NULL, 0, &response ) )
+		return 1;
+
+	if ( response.ret == 0 && SMSA_OPCODE(response.op) == SMSA_NET_HELLO && SMSA_BLOCKID(response.op) >= 2 ) {
+		conn->version = SMSA_BLOCKID(response.op);
+		conn->features = SMSA_DRUMID(response.op) & features;
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Connection [%d] speaks protocol version %d, features [%x]", conn->index, conn->version, conn->features );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : exchangePacket
+// Description  : Sends a request over a connection and receives its response.
+//                A version 1 connection can only carry one block in a packet,
+//                so an operation that covers more is sent as one packet per
+//                block, stopping at the first that fails.
+//
+// Inputs       : conn - the connection
+//                op - opcode for smsa_operation
+//                ret - will hold the return of smsa_operation
+//                blocks - the blocks to be read/writen from (READ/WRITE)
+//                count - the number of blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int exchangePacket ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, int16_t *ret, unsigned char *blocks, uint16_t count ) {
+
+        SMSA_FRAME response;    //header of the response
+        int i;
+
+
+	if ( count > 1 && conn->version < 2 ) {
+		for ( i = 0; i < count; i++ ) {
+			if ( exchangePacket ( conn, SMSA_NET_OPERATION ( SMSA_OPCODE(op), SMSA_DRUMID(op), SMSA_BLOCKID(op)+i ),
+					ret, &blocks[i*SMSA_BLOCK_SIZE], 1 ) )
+				return 1;
+			if ( *ret != 0 )
+				break;
+		}
+		return 0;
+	}
+
+	if ( exchangeFrame ( conn, op, blocks, count, &response ) )
+		return 1;
+	*ret = response.ret;
+
+	//check return and make sure it is not an invalid return
+	if ( *ret == 1 ) {
+		logMessage ( LOG_INFO_LEVEL, "_exchangePacket:Return value is an error value" );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : exchangeFrame
+// Description  : Sends one request frame over a connection, framed in the protocol
+//                version of the connection, and receives its response. The
+//                response has to carry the id of the request, and match its
+//                checksum. The blocks in the response are copied out to blocks.
+//                The server has until the deadline of the connection to answer.
+//                A read of the pool can be hedged, see hedgedRead.
+//
+// Inputs       : conn - the connection
+//                op - opcode for smsa_operation
+//                blocks - the blocks to be read/writen from (READ/WRITE)
+//                count - the number of blocks
+//                response - will hold the header of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int exchangeFrame ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count, SMSA_FRAME *response ) {
+
+        SMSA_FRAME request;                //header of the request
+        uint32_t cmd = SMSA_OPCODE(op);
+
+
+	conn->deadline = clientDeadline ();
+
+	//The response to a request we stopped waiting for is still on its way
+	if ( conn->abandoned != 0 && drainConnection ( conn ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_exchangeFrame:Failed to drop an abandoned response on connection [%d]", conn->index );
+		return 1;
+	}
+
+	packRequest ( conn, op, blocks, count, &request );
+
+	if ( hedging && !conn->replica && conn->version >= 2 && ( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT ) && blocks != NULL )
+		return ( hedgedRead ( conn, &request, blocks, count, response ) );
+
+	//Send it and wait for the whole response to be in recvBuffer
+	if ( conn->uring ) {
+		if ( uringTransfer ( conn, request.len, response ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_exchangeFrame:Failed to perform the operation with io_uring" );
+			return 1;
+		}
+	}
+	else if ( socketTransfer ( conn, request.len, response ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_exchangeFrame:Failed to perform the operation" );
+		return 1;
+	}
+
+	return ( takeResponse ( conn, &request, blocks, count, response ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : packRequest
+// Description  : Puts a request together in the send buffer of a connection.
+//                Writes, and the moves of a drum out, are the only requests that
+//                carry blocks.
+//
+// Inputs       : conn - the connection
+//                op - opcode for smsa_operation
+//                blocks - the blocks to be writen ( WRITE )
+//                count - the number of blocks
+//                request - will hold the header of the request
+// Outputs      : none
+
+void packRequest ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count, SMSA_FRAME *request ) {
+
+        uint32_t header;                   //size of a header in the version of the connection
+        uint32_t cmd = SMSA_OPCODE(op);
+
+
+	header = smsa_frame_header_size ( conn->version );
+	memset ( request, 0, sizeof(SMSA_FRAME) );
+	request->id = ++conn->nextId;
+	request->op = op;
+	request->blocks = count;
+	request->seq = conn->wantSeq;
+	request->len = header;
+	if ( ( cmd == SMSA_DISK_WRITE || cmd == SMSA_NET_WRITE_AT || cmd == SMSA_NET_MOVE_DRUM ) && blocks != NULL ) {
+		request->len += smsa_encode_payload ( conn->features, blocks, count, &conn->sendBuffer[header], &request->flags );
+		if ( conn->features & SMSA_NET_FLAG_CHECKSUM ) {
+			request->flags |= SMSA_NET_FLAG_CHECKSUM;
+			request->checksum = smsa_crc32 ( blocks, count*SMSA_BLOCK_SIZE );
+		}
+	}
+	smsa_pack_frame ( conn->version, conn->sendBuffer, request );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeResponse
+// Description  : Checks the response to a request that is in the receive buffer
+//                of a connection, and copies out the blocks its payload holds.
+//                The response has to carry the id of the request, and match
+//                its checksum.
+//
+// Inputs       : conn - the connection
+//                request - the header of the request
+//                blocks - will hold the blocks that were read (READ)
+//                count - the number of blocks
+//                response - the header of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int takeResponse ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *request, unsigned char *blocks, uint16_t count, SMSA_FRAME *response ) {
+
+        uint32_t header = smsa_frame_header_size ( conn->version );
+        uint32_t size;                     //size of the payload
+
+
+	if ( conn->version >= 2 && response->id != request->id ) {
+		logMessage ( LOG_ERROR_LEVEL, "_takeResponse:Response [%u] to request [%u]", response->id, request->id );
+		return 1;
+	}
+	conn->seq = response->seq;
+
+	//Copy out the blocks the payload holds, and check them against the checksum
+	size = response->len - header;
+	if ( size > 0 && blocks != NULL ) {
+		if ( ( response->flags & ( SMSA_NET_FLAG_UNIFORM|SMSA_NET_FLAG_COMPRESSED ) & ~conn->features ) ||
+				smsa_decode_payload ( response->flags, &conn->recvBuffer[header], size, blocks, count ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_takeResponse:Bad response payload on connection [%d]", conn->index );
+			return 1;
+		}
+		size = count*SMSA_BLOCK_SIZE;
+		if ( ( response->flags & SMSA_NET_FLAG_CHECKSUM ) && smsa_crc32 ( blocks, size ) != response->checksum ) {
+			logMessage ( LOG_ERROR_LEVEL, "_takeResponse:Bad checksum on connection [%d]", conn->index );
+			return 1;
+		}
+	}
+
+	logMessage( LOG_INFO_LEVEL, "Received %d bytes on handle %d", response->len, conn->sock );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hedgedRead
+// Description  : Sends a read over a connection of the pool, and gives the server
+//                as long as SMSA_HEDGE_PERCENTILE percent of the reads before it
+//                took to answer. If it has not by then, the read is sent again
+//                as an SMSA_NET_READ_AT over another connection, see sendHedge,
+//                and the first of the two to answer is taken. The other is
+//                abandoned, and its response dropped when it comes in. A read
+//                the other connection answers first has not moved the heads of
+//                the connection as far as we can tell, so they are seeked again
+//                before the next operation that uses them.
+//
+//                A hedge the replica fails, because it has not performed our
+//                writes yet, leaves the read to the connection.
+//
+// Inputs       : conn - the connection
+//                request - the header of the read, packed in its send buffer
+//                blocks - will hold the blocks that were read
+//                count - the number of blocks
+//                response - will hold the header of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int hedgedRead ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *request, unsigned char *blocks, uint16_t count, SMSA_FRAME *response ) {
+
+        SMSA_CLIENT_CONNECTION *hedge = NULL;  //connection the read was sent again over ( NULL if none )
+        SMSA_CLIENT_CONNECTION *from;          //connection a frame came in on
+        SMSA_FRAME copy;                       //header of the read sent again
+        uint64_t start = clientClock ();       //when the read was sent
+        uint32_t delay;                        //usec the read waits before it is hedged
+        int ready;
+
+
+	if ( sendBytes ( conn->sock, request->len, conn->sendBuffer ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_hedgedRead:Failed to send a request" );
+		return 1;
+	}
+
+	//Until enough reads are timed there is no delay, and no hedge
+	pthread_mutex_lock ( &hedgeLock );
+	delay = hedgeDelay;
+	pthread_mutex_unlock ( &hedgeLock );
+	if ( delay > 0 && ( ready = waitConnections ( conn, NULL, start+delay ) ) <= 0 ) {
+		if ( ready == -1 )
+			return 1;
+		hedge = sendHedge ( conn, request, count, &copy );
+	}
+
+	//Take the frames of whichever connection has one, until a response is in
+	for ( ;; ) {
+
+		from = conn;
+		if ( hedge != NULL ) {
+			if ( ( ready = waitConnections ( conn, hedge, conn->deadline ) ) <= 0 ) {
+				logMessage ( LOG_ERROR_LEVEL, "_hedgedRead:No response over connection [%d] or [%d]", conn->index, hedge->index );
+				hedge->abandoned = copy.id;
+				pthread_mutex_unlock ( &hedge->lock );
+				return 1;
+			}
+			if ( ready == 2 )
+				from = hedge;
+		}
+
+		if ( from == conn ) {
+			if ( readFrame ( conn, response ) ) {
+				logMessage ( LOG_ERROR_LEVEL, "_hedgedRead:Failed to read the response" );
+				if ( hedge != NULL ) {
+					hedge->abandoned = copy.id;
+					pthread_mutex_unlock ( &hedge->lock );
+				}
+				return 1;
+			}
+			if ( !takeInvalidation ( conn, response ) )
+				break;
+			continue;
+		}
+
+		//A frame from the other connection
+		if ( readFrame ( hedge, response ) ) {
+			logMessage ( LOG_WARNING_LEVEL, "Lost connection [%d] a read was hedged over", hedge->index );
+			invalidateConnection ( hedge );
+			closeConnection ( hedge );
+		}
+		else if ( takeInvalidation ( hedge, response ) )
+			continue;
+		else if ( takeResponse ( hedge, &copy, blocks, count, response ) == 0 && response->ret == 0 ) {
+			conn->abandoned = request->id;
+			if ( SMSA_OPCODE(request->op) == SMSA_DISK_READ )
+				conn->head.drum = SMSA_DISK_ARRAY_SIZE;
+			pthread_mutex_unlock ( &hedge->lock );
+
+			pthread_mutex_lock ( &hedgeLock );
+			hedgeWins++;
+			pthread_mutex_unlock ( &hedgeLock );
+			timeRead ( clientClock () - start );
+			return 0;
+		}
+		pthread_mutex_unlock ( &hedge->lock );
+		hedge = NULL;
+	}
+
+	if ( hedge != NULL ) {
+		hedge->abandoned = copy.id;
+		pthread_mutex_unlock ( &hedge->lock );
+	}
+	if ( takeResponse ( conn, request, blocks, count, response ) )
+		return 1;
+	timeRead ( clientClock () - start );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendHedge
+// Description  : Sends a read again over another connection, as an
+//                SMSA_NET_READ_AT of the same blocks, so it does not move any
+//                heads. The replicas are tried first, then the other
+//                connections of the pool, which go to the same server unless
+//                there is a shard map. Only a connection that is idle is used,
+//                and it is left locked until the read is answered or abandoned.
+//
+// Inputs       : conn - the connection the read went over
+//                request - the header of the read
+//                count - the number of blocks
+//                copy - will hold the header of the read sent again
+// Outputs      : the connection it was sent over, or NULL if none
+
+SMSA_CLIENT_CONNECTION *sendHedge ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *request, uint16_t count, SMSA_FRAME *copy ) {
+
+        SMSA_CLIENT_CONNECTION *hedge = NULL;  //connection the read is sent again over
+        SMSA_DRUM_ID drum;                     //drum of the read
+        SMSA_BLOCK_ID block;                   //first block of the read
+        uint32_t seq;                          //sequence number a replica has to have
+        int i;
+
+
+	//A read at the heads reads where the heads of the connection are
+	if ( SMSA_OPCODE(request->op) == SMSA_DISK_READ ) {
+		drum = conn->head.drum;
+		block = conn->head.block;
+	}
+	else {
+		drum = SMSA_DRUMID(request->op);
+		block = SMSA_BLOCKID(request->op);
+	}
+	if ( drum >= SMSA_DISK_ARRAY_SIZE || block+count > SMSA_MAX_BLOCK_ID )
+		return NULL;
+
+	pthread_mutex_lock ( &replicaLock );
+	seq = ( consistency == SMSA_CONSISTENCY_SESSION ) ? lastWriteSeq : 0;
+	pthread_mutex_unlock ( &replicaLock );
+
+	for ( i = 0; i < replicaCount+poolSize && hedge == NULL; i++ ) {
+		if ( i < replicaCount )
+			hedge = &replicas[(nextReplica+i) % replicaCount];
+		else if ( !sharded )
+			hedge = &pool[(conn->index+1+i-replicaCount) % poolSize];
+		else
+			break;
+
+		if ( hedge == conn || pthread_mutex_trylock ( &hedge->lock ) != 0 )
+			hedge = NULL;
+		else if ( hedge->sock == -1 || hedge->version < 2 || hedge->abandoned != 0 ) {
+			pthread_mutex_unlock ( &hedge->lock );
+			hedge = NULL;
+		}
+	}
+	if ( hedge == NULL )
+		return NULL;
+
+	hedge->deadline = conn->deadline;
+	hedge->wantSeq = ( hedge->replica ) ? seq : 0;
+	packRequest ( hedge, SMSA_NET_OPERATION ( SMSA_NET_READ_AT, drum, block ), NULL, count, copy );
+	if ( sendBytes ( hedge->sock, copy->len, hedge->sendBuffer ) ) {
+		logMessage ( LOG_WARNING_LEVEL, "Lost connection [%d] a read was hedged over", hedge->index );
+		invalidateConnection ( hedge );
+		closeConnection ( hedge );
+		pthread_mutex_unlock ( &hedge->lock );
+		return NULL;
+	}
+
+	pthread_mutex_lock ( &hedgeLock );
+	hedgedReads++;
+	pthread_mutex_unlock ( &hedgeLock );
+
+	return hedge;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : waitConnections
+// Description  : Waits for a frame to come in on a connection, or either of two
+//
+// Inputs       : conn - the connection
+//                hedge - the other connection ( NULL for none )
+//                until - clientClock time to give up at ( 0 for never )
+// Outputs      : 1 if conn has a frame, 2 if hedge has one, 0 if the time is
+//                up, -1 if failure
+
+int waitConnections ( SMSA_CLIENT_CONNECTION *conn, SMSA_CLIENT_CONNECTION *hedge, uint64_t until ) {
+
+        fd_set readEvent;
+        struct timeval wait;               //how long there is left to wait
+        uint64_t now;
+        int ret;
+
+
+	do {
+		FD_ZERO ( &readEvent );
+		FD_SET ( conn->sock, &readEvent );
+		if ( hedge != NULL )
+			FD_SET ( hedge->sock, &readEvent );
+
+		now = clientClock ();
+		if ( until != 0 && now >= until )
+			return 0;
+		wait.tv_sec = ( until-now ) / 1000000;
+		wait.tv_usec = ( until-now ) % 1000000;
+
+		ret = select ( ( hedge != NULL && hedge->sock > conn->sock ) ? hedge->sock+1 : conn->sock+1,
+				&readEvent, NULL, NULL, ( until != 0 ) ? &wait : NULL );
+	} while ( ret == -1 && errno == EINTR );
+
+	if ( ret == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_waitConnections:Failure to wait and select data [%s]", strerror(errno) );
+		return -1;
+	}
+	if ( ret == 0 )
+		return 0;
+
+	return ( FD_ISSET ( conn->sock, &readEvent ) ? 1 : 2 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : timeRead
+// Description  : Keeps the time a read took to be answered, and every
+//                SMSA_HEDGE_UPDATE reads works out again how long a read
+//                waits before it is hedged, from the latest SMSA_HEDGE_SAMPLES
+//
+// Inputs       : usec - the time the read took
+// Outputs      : none
+
+void timeRead ( uint64_t usec ) {
+
+        uint32_t sorted[SMSA_HEDGE_SAMPLES];   //the latest times, in order
+        uint32_t samples;
+
+
+	pthread_mutex_lock ( &hedgeLock );
+	readLatency[readsTimed % SMSA_HEDGE_SAMPLES] = ( usec > UINT32_MAX ) ? UINT32_MAX : usec;
+	readsTimed++;
+
+	if ( readsTimed % SMSA_HEDGE_UPDATE == 0 ) {
+		samples = ( readsTimed < SMSA_HEDGE_SAMPLES ) ? readsTimed : SMSA_HEDGE_SAMPLES;
+		memcpy ( sorted, readLatency, samples*sizeof(uint32_t) );
+		qsort ( sorted, samples, sizeof(uint32_t), compareLatency );
+		hedgeDelay = sorted[samples*SMSA_HEDGE_PERCENTILE/100];
+		if ( hedgeDelay == 0 )
+			hedgeDelay = 1;
+	}
+	pthread_mutex_unlock ( &hedgeLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : compareLatency
+// Description  : Orders two read times for qsort
+//
+// Inputs       : a, b - the times
+// Outputs      : less than, equal to, or greater than 0 as a is to b
+
+int compareLatency ( const void *a, const void *b ) {
+
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return ( ( x > y ) - ( x < y ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drainConnection
+// Description  : Reads frames off a connection until the response to the
+//                request that was abandoned on it is in, and drops it. The
+//                invalidations that come in with it are taken.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, 1 if failure
+
+int drainConnection ( SMSA_CLIENT_CONNECTION *conn ) {
+
+        SMSA_FRAME frame;
+
+
+	while ( conn->abandoned != 0 ) {
+		if ( readFrame ( conn, &frame ) )
+			return 1;
+		if ( takeInvalidation ( conn, &frame ) )
+			continue;
+		if ( frame.id != conn->abandoned ) {
+			logMessage ( LOG_ERROR_LEVEL, "_drainConnection:Response [%u] while waiting for [%u]", frame.id, conn->abandoned );
+			return 1;
+		}
+		conn->abandoned = 0;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : socketTransfer
+// Description  : Sends the request in sendBuffer with plain system calls, and
+//                reads its response into recvBuffer, see readFrame
+//
+// Inputs       : conn - the connection
+//                sendLen - the length of the request
+//                response - will hold the header of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int socketTransfer ( SMSA_CLIENT_CONNECTION *conn, uint32_t sendLen, SMSA_FRAME *response ) {
+
+        //send a request
+	logMessage( LOG_INFO_LEVEL, "Sending %d bytes on handle %d", sendLen, conn->sock );
+        if ( sendBytes ( conn->sock, sendLen, conn->sendBuffer ) ) {
+        	logMessage ( LOG_ERROR_LEVEL, "_socketTransfer:Failed to send a request" );
+                return 1;
+        }
+
+	logMessage ( LOG_INFO_LEVEL, "Packet Sent to the Server" );
+ 
+       	//Wait for response to come in, until the deadline
+       	if ( selectData ( conn->sock, conn->deadline ) ) {
+       		logMessage ( LOG_ERROR_LEVEL, "_socketTransfer:Failed to select data" );
+                return 1;
+       	}
+
+	logMessage( LOG_INFO_LEVEL, "Selected Data Sent From the Server. Processing Now..." );
+
+	//Invalidations the server sent ahead of the response are taken on the way
+	do {
+		if ( readFrame ( conn, response ) ) {
+			logMessage( LOG_ERROR_LEVEL, "_socketTransfer:Failed to read the response" );
+			return 1;
+		}
+	} while ( takeInvalidation ( conn, response ) );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readFrame
+// Description  : Reads the next frame off a connection into recvBuffer, the
+//                header first, which says how much more there is to read. The
+//                server has until the deadline of the connection to send it.
+//
+// Inputs       : conn - the connection
+//                frame - will hold the header of the frame
+// Outputs      : 0 if successful, 1 if failure
+
+int readFrame ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *frame ) {
+
+        uint32_t header = smsa_frame_header_size ( conn->version );
+
+	if ( readBytes ( conn->sock, header, conn->recvBuffer, conn->deadline ) ) {
+		logMessage( LOG_ERROR_LEVEL, "_readFrame:Failed to read the frame header" );
+		return 1;
+	}
+	if ( smsa_unpack_frame ( conn->version, conn->recvBuffer, frame ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_readFrame:Bad frame length [%u]", frame->len );
+		return 1;
+	}
+
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Packet Header Successfully Processed, len [%d], op [%d], ret [%d]", frame->len, frame->op, frame->ret );
+
+	if ( frame->len > header && readBytes ( conn->sock, frame->len-header, &conn->recvBuffer[header], conn->deadline ) ) {
+		logMessage( LOG_ERROR_LEVEL, "_readFrame:Failed to read the frame payload" );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupUring
+// Description  : Sets up a ring for the connection, and registers the packet
+//                buffers with it, so the kernel pins them once instead of on
+//                every request
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, 1 if failure
+
+int setupUring ( SMSA_CLIENT_CONNECTION *conn ) {
+
+        struct iovec iov[2];    //the buffers to register
+
+	if ( smsa_uring_init ( &conn->ring, 4 ) )
+		return 1;
+
+	iov[0].iov_base = conn->sendBuffer;
+	iov[0].iov_len = sizeof(conn->sendBuffer);
+	iov[1].iov_base = conn->recvBuffer;
+	iov[1].iov_len = sizeof(conn->recvBuffer);
+	if ( smsa_uring_register_buffers ( &conn->ring, iov, 2 ) ) {
+		smsa_uring_close ( &conn->ring );
+		return 1;
+	}
+
+	conn->uring = 1;
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uringTransfer
+// Description  : Sends the request in sendBuffer and reads its response into
+//                recvBuffer with io_uring. The write of the request and the read
+//                of the response are linked and submitted together, so one
+//                system call sends the request and waits for the response. Only
+//                if the response comes in pieces are more reads needed. With
+//                invalidations, the reads can take frames the server sent before
+//                or after the response too, and those are taken out of the way.
+//                Every read is linked to a timeout at the deadline of the
+//                connection, which cancels it if the server has not answered.
+//
+// Inputs       : conn - the connection
+//                sendLen - the length of the request
+//                response - will hold the header of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int uringTransfer ( SMSA_CLIENT_CONNECTION *conn, uint32_t sendLen, SMSA_FRAME *response ) {
+
+        struct io_uring_sqe *sqe;          //entry for the write or a read
+        struct io_uring_cqe *cqe;          //completion of the write or a read
+        uint32_t header = smsa_frame_header_size ( conn->version );
+        uint32_t len = 0;                  //length of the response ( 0 until its header is in )
+        uint32_t got = 0;                  //bytes of the response read so far
+        uint32_t index;                    //start of a frame read after the response
+        unsigned char tail[SMSA_NET_V2_HEADER_SIZE];  //a frame after the response, put together
+        SMSA_FRAME frame;                  //header of a frame after the response
+        struct __kernel_timespec wait;     //how long a read has until the deadline
+        uint64_t now;
+        int waiting;                       //completions we are waiting for
+        int res;
+
+
+	//The write, linked to the read that takes the response
+	sqe = smsa_uring_sqe ( &conn->ring );
+	sqe->opcode = IORING_OP_WRITE_FIXED;
+	sqe->fd = conn->sock;
+	sqe->addr = (uint64_t)(uintptr_t)conn->sendBuffer;
+	sqe->len = sendLen;
+	sqe->buf_index = 0;
+	sqe->flags = IOSQE_IO_LINK;
+	sqe->user_data = 0;
+	waiting = 1;
+
+	//Keep reading until the whole response is in. The server sends one
+	//response per request, so only invalidations can come after it
+	while ( len == 0 || got < len ) {
+
+		sqe = smsa_uring_sqe ( &conn->ring );
+		sqe->opcode = IORING_OP_READ_FIXED;
+		sqe->fd = conn->sock;
+		sqe->addr = (uint64_t)(uintptr_t)&conn->recvBuffer[got];
+		sqe->len = ( ( len == 0 ) ? sizeof(conn->recvBuffer) : len ) - got;
+		sqe->buf_index = 1;
+		sqe->user_data = 1;
+		waiting++;
+
+		if ( conn->deadline != 0 ) {
+			now = clientClock ();
+			now = ( conn->deadline > now ) ? conn->deadline-now : 0;
+			wait.tv_sec = now / 1000000;
+			wait.tv_nsec = ( now % 1000000 ) * 1000;
+			sqe->flags |= IOSQE_IO_LINK;
+			sqe = smsa_uring_sqe ( &conn->ring );
+			sqe->opcode = IORING_OP_LINK_TIMEOUT;
+			sqe->addr = (uint64_t)(uintptr_t)&wait;
+			sqe->len = 1;
+			sqe->user_data = 2;
+			waiting++;
+		}
+
+		if ( smsa_uring_submit ( &conn->ring, waiting ) == -1 && errno != EINTR )
+			return 1;
+
+		//reap the completions, the write first if it was in this submit
+		while ( waiting > 0 ) {
+			if ( ( cqe = smsa_uring_peek ( &conn->ring ) ) == NULL ) {
+				if ( smsa_uring_submit ( &conn->ring, waiting ) == -1 && errno != EINTR )
+					return 1;
+				continue;
+			}
+			res = cqe->res;
+			if ( cqe->user_data == 0 && res != sendLen ) {
+				logMessage ( LOG_ERROR_LEVEL, "_uringTransfer:Failed to send a request [%s]", ( res < 0 ) ? strerror(-res) : "short write" );
+				smsa_uring_seen ( &conn->ring );
+				return 1;
+			}
+			if ( cqe->user_data == 1 ) {
+				if ( res == -ECANCELED ) {
+					logMessage ( LOG_ERROR_LEVEL, "_uringTransfer:Timed out waiting for the response" );
+					smsa_uring_seen ( &conn->ring );
+					return 1;
+				}
+				if ( res <= 0 ) {
+					logMessage ( LOG_ERROR_LEVEL, "_uringTransfer:Failed to read the response [%s]", ( res < 0 ) ? strerror(-res) : "File was closed" );
+					smsa_uring_seen ( &conn->ring );
+					return 1;
+				}
+				got += res;
+			}
+			smsa_uring_seen ( &conn->ring );
+			waiting--;
+		}
+
+		//once the header is in we know how long the response is. The
+		//invalidations ahead of it are taken first
+		while ( len == 0 && got >= header ) {
+			if ( smsa_unpack_frame ( conn->version, conn->recvBuffer, response ) ) {
+				logMessage ( LOG_ERROR_LEVEL, "_uringTransfer:Bad response length [%u]", response->len );
+				return 1;
+			}
+			if ( takeInvalidation ( conn, response ) ) {
+				memmove ( conn->recvBuffer, &conn->recvBuffer[header], got-header );
+				got -= header;
+			}
+			else
+				len = response->len;
+		}
+	}
+
+	//Take the invalidations that came in behind the response, reading the
+	//rest of one that only came in part of the way
+	for ( index = len; index < got; index += header ) {
+		memcpy ( tail, &conn->recvBuffer[index], ( got-index < header ) ? got-index : header );
+		if ( got-index < header && readBytes ( conn->sock, header-(got-index), &tail[got-index], conn->deadline ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_uringTransfer:Failed to read a frame after the response" );
+			return 1;
+		}
+		if ( smsa_unpack_frame ( conn->version, tail, &frame ) || !takeInvalidation ( conn, &frame ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_uringTransfer:Unexpected frame [%x] after the response", frame.op );
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeInvalidation
+// Description  : Hands a frame to the invalidate handler, if it is an
+//                SMSA_NET_INVALIDATE the server sent on its own. Only a
+//                connection that asked for them can get one, and it is always
+//                just a header.
+//
+// Inputs       : conn - the connection the frame came in on
+//                frame - the header of the frame
+// Outputs      : 1 if it was an invalidation, 0 if not
+
+int takeInvalidation ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *frame ) {
+
+	if ( !( conn->features & SMSA_NET_FLAG_INVALIDATE ) || SMSA_OPCODE(frame->op) != SMSA_NET_INVALIDATE ||
+			frame->id != 0 || frame->len != smsa_frame_header_size ( conn->version ) )
+		return 0;
+
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Invalidate drum [%u], blocks [%u] to [%u]", SMSA_DRUMID(frame->op), SMSA_BLOCKID(frame->op), SMSA_BLOCKID(frame->op)+frame->blocks );
+
+	if ( invalidateHandler != NULL )
+		invalidateHandler ( SMSA_DRUMID(frame->op), SMSA_BLOCKID(frame->op), ( frame->blocks > 0 ) ? frame->blocks : SMSA_MAX_BLOCK_ID );
+	return 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : invalidateConnection
+// Description  : Drops every block of the drums of a connection that is being
+//                closed, if it had invalidations. Its leases go with it, so
+//                nothing would say when they are written. A replica can have
+//                read any drum.
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void invalidateConnection ( SMSA_CLIENT_CONNECTION *conn ) {
+
+        SMSA_DRUM_ID drum;
+
+	if ( invalidateHandler == NULL || !( conn->features & SMSA_NET_FLAG_INVALIDATE ) )
+		return;
+
+	for ( drum = 0; drum < SMSA_DISK_ARRAY_SIZE; drum++ ) {
+		if ( conn->replica || shardMap[drum] == conn->index )
+			invalidateHandler ( drum, 0, SMSA_MAX_BLOCK_ID );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readBytes
+// Description  : Read a certain amount of bytes from the client. With a
+//                deadline, it only waits for them until then.
+//
+// Inputs       : server - socket file handle
+//                len - amount of bytes to read
+//                block - the read of the block
+//                deadline - clientClock time to give up at ( 0 for never )
+// Outputs      : 0 if successful, -1 if failure
+
+int readBytes ( int server, uint32_t len, unsigned char *block, uint64_t deadline ) {
+
+        int readBytes = 0;     //how many bytes have been read
+        int rb;                //current byte that has been read
+
+        //Run until all bytes have been read which is when the amount
+        //of bytes that have been read ( readBytes ) is no longer less then
+        //the amount of bytes total that need to be read ( len ).
+        while ( readBytes < len ) {
+
+                //Read byte into "block", at the "block" index of readBytes, from the socket ( server ). 
+                //The readBytes allows us to move across the "block" so that we don't read over stuff
+                //on the "block". rb will contain the amount of bytes that were able to be read. We wish for
+                //this to be the entire len variable, but it might not be ready for us to read the first time.
+                //This loop will allow us to continue reading until we have read the amount of bytes in len.
+                //With a deadline nothing is waited for here, and if nothing is
+                //in yet we wait for it until the deadline.
+                if ( (rb = recv( server, &block[readBytes], len-readBytes, ( deadline != 0 ) ? MSG_DONTWAIT : 0 )) < 0 ) {
+                        if ( deadline != 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+                                if ( selectData ( server, deadline ) )
+                                        return 1;
+                                continue;
+                        }
+                        logMessage( LOG_ERROR_LEVEL, "_readBytes:Failed to read a byte [%s]", strerror(errno) );
+                        return 1;
+                }
+                else if ( rb == 0 ) {
+                        //This means the file was closed
+                        logMessage( LOG_ERROR_LEVEL, "_readBytes:File was closed" );
+                        return 1;
+                }
+
+                //Increment the amount of Bytes that have been read ( readBytes ), by the amount
+                //of bytes that were just read in this iteration of the loop.
+                readBytes += rb;
+        }
+	
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Successfully Read [%d] Bytes", readBytes );
+
+        return 0;
+
+}
+
+
+
+//////////////////////////////////////////////////////////////////
+// Function     : sendBytes
+// Description  : Read a certain amount of bytes from the client
+//
+// Inputs       : server - socket file handle
+//                len - amount of bytes to read
+//                block - the read of the block
+// Outputs      : 0 if successful, -1 if failure
+
+int sendBytes ( int server, uint32_t len, unsigned char *buf ) {
+
+        int sentBytes = 0;      //Amount of bytes that have been sent
+        int sb;
+
+        //Run until all bytes ( len ) have been sent which is when the 
+        //amount of sentBytes no longer less than len
+        while ( sentBytes < len ) {
+
+                //Write bytes from buf onto the socket ( server ). It will attempt to write all 
+                //bytes ( len ), but might not be able to. So it will store the amount of bytes that
+                //were able to be sent into sb. MSG_NOSIGNAL turns a server that went away into an
+                //error we can reconnect from, instead of a SIGPIPE
+                if ( (sb = send( server, &buf[sentBytes], len-sentBytes, MSG_NOSIGNAL )) < 0 ) {
+                        logMessage( LOG_ERROR_LEVEL, "_sendBytes:Failed to write a byte [%s]", strerror(errno) );
+                        return 1;
+                }
+                else if ( sb == 0 ) {
+                        //This means the file was closed
+                        logMessage( LOG_ERROR_LEVEL, "_sendBytes:File was closed" );
+                        return 1;
+                }
+                //Increment the amount of Bytes that have been sent ( sentBytes ), by the amount of
+                //bytes that were able to be sent during this iteration of the loop ( sb ). 
+                sentBytes += sb;
+        }
+
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Successfully Sent [%d] Bytes", sentBytes );
+        return 0;
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : selectData
+// Description  : Waits for data and then selects of it to be processed
+//
+// Inputs       : int - server file handler
+//                deadline - clientClock time to give up at ( 0 for never )
+// Outputs      : 0 if successful, -1 if failure
+
+int selectData ( int sock, uint64_t deadline ) {
+
+        fd_set readEvent;
+        int maxSocketChecks = sock + 1;
+        struct timeval wait;    //how long there is left until the deadline
+        uint64_t now;
+        int ret;
+
+        do {
+                //Initialize and set the file descriptors
+                FD_ZERO( &readEvent );
+                FD_SET( sock, &readEvent );
+
+                if ( deadline != 0 ) {
+                        if ( ( now = clientClock () ) >= deadline ) {
+                                logMessage( LOG_ERROR_LEVEL, "_selectData:Timed out waiting for the server" );
+                                return 1;
+                        }
+                        wait.tv_sec = ( deadline-now ) / 1000000;
+                        wait.tv_usec = ( deadline-now ) % 1000000;
+                }
+
+                //select and wait
+                ret = select( maxSocketChecks, &readEvent, NULL, NULL, ( deadline != 0 ) ? &wait : NULL );
+        } while ( ret == -1 && errno == EINTR );
+
+        if ( ret == -1 ) {
+                logMessage( LOG_ERROR_LEVEL, "_selectData:Failure to wait and select data [%s]", strerror(errno) );
+                return 1;
+        }
+        if ( ret == 0 ) {
+                logMessage( LOG_ERROR_LEVEL, "_selectData:Timed out waiting for the server" );
+                return 1;
+        }
+
+        //make sure we are selected on the read
+        if ( FD_ISSET ( sock, &readEvent ) == 0 ) {
+                logMessage( LOG_ERROR_LEVEL, "_selectData:Failure to select on the read [%s]", strerror(errno) );
+                return 1;
+        }
+
+        return 0;
+
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_set_address
+// Description  : Sets the address and port of the server that the client will
+//                connect to on the next mount. Passing NULL or 0 leaves that
+//                value to the environment ( SMSA_ADDRESS_ENV / SMSA_PORT_ENV ),
+//                or to the defaults if the environment does not set it either.
+//
+// Inputs       : ip - host name or IPv4/IPv6 address of the server
+//                port - port number of the server
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_set_address ( char *ip, uint16_t port ) {
+
+	//free any address that was set by a previous call
+	free ( serverIP );
+	serverIP = NULL;
+
+	//keep our own copy, since the caller might reuse its buffer
+	if ( ip != NULL && ( serverIP = strdup ( ip ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_set_address:Failed to copy the address [%s]", strerror(errno) );
+		return -1;
+	}
+	serverPort = port;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_set_transport
+// Description  : Sets how the client talks to the server, starting with the next
+//                mount. SMSA_TRANSPORT_DEFAULT leaves it to the environment
+//                ( SMSA_TRANSPORT_ENV ).
+//
+// Inputs       : transport - the transport to use
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_set_transport ( SMSA_TRANSPORT transport ) {
 
+	clientTransport = transport;
+	return 0;
+}
 
-        int blkSize = SMSA_BLOCK_SIZE;     //number of bytes ia block
-        int16_t ret;                       //
 
 
-	//If we recieve a MOUNT command, then a connection needs to be established with
-	//the server, so that we may send the disk commands
-	if ( SMSA_OPCODE(op) == SMSA_MOUNT ) {
-        	if ( setupConnection ( &sock ) ) {
-                	logMessage ( LOG_ERROR_LEVEL, "_smsa_client_operation:Failed to properly set up the connection" );
-                	return 1;
-		}
-		logMessage ( LOG_INFO_LEVEL, "Socket Successfully initialized. Socket File Handle [%d]", sock );
-        }
-	
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getClientTransport
+// Description  : Decides which transport to use. A transport set through
+//                smsa_client_set_transport wins, then the environment, and
+//                otherwise plain sockets
+//
+// Inputs       : none
+// Outputs      : the transport
 
-        //send a request
-        if ( sendPacket( sock, op, 0, (SMSA_OPCODE(op) == SMSA_DISK_WRITE) ? block: NULL ) == -1) {
-        	logMessage ( LOG_ERROR_LEVEL, "_smsa_client_operation:Failed to send a request" );
-                return 1;
-        }
+SMSA_TRANSPORT getClientTransport ( void ) {
 
-	logMessage ( LOG_INFO_LEVEL, "Packet Sent to the Server" );
- 
-       	//Wait for response to come in
-       	if ( selectData ( sock ) ) {
-       		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to select data [%s]", strerror(errno) );
-                return 1;
-       	}
+	char *env;	//value of the environment variable
 
-	logMessage( LOG_INFO_LEVEL, "Selected Data Sent From the Server. Processing Now..." );
+	if ( clientTransport != SMSA_TRANSPORT_DEFAULT )
+		return clientTransport;
+	if ( ( env = getenv ( SMSA_TRANSPORT_ENV ) ) != NULL && strcmp ( env, "uring" ) == 0 )
+		return SMSA_TRANSPORT_URING;
 
-       	//recieve data and process the packet
-       	if ( recievePacket( sock, &op, &ret, &blkSize, block ) == 1 ) {
-       		logMessage( LOG_ERROR_LEVEL, "_smsa_server:Failed to properly recieve a packet" );
-                return 1;
-       	}
+	return SMSA_TRANSPORT_SOCKETS;
+}
 
-	logMessage ( LOG_INFO_LEVEL, "Packet Successfully Processed" );
-       
-	
-	//If the incoming command was an unmount command, then the disk, by now, has
-	//been unmounted and will not be used again until mount is recieved. This means
-	//that it is ok to close down the connection with the server	
-	if ( SMSA_OPCODE(op) == SMSA_UNMOUNT ) {
-		close( sock );
-		logMessage ( LOG_INFO_LEVEL, "Sending UNMOUNT Command. Closing Connection with the Server");
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_set_connections
+// Description  : Sets how many connections the client spreads the drums over,
+//                starting with the next mount. 0 leaves it to the environment
+//                ( SMSA_CONNECTIONS_ENV ).
+//
+// Inputs       : connections - the number of connections, up to SMSA_MAX_CONNECTIONS
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_client_set_connections ( int connections ) {
+
+	if ( connections < 0 || connections > SMSA_MAX_CONNECTIONS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_set_connections:Bad number of connections [%d]", connections );
+		return -1;
 	}
- 	
 
-       	return 0;
+	clientConnections = connections;
+	return 0;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : recievePacket
-// Description  : Recieve a packet from the client
+// Function     : getClientConnections
+// Description  : Decides how many connections to make. A number set through
+//                smsa_client_set_connections wins, then the environment, and
+//                otherwise one
 //
-// Inputs       : server - socket file handle
-//                op - opcode for smsa_operation
-//                ret - return of smsa_operation
-//                blkSize - num of bytes to read into the block
-//                block - the read of the block
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : none
+// Outputs      : the number of connections
 
-int recievePacket ( int server, uint32_t *op, int16_t *ret, int *blkSize, unsigned char *block ) {
-	
-        uint32_t len;
-        uint32_t headerIndex = 0;
-        int twoBytes = sizeof ( uint16_t );
-        unsigned char header[SMSA_NET_HEADER_SIZE];
-
-    	// SMSA Packet definition
-    	//
-    	//  Bytes 0-1   : length - how many total bytes in packet
-    	//  Bytes 2-6   : opcode - the opcode for the command
-    	//  Bytes 7-8   : return - return code of comamnd 
-    	//  Bytes 6-261 : block - as needed, SMSA_BLOCK
-    	//
-
-    	//Read the packet into header
-    	if ( readBytes ( server, SMSA_NET_HEADER_SIZE, header ) == -1 ) {
-                logMessage( LOG_ERROR_LEVEL, "_recievePacket:Failure to read bytes properly [%s]", strerror(errno) );
-                return 1;
-    	}
+int getClientConnections ( void ) {
 
+	char *env;	//value of the environment variable
+	int connections;
 
-    	//Put data into host byte order
-    	//The first two bytes that have been placed in header is the length
-    	//of the entire packet. The next 4 bytes is the opcode of the command
-    	//to be used on the smsa_operation function ( size of uint32_t ). The
-    	//following two bytes hold the return of the command. All of the remaining
-    	//bytes ( len - index ), are the block ( 255 bytes ), and will be read into the block
-    	memcpy( &len, header, twoBytes );           //LENGTH
-    	headerIndex += twoBytes;
+	if ( clientConnections != 0 )
+		return clientConnections;
+	if ( ( env = getenv ( SMSA_CONNECTIONS_ENV ) ) != NULL && *env != '\0' ) {
+		if ( sscanf ( env, "%d", &connections ) == 1 && connections > 0 && connections <= SMSA_MAX_CONNECTIONS )
+			return connections;
+		logMessage ( LOG_WARNING_LEVEL, "Bad number of connections in %s [%s], using one", SMSA_CONNECTIONS_ENV, env );
+	}
 
-    	len = ntohs ( len );  //host byte order
+	return 1;
+}
 
-    	memcpy( op, &header[headerIndex], 2*twoBytes );       //OPCODE
-    	headerIndex += 2*twoBytes;
 
-    	*op = ntohl ( *op ); //host byte order
 
-    	memcpy( ret, &header[headerIndex], twoBytes );       //RETURN
-    	headerIndex += twoBytes;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_set_protocol
+// Description  : Sets the highest protocol version the client asks for, and the
+//                SMSA_NET_FLAGS it would like to use, starting with the next
+//                mount. A version of 0 leaves it to the environment
+//                ( SMSA_PROTOCOL_ENV ).
+//
+// Inputs       : version - the highest version, up to SMSA_NET_VERSION
+//                flags - the SMSA_NET_FLAGS to ask for
+// Outputs      : 0 if successful, -1 if failure
 
-    	*ret = ntohs ( *ret ); //host byte order
+int smsa_client_set_protocol ( int version, uint16_t flags ) {
 
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Packet Header Successfully Processed, len [%d], op [%d], ret [%d]", len, *op, *ret );
-	
-	//check return and make sure it is not an invalid return
-	if ( *ret == 1 ) {
-		logMessage ( LOG_INFO_LEVEL, "_readPacket:Return value is an error value" );
-		return 1;
+	if ( version < 0 || version > SMSA_NET_VERSION ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_set_protocol:Bad protocol version [%d]", version );
+		return -1;
 	}
-		
 
-    	//check to see if there is more data to read
-	if ( len > SMSA_NET_HEADER_SIZE ) {
+	clientProtocol = version;
+	clientFeatures = flags & ( SMSA_NET_FLAG_CHECKSUM | SMSA_NET_FLAG_COMPRESSED );
+	return 0;
+}
+
+
 
-		if ( DEBUG )
-			logMessage ( LOG_INFO_LEVEL, "Packet Contains Block. Reading Now..");
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getClientProtocol
+// Description  : Decides the highest protocol version to ask for. A version set
+//                through smsa_client_set_protocol wins, then the environment, and
+//                otherwise SMSA_NET_VERSION
+//
+// Inputs       : none
+// Outputs      : the version
 
-        	//Call readBytes to read the Length of the packet ( len ) minus the 
-        	//size of the packet header ( SMSA_NET_HEADER_SIZE ), which is in fact
-        	//reading the block portion of the packet 
-        	if ( readBytes( server, len-SMSA_NET_HEADER_SIZE, block ) == -1 ) {
-          		logMessage( LOG_ERROR_LEVEL, "_recievePacket:Failed to read bytes [%s]", strerror(errno) );
-                	return 1;
-    		}
-        	//Adjust the blkSize for the use of other functions. The blockSize, in bytes, 
-        	//is the length of the packet minus the packet header. The only reason that we 
-        	//are not hard coding 255 here is because we might in the future want to use a 
-        	//different SMSA_BLOCK_SIZE
-        	*blkSize = len-SMSA_NET_HEADER_SIZE;
-    	}
-    	else
-        	*blkSize = 0;  //No block in this packet.
+int getClientProtocol ( void ) {
 
+	char *env;	//value of the environment variable
+	int version;
 
-    	logMessage( LOG_INFO_LEVEL, "Received %d bytes on handle %d", len, server );
-    	return 0;
+	if ( clientProtocol != 0 )
+		return clientProtocol;
+	if ( ( env = getenv ( SMSA_PROTOCOL_ENV ) ) != NULL && sscanf ( env, "%d", &version ) == 1 &&
+			version >= 1 && version <= SMSA_NET_VERSION )
+		return version;
 
+	return SMSA_NET_VERSION;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : readBytes
-// Description  : Read a certain amount of bytes from the client
+// Function     : smsa_client_set_shards
+// Description  : Sets the shard map of a cluster, the servers the drums are
+//                spread over, starting with the next mount ( see setupShards ).
+//                NULL leaves it to the environment ( SMSA_SHARDS_ENV ), and
+//                without one the whole array is on one server.
 //
-// Inputs       : server - socket file handle
-//                len - amount of bytes to read
-//                block - the read of the block
+// Inputs       : shards - the shard map
 // Outputs      : 0 if successful, -1 if failure
 
-int readBytes ( int server, uint32_t len, unsigned char *block ) {
+int smsa_client_set_shards ( char *shards ) {
 
-        int readBytes = 0;     //how many bytes have been read
-        int rb;                //current byte that has been read
+	//free any shard map that was set by a previous call
+	free ( clientShards );
+	clientShards = NULL;
 
-        //Run until all bytes have been read which is when the amount
-        //of bytes that have been read ( readBytes ) is no longer less then
-        //the amount of bytes total that need to be read ( len ).
-        while ( readBytes < len ) {
+	//keep our own copy, since the caller might reuse its buffer
+	if ( shards != NULL && ( clientShards = strdup ( shards ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_set_shards:Failed to copy the shard map [%s]", strerror(errno) );
+		return -1;
+	}
 
-                //Read byte into "block", at the "block" index of readBytes, from the socket ( server ). 
-                //The readBytes allows us to move across the "block" so that we don't read over stuff
-                //on the "block". rb will contain the amount of bytes that were able to be read. We wish for
-                //this to be the entire len variable, but it might not be ready for us to read the first time.
-                //This loop will allow us to continue reading until we have read the amount of bytes in len.
-                if ( (rb = read( server, &block[readBytes], len-readBytes )) < 0 ) {
-                        logMessage( LOG_ERROR_LEVEL, "_readBytes:Failed to read a byte [%s]", strerror(errno) );
-                        return 1;
-                }
-                else if ( rb == 0 ) {
-                        //This means the file was closed
-                        logMessage( LOG_ERROR_LEVEL, "_readBytes:File was closed" );
-                        return 1;
-                }
+	return 0;
+}
 
-                //Increment the amount of Bytes that have been read ( readBytes ), by the amount
-                //of bytes that were just read in this iteration of the loop.
-                readBytes =+ rb;
-        }
-	
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Successfully Read [%d] Bytes", readBytes );
 
-        return 0;
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_client_move_drum
+// Description  : Moves a drum to another server of the cluster while the array
+//                is mounted. Both servers fence the drum first, so every write
+//                the old one took is done before its blocks are copied to the
+//                new one, and the operations other clients send on it fail with
+//                SMSA_NET_MOVED until it is moved. Then the old server sends
+//                them to the new one, which takes the drum, and the operations
+//                of this client go there too ( see smsa_network.h ).
+//
+//                Nothing else in this client can use the drum while it is
+//                copied. Operations at the heads wait on the session heads, and
+//                the rest on the connections of the two servers, then look the
+//                drum up again. If the copy fails, the drum stays where it was.
+//
+// Inputs       : drum - the drum
+//                server - the server it goes to, by its place in the shard map
+// Outputs      : 0 if successful, 1 if failure
+
+int smsa_client_move_drum ( SMSA_DRUM_ID drum, int server ) {
+
+        SMSA_CLIENT_CONNECTION *from, *to;    //the servers the drum moves from and to
+        unsigned char *blocks;                //blocks being copied
+        uint32_t block;                       //first block being copied
+        uint16_t count;                       //number of blocks being copied
+        int16_t ret;
+        int err = 0;
+
+
+	if ( !sharded || drum >= SMSA_DISK_ARRAY_SIZE || server < 0 || server >= poolSize ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_move_drum:Can not move drum [%u] to server [%d]", drum, server );
+		return 1;
+	}
+
+	pthread_mutex_lock ( &headLock );
+	from = &pool[shardMap[drum]];
+	to = &pool[server];
+	if ( from == to ) {
+		pthread_mutex_unlock ( &headLock );
+		return 0;
+	}
+
+	if ( ( blocks = malloc ( SMSA_NET_MAX_BLOCKS*SMSA_BLOCK_SIZE ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_move_drum:Failed to allocate the blocks to copy [%s]", strerror(errno) );
+		pthread_mutex_unlock ( &headLock );
+		return 1;
+	}
+
+	//Take the locks of the connections in the order of the pool, so two moves
+	//never wait on each other
+	pthread_mutex_lock ( ( from->index < to->index ) ? &from->lock : &to->lock );
+	pthread_mutex_lock ( ( from->index < to->index ) ? &to->lock : &from->lock );
+
+	err = moveOperation ( from, drum, SMSA_NET_MOVE_FENCE, NULL ) || moveOperation ( to, drum, SMSA_NET_MOVE_FENCE, NULL );
+
+	for ( block = 0; block < SMSA_MAX_BLOCK_ID && err == 0; block += count ) {
+		count = ( SMSA_MAX_BLOCK_ID-block < SMSA_NET_MAX_BLOCKS ) ? SMSA_MAX_BLOCK_ID-block : SMSA_NET_MAX_BLOCKS;
+		err = poolOperation ( from, SMSA_NET_OPERATION ( SMSA_NET_READ_AT, drum, block ), &ret, blocks, count ) || ret != 0 ||
+			poolOperation ( to, SMSA_NET_OPERATION ( SMSA_NET_WRITE_AT, drum, block ), &ret, blocks, count ) || ret != 0;
+	}
+
+	//The old server sends the others to the new one, which has them wait
+	//until it takes the drum
+	if ( err == 0 ) {
+		memset ( blocks, 0, SMSA_BLOCK_SIZE );
+		snprintf ( (char *)blocks, SMSA_BLOCK_SIZE, ( strchr ( to->host, ':' ) != NULL ) ? "[%s]:%u" : "%s:%u", to->host, to->port );
+		err = moveOperation ( from, drum, SMSA_NET_MOVE_OUT, blocks ) || moveOperation ( to, drum, SMSA_NET_MOVE_IN, NULL );
+	}
+
+	if ( err == 0 ) {
+		shardMap[drum] = server;
+		drumMoves++;
+
+		//the leases on the cached blocks of the drum stay with the old
+		//server, which will not hear about the writes any more
+		if ( invalidateHandler != NULL && ( from->features & SMSA_NET_FLAG_INVALIDATE ) )
+			invalidateHandler ( drum, 0, SMSA_MAX_BLOCK_ID );
+		logMessage ( LOG_INFO_LEVEL, "Moved drum [%u] from [%s/%u] to [%s/%u]", drum, from->host, from->port, to->host, to->port );
+	}
+	else {
+		moveOperation ( from, drum, SMSA_NET_MOVE_ABORT, NULL );
+		moveOperation ( to, drum, SMSA_NET_MOVE_ABORT, NULL );
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_move_drum:Failed to move drum [%u] to [%s/%u]", drum, to->host, to->port );
+	}
+
+	pthread_mutex_unlock ( &to->lock );
+	pthread_mutex_unlock ( &from->lock );
+	pthread_mutex_unlock ( &headLock );
+	free ( blocks );
+
+	return err;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sendPacket
-// Description  : Send a packet to the client
+// Function     : moveOperation
+// Description  : Sends an SMSA_NET_MOVE_DRUM for a drum over a connection of the
+//                pool. The caller holds the lock of the connection.
 //
-// Inputs       : server - socket file handle
-//                op - opcode for smsa_operation
-//                ret - return of smsa_operation
-//                blkSize - num of bytes to read into the block
-//                block - the read of the block
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : conn - the connection
+//                drum - the drum
+//                phase - what the server is to do with it
+//                home - the host:port it moves to, in a block ( OUT, NULL otherwise )
+// Outputs      : 0 if successful, 1 if failure
 
-int sendPacket ( int server, uint32_t op, int16_t ret, unsigned char *block ) {
-
-        uint32_t len;
-        uint32_t bufIndex = 0;
-        int twoBytes = sizeof ( uint16_t );
-        unsigned char buf[SMSA_NET_HEADER_SIZE + SMSA_BLOCK_SIZE];
-
-    // SMSA Packet definition
-    //
-    //  Bytes 0-1   : length - how many total bytes in packet
-    //  Bytes 2-6   : opcode - the opcode for the command
-    //  Bytes 7-8   : return - return code of comamnd 
-    //  Bytes 6-261 : block - as needed, SMSA_BLOCK
-    //
-
-    //Set the size of the packet. Which is the size of the packet header. Unless
-    //there is a block to be read, then it is the size of a packet header plus
-    //size of the block.
-    len = SMSA_NET_HEADER_SIZE;
-    if ( block != NULL ) {
-        len += SMSA_BLOCK_SIZE;
-    }
+int moveOperation ( SMSA_CLIENT_CONNECTION *conn, SMSA_DRUM_ID drum, SMSA_NET_MOVE_PHASE phase, unsigned char *home ) {
+
+        int16_t ret;
+
+	if ( poolOperation ( conn, SMSA_NET_OPERATION ( SMSA_NET_MOVE_DRUM, drum, phase ), &ret, home, ( home != NULL ) ? 1 : 0 ) || ret != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_moveOperation:[%s/%u] failed phase [%d] of the move of drum [%u]", conn->host, conn->port, phase, drum );
+		return 1;
+	}
+
+	return 0;
+}
 
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Putting Together Packet to be Sent of [%d] Bytes", len );
 
-    //Put in network byte config
-    len = htons(len);
-    op = htonl(op);
-    ret = htons(ret);
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : findDrum
+// Description  : Asks the server of a connection where a drum it failed an
+//                operation on with SMSA_NET_MOVED went, and points the shard map
+//                at that server. The leases on the cached blocks of the drum
+//                stay with the old server, so they are dropped. The caller holds
+//                the lock of the connection.
+//
+// Inputs       : conn - the connection
+//                drum - the drum
+// Outputs      : 0 if the map points where it went, 1 if it is still being
+//                moved, -1 if failure
 
-    //Put together a packet
-    memcpy( &buf[bufIndex], &len, sizeof( len ) );      //LENGTH
-    bufIndex += twoBytes;
+int findDrum ( SMSA_CLIENT_CONNECTION *conn, SMSA_DRUM_ID drum ) {
 
-    memcpy( &buf[bufIndex], &op, sizeof( op ) );        //OPCODE        
-    bufIndex += 2*twoBytes;
+        unsigned char home[SMSA_MAX_BLOCK_SIZE];  //host:port of the server the drum went to
+        char host[NI_MAXHOST];                    //its host
+        uint16_t port;                            //its port
+        int16_t ret;
+        int i;
 
-    memcpy( &buf[bufIndex], &ret, sizeof( ret) );       //RETURN
-    bufIndex += twoBytes;
 
-    //If this is a read, add the block to the packet
-    if ( block != NULL ) {
-        memcpy( &buf[bufIndex], block, SMSA_BLOCK_SIZE );
-        bufIndex += SMSA_BLOCK_SIZE;    //incrememnt the index the size of the block we just added to the packet
-    }
+	if ( poolOperation ( conn, SMSA_NET_OPERATION ( SMSA_NET_DRUM_HOME, drum, 0 ), &ret, home, 1 ) || ret != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_findDrum:Failed to ask [%s/%u] where drum [%u] went", conn->host, conn->port, drum );
+		return -1;
+	}
+	home[SMSA_BLOCK_SIZE-1] = '\0';
+	if ( home[0] == '\0' )
+		return 1;
 
-    //call sendBytes to send the packet we have just constructed to the 
-    //client over our socket ( server ).
-    logMessage( LOG_INFO_LEVEL, "Sending %d bytes on handle %d", bufIndex, server );
-    return( sendBytes( server, bufIndex, buf) );
+	if ( smsa_parse_address ( (char *)home, host, sizeof(host), &port ) == 0 ) {
+		for ( i = 0; i < poolSize; i++ ) {
+			if ( pool[i].port != port || strcmp ( pool[i].host, host ) != 0 )
+				continue;
 
+			shardMap[drum] = i;
+			if ( invalidateHandler != NULL && ( conn->features & SMSA_NET_FLAG_INVALIDATE ) )
+				invalidateHandler ( drum, 0, SMSA_MAX_BLOCK_ID );
+			logMessage ( LOG_INFO_LEVEL, "Drum [%u] was moved from [%s/%u] to [%s/%u]", drum, conn->host, conn->port, host, port );
+			return 0;
+		}
+	}
 
+	logMessage ( LOG_ERROR_LEVEL, "_findDrum:Drum [%u] went to [%s], which is not in the shard map", drum, home );
+	return -1;
 }
 
-//////////////////////////////////////////////////////////////////
-// Function     : sendBytes
-// Description  : Read a certain amount of bytes from the client
+
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : server - socket file handle
-//                len - amount of bytes to read
-//                block - the read of the block
+// Function     : smsa_client_set_replicas
+// Description  : Sets the replicas the client spreads its reads over, starting
+//                with the next mount, and what the reads have to see. A replica
+//                is a follower of the server ( see smsa_network.h ), given as
+//                host:port, with a comma between them. NULL leaves the replicas
+//                to the environment ( SMSA_REPLICAS_ENV ), and
+//                SMSA_CONSISTENCY_DEFAULT the consistency ( SMSA_CONSISTENCY_ENV ).
+//
+// Inputs       : replicas - the replicas
+//                consistency - what a read from a replica has to see
 // Outputs      : 0 if successful, -1 if failure
 
-int sendBytes ( int server, uint32_t len, unsigned char *buf ) {
+int smsa_client_set_replicas ( char *replicas, SMSA_CONSISTENCY consistency ) {
 
-        int sentBytes = 0;      //Amount of bytes that have been sent
-        int sb;
+	//free any replicas that were set by a previous call
+	free ( clientReplicas );
+	clientReplicas = NULL;
 
-        //Run until all bytes ( len ) have been sent which is when the 
-        //amount of sentBytes no longer less than len
-        while ( sentBytes < len ) {
+	//keep our own copy, since the caller might reuse its buffer
+	if ( replicas != NULL && ( clientReplicas = strdup ( replicas ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_client_set_replicas:Failed to copy the replicas [%s]", strerror(errno) );
+		return -1;
+	}
+	clientConsistency = consistency;
 
-                //Write bytes from buf onto the socket ( server ). It will attempt to write all 
-                //bytes ( len ), but might not be able to. So it will store the amount of bytes that
-                //were able to be sent into sb.
-                if ( (sb = write( server, &buf[sentBytes], len-sentBytes )) < 0 ) {
-                        logMessage( LOG_ERROR_LEVEL, "_sendBytes:Failed to write a byte [%s]", strerror(errno) );
-                        return 1;
-                }
-                else if ( sb == 0 ) {
-                        //This means the file was closed
-                        logMessage( LOG_ERROR_LEVEL, "_sendBytes:File was closed" );
-                        return 1;
-                }
-                //Increment the amount of Bytes that have been sent ( sentBytes ), by the amount of
-                //bytes that were able to be sent during this iteration of the loop ( sb ). 
-                sentBytes =+ sb;
-        }
+	return 0;
+}
 
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Successfully Sent [%d] Bytes", sentBytes );
-        return 0;
 
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getClientConsistency
+// Description  : Decides what a read from a replica has to see. A consistency
+//                set through smsa_client_set_replicas wins, then the environment,
+//                and otherwise the writes of the client
+//
+// Inputs       : none
+// Outputs      : the consistency
+
+SMSA_CONSISTENCY getClientConsistency ( void ) {
+
+	char *env;	//value of the environment variable
+
+	if ( clientConsistency != SMSA_CONSISTENCY_DEFAULT )
+		return clientConsistency;
+	if ( ( env = getenv ( SMSA_CONSISTENCY_ENV ) ) != NULL && *env != '\0' ) {
+		if ( strcmp ( env, "leader" ) == 0 )
+			return SMSA_CONSISTENCY_LEADER;
+		if ( strcmp ( env, "session" ) == 0 )
+			return SMSA_CONSISTENCY_SESSION;
+		if ( strcmp ( env, "any" ) == 0 )
+			return SMSA_CONSISTENCY_ANY;
+		logMessage ( LOG_WARNING_LEVEL, "Bad consistency in %s [%s], reading our writes", SMSA_CONSISTENCY_ENV, env );
+	}
+
+	return SMSA_CONSISTENCY_SESSION;
 }
 
 
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : selectData
-// Description  : Waits for data and then selects of it to be processed
+// Function     : smsa_client_set_timeout
+// Description  : Sets how long the client waits for the server to answer a
+//                request, starting with the next mount, and if a slow read is
+//                sent again over another connection ( see hedgedRead ). A
+//                timeout of 0 leaves it to the environment ( SMSA_TIMEOUT_ENV ).
 //
-// Inputs       : int - server file handler
+// Inputs       : timeout - the msec to wait
+//                hedge - true to hedge slow reads
 // Outputs      : 0 if successful, -1 if failure
 
-int selectData ( int sock ) {
+int smsa_client_set_timeout ( uint32_t timeout, int hedge ) {
 
-        fd_set readEvent;
-        int maxSocketChecks = sock + 1;
+	clientTimeout = timeout;
+	clientHedge = hedge;
+	return 0;
+}
 
-        //Initialize and set the file descriptors
-        FD_ZERO( &readEvent );
-        FD_SET( sock, &readEvent );
 
-        //select and wait
-        if ( select( maxSocketChecks, &readEvent, NULL, NULL, NULL ) == -1 ) {
-                logMessage( LOG_ERROR_LEVEL, "_selectData:Failure to wait and select data [%s]", strerror(errno) );
-                return 1;
-        }
 
-        //make sure we are selected on the read
-        if ( FD_ISSET ( sock, &readEvent ) == 0 ) {
-                logMessage( LOG_ERROR_LEVEL, "_selectData:Failure to select on the read [%s]", strerror(errno) );
-                return 1;
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getClientTimeout
+// Description  : Decides how long to wait for a response. A timeout set through
+//                smsa_client_set_timeout wins, then the environment, where 0
+//                waits for ever, and otherwise SMSA_DEFAULT_TIMEOUT
+//
+// Inputs       : none
+// Outputs      : the msec to wait ( 0 for ever )
 
-        return 0;
+uint32_t getClientTimeout ( void ) {
+
+	char *env;	//value of the environment variable
+	uint32_t timeout;
+
+	if ( clientTimeout != 0 )
+		return clientTimeout;
+	if ( ( env = getenv ( SMSA_TIMEOUT_ENV ) ) != NULL && *env != '\0' ) {
+		if ( sscanf ( env, "%u", &timeout ) == 1 )
+			return timeout;
+		logMessage ( LOG_WARNING_LEVEL, "Bad timeout in %s [%s], using %u msec", SMSA_TIMEOUT_ENV, env, SMSA_DEFAULT_TIMEOUT );
+	}
 
+	return SMSA_DEFAULT_TIMEOUT;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : setUpServer
-// Description  : Sets up the server by creating the socket, binding it to the right addresss
-//                and starts the server listening. It then sets the server input equal to the
-//                socket file handler.
+// Function     : clientClock
+// Description  : Reads the clock deadlines are kept in, which only ever moves
+//                forward
 //
-// Inputs       : int - server file handler
+// Inputs       : none
+// Outputs      : the time in usec
+
+uint64_t clientClock ( void ) {
+
+	struct timespec now;
+
+	clock_gettime ( CLOCK_MONOTONIC, &now );
+	return ( (uint64_t)now.tv_sec*1000000 + now.tv_nsec/1000 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : clientDeadline
+// Description  : Works out when a request sent now has to be answered by
+//
+// Inputs       : none
+// Outputs      : the clientClock time, or 0 to wait for ever
+
+uint64_t clientDeadline ( void ) {
+
+	if ( responseTimeout == 0 )
+		return 0;
+
+	return ( clientClock () + (uint64_t)responseTimeout*1000 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getServerAddress
+// Description  : Decides which address and port to connect to. An address set
+//                through smsa_client_set_address wins, then the environment, and
+//                finally the SMSA_DEFAULT_IP and SMSA_DEFAULT_PORT defines
+//
+// Inputs       : ip - will point to the address to connect to
+//                port - will hold the port to connect to
+// Outputs      : 0 if successful, -1 if failure
+
+int getServerAddress ( char **ip, uint16_t *port ) {
+
+	char *env;               //value of an environment variable
+	unsigned int envPort;    //port parsed out of the environment
+
+
+	//find the address
+	if ( serverIP != NULL )
+		*ip = serverIP;
+	else if ( ( env = getenv ( SMSA_ADDRESS_ENV ) ) != NULL && *env != '\0' )
+		*ip = env;
+	else
+		*ip = SMSA_DEFAULT_IP;
+
+	//find the port, making sure that a port from the environment is sane
+	if ( serverPort != 0 )
+		*port = serverPort;
+	else if ( ( env = getenv ( SMSA_PORT_ENV ) ) != NULL && *env != '\0' ) {
+		if ( sscanf ( env, "%u", &envPort ) != 1 || envPort == 0 || envPort > 65535 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_getServerAddress:Bad port in %s [%s]", SMSA_PORT_ENV, env );
+			return -1;
+		}
+		*port = envPort;
+	}
+	else
+		*port = SMSA_DEFAULT_PORT;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setupConnection
+// Description  : Sets up the connection by resolving the server address, creating
+//                the socket and connecting it to the server. The address may be a
+//                host name, an IPv4 or an IPv6 address, every address it resolves
+//                to is tried in order until one of them connects.
+//
+// Inputs       : int - will hold the socket file handle
+//                ip - address of the server
+//                port - port of the server
 // Outputs      : 0 if successful, -1 if failure
 
-int setupConnection ( int *sock ) {
+int setupConnection ( int *sock, char *ip, uint16_t port ) {
+
 
+        struct addrinfo hints;             //what kind of addresses we want back
+        struct addrinfo *results, *addr;   //list of addresses the server resolved to
+        char portString[8];                //port as a string for getaddrinfo
+        struct timeval wait;               //most time a connect or send can take
+        int err;
 
-        struct sockaddr_in clientAddress;  //holds server addres
-	char *ip = "127.0.0.1";
 
+	snprintf ( portString, sizeof(portString), "%u", port );
 
-	//Set up teh client address settings
-	clientAddress.sin_family = AF_INET;
-	clientAddress.sin_port = htons(SMSA_DEFAULT_PORT);
-	if ( inet_aton ( ip, &clientAddress.sin_addr ) == 0 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setupConnection:Failed to map ip adderss to the clientAddress [%s]", strerror(errno) );
+	//Resolve the address. AF_UNSPEC lets the address be either IPv4 or IPv6
+	memset ( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ( ( err = getaddrinfo ( ip, portString, &hints, &results ) ) != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupConnection:Failed to resolve the server address [%s] [%s]", ip, gai_strerror(err) );
 		return 1;
 	}
  
-	logMessage ( LOG_INFO_LEVEL, "Successfully mapped clientAddress to Port [%d], ip [%s]", SMSA_DEFAULT_PORT, ip );
+	logMessage ( LOG_INFO_LEVEL, "Successfully resolved server address to Port [%d], ip [%s]", port, ip );
+
+	//Try each of the addresses until one connects
+	*sock = -1;
+	for ( addr = results; addr != NULL; addr = addr->ai_next ) {
+
+        	//Create the socket
+        	//Set up a socket using TCP protocol ( SOCK_STREAM ), and the address family 
+        	//that the address resolved to, while setting the sock variable to the file handle
+        	if ( ( *sock = socket ( addr->ai_family, addr->ai_socktype, addr->ai_protocol ) ) == -1 ) {
+                	logMessage( LOG_ERROR_LEVEL, "_setupConnection:Failed to set up the socket [%s]", strerror(errno) );
+                	continue;
+        	}
+
+		//A server that does not answer can hold up neither the connect nor
+		//a send for longer than a response would be waited for
+		if ( responseTimeout > 0 ) {
+			wait.tv_sec = responseTimeout / 1000;
+			wait.tv_usec = ( responseTimeout % 1000 ) * 1000;
+			setsockopt ( *sock, SOL_SOCKET, SO_SNDTIMEO, &wait, sizeof(wait) );
+		}
 
-        //Create the socket
-        //Set up a socket using TCP protocol ( SOCK_STREAM ), and the address family 
-        //version of inet, while setting the server variable to the file handle
-        if ( ( *sock = socket ( PF_INET, SOCK_STREAM, 0 ) ) == -1 ) {
-                logMessage( LOG_ERROR_LEVEL, "_setupConnection:Failed to set up the socket [%s}", strerror(errno) );
-                return 1;
-        }
+        	//Connect the socket to the server
+        	if ( connect ( *sock, addr->ai_addr, addr->ai_addrlen ) == -1 ) {
+                	logMessage ( LOG_ERROR_LEVEL, "_setupConnection:Failed during the connect function [%s]", strerror(errno) );
+			close ( *sock );
+			*sock = -1;
+                	continue;
+        	}
 
-	logMessage ( LOG_INFO_LEVEL, "Socket Successfully Initialized" );
+		break;
+	}
+	freeaddrinfo ( results );
 
-        //Connect the socket to the clientAddress
-        if ( connect ( *sock, (const struct sockaddr*)&clientAddress,  sizeof(struct sockaddr) ) == -1 ) {
-                logMessage ( LOG_ERROR_LEVEL, "_setupConnection:Failed during the connect function [%s]", strerror(errno) );
-                return 1;
-        }
+	if ( *sock == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setupConnection:Could not connect to the server [%s/%d]", ip, port );
+		return 1;
+	}
 
 	logMessage ( LOG_INFO_LEVEL, "Connected socket to server" );
 
@@ -0,0 +1,144 @@
+#ifndef SMSA_CLIENT_INCLUDED
+#define SMSA_CLIENT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_client.h
+//  Description    : This is the client side of the SMSA communication protocol.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+#include <pthread.h>
+#include <netdb.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+#include <smsa_protocol.h>
+#include <smsa_uring.h>
+
+// Defines
+#define SMSA_MAX_CONNECTIONS SMSA_DEFAULT_DRUMS		// most connections in the pool ( one per drum of the default array )
+#define SMSA_MAX_PACKET_SIZE (SMSA_NET_HEADER_SIZE+SMSA_MAX_BLOCK_SIZE)	// largest version 1 packet on the wire
+#define SMSA_RECONNECT_TRIES 6					// times an operation reconnects before it fails
+#define SMSA_RECONNECT_DELAY 10000				// microseconds before the first reconnect
+#define SMSA_RECONNECT_MAX_DELAY 1000000			// most microseconds between reconnects
+#define SMSA_MOVE_DELAY 1000					// microseconds before an operation on a drum being moved is sent again
+#define SMSA_MAX_REPLICAS 8					// most replicas reads are spread over
+#define SMSA_HEDGE_SAMPLES 256					// latest reads the hedge delay is worked out from
+#define SMSA_HEDGE_UPDATE 64					// reads between working the hedge delay out again
+#define SMSA_HEDGE_PERCENTILE 95				// percentile of the read latency a read is hedged after
+
+//
+// Type Definitions
+
+// This is one connection of the pool. Operations on a drum always go over the
+// connection the drum hashes to, so a connection that stalls only holds up
+// its own drums. The server keeps seek heads for every connection, and head
+// keeps track of where they are, so they can be put where the session heads
+// are before an operation that uses them. A replica is a connection of its
+// own to a follower, that only ever reads at a drum/block. A request the client
+// stopped waiting for is abandoned, and its response is dropped when it comes in
+typedef struct {
+	int		index;		// position of the connection in the pool
+	int		sock;		// socket file handle ( -1 if not connected )
+	SMSA_HEAD	head;		// where the server has the heads of this connection
+	int		version;	// protocol version agreed on with the server
+	uint16_t	features;	// SMSA_NET_FLAGS agreed on with the server
+	uint32_t	nextId;		// id of the last request sent ( version 2 )
+	pthread_mutex_t	lock;		// held while an operation is using the connection
+	int		replica;	// true if the connection is to a replica
+	char		host[NI_MAXHOST];	// address of a replica, or of a server of the shard map
+	uint16_t	port;		// port of a replica, or of a server of the shard map
+	int		outstanding;	// reads in flight on it, while there are replicas
+	uint32_t	wantSeq;	// sequence number the follower has to have for the next request ( version 2 )
+	uint32_t	seq;		// sequence number the last response carried ( version 2 )
+	uint64_t	deadline;	// clientClock time the request in flight has to be answered by ( 0 for never )
+	uint32_t	abandoned;	// id of the request whose response is dropped ( 0 for none, version 2 )
+	int		uring;		// true while the connection uses ring
+	SMSA_URING	ring;		// ring used when the transport is io_uring
+	unsigned char	sendBuffer[SMSA_NET_MAX_FRAME_SIZE];	// registered buffer requests are sent from
+	unsigned char	recvBuffer[SMSA_NET_MAX_FRAME_SIZE];	// registered buffer responses are read into
+} SMSA_CLIENT_CONNECTION;
+
+
+//
+// Funtional Prototypes
+
+// Connect every connection of the pool and mount the array on each
+int mountPool ( uint32_t op );
+
+// Unmount the array on every connection of the pool and close them
+int unmountPool ( uint32_t op );
+
+// Connect to the replicas and mount the array on each
+void mountReplicas ( uint32_t op );
+
+// Try to perform a read on a replica
+int replicaRead ( uint32_t op, unsigned char *blocks, uint16_t count );
+
+// Pick the replica a read of a drum goes to ( NULL for the leader )
+SMSA_CLIENT_CONNECTION *pickReader ( SMSA_DRUM_ID drum );
+
+// Pick the connection of the pool an operation goes over
+SMSA_CLIENT_CONNECTION *poolConnection ( uint32_t op );
+
+// Tell the drum an operation is on
+SMSA_DRUM_ID operationDrum ( uint32_t op );
+
+// Send an SMSA_NET_MOVE_DRUM over a connection of the pool
+int moveOperation ( SMSA_CLIENT_CONNECTION *conn, SMSA_DRUM_ID drum, SMSA_NET_MOVE_PHASE phase, unsigned char *home );
+
+// Point the shard map at where the server of a connection says a drum went
+int findDrum ( SMSA_CLIENT_CONNECTION *conn, SMSA_DRUM_ID drum );
+
+// Perform an operation on a connection, reconnecting if the connection drops
+int poolOperation ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, int16_t *ret, unsigned char *blocks, uint16_t count );
+
+// Tell how many servers the pool is connected to
+int serverCount ( void );
+
+// Perform an operation on the server of a connection, rather than on a drum
+int serverOperation ( SMSA_CLIENT_CONNECTION *conn, uint32_t op );
+
+// Move the heads of a connection to the session heads, if the operation uses them
+int syncHeads ( SMSA_CLIENT_CONNECTION *conn, uint32_t op );
+
+// Move a set of heads the way a successful operation moves them on the server
+void followHeads ( SMSA_HEAD *head, uint32_t op, int16_t ret );
+
+// Connect a connection of the pool and mount the array on it
+int openConnection ( SMSA_CLIENT_CONNECTION *conn, uint32_t op );
+
+// Take the geometry of the array out of the response to a mount
+int takeGeometry ( SMSA_CLIENT_CONNECTION *conn, uint32_t op );
+
+// Close a connection of the pool
+void closeConnection ( SMSA_CLIENT_CONNECTION *conn );
+
+// Agree on a protocol version and features with the server
+int helloConnection ( SMSA_CLIENT_CONNECTION *conn );
+
+// Send a request over a connection and receive its response
+int exchangePacket ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, int16_t *ret, unsigned char *blocks, uint16_t count );
+
+// Take the SMSA_NET_INVALIDATE frames waiting on a connection
+int pollConnection ( SMSA_CLIENT_CONNECTION *conn );
+
+// Send one request frame over a connection and receive the response frame
+int exchangeFrame ( SMSA_CLIENT_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count, SMSA_FRAME *response );
+
+// Send a read over a connection, and again over another once it is slow
+int hedgedRead ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *request, unsigned char *blocks, uint16_t count, SMSA_FRAME *response );
+
+// Send the copy of a slow read over another connection
+SMSA_CLIENT_CONNECTION *sendHedge ( SMSA_CLIENT_CONNECTION *conn, SMSA_FRAME *request, uint16_t count, SMSA_FRAME *hedge );
+
+// Read the response to an abandoned request off a connection
+int drainConnection ( SMSA_CLIENT_CONNECTION *conn );
+
+#endif
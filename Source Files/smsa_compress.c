@@ -0,0 +1,585 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_compress.c
+//  Description   : This is the payload encoding of the SMSA protocol. With
+//		    SMSA_NET_FLAG_UNIFORM, every block of the payload is a single
+//		    byte value repeated, and only that byte is sent for each. A
+//		    freshly formatted drum is nothing but such blocks.
+//
+//		    With SMSA_NET_FLAG_COMPRESSED, the payload starts with the
+//		    SMSA_CODEC it was compressed with:
+//
+//		    SMSA_CODEC_RLE - pairs of bytes, a run length less one and
+//		    the byte that repeats. Uniform blocks, which is what most of
+//		    the workloads write and what a formatted drum holds, come down
+//		    to two bytes, so they are checked for first.
+//
+//		    SMSA_CODEC_LZ4 - an LZ4 block, in the standard LZ4 block
+//		    format, for everything else.
+//
+//		    A payload that is not uniform, and does not get smaller, is sent
+//		    as it is.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+#include <smsa_compress.h>
+#include <cmpsc311_log.h>
+
+
+// Defines
+#define SMSA_UNIFORM_CHUNK 64		// bytes compared between checks for a difference
+#define SMSA_RLE_MAX_RUN 256		// longest run in a pair
+#define SMSA_LZ4_HASH_LOG 10		// bits of the hash of 4 bytes
+#define SMSA_LZ4_MIN_MATCH 4		// shortest match LZ4 can encode
+#define SMSA_LZ4_LAST_LITERALS 5	// bytes at the end that are always literals
+#define SMSA_LZ4_MATCH_LIMIT 12		// a match can not start closer to the end than this
+#define SMSA_LZ4_MAX_OFFSET 65535	// farthest back a match can be, in the 16 bits of its offset
+
+
+// Global Variables
+SMSA_COMPRESS_STATS compressStats;				//payload encoding stats of this process
+pthread_mutex_t compressLock = PTHREAD_MUTEX_INITIALIZER;	//held while compressStats is updated
+
+
+//Functional Prototypes
+uint32_t rleCompress ( unsigned char *in, uint32_t len, unsigned char *out, uint32_t max );
+int rleDecompress ( unsigned char *in, uint32_t inLen, unsigned char *out, uint32_t len );
+uint32_t lz4Compress ( unsigned char *in, uint32_t len, unsigned char *out, uint32_t max );
+int lz4Sequence ( unsigned char *out, uint32_t *pos, uint32_t max, unsigned char *literals, uint32_t litLen, uint32_t offset, uint32_t matchLen );
+int lz4Decompress ( unsigned char *in, uint32_t inLen, unsigned char *out, uint32_t len );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uniform_fill
+// Description  : Tells if a block is all one byte value. The block is compared
+//		  against the byte a word at a time, and the differences are
+//		  only checked between chunks, so the compiler can vectorize
+//		  the comparison of a chunk.
+//
+// Inputs       : block - the block
+//		  len - the length of the block
+// Outputs      : the byte the block is filled with, -1 if it is not uniform
+
+int smsa_uniform_fill ( unsigned char *block, uint32_t len ) {
+
+	uint64_t fill;		//the first byte, in every byte of a word
+	uint64_t word;
+	uint64_t diff = 0;	//bits that differ from the fill
+	uint32_t i, j;
+
+
+	if ( len == 0 )
+		return -1;
+	fill = block[0] * 0x0101010101010101ULL;
+
+	for ( i = 0; i + SMSA_UNIFORM_CHUNK <= len; i += SMSA_UNIFORM_CHUNK ) {
+		for ( j = 0; j < SMSA_UNIFORM_CHUNK; j += sizeof(word) ) {
+			memcpy ( &word, &block[i+j], sizeof(word) );
+			diff |= word ^ fill;
+		}
+		if ( diff != 0 )
+			return -1;
+	}
+	for ( ; i < len; i++ )
+		diff |= block[i] ^ block[0];
+
+	return ( ( diff == 0 ) ? block[0] : -1 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_encode_payload
+// Description  : Encodes the blocks of a payload in the smallest way the features
+//		  allow. Blocks that are all uniform go as a byte each, otherwise
+//		  they are compressed if that makes them smaller, and otherwise
+//		  they go as they are.
+//
+// Inputs       : features - the SMSA_NET_FLAGS agreed on for the connection
+//		  blocks - the blocks
+//		  count - the number of blocks
+//		  out - where the payload goes, with room for all the blocks
+//		  flags - the flags of the frame, the encoding is added to them
+// Outputs      : the length of the payload
+
+uint32_t smsa_encode_payload ( uint16_t features, unsigned char *blocks, uint16_t count, unsigned char *out, uint16_t *flags ) {
+
+	uint32_t len = count*SMSA_BLOCK_SIZE;	//length of the blocks
+	uint32_t size = 0;			//length of the payload
+	int fill, i;
+
+
+	if ( features & SMSA_NET_FLAG_UNIFORM ) {
+		for ( i = 0; i < count && ( fill = smsa_uniform_fill ( &blocks[i*SMSA_BLOCK_SIZE], SMSA_BLOCK_SIZE ) ) != -1; i++ )
+			out[i] = fill;
+		if ( i == count ) {
+			*flags |= SMSA_NET_FLAG_UNIFORM;
+			size = count;
+		}
+	}
+
+	if ( size == 0 && ( features & SMSA_NET_FLAG_COMPRESSED ) && ( size = smsa_compress ( blocks, len, out, len ) ) > 0 )
+		*flags |= SMSA_NET_FLAG_COMPRESSED;
+
+	if ( size == 0 ) {
+		memcpy ( out, blocks, len );
+		size = len;
+	}
+
+	pthread_mutex_lock ( &compressLock );
+	compressStats.payloads++;
+	compressStats.sentBytes += len;
+	compressStats.sentWire += size;
+	if ( *flags & SMSA_NET_FLAG_UNIFORM )
+		compressStats.uniform++;
+	else if ( !( *flags & SMSA_NET_FLAG_COMPRESSED ) )
+		compressStats.raw++;
+	else if ( out[0] == SMSA_CODEC_RLE )
+		compressStats.rle++;
+	else
+		compressStats.lz4++;
+	pthread_mutex_unlock ( &compressLock );
+
+	return size;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_decode_payload
+// Description  : Decodes a payload back into its blocks, the way the flags of its
+//		  frame say it was encoded. It has to come out to exactly count
+//		  blocks.
+//
+// Inputs       : flags - the flags of the frame
+//		  in - the payload
+//		  len - the length of the payload
+//		  blocks - where the blocks go
+//		  count - the number of blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int smsa_decode_payload ( uint16_t flags, unsigned char *in, uint32_t len, unsigned char *blocks, uint16_t count ) {
+
+	int i;
+
+	if ( flags & SMSA_NET_FLAG_UNIFORM ) {
+		if ( len != count ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_decode_payload:Uniform payload of [%u] bytes for [%u] blocks", len, count );
+			return 1;
+		}
+		for ( i = 0; i < count; i++ )
+			memset ( &blocks[i*SMSA_BLOCK_SIZE], in[i], SMSA_BLOCK_SIZE );
+	}
+	else if ( flags & SMSA_NET_FLAG_COMPRESSED ) {
+		if ( smsa_decompress ( in, len, blocks, count*SMSA_BLOCK_SIZE ) )
+			return 1;
+	}
+	else {
+		if ( len != count*SMSA_BLOCK_SIZE ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_decode_payload:Payload of [%u] bytes for [%u] blocks", len, count );
+			return 1;
+		}
+		memcpy ( blocks, in, len );
+		return 0;
+	}
+
+	pthread_mutex_lock ( &compressLock );
+	compressStats.received++;
+	compressStats.receivedBytes += count*SMSA_BLOCK_SIZE;
+	compressStats.receivedWire += len;
+	pthread_mutex_unlock ( &compressLock );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_compress
+// Description  : Compresses a payload. Run length encoding is tried first, as
+//		  long as the payload is mostly runs, and LZ4 otherwise.
+//
+// Inputs       : in - the payload
+//		  len - the length of the payload
+//		  out - where the compressed payload goes
+//		  max - the most bytes that fit in out
+// Outputs      : the length of the compressed payload, 0 if it did not get smaller
+
+uint32_t smsa_compress ( unsigned char *in, uint32_t len, unsigned char *out, uint32_t max ) {
+
+	uint32_t size = 0;	//size of the compressed payload
+
+
+	//Never bother with a payload unless it shrinks
+	if ( max >= len )
+		max = ( len > 0 ) ? len - 1 : 0;
+	if ( max <= 1 )
+		return 0;
+
+	out[0] = SMSA_CODEC_RLE;
+	if ( ( size = rleCompress ( in, len, &out[1], ( max-1 < len/8 ) ? max-1 : len/8 ) ) == 0 ) {
+		out[0] = SMSA_CODEC_LZ4;
+		size = lz4Compress ( in, len, &out[1], max-1 );
+	}
+
+	return ( ( size > 0 ) ? size + 1 : 0 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_decompress
+// Description  : Decompresses a payload. Anything that would write outside of
+//		  out, or does not fill it exactly, is a failure.
+//
+// Inputs       : in - the compressed payload
+//		  inLen - the length of the compressed payload
+//		  out - where the payload goes
+//		  len - the length of the payload
+// Outputs      : 0 if successful, 1 if failure
+
+int smsa_decompress ( unsigned char *in, uint32_t inLen, unsigned char *out, uint32_t len ) {
+
+	int err;
+
+	if ( inLen < 1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_decompress:Empty payload" );
+		return 1;
+	}
+
+	switch ( in[0] ) {
+		case SMSA_CODEC_RLE:
+			err = rleDecompress ( &in[1], inLen-1, out, len );
+			break;
+		case SMSA_CODEC_LZ4:
+			err = lz4Decompress ( &in[1], inLen-1, out, len );
+			break;
+		default:
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_decompress:Unknown codec [%u]", in[0] );
+			return 1;
+	}
+
+	if ( err ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_decompress:Corrupt payload with codec [%u]", in[0] );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_compress_stats
+// Description  : Gives the payload encoding stats of this process
+//
+// Inputs       : stats - will hold the stats
+// Outputs      : none
+
+void smsa_compress_stats ( SMSA_COMPRESS_STATS *stats ) {
+
+	pthread_mutex_lock ( &compressLock );
+	*stats = compressStats;
+	pthread_mutex_unlock ( &compressLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_compress_stats
+// Description  : Logs how many bytes payload encoding saved, in both directions.
+//		  It logs nothing if no payload was ever encoded
+//
+// Inputs       : who - what to call this side of the connection in the log
+// Outputs      : none
+
+void smsa_log_compress_stats ( char *who ) {
+
+	SMSA_COMPRESS_STATS stats;
+
+	smsa_compress_stats ( &stats );
+	if ( stats.payloads == stats.raw && stats.received == 0 )
+		return;
+
+	logMessage ( LOG_OUTPUT_LEVEL, "%s payloads sent %llu (%llu uniform, %llu rle, %llu lz4, %llu raw), %llu bytes as %llu, saved %llu bytes",
+			who, (unsigned long long)stats.payloads, (unsigned long long)stats.uniform, (unsigned long long)stats.rle, (unsigned long long)stats.lz4,
+			(unsigned long long)stats.raw, (unsigned long long)stats.sentBytes, (unsigned long long)stats.sentWire,
+			(unsigned long long)( stats.sentBytes - stats.sentWire ) );
+	logMessage ( LOG_OUTPUT_LEVEL, "%s payloads received %llu encoded, %llu bytes as %llu, saved %llu bytes",
+			who, (unsigned long long)stats.received, (unsigned long long)stats.receivedBytes,
+			(unsigned long long)stats.receivedWire, (unsigned long long)( stats.receivedBytes - stats.receivedWire ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rleCompress
+// Description  : Run length encodes a payload, giving up as soon as it will not
+//		  fit in max bytes
+//
+// Inputs       : in - the payload
+//		  len - the length of the payload
+//		  out - where the pairs go
+//		  max - the most bytes that fit in out
+// Outputs      : the length of the pairs, 0 if they did not fit
+
+uint32_t rleCompress ( unsigned char *in, uint32_t len, unsigned char *out, uint32_t max ) {
+
+	uint32_t pos = 0, size = 0;
+	uint32_t run;
+
+	while ( pos < len ) {
+		if ( size + 2 > max )
+			return 0;
+		for ( run = 1; run < SMSA_RLE_MAX_RUN && pos + run < len && in[pos+run] == in[pos]; run++ );
+		out[size++] = run - 1;
+		out[size++] = in[pos];
+		pos += run;
+	}
+
+	return size;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : rleDecompress
+// Description  : Expands run length encoded pairs
+//
+// Inputs       : in - the pairs
+//		  inLen - the length of the pairs
+//		  out - where the payload goes
+//		  len - the length of the payload
+// Outputs      : 0 if successful, 1 if failure
+
+int rleDecompress ( unsigned char *in, uint32_t inLen, unsigned char *out, uint32_t len ) {
+
+	uint32_t pos = 0, i;
+	uint32_t run;
+
+	if ( inLen % 2 != 0 )
+		return 1;
+
+	for ( i = 0; i < inLen; i += 2 ) {
+		run = in[i] + 1;
+		if ( pos + run > len )
+			return 1;
+		memset ( &out[pos], in[i+1], run );
+		pos += run;
+	}
+
+	return ( pos == len ) ? 0 : 1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz4Compress
+// Description  : Compresses a payload into an LZ4 block. Matches are found with a
+//		  table of where each hash of 4 bytes was last seen, taking the
+//		  first match found, which is what the fast mode of LZ4 does. A
+//		  payload can be longer than an offset reaches, so a match that is
+//		  further back than SMSA_LZ4_MAX_OFFSET is passed over.
+//
+// Inputs       : in - the payload
+//		  len - the length of the payload
+//		  out - where the block goes
+//		  max - the most bytes that fit in out
+// Outputs      : the length of the block, 0 if it did not fit
+
+uint32_t lz4Compress ( unsigned char *in, uint32_t len, unsigned char *out, uint32_t max ) {
+
+	uint32_t table[1<<SMSA_LZ4_HASH_LOG];	//position+1 of the last 4 bytes with each hash
+	uint32_t pos = 0, anchor = 0, size = 0;
+	uint32_t here, there, ref, matchLen, hash;
+
+
+	memset ( table, 0, sizeof(table) );
+
+	while ( pos + SMSA_LZ4_MATCH_LIMIT <= len ) {
+
+		memcpy ( &here, &in[pos], sizeof(here) );
+		hash = ( here * 2654435761U ) >> ( 32 - SMSA_LZ4_HASH_LOG );
+		ref = table[hash];
+		table[hash] = pos + 1;
+
+		if ( ref == 0 || pos - ( ref - 1 ) > SMSA_LZ4_MAX_OFFSET ) {
+			pos++;
+			continue;
+		}
+		ref--;
+		memcpy ( &there, &in[ref], sizeof(there) );
+		if ( there != here ) {
+			pos++;
+			continue;
+		}
+
+		//extend the match as far as it goes, stopping short of the last literals
+		for ( matchLen = SMSA_LZ4_MIN_MATCH; pos + matchLen < len - SMSA_LZ4_LAST_LITERALS &&
+				in[ref+matchLen] == in[pos+matchLen]; matchLen++ );
+
+		if ( lz4Sequence ( out, &size, max, &in[anchor], pos-anchor, pos-ref, matchLen ) )
+			return 0;
+		pos += matchLen;
+		anchor = pos;
+	}
+
+	//the rest is the literals of the last sequence
+	if ( lz4Sequence ( out, &size, max, &in[anchor], len-anchor, 0, 0 ) )
+		return 0;
+
+	return size;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz4Sequence
+// Description  : Adds one LZ4 sequence to a block, a token, the literals, and the
+//		  offset and length of the match that follows them. The last
+//		  sequence has no match.
+//
+// Inputs       : out - the block
+//		  pos - the length of the block, moved past the sequence
+//		  max - the most bytes that fit in out
+//		  literals - the literals
+//		  litLen - the number of literals
+//		  offset - how far back the match is
+//		  matchLen - the length of the match ( 0 for the last sequence )
+// Outputs      : 0 if successful, 1 if it did not fit
+
+int lz4Sequence ( unsigned char *out, uint32_t *pos, uint32_t max, unsigned char *literals, uint32_t litLen, uint32_t offset, uint32_t matchLen ) {
+
+	uint32_t need;		//most bytes the sequence can take
+	uint32_t token;		//where the token is
+	uint32_t n;
+
+
+	need = 1 + litLen/255 + 1 + litLen + ( ( matchLen > 0 ) ? 2 + matchLen/255 + 1 : 0 );
+	if ( *pos + need > max )
+		return 1;
+
+	//the token holds the literal length and match length, up to 15 each,
+	//and the rest of them follows in bytes of 255
+	token = (*pos)++;
+	if ( litLen >= 15 ) {
+		out[token] = 15 << 4;
+		for ( n = litLen - 15; n >= 255; n -= 255 )
+			out[(*pos)++] = 255;
+		out[(*pos)++] = n;
+	}
+	else
+		out[token] = litLen << 4;
+
+	memcpy ( &out[*pos], literals, litLen );
+	*pos += litLen;
+
+	if ( matchLen == 0 )
+		return 0;
+
+	out[(*pos)++] = offset & 0xff;
+	out[(*pos)++] = offset >> 8;
+	if ( matchLen - SMSA_LZ4_MIN_MATCH >= 15 ) {
+		out[token] |= 15;
+		for ( n = matchLen - SMSA_LZ4_MIN_MATCH - 15; n >= 255; n -= 255 )
+			out[(*pos)++] = 255;
+		out[(*pos)++] = n;
+	}
+	else
+		out[token] |= matchLen - SMSA_LZ4_MIN_MATCH;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lz4Decompress
+// Description  : Expands an LZ4 block, checking every length and offset against
+//		  the buffers
+//
+// Inputs       : in - the block
+//		  inLen - the length of the block
+//		  out - where the payload goes
+//		  len - the length of the payload
+// Outputs      : 0 if successful, 1 if failure
+
+int lz4Decompress ( unsigned char *in, uint32_t inLen, unsigned char *out, uint32_t len ) {
+
+	uint32_t pos = 0, size = 0;
+	uint32_t token, litLen, matchLen, offset, b;
+
+
+	while ( pos < inLen ) {
+
+		token = in[pos++];
+
+		//the literals
+		litLen = token >> 4;
+		if ( litLen == 15 ) {
+			do {
+				if ( pos >= inLen )
+					return 1;
+				b = in[pos++];
+				litLen += b;
+			} while ( b == 255 );
+		}
+		if ( litLen > inLen - pos || litLen > len - size )
+			return 1;
+		memcpy ( &out[size], &in[pos], litLen );
+		pos += litLen;
+		size += litLen;
+
+		//the last sequence ends with its literals
+		if ( pos == inLen )
+			break;
+
+		//the match, which may overlap what it copies
+		if ( inLen - pos < 2 )
+			return 1;
+		offset = in[pos] | ( in[pos+1] << 8 );
+		pos += 2;
+		if ( offset == 0 || offset > size )
+			return 1;
+
+		matchLen = token & 15;
+		if ( matchLen == 15 ) {
+			do {
+				if ( pos >= inLen )
+					return 1;
+				b = in[pos++];
+				matchLen += b;
+			} while ( b == 255 );
+		}
+		matchLen += SMSA_LZ4_MIN_MATCH;
+		if ( matchLen > len - size )
+			return 1;
+		for ( ; matchLen > 0; matchLen--, size++ )
+			out[size] = out[size-offset];
+	}
+
+	return ( size == len ) ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#ifndef SMSA_COMPRESS_INCLUDED
+#define SMSA_COMPRESS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_compress.h
+//  Description    : This is the payload encoding of the SMSA protocol, used by
+//                   the client and the server once they agree on
+//                   SMSA_NET_FLAG_UNIFORM or SMSA_NET_FLAG_COMPRESSED. See
+//                   smsa_compress.c for the formats.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+//
+// Type Definitions
+
+// The codec a compressed payload starts with
+typedef enum {
+	SMSA_CODEC_RLE	= 1,	// Runs of a byte, for uniform blocks
+	SMSA_CODEC_LZ4	= 2,	// An LZ4 block, for everything else
+} SMSA_CODEC;
+
+// What payload encoding has done so far in this process
+typedef struct {
+	uint64_t	payloads;	// payloads given to smsa_encode_payload
+	uint64_t	uniform;	// payloads sent as SMSA_NET_FLAG_UNIFORM
+	uint64_t	rle;		// payloads sent with SMSA_CODEC_RLE
+	uint64_t	lz4;		// payloads sent with SMSA_CODEC_LZ4
+	uint64_t	raw;		// payloads that did not get smaller, sent as they were
+	uint64_t	sentBytes;	// bytes of the payloads given to smsa_encode_payload
+	uint64_t	sentWire;	// bytes of those payloads that went on the wire
+	uint64_t	received;	// encoded payloads given to smsa_decode_payload
+	uint64_t	receivedBytes;	// bytes they decompressed to
+	uint64_t	receivedWire;	// bytes of them that came over the wire
+} SMSA_COMPRESS_STATS;
+
+
+//
+// Funtional Prototypes
+
+// Tell if a block is all one byte value, gives the byte or -1
+int smsa_uniform_fill ( unsigned char *block, uint32_t len );
+
+// Encode the blocks of a payload with the features agreed on, adding the flags that say how
+uint32_t smsa_encode_payload ( uint16_t features, unsigned char *blocks, uint16_t count, unsigned char *out, uint16_t *flags );
+
+// Decode a payload back into its blocks, the way its flags say it was encoded
+int smsa_decode_payload ( uint16_t flags, unsigned char *in, uint32_t len, unsigned char *blocks, uint16_t count );
+
+// Compress a payload, gives 0 if it would not get smaller
+uint32_t smsa_compress ( unsigned char *in, uint32_t len, unsigned char *out, uint32_t max );
+
+// Decompress a payload, that has to come out to exactly len bytes
+int smsa_decompress ( unsigned char *in, uint32_t inLen, unsigned char *out, uint32_t len );
+
+// Get the payload encoding stats of this process
+void smsa_compress_stats ( SMSA_COMPRESS_STATS *stats );
+
+// Log the payload encoding stats of this process, if anything was encoded
+void smsa_log_compress_stats ( char *who );
+
+#endif
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <arpa/inet.h>
 
 
 // Project Include Files
@@ -18,17 +19,11 @@
 #include <smsa_driver.h>
 #include <cmpsc311_log.h>
 #include <smsa_cache.h>
+#include <smsa_protocol.h>
 
 
 // Defines
-#define OPCODE_BIT_WIDTH 6		//Bit widths of command to send to smsa device
-#define DRUM_ID_BIT_WIDTH 4
-#define RESERVED_BIT_WIDTH 14
-#define BLOCK_ID_BIT_WIDTH 8
-#define TOTAL_COMMAND_BIT_WIDTH 32
-
 #define DONT_CARE 0
-#define BLOCK_SIZE 256
 
 /* DEBUG */
 #define DEBUG 0				//If set to 1, more info will be displayed when errors occur
@@ -39,6 +34,10 @@
 // Global data
 int cache_hits;				//Two variables to check the performance of the cache
 int disk_reads;
+int coherent;				//true if the server says when other clients write cached blocks
+char *snapshotFile;			//file the array is restored from and saved to ( NULL for none )
+int exportArray;			//true if the server exports the array on unmount
+unsigned char *batch;			//blocks read or written in one operation, SMSA_NET_MAX_BLOCKS of them
 
 HEAD head;			//This struct defined in the head will contain the disk and block head postions
 
@@ -47,14 +46,62 @@ HEAD head;			//This struct defined in the head will contain the disk and block h
 // Function     : smsa_vmount
 // Description  : Mount the SMSA disk array virtual address space
 //
-// Inputs       : none
+// Inputs       : cache_size - number of lines in the block cache
 // Outputs      : -1 if failure or 0 if successful
 int smsa_vmount( int cache_size ) {
+
+	SMSA_MOUNT_OPTIONS options;	//default options, with the given cache size
+
+	memset ( &options, 0, sizeof(options) );
+	options.cache_size = cache_size;
+
+	return ( smsa_vmount_options ( &options ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_vmount_options
+// Description  : Mount the SMSA disk array virtual address space
+//
+// Inputs       : options - the mount options, see SMSA_MOUNT_OPTIONS
+// Outputs      : -1 if failure or 0 if successful
+int smsa_vmount_options( SMSA_MOUNT_OPTIONS *options ) {
 	
 	uint32_t command;   	 //holds the generated op command
 	ERROR_SOURCE err = 0;	 //holds return values of function calls to checkForErrors	
 	
 
+	//tell the client where the server is before the mount connects to it.
+	//NULL and 0 leave the choice to the environment or the defaults
+	if ( smsa_client_set_address ( options->server_ip, options->server_port ) ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to set the server address" );
+		return 1;
+	}
+	smsa_client_set_transport ( options->transport );
+	if ( smsa_client_set_connections ( options->connections ) ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to set the number of connections" );
+		return 1;
+	}
+	if ( smsa_client_set_protocol ( options->protocol, ( options->checksums ? SMSA_NET_FLAG_CHECKSUM : 0 ) |
+			( options->compression ? SMSA_NET_FLAG_COMPRESSED : 0 ) ) ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to set the protocol version" );
+		return 1;
+	}
+	if ( smsa_client_set_replicas ( options->replicas, options->consistency ) ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to set the replicas" );
+		return 1;
+	}
+	if ( smsa_client_set_shards ( options->shards ) ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to set the shard map" );
+		return 1;
+	}
+	smsa_client_set_timeout ( options->timeout, !options->no_hedging );
+
+	//when other clients share the array, the server tells us which of the
+	//blocks in our cache they write, so the cache never hands back old data
+	coherent = options->coherent;
+	smsa_client_set_invalidate ( coherent ? invalidateCachedBlocks : NULL );
+
 	//generate the op command, so that we can use this 
 	//command to call the smsa_operation function to mount
 	//the disk. DONT_CARE is defined as 0. After function call,
@@ -80,10 +127,18 @@ int smsa_vmount( int cache_size ) {
 
 	
 	//initialize cache
-	if ( smsa_init_cache ( cache_size ) ) {
+	if ( smsa_init_cache ( options->cache_size ) ) {
 		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to succesfully initialize the cache" );
 		return 1;
 	}
+
+	//the blocks are as big as the array the server mounted, so the
+	//batch they are read and written in is sized now
+	free ( batch );
+	if ( ( batch = malloc ( SMSA_NET_MAX_BLOCKS*SMSA_BLOCK_SIZE ) ) == NULL ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_vmount:Failed to allocate the batch of blocks" );
+		return 1;
+	}
 	
 
 	//Initialize the drum and block head positions to zero
@@ -93,13 +148,17 @@ int smsa_vmount( int cache_size ) {
 	if ( DEBUG )
 		logMessage ( LOG_INFO_LEVEL, "Block and Drum Head Structure Initalized Drum Head To %d and Block Head To %d", head.drum, head.block );
 
-	//restore the memory that was saved in the txt file,
+	//restore the memory that was saved in the snapshot file,
 	//when vunmount finished. This will load the all disk
 	//and blocks with the contents of the file. If this function
 	//fails, we will not return 1 here and cause the program
 	//to fail, because being unable to load the memory from 
 	//the file is not a catastrophic error
-//	err = restoreDiskFromFile();
+	free ( snapshotFile );
+	snapshotFile = ( options->snapshot != NULL ) ? strdup ( options->snapshot ) : NULL;
+	if ( snapshotFile != NULL )
+		restoreDiskFromFile ( snapshotFile );
+	exportArray = options->export;
 
 	
 	//initialize cache performance variables
@@ -137,7 +196,16 @@ int smsa_vunmount( void )  {
 	//function we will not return a 1 since it is not a catastrophic
 	//error, and the virtual memory will still function properly 
 	//once mount is called
-//	err = saveDiskToFile();
+	if ( snapshotFile != NULL ) {
+		saveDiskToFile ( snapshotFile );
+		free ( snapshotFile );
+		snapshotFile = NULL;
+	}
+
+	//the server can also keep a backup of its own, which other clients
+	//keep writing through
+	if ( exportArray && smsa_client_export () )
+		logMessage ( LOG_WARNING_LEVEL, "The server failed to export the array" );
 
 	//generate the op command so that we can use it to call
 	//the smsa_operation function to unmount the disk. Once 
@@ -156,16 +224,19 @@ int smsa_vunmount( void )  {
 	if ( smsa_client_operation ( command, NULL ) ) {
 		logMessage ( LOG_INFO_LEVEL, "_smsa_vunmount:Failed to send UNMOUNT command on the network");
 		return 1;
+	}
 	
 
 	logMessage ( LOG_INFO_LEVEL, "Successfully Unmounted the Disk" );
 
 
 	//free cache
-	if ( smsa_close_cache() )
+	if ( smsa_close_cache() ) {
 		logMessage ( LOG_INFO_LEVEL, "_smsa_vunmount:Failed to properly close cache in smsa_close_cache()" );
 		return 1;
 	}
+	free ( batch );
+	batch = NULL;
 
 	
 	//if checkForErrors finds that err is non-zero, it will return 1. 
@@ -193,13 +264,16 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 	//through various loops so that the write can be completed
 	SMSA_DRUM_ID drumStart, drumEnd, currentDrum;
 	SMSA_BLOCK_ID blockStart, blockEnd, currentBlock;
-	uint32_t byteStart, byteEnd, upperBound, lowerBound;
+	uint32_t byteStart, byteEnd, upperBound = 0, lowerBound = 0;
 
+	SMSA_DRUM_ID batchDrum = 0;		//drum of the blocks last read from the disk
+	SMSA_BLOCK_ID batchBlock = 0, batchEnd = 0;	//the blocks last read from the disk ( none yet )
+	uint32_t count;				//blocks read from the disk at once
 
-	unsigned char *temp;	
+	unsigned char *temp;			//the current block, from the disk or the cache
 	unsigned char *cacheLine;		//variable to hold the value at the current block
 	
-	int bufferIndex = 0;			//holds the current index of the buffer that we are reading from
+	uint32_t bufferIndex = 0;		//holds the current index of the buffer that we are reading from
 	
 	ERROR_SOURCE err = 0;		 	//holds return values of function calls to checkForErrors	
 	
@@ -207,6 +281,10 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 	//get the start and stop positions of the drum, block and byte
 	err = getDiskBlockParameters ( addr, len, &drumStart, &blockStart, &drumEnd, &blockEnd, &byteStart, &byteEnd );
 
+	//a request that is not all in the array goes no further
+	if ( checkForErrors ( err, "_smsa_vread", addr, len, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE ) )
+		return 1;
+
 	//current drum and block allow us to move through
 	//the while loop. Set them to the starting positions
 	currentDrum = drumStart;
@@ -216,10 +294,8 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 		logMessage ( LOG_INFO_LEVEL,"Initialized currentDrum and currentBlock Tnitialized To drumStart %d, and blockStart %d", drumStart, blockStart );
 
 
-	//since during the while loop below, the drumHead won't 
-	//necessarily be set on the first run through, we must set
-	//it here to ensure it is set to the correct position
-	err = seekIfNeedTo ( currentDrum, currentBlock );
+	//drop what other clients wrote before we look in the cache
+	pollInvalidations ( currentDrum );
 
 
 	//this loop continues while we have not reached the end of (addr + len)
@@ -229,14 +305,6 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 	    		|| ( currentDrum == drumEnd + 1 && currentBlock == 0 ) ) ) {
 
 
-		//In order for the memory to be presevered through multiple calls of v
-		//v_read/v_write, we must allocate the memory so that it remains on the stack
-		//rather than vanishing when the function returns.		
-		temp = (unsigned char*) malloc ( SMSA_BLOCK_SIZE * sizeof ( char ) );		
-
-		if ( DEBUG )
-			logMessage ( LOG_INFO_LEVEL, "Successfully Malloced [%d] Bytes of Data To temp", SMSA_BLOCK_SIZE*sizeof( char ) );
-		
 		//check cache first
 		cacheLine = smsa_get_cache_line ( currentDrum, currentBlock );
 
@@ -246,12 +314,27 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 		//bytes to copy to bu
 		if ( cacheLine == NULL ) {
 		
-			//Cache miss, now read disk
-			err = readLowLevel ( temp ) ;
+			//Cache miss, now read disk. The blocks of the request that
+			//follow it on this drum are read in the same operation, so
+			//a large request costs one round trip per batch rather than
+			//one per block. An earlier miss may have read this one already
+			if ( currentDrum != batchDrum || currentBlock >= batchEnd ) {
+				count = ( ( currentDrum == drumEnd ) ? blockEnd+1 : SMSA_MAX_BLOCK_ID ) - currentBlock;
+				if ( count > SMSA_NET_MAX_BLOCKS )
+					count = SMSA_NET_MAX_BLOCKS;
+
+				err = readLowLevel ( currentDrum, currentBlock, count, batch );
+				batchDrum = currentDrum;
+				batchBlock = currentBlock;
+				batchEnd = ( err ) ? 0 : currentBlock + count;
+			}
+			temp = &batch[( currentBlock - batchBlock )*SMSA_BLOCK_SIZE];
 
 			//Now that this is the most recently used block of memory, we 
-			//need to make sure that it is in the cache.
-			err = smsa_put_cache_line ( currentDrum, currentBlock, temp );	
+			//need to make sure that it is in the cache. The cache keeps
+			//its own copy of it
+			if ( !err )
+				err = smsa_put_cache_line ( currentDrum, currentBlock, temp );	
 			
 			//performance stats
 			disk_reads++;
@@ -271,7 +354,16 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 		//from the current block values that should be overwritten.
 		//After this function call, lowerBound, and upperBound will be 
 		//set to the proper values in order for the memcpy to work
-		err = findMemCpyBounds ( drumStart, blockStart, byteStart, drumEnd, blockEnd, byteEnd, currentDrum, currentBlock, &lowerBound, &upperBound );
+		if ( !err )
+			err = findMemCpyBounds ( drumStart, blockStart, byteStart, drumEnd, blockEnd, byteEnd, currentDrum, currentBlock, &lowerBound, &upperBound );
+
+		//check for errors during the loop, and at the end. This will allow us
+		//to find where the errors occur, since were checking throughout the 
+		//entire process. However, we don't want to stop the program unless
+		//a error was found. So, we will return 1, only if checkForErrors results
+		//in one
+		if ( checkForErrors ( err, "_smsa_vread", addr, len, drumStart, blockStart, currentDrum, currentBlock, drumEnd, blockEnd ) )
+			return 1; 
 
 		//memcopy will copy all of the desired temp to buf.
 		//This is all based on the lower and upper bounds which was
@@ -296,32 +388,19 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 
 		if ( DEBUG )
 			logMessage ( LOG_INFO_LEVEL, "BufferIndex Set From [%d] to [%d]", bufferIndex-(upperBound-lowerBound), bufferIndex);
-
-		//check for errors during the loop, and at the end. This will allow us
-		//to find where the errors occur, since were checking throughout the 
-		//entire process. However, we don't want to stop the program unless
-		//a error was found. So, we will return 1, only if checkForErrors results
-		//in one
-		if ( checkForErrors ( err, "_smsa_vread", addr, len, drumStart, blockStart, currentDrum, currentBlock, drumEnd, blockEnd ) )
-			return 1; 
 	
 		
 		//increment the block
 		currentBlock++;
 
 		//if the current block is out of the bounds for the 
-		//disk size (currentBlock > 256), then set the current 
+		//disk size (currentBlock == SMSA_MAX_BLOCK_ID), then set the current 
 		//block to zero, and start reading the next disk
-		if ( currentBlock == SMSA_BLOCK_SIZE ) {
+		if ( currentBlock == SMSA_MAX_BLOCK_ID ) {
 			currentDrum++;
 			currentBlock = 0;
+			pollInvalidations ( currentDrum );
 		}
-
-		//adjust the block and drum head if neccessary	
-		err = seekIfNeedTo ( currentDrum, currentBlock );	
-
-
-		
 	}
 	
 		
@@ -336,7 +415,9 @@ int smsa_vread( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf ) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : smsa_vwrite
-// Description  : Write to the SMSA virtual address space
+// Description  : Write to the SMSA virtual address space. The blocks are 
+//		  gathered into batches that are written in one operation each,
+//		  SMSA_NET_MAX_BLOCKS blocks of a drum at a time
 //
 // Inputs       : addr - the address to write to
 //                len - the number of bytes to write
@@ -352,57 +433,63 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 	//through various loops so that the write can be completed
 	SMSA_DRUM_ID drumStart, drumEnd, currentDrum;
 	SMSA_BLOCK_ID blockStart, blockEnd, currentBlock;
-	uint32_t byteStart, byteEnd, upperBound, lowerBound;
+	uint32_t byteStart, byteEnd, upperBound = 0, lowerBound = 0;
 	
+	SMSA_DRUM_ID batchDrum = 0;		//drum of the blocks waiting to be written
+	SMSA_BLOCK_ID batchBlock = 0;		//first of the blocks waiting to be written
+	uint32_t count = 0;			//blocks waiting to be written
+	int done = 0;				//true once the last block is in the batch
+	uint32_t i;				//block of the batch being put in the cache
 
-	unsigned char *temp;		//variable to hold the value at the current block
-	unsigned char *cacheLine;
-	int bufferIndex = 0;			//holds the current index of the buffer that we are reading from
-
-
-	ERROR_SOURCE err = 0;		 	//holds return values of function calls to checkForErrors
+	unsigned char *temp;			//where the current block is put together, in the batch
+	unsigned char *cacheLine;		//variable to hold the value at the current block
+	
+	uint32_t bufferIndex = 0;		//holds the current index of the buffer that we are reading from
+	
+	ERROR_SOURCE err = 0;		 	//holds return values of function calls to checkForErrors	
        	
 		
 	//get the start and stop positions of the drum, block, and byte
 	err = getDiskBlockParameters ( addr, len, &drumStart, &blockStart, &drumEnd, &blockEnd, &byteStart, &byteEnd );
+
+	//a request that is not all in the array goes no further
+	if ( checkForErrors ( err, "_vwrite", addr, len, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE ) )
+		return 1;
 	
 
 	//current drum and block allow us to move through
 	//the while loop. Set them to the starting positions
 	currentDrum = drumStart;
 	currentBlock = blockStart;
-	
+
 	if ( DEBUG )
 		logMessage ( LOG_INFO_LEVEL,"Initialized currentDrum and currentBlock Initialized To drumStart %d, and blockStart %d", drumStart, blockStart );
 
 
-	//since during the while loop below, the drumHead won't 
-	//necessarily be set on the first run through, we must set
-	//it here to ensure it is set to the correct position
-	err = seekIfNeedTo ( currentDrum, currentBlock );	
+	//a partial block is merged with what the cache holds, so drop what
+	//other clients wrote first
+	pollInvalidations ( currentDrum );
 
 	
-	//this loop continues while we have not reached the end of (addr + len)
-	//which is the place where the write will extend to. The conditions will
-	//stop the loop, after the last block has been written too
-	while( !( ( currentDrum == drumEnd && currentBlock == blockEnd+1 )
-	    		|| ( currentDrum == drumEnd + 1 && currentBlock == 0 ) ) ) {
+	//this loop continues until the last block has been written. The
+	//blocks go into the batch as they are put together, and the batch
+	//is written once it is full, the drum ends, or the request does
+	while( !done ) {
 	
 			
-		//In order for the memory to be presevered through multiple calls of v
-		//v_read/v_write, we must allocate the memory so that it remains on the stack
-		//rather than vanishing when the function returns.		
-		temp = (unsigned char*) malloc ( SMSA_BLOCK_SIZE * sizeof ( char ) );		
-	
-		if ( DEBUG )
-			logMessage ( LOG_INFO_LEVEL, "Successfully Malloced [%d] Bytes of Data To temp", SMSA_BLOCK_SIZE*sizeof( char ) );
-						
 		//This is where we decide the specific bytes ( letters ) 
 		//from the current block values that should be overwritten
 		//this function sets the lowerBound and upperBound to the appropriate
 		//values. 
 		err = findMemCpyBounds ( drumStart, blockStart, byteStart, drumEnd, blockEnd, byteEnd, currentDrum, currentBlock, &lowerBound, &upperBound );
 		
+		//the block is put together in the next place in the batch
+		if ( count == 0 ) {
+			batchDrum = currentDrum;
+			batchBlock = currentBlock;
+		}
+		temp = &batch[count*SMSA_BLOCK_SIZE];
+
 
 		//in order to handle a write, sometimes, we must
 		//write only some of a given block. Therefore, we 
@@ -419,16 +506,16 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 			if ( cacheLine == NULL )  { //if not in cache perform read	
 				
 				//cache miss. read disk.
-				err = readLowLevel ( temp );
+				err = readLowLevel ( currentDrum, currentBlock, 1, temp );
 				
 				//performance stats
 				disk_reads++;
 			}
 			else {			//otherwise copy the cache line into our temp 
 
-				//Now cacheLine contains the block that we were looking for
-				//so set temp equal to it
-				temp = cacheLine;
+				//Now cacheLine contains the block that we were looking for.
+				//It belongs to the cache, so copy it rather than change it
+				memcpy ( temp, cacheLine, SMSA_BLOCK_SIZE );
 		
 				//performance stats	
 				cache_hits++;
@@ -444,6 +531,7 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 		//If the whole block should be overwriten, the bounds will have 
 		//been set to completely overwrite temp with buf.
 		memcpy ( &temp[lowerBound], &buf[bufferIndex], upperBound - lowerBound );
+		count++;
 
 
 		if ( DEBUG )
@@ -459,46 +547,42 @@ int smsa_vwrite( SMSA_VIRTUAL_ADDRESS addr, uint32_t len, unsigned char *buf )
 		if ( DEBUG )
 			logMessage ( LOG_INFO_LEVEL, "BufferIndex Set From [%d] to [%d]", bufferIndex-(upperBound-lowerBound), bufferIndex);
 
-		//since the block was incremented in the previous 
-		//smsa_operation (read) call, we need to set it back
-		//to the desired write postion
-		err = setBlockHead ( currentBlock );
-
-		//in all scenarios we write temp back to the current block
-		//location. If only part of the current block should be
-		//overwritten, then temp will contain the partially
-		//modified version. If all of the current block should
-		//be overwritten, then temp will contain 255 characters
-		//from the buffer
-		err = writeLowLevel ( temp );
-		
-		//update the cache so that it contains our new block
-		err = smsa_put_cache_line ( currentDrum, currentBlock, temp );
-
-		//check for errors during the loop, and at the end. This will allow us
-		//to find where the errors occur, since were checking throughout the 
-		//entire process. However, we don't want to stop the program unless
-		//a error was found. So, we will return 1, only if checkForErrors results in 
-		//one
-		if ( checkForErrors ( err, "_vwrite", addr, len, drumStart, blockStart, currentDrum, currentBlock, drumEnd, blockEnd ) )
-			return 1; 
-		
 		
 		//increment the block
+		done = ( currentDrum == drumEnd && currentBlock == blockEnd );
 		currentBlock++;
 
 		//if the current block is out of the bounds for the 
 		//disk size, then set the current block to zero, 
 		//and start reading the next disk
-		if ( currentBlock == 256 ) {
+		if ( currentBlock == SMSA_MAX_BLOCK_ID ) {
 			currentDrum++;
 			currentBlock = 0;
 		}
 
-		//make sure the drum and block heads are properly set
-		err = seekIfNeedTo( currentDrum, currentBlock );
+		//in all scenarios we write the batch once it is full, or the
+		//next block is on another drum, or this was the last block. If
+		//only part of a block should be overwritten, then the batch 
+		//holds the partially modified version of it
+		if ( !err && ( done || count == SMSA_NET_MAX_BLOCKS || currentDrum != batchDrum ) ) {
+			err = writeLowLevel ( batchDrum, batchBlock, count, batch );
 
-			
+			//update the cache so that it contains our new blocks
+			for ( i = 0; i < count && !err; i++ )
+				err = smsa_put_cache_line ( batchDrum, batchBlock+i, &batch[i*SMSA_BLOCK_SIZE] );
+			count = 0;
+
+			if ( currentDrum != batchDrum && !done )
+				pollInvalidations ( currentDrum );
+		}
+
+		//check for errors during the loop, and at the end. This will allow us
+		//to find where the errors occur, since were checking throughout the 
+		//entire process. However, we don't want to stop the program unless
+		//a error was found. So, we will return 1, only if checkForErrors results in 
+		//one
+		if ( checkForErrors ( err, "_vwrite", addr, len, drumStart, blockStart, currentDrum, currentBlock, drumEnd, blockEnd ) )
+			return 1; 
 	}
 
 	
@@ -535,43 +619,47 @@ int getDiskBlockParameters( SMSA_VIRTUAL_ADDRESS addr, uint32_t len,
 						uint32_t *byteStart, uint32_t *byteEnd ) {
 	
 		
+	SMSA_VIRTUAL_ADDRESS last = addr + len - 1;	//the last byte of the request
+
+
+	//the request has to be in the array, which is as big as the
+	//geometry the array was mounted with
+	if ( len == 0 || last < addr || last >= MAX_SMSA_VIRTUAL_ADDRESS ) {
+		logMessage ( SMSA_MAX_ERRNO, "getDiskBlockParameters Failed. request out of bounds. addr = [%llu]. len = [%u]", (unsigned long long)addr, len );
+		return 2;
+	}
+
 	//find diskStart
-	//Only need the last 4 of the 20 total bits. So shift away
-	//the other 16 that we don't need
-	*diskStart = addr >> 16;
+	//Each drum holds SMSA_DISK_SIZE bytes of the address space, 
+	//so the drum is how many whole drums come before the address
+	*diskStart = addr / SMSA_DISK_SIZE;
 
 	//find blockStart
-	//We only want the bits from 7-15. So first we 
-	//AND away the upper 4 bits ( disk number), then
-	//we shift away the other beginning 8 bits ( byte number )
-	//This leaves us with the 8 bits representing the 
-	//block number
-	*blockStart = addr & 0xffff;
-	*blockStart = *blockStart >> 8;
+	//Take away the drums before the address, which leaves 
+	//the offset into the drum. Each block is SMSA_BLOCK_SIZE
+	//bytes, so dividing by it gives the block number
+	*blockStart = ( addr % SMSA_DISK_SIZE ) / SMSA_BLOCK_SIZE;
 
 	//find diskEnd
 	//Add together addr and len to give the ending 
 	//address. Then proceed with the same procedure
 	//used for diskStart
-	*diskEnd = ( addr + len - 1) >> 16;
+	*diskEnd = last / SMSA_DISK_SIZE;
 
 	//find blockEnd 
 	//Add together addr and len to give the ending address,
 	//and then proceed with procedure from blockStart
-	*blockEnd = ( addr + len -1 ) & 0xffff;
-	*blockEnd = ( *blockEnd ) >> 8;
+	*blockEnd = ( last % SMSA_DISK_SIZE ) / SMSA_BLOCK_SIZE;
 
 	//find byteStart
 	//This will be used to determine bounds of 
-	//where to read/write from a given block. In 
-	//order to find it, we AND away the upper 12 bits,
-	//leaving us with the bottom 8 which represents the
-	//byte
-	*byteStart = addr & 0xff;
+	//where to read/write from a given block. It is
+	//what is left of the address after the whole blocks
+	*byteStart = addr % SMSA_BLOCK_SIZE;
 
 	//find byteEnd
 	//see comments for byteStart
-	*byteEnd = ( addr + len -1) & 0xff;
+	*byteEnd = last % SMSA_BLOCK_SIZE;
 	
 
 
@@ -582,9 +670,9 @@ int getDiskBlockParameters( SMSA_VIRTUAL_ADDRESS addr, uint32_t len,
 
 	//bounds check all data, we know it cant be below 
 	//zero (unsigned int ) so just check upper bound
-	if ( *diskStart > 15 || *diskEnd > 15 || *blockStart > SMSA_BLOCK_SIZE
-			|| *blockEnd > SMSA_BLOCK_SIZE || *byteStart > SMSA_BLOCK_SIZE
-			|| *byteEnd > SMSA_BLOCK_SIZE ) {	
+	if ( *diskStart >= SMSA_DISK_ARRAY_SIZE || *diskEnd >= SMSA_DISK_ARRAY_SIZE 
+			|| *blockStart >= SMSA_MAX_BLOCK_ID || *blockEnd >= SMSA_MAX_BLOCK_ID
+			|| *byteStart >= SMSA_BLOCK_SIZE || *byteEnd >= SMSA_BLOCK_SIZE ) {	
 		logMessage ( SMSA_MAX_ERRNO, "getDiskBlockParameters Failed. disk parameter outputs out of bounds. diskStart = [%d]. blockStart = [%d]. diskEnd = [%d]. blockEnd = [%d]. byteStart = [%d]. byteEnd = [%d]", *diskStart, *blockStart, *diskEnd, *blockEnd, *byteStart, *byteEnd );
 		return 2; 
 	}
@@ -597,15 +685,19 @@ int getDiskBlockParameters( SMSA_VIRTUAL_ADDRESS addr, uint32_t len,
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : writeLowLevel
-// Description  : This function writes a string where the drumID and blockID 
-//		    are already pointing. 
+// Description  : This function writes blocks of a drum in one operation, which
+//		  names the drum and block, so the heads do not have to be
+//		  moved first
 //
-// Inputs       : buffer - string value to be written to memory
+// Inputs       : drum - the drum to write to
+//		  block - the first block to write
+//		  count - the number of blocks, up to SMSA_NET_MAX_BLOCKS
+//		  buffer - the blocks to be written to memory
 //             
 // Outputs      : -1 if failure or 0 if successful
 //
 //
-int writeLowLevel ( unsigned char * buffer ) {
+int writeLowLevel ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char * buffer ) {
 
 	uint32_t command;	
 	ERROR_SOURCE err = 0;		 //holds return values of function calls to check for errors	
@@ -613,20 +705,17 @@ int writeLowLevel ( unsigned char * buffer ) {
 
 	//use this function to generate the command that will be passed to 
 	//the low level smsa_operation function.
-	err = generateOPCommand( &command, SMSA_DISK_WRITE, DONT_CARE, DONT_CARE, DONT_CARE );
+	err = generateOPCommand( &command, SMSA_NET_WRITE_AT, drum, DONT_CARE, block );
 
 
 	//now that command contains the value needed to choose a write 
 	//command, call the SMSA operation function with the command and buffer as parameters.
-	//After function is donebuffer will be written to the current disk and block location
-	err = smsa_client_operation( command, buffer );
+	//After function is done buffer will be written to the blocks of the drum
+	err = smsa_client_operation_blocks( command, count, buffer );
 	
 	
 	logMessage ( LOG_INFO_LEVEL, "Successfully Completed Write Of [%p]", buffer );
 
-	//Increment the position of the block head
-	head.block++;
-	
 	//check for errors. if checkForError returns 1, then
 	//there are errors, and the function will return its
 	//error number defined in the header
@@ -640,15 +729,19 @@ int writeLowLevel ( unsigned char * buffer ) {
 ////////////////////////////////////////////////////////////////////////////////
 ////
 //// Function     : readLowLevel
-//// Description  : This function reads a string where the drumID and blockID 
-////                are already pointing. 
+//// Description  : This function reads blocks of a drum in one operation, which 
+////                names the drum and block, so the heads do not have to be
+////                moved first
 ////
-//// Inputs       : buffer - string value set to the read contents of the memory
+//// Inputs       : drum - the drum to read from
+////                block - the first block to read
+////                count - the number of blocks, up to SMSA_NET_MAX_BLOCKS
+////                buffer - set to the read contents of the memory
 ////             
 //// Outputs      : -1 if failure or 0 if successful
 ////
 ////
-int readLowLevel ( unsigned char * buffer ) {
+int readLowLevel ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char * buffer ) {
 
 	uint32_t command;
 	ERROR_SOURCE err = 0;		 //holds return values of function calls to checkForErrors	
@@ -656,21 +749,18 @@ int readLowLevel ( unsigned char * buffer ) {
 
 	//use this function to generate the command that will be passed to 
 	//the low level smsa_operation function. 
-        err = generateOPCommand( &command, SMSA_DISK_READ, DONT_CARE, DONT_CARE, DONT_CARE );
+        err = generateOPCommand( &command, SMSA_NET_READ_AT, drum, DONT_CARE, block );
 
 
         //Now that command has the appropriate value to perform a read,
 	//call the SMSA operation function with the command and buffer 
 	//as parameters.After function is done buffer will contain the 
-	//value at the location of the current disk and block
-	err = smsa_client_operation( command, buffer );
+	//blocks at the drum and block
+	err = smsa_client_operation_blocks( command, count, buffer );
 
 
 	logMessage ( LOG_INFO_LEVEL, "Successfully Completed Read, buf Is Now [%p]", buffer );
 
-	
-	//Increment the position of the block head
-	head.block++;
 		
 	//check for errors. if checkForErrors returns a 1,
 	//then this function will return its assigned error number
@@ -685,41 +775,41 @@ int readLowLevel ( unsigned char * buffer ) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : seekIfNeedTo
-// Description  : Checks to see if the drum/block heads need to be set depending on 
-//		  if this is the first seek, and on the currentDrum and currentBlock
-//		  values
-// 		  
+// Function     : invalidateCachedBlocks
+// Description  : The handler the client hands the invalidations of the server to.
+//		  Another client wrote the blocks, so the copies in our cache
+//		  are old, and they are dropped
 //
-// Inputs       : currentDrum - holds the disk number that we are currently read/writing at
-//             	  currentBlock - holds the block value we are currently read/writing at
-//		  initialSeek - if true, we need to set drum and block head, otherwise
-//				just check to see if drumHead needs set	
-// Outputs      : -1 if failure or 0 if successful
+// Inputs       : drum - the drum of the blocks
+//		  block - the first block
+//		  count - the number of blocks
+// Outputs      : none
+
+void invalidateCachedBlocks ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count ) {
+
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Server Invalidated Drum [%d], Blocks [%d] to [%d]", drum, block, block+count-1 );
+
+	smsa_invalidate_cache_lines ( drum, block, count );
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
 //
-int seekIfNeedTo ( uint32_t currentDrum, uint32_t currentBlock ) {
+// Function     : pollInvalidations
+// Description  : Takes the invalidations the server sent for a drum while we were
+//		  not talking to it, so the cache is up to date before we look
+//		  in it. It does nothing unless the mount asked for them
+//
+// Inputs       : drum - the drum about to be looked up
+// Outputs      : -1 if failure or 0 if successful
 
-	ERROR_SOURCE err = 0;		 //holds return values of function calls to checkForErrors
+int pollInvalidations ( SMSA_DRUM_ID drum ) {
 
-		
-	//place both the drum and block heads in the correct position
-	//we will only change the drumHead if the currentBlock has reset
-	//to zero
-	if ( currentDrum != head.drum) {
-		setDrumHead ( currentDrum );
-		head.block = 0;
-	}
-	if ( currentBlock != head.block ) {
-		setBlockHead ( currentBlock );
-	}
-	
-	//check for errors. if checkForError returns 1, then
-	//there are errors, and the function will return its
-	//error number defined in the header
-	if ( checkForErrors ( err, "_seekIfNeedTo", DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE ) )
-		return 5; 
-	
-	return 0;	
+	if ( !coherent || drum >= SMSA_DISK_ARRAY_SIZE )
+		return 0;
+
+	return ( smsa_client_poll_invalidations ( drum ) );
 }
 
 
@@ -736,7 +826,7 @@ int seekIfNeedTo ( uint32_t currentDrum, uint32_t currentBlock ) {
 int setDrumHead ( uint32_t drumID ) {
 	
 	uint32_t command;
-	unsigned char buffer[BLOCK_SIZE];
+	unsigned char buffer[SMSA_MAX_BLOCK_SIZE];
 	ERROR_SOURCE err = 0;		 //holds return values of function calls to checkForErrors	
 
 
@@ -765,49 +855,6 @@ int setDrumHead ( uint32_t drumID ) {
 	return 0; //everything went fine
 }
 
-//////////////////////////////////////////////////////////////////////////////
-//
-// Function     : setBlockID
-// Description  : Takes a blockID and sets the block head to the specified blockID 
-//		  using the base SMSA operation function
-//
-// Inputs       : blockID - holds the block number to set the block head to 
-//             
-// Outputs      : -1 if failure or 0 if successful
-//
-//
-int setBlockHead ( uint32_t blockID ) {
-
-	uint32_t command;
- 	unsigned char buffer[BLOCK_SIZE];
-	ERROR_SOURCE err = 0;		 //holds return values of function calls to checkForErrors	
-
-
-	//use the function to generate the command that will be passed to 
-	//the low level smsa_operation function.
-	err = generateOPCommand ( &command, SMSA_SEEK_BLOCK , DONT_CARE, DONT_CARE, blockID );
-
-	//Now that command contains the proper value to seek
-	//to a block,call the SMSA operation function with the 
-	//command and buffer as parameters. After function is done,
-	//the block head will be moved to the value specified
-	err = smsa_client_operation (command, buffer );
-
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Successfully Seeked to Block [%d]", blockID );
-
-	//Adjust the position of the block head 
-	head.block = blockID;
-
-	//check for errors. if checkForError returns 1, then
-	//there are errors, and the function will return its
-	//error number defined in the header
-	if ( checkForErrors ( err, "_setBlockHead", DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE ) )
-		return 7;
- 
-	return 0; //everything went fine
-}
-
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : generateOPCommand
@@ -815,14 +862,19 @@ int setBlockHead ( uint32_t blockID ) {
 //
 // Inputs       : command - will hold decimal representation of our OP
 //                opCode - decimal of the opcode we wish to use
+//                drumID - the drum of the command
+//                reserved - not used, its bits hold the high bits of the drum and block IDs
+//                blockID - the block of the command
 // Outputs      : -1 if failure or 0 if successful
 //
 int generateOPCommand( uint32_t *command, SMSA_OPCODE opcode, SMSA_DRUM_ID drumID, SMSA_RESERVED reserved, SMSA_BLOCK_ID blockID  ) {
 	
 	//concatenates all sections of the command, in
 	//order to create on uint32_t command that can
-	//be used in the smsa_operation function
-	*command = ( ( opcode << (26) ) | ( drumID << (22) ) | ( reserved << (8) ) | ( blockID ) );        
+	//be used in the smsa_operation function. The drum
+	//and block IDs are wider than their fields were, so
+	//this lays them out the same way the server reads them
+	*command = SMSA_NET_OPERATION ( opcode, drumID, blockID );
 
 	return 0;
 }	
@@ -831,170 +883,360 @@ int generateOPCommand( uint32_t *command, SMSA_OPCODE opcode, SMSA_DRUM_ID drumI
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : saveDiskToFile
-// Description  : takes the contents of our virtual disk and writes them to a txt
-//		  file during unmount, so that they can be restored during mount
+// Description  : takes a snapshot of the array and writes it to a binary file.
+//		  Each drum is read in batches of SMSA_NET_MAX_BLOCKS blocks, and
+//		  only the runs of blocks in a batch that are not all zero are
+//		  written, each with the CRC32 of its blocks. The array is read
+//		  straight from the server, so the snapshot does not go through
+//		  the cache. It is read from a point-in-time image the server
+//		  takes, so it holds none of the writes other clients make
+//		  meanwhile, unless the server can not take one
 //
-// Inputs       : command - will hold decimal representation of our OP
-//                opCode - decimal of the opcode we wish to use
-// Outputs      : -1 if failure or 0 if successful
+// Inputs       : file - the file to write the snapshot to
+// Outputs      : 0 if successful, 1 if failure
 //
-int saveDiskToFile ( ) {
+int saveDiskToFile ( char *file ) {
 
-	logMessage ( LOG_INFO_LEVEL, "Saving memory contents... " );
-
-	int currentDisk = 0;
-	int currentBlock = 0;
-	unsigned char temp[SMSA_BLOCK_SIZE];
+	SMSA_SNAPSHOT_HEADER header;	//header of the file
+	SMSA_SNAPSHOT_RUN run;		//header of each run of blocks
+	FILE *ptr_file;
+	uint32_t currentDisk, first, count, currentBlock, start;
+	uint32_t saved = 0;		//blocks written to the file
+	uint32_t readCommand;		//SMSA_NET_SNAPSHOT_READ, or SMSA_NET_READ_AT without an image
+	int imaged, err = 0;
 
-	ERROR_SOURCE err = 0;		 //holds return values of function calls to checkForErrors
 
+	logMessage ( LOG_INFO_LEVEL, "Saving memory contents to [%s]... ", file );
 
-	//open file
-	FILE *ptr_file;
-	ptr_file = fopen ( "saved_memory.txt", "w" );
-	
-	//make sure it was opened properly
-	if ( !ptr_file ) {
-		logMessage ( SMSA_MAX_ERRNO, "_vunmount:Could not load the file to save the memory to" );
+	if ( ( ptr_file = fopen ( file, "wb" ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_saveDiskToFile:Could not open [%s] to save the memory to", file );
 		return 1;
 	}
 
+	memset ( &header, 0, sizeof(header) );
+	header.magic = SMSA_SNAPSHOT_MAGIC;
+	header.version = SMSA_SNAPSHOT_VERSION;
+	header.drums = SMSA_DISK_ARRAY_SIZE;
+	header.blocks = SMSA_MAX_BLOCK_ID;
+	header.blockSize = SMSA_BLOCK_SIZE;
+	err = writeSnapshotHeader ( ptr_file, &header );
 
-	//set drum and block head to initial states
-	seekIfNeedTo ( currentDisk, currentBlock );
-
-	while (  !( currentDisk == 16 && currentBlock == 0 ) ) {
-
-		//adjust drum and block head appropriately
-		err = seekIfNeedTo ( currentDisk, currentBlock );
+	imaged = ( smsa_client_snapshot ( 1 ) == 0 );
+	readCommand = ( imaged ) ? SMSA_NET_SNAPSHOT_READ : SMSA_NET_READ_AT;
+	if ( !imaged )
+		logMessage ( LOG_WARNING_LEVEL, "The server did not take an image, saving the array as it changes" );
 
-		//perform read at current drum and head position
-		err = readLowLevel ( temp );
-	
-		//copy the read block into ONE LINE of the
-		//text file. this is the only way that vmount
-		//will be able to recognize what is in the 
-		//file.
-		fprintf ( ptr_file, "%d", *temp );	
-	
+	for ( currentDisk = 0; currentDisk < SMSA_DISK_ARRAY_SIZE && !err; currentDisk++ ) {
+		for ( first = 0; first < SMSA_MAX_BLOCK_ID && !err; first += count ) {
 
-		//line break, since this block is done reading
-		fprintf ( ptr_file, "\n" );
+			//read a batch of the drum
+			count = ( SMSA_MAX_BLOCK_ID - first < SMSA_NET_MAX_BLOCKS ) ? SMSA_MAX_BLOCK_ID - first : SMSA_NET_MAX_BLOCKS;
+			err = smsa_client_operation_blocks ( SMSA_NET_OPERATION ( readCommand, currentDisk, first ), count, batch );
 
-	
-		//check for errors. if checkForError returns 1, then
-		//there are errors, and the function will return its
-		//error number defined in the header
-		if ( checkForErrors ( err, "_saveDiskToFile", DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE ) )
-		return 9; 
-
-		//increment block...
-		currentBlock++;		
-
-		// and check to make sure the block
-		//does not exceed 255. If it does increment the disk
-		//and set the block to 0		
-		if ( currentBlock == 256 ) {
-			currentDisk++;
+			//then write every run of blocks in it that are not all zero
 			currentBlock = 0;
+			while ( currentBlock < count && !err ) {
+
+				if ( zeroBlock ( &batch[currentBlock*SMSA_BLOCK_SIZE] ) ) {
+					currentBlock++;
+					continue;
+				}
+				start = currentBlock;
+				while ( currentBlock < count && !zeroBlock ( &batch[currentBlock*SMSA_BLOCK_SIZE] ) )
+					currentBlock++;
+
+				memset ( &run, 0, sizeof(run) );
+				run.drum = currentDisk;
+				run.block = first + start;
+				run.count = currentBlock - start;
+				run.checksum = smsa_crc32 ( &batch[start*SMSA_BLOCK_SIZE], run.count*SMSA_BLOCK_SIZE );
+				if ( writeSnapshotRun ( ptr_file, &run ) ||
+						fwrite ( &batch[start*SMSA_BLOCK_SIZE], SMSA_BLOCK_SIZE, run.count, ptr_file ) != run.count )
+					err = 1;
+				saved += run.count;
+			}
 		}
+	}
 
-		
-		
+	if ( imaged )
+		smsa_client_snapshot ( 0 );
+
+	//a run of no blocks ends the snapshot, so a cut off file is never restored
+	memset ( &run, 0, sizeof(run) );
+	if ( !err )
+		err = writeSnapshotRun ( ptr_file, &run );
+	if ( fclose ( ptr_file ) )
+		err = 1;
+
+	if ( err ) {
+		logMessage ( LOG_ERROR_LEVEL, "_saveDiskToFile:Failed to save the memory to [%s]", file );
+		return 1;
 	}
-	fclose(ptr_file);
-	
-	logMessage ( LOG_INFO_LEVEL, "Successfully saved memory contents to file, [%d] [%d]", currentDisk, currentBlock );
-	return 0;		
+
+	logMessage ( LOG_INFO_LEVEL, "Successfully saved memory contents to [%s], %u blocks that are not zero", file, saved );
+	return 0;
 }
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : restoreDiskFromFile
-// Description  : runs through a file, and restores the memory that was saved on
-//		  this file to the memory.
+// Description  : restores the array from a snapshot taken by saveDiskToFile. 
+//		  Every drum is formatted, then the file is read a run at a time,
+//		  and each run is checked against its checksum before it is 
+//		  written back. A damaged or cut off file formats the array again,
+//		  so it is left empty rather than half restored. The cache is 
+//		  dropped, since the array changed under it
 //
-// Inputs       : command - will hold decimal representation of our OP
-//                opCode - decimal of the opcode we wish to use
-// Outputs      : -1 if failure or 0 if successful
+// Inputs       : file - the file to restore the snapshot from
+// Outputs      : 0 if successful, 1 if failure
 //
-int restoreDiskFromFile () {
+int restoreDiskFromFile ( char *file ) {
 
+	SMSA_SNAPSHOT_HEADER header;	//header of the file
+	SMSA_SNAPSHOT_RUN run;		//header of each run of blocks
+	FILE *ptr_file;
+	uint32_t currentDisk;
+	uint32_t restored = 0;		//blocks written back
+	int damaged = 0;		//true once a run did not check out
+	int err = 0;
 
-	logMessage ( LOG_INFO_LEVEL, "Restoring memory contents... " );
 
-	int currentDisk = 0;
-	int currentBlock = 0;
-	unsigned char temp[SMSA_BLOCK_SIZE];
+	logMessage ( LOG_INFO_LEVEL, "Restoring memory contents from [%s]... ", file );
 
-	ERROR_SOURCE err = 0;		 //holds return values of function calls to checkForErrors	
+	if ( ( ptr_file = fopen ( file, "rb" ) ) == NULL ) {
+		logMessage ( LOG_INFO_LEVEL, "_restoreDiskFromFile:Could not open [%s] to restore memory from", file );
+		return 1;
+	}
 
+	if ( readSnapshotHeader ( ptr_file, &header ) || header.magic != SMSA_SNAPSHOT_MAGIC || header.version != SMSA_SNAPSHOT_VERSION ||
+			header.drums != SMSA_DISK_ARRAY_SIZE || header.blocks != SMSA_MAX_BLOCK_ID ||
+			header.blockSize != SMSA_BLOCK_SIZE ) {
+		logMessage ( LOG_ERROR_LEVEL, "_restoreDiskFromFile:[%s] is not a snapshot of this array", file );
+		fclose ( ptr_file );
+		return 1;
+	}
 
-	//open file
-	FILE *ptr_file;
-	ptr_file = fopen ( "saved_memory.txt", "r" );
-	
-	//make sure it was opened properly
-	if ( !ptr_file ) {
-		logMessage ( SMSA_MAX_ERRNO, "_vmount:Could not load the file to restore memory from" );
+	err = formatArray ();
+
+	//each run fits in the batch, and is only written once its blocks
+	//match the checksum
+	while ( !err ) {
+
+		if ( readSnapshotRun ( ptr_file, &run ) ) {
+			damaged = 1;
+			break;
+		}
+		if ( run.count == 0 )
+			break;
+
+		if ( run.drum >= SMSA_DISK_ARRAY_SIZE || run.count > SMSA_NET_MAX_BLOCKS || run.block >= SMSA_MAX_BLOCK_ID ||
+				run.count > SMSA_MAX_BLOCK_ID - run.block ||
+				fread ( batch, SMSA_BLOCK_SIZE, run.count, ptr_file ) != run.count ||
+				smsa_crc32 ( batch, run.count*SMSA_BLOCK_SIZE ) != run.checksum ) {
+			damaged = 1;
+			break;
+		}
+
+		err = smsa_client_operation_blocks ( SMSA_NET_OPERATION ( SMSA_NET_WRITE_AT, run.drum, run.block ), run.count, batch );
+		restored += run.count;
+	}
+	fclose ( ptr_file );
+
+	if ( damaged ) {
+		formatArray ();
+		err = 1;
+	}
+
+	for ( currentDisk = 0; currentDisk < SMSA_DISK_ARRAY_SIZE; currentDisk++ )
+		smsa_invalidate_cache_lines ( currentDisk, 0, SMSA_MAX_BLOCK_ID );
+
+	if ( err ) {
+		logMessage ( LOG_ERROR_LEVEL, "_restoreDiskFromFile:Failed to restore memory from [%s]%s", file,
+				( damaged ) ? ", it is damaged or cut off" : "" );
 		return 1;
 	}
 
-	//make sure drum and block head are initially set properly
-	err = seekIfNeedTo ( currentDisk, currentBlock );
+	logMessage ( LOG_INFO_LEVEL, "Successfully restored memory contents from [%s], %u blocks that are not zero", file, restored );
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : formatArray
+// Description  : formats every drum of the array, leaving the heads on the
+//		  first drum
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+//
+int formatArray ( void ) {
+
+	uint32_t currentDisk, command;
+	int err = 0;
+
+	for ( currentDisk = 0; currentDisk < SMSA_DISK_ARRAY_SIZE && !err; currentDisk++ ) {
+		generateOPCommand ( &command, SMSA_FORMAT_DRUM, DONT_CARE, DONT_CARE, DONT_CARE );
+		err = setDrumHead ( currentDisk ) || smsa_client_operation ( command, NULL );
+	}
+	head.drum = 0;
+	head.block = 0;
+
+	return err;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSnapshotHeader
+// Description  : writes the header of a snapshot file, a field at a time in
+//		  network byte order
+//
+// Inputs       : file - the snapshot file
+//		  header - the header
+// Outputs      : 0 if successful, 1 if failure
+//
+int writeSnapshotHeader ( FILE *file, SMSA_SNAPSHOT_HEADER *header ) {
+
+	unsigned char buf[SMSA_SNAPSHOT_HEADER_SIZE];
+	uint32_t word;
+	uint16_t half;
+
+	word = htonl ( header->magic );
+	memcpy ( &buf[0], &word, 4 );
+	half = htons ( header->version );
+	memcpy ( &buf[4], &half, 2 );
+	half = htons ( header->blockSize );
+	memcpy ( &buf[6], &half, 2 );
+	word = htonl ( header->drums );
+	memcpy ( &buf[8], &word, 4 );
+	word = htonl ( header->blocks );
+	memcpy ( &buf[12], &word, 4 );
+
+	return ( fwrite ( buf, sizeof(buf), 1, file ) != 1 );
+}
+
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSnapshotHeader
+// Description  : reads the header of a snapshot file written by
+//		  writeSnapshotHeader
+//
+// Inputs       : file - the snapshot file
+//		  header - will hold the header
+// Outputs      : 0 if successful, 1 if failure
+//
+int readSnapshotHeader ( FILE *file, SMSA_SNAPSHOT_HEADER *header ) {
 
-	while ( currentDisk != 16 ) {
+	unsigned char buf[SMSA_SNAPSHOT_HEADER_SIZE];
+	uint32_t word;
+	uint16_t half;
 
-		
-		//adjust drum and block head appropriatly
-		err = seekIfNeedTo ( currentDisk, currentBlock );
-
-
-		int tempInt;
-		//this conditional grabs the entire line of the text
-		//file we have open, and stores it in temp. If the 
-		//line is empty, fgets returns NULL, and therefore we
-		//must set the temp array to all zeros. If the line 
-		//is not empty, then temp contains the values we need
-		//to write to the currentblock.
-		fscanf ( ptr_file, "%d", &tempInt );
-		*temp = tempInt;
-		logMessage ( LOG_INFO_LEVEL,"temp = %d\n", *temp );	
-	
-		//now since the drum and block head are both set to the 
-		//appropriate postion, and the temp string contains all 
-		//of the contents that we want to write at this particular
-		//block, we can call a write
-		err = writeLowLevel ( temp );
-
-		//check for errors. if checkForError returns 1, then
-		//there are errors, and the function will return its
-		//error number defined in the header
-		if ( checkForErrors ( err, "_restoreDiskFromFile", DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE, DONT_CARE ) )
-			return 10; 
-
-
-		//increment block...
-		currentBlock++;		
-
-		// and check to make sure the block
-		//does not exceed 255. If it does increment the disk
-		//and set the block to 0		
-		if ( currentBlock == SMSA_BLOCK_SIZE ) {
-			currentDisk++;
-			currentBlock = 0;
-		}
-	
-	}	
-	fclose(ptr_file);
+	if ( fread ( buf, sizeof(buf), 1, file ) != 1 )
+		return 1;
+
+	memcpy ( &word, &buf[0], 4 );
+	header->magic = ntohl ( word );
+	memcpy ( &half, &buf[4], 2 );
+	header->version = ntohs ( half );
+	memcpy ( &half, &buf[6], 2 );
+	header->blockSize = ntohs ( half );
+	memcpy ( &word, &buf[8], 4 );
+	header->drums = ntohl ( word );
+	memcpy ( &word, &buf[12], 4 );
+	header->blocks = ntohl ( word );
+
+	return 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSnapshotRun
+// Description  : writes the header of a run of blocks to a snapshot file, a
+//		  field at a time in network byte order
+//
+// Inputs       : file - the snapshot file
+//		  run - the header of the run
+// Outputs      : 0 if successful, 1 if failure
+//
+int writeSnapshotRun ( FILE *file, SMSA_SNAPSHOT_RUN *run ) {
+
+	unsigned char buf[SMSA_SNAPSHOT_RUN_SIZE];
+	uint32_t word;
+	uint16_t half;
+
+	half = htons ( run->drum );
+	memcpy ( &buf[0], &half, 2 );
+	half = htons ( run->pad );
+	memcpy ( &buf[2], &half, 2 );
+	word = htonl ( run->block );
+	memcpy ( &buf[4], &word, 4 );
+	word = htonl ( run->count );
+	memcpy ( &buf[8], &word, 4 );
+	word = htonl ( run->checksum );
+	memcpy ( &buf[12], &word, 4 );
+
+	return ( fwrite ( buf, sizeof(buf), 1, file ) != 1 );
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSnapshotRun
+// Description  : reads the header of a run of blocks written by writeSnapshotRun
+//
+// Inputs       : file - the snapshot file
+//		  run - will hold the header of the run
+// Outputs      : 0 if successful, 1 if failure
+//
+int readSnapshotRun ( FILE *file, SMSA_SNAPSHOT_RUN *run ) {
+
+	unsigned char buf[SMSA_SNAPSHOT_RUN_SIZE];
+	uint32_t word;
+	uint16_t half;
+
+	if ( fread ( buf, sizeof(buf), 1, file ) != 1 )
+		return 1;
+
+	memcpy ( &half, &buf[0], 2 );
+	run->drum = ntohs ( half );
+	memcpy ( &half, &buf[2], 2 );
+	run->pad = ntohs ( half );
+	memcpy ( &word, &buf[4], 4 );
+	run->block = ntohl ( word );
+	memcpy ( &word, &buf[8], 4 );
+	run->count = ntohl ( word );
+	memcpy ( &word, &buf[12], 4 );
+	run->checksum = ntohl ( word );
 
-	logMessage ( LOG_INFO_LEVEL, "Successfully restored memory contents from file" );
 	return 0;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : zeroBlock
+// Description  : tells if every byte of a block is zero
+//
+// Inputs       : block - the block
+// Outputs      : 1 if it is all zero, 0 if not
+//
+int zeroBlock ( unsigned char *block ) {
+
+	int i;
+
+	for ( i = 0; i < SMSA_BLOCK_SIZE; i++ ) {
+		if ( block[i] != 0 )
+			return 0;
+	}
+
+	return 1;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : getMemCpyBounds
@@ -1062,7 +1304,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 	switch ( err ) {
 		
 		case 1: if ( DEBUG ) {		
-				logMessage ( SMSA_MAX_ERRNO,  "smsa_operation failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "smsa_operation failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {
 					logMessage ( SMSA_MAX_ERRNO,  "smsa_operation function failed during %s", currentFunction );	
@@ -1070,7 +1312,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 2: if ( DEBUG ) {
-				logMessage ( SMSA_MAX_ERRNO,  " getDiskBlockParameters failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  " getDiskBlockParameters failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {
 				logMessage ( SMSA_MAX_ERRNO,  "getDiskBlockParameters function failed during %s", currentFunction );
@@ -1078,7 +1320,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 	
 		case 3: if ( DEBUG ) {
-				logMessage ( SMSA_MAX_ERRNO,  "writeLowLevel failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "writeLowLevel failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {	
 				logMessage ( SMSA_MAX_ERRNO,  "writeLowLevel function failed during %s", currentFunction );
@@ -1086,7 +1328,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 4: if ( DEBUG ) { 
-				logMessage ( SMSA_MAX_ERRNO,  "readLowLevel failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "readLowLevel failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 
 			}
 			else {	
@@ -1095,7 +1337,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			}	
 	
 		case 5: if ( DEBUG ) {	
-				logMessage ( SMSA_MAX_ERRNO,  "seekIfNeedTo failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "seekIfNeedTo failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {	
 				logMessage ( SMSA_MAX_ERRNO,  "seekIfNeedTo function failed during %s", currentFunction );
@@ -1103,7 +1345,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 6: if ( DEBUG ) {	
-				logMessage ( SMSA_MAX_ERRNO,  "setDrumHead failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "setDrumHead failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {
 				logMessage ( SMSA_MAX_ERRNO,  "setDrumHead function failed during %s", currentFunction );
@@ -1111,7 +1353,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 7: if ( DEBUG ) {
-				logMessage ( SMSA_MAX_ERRNO,  "setBlockHead failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "setBlockHead failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {	
 				logMessage ( SMSA_MAX_ERRNO,  "setBlockHead function failed during %s", currentFunction );
@@ -1119,7 +1361,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 8: if ( DEBUG ) {	
-				logMessage ( SMSA_MAX_ERRNO,  "generateOPCommand failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "generateOPCommand failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else {	
 				logMessage ( SMSA_MAX_ERRNO,  "generateOPCommand function failed during %s", currentFunction );
@@ -1128,7 +1370,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 	
 		case 9: if ( DEBUG ) {	
-				logMessage ( SMSA_MAX_ERRNO,  "saveDiskToFile function failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
+				logMessage ( SMSA_MAX_ERRNO,  "saveDiskToFile function failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd );
 			}
 			else { 
 				logMessage ( SMSA_MAX_ERRNO,  "saveDiskToFile function failed during %s", currentFunction );
@@ -1136,7 +1378,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 10: if ( DEBUG ) {	
-				logMessage ( SMSA_MAX_ERRNO,  "restoreDiskFromFile function failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd ); 
+				logMessage ( SMSA_MAX_ERRNO,  "restoreDiskFromFile function failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd ); 
 			}
 			else {
 				logMessage ( SMSA_MAX_ERRNO,  "restoreDiskFromFile function failed during %s", currentFunction );
@@ -1144,7 +1386,7 @@ int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRE
 			return 1;
 
 		case 11: if ( DEBUG ) {	
-				logMessage ( SMSA_MAX_ERRNO,  "smsa_put_cache_line function failed during %s.\n				addr = [%d]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd ); 
+				logMessage ( SMSA_MAX_ERRNO,  "smsa_put_cache_line function failed during %s.\n				addr = [%llu]\n				len = [%d].\n				diskStart = [%d].\n				blockStart = [%d].\n				currentDisk = [%d].\n				currentBlock = [%d].\n				diskEnd = [%d].\n				blockEnd = [%d]", currentFunction, (unsigned long long)addr, len, diskStart, blockStart, currentDisk, currentBlock, diskEnd, blockEnd ); 
 			}
 			else {
 				logMessage ( SMSA_MAX_ERRNO,  "smsa_put_cache_line function failed during %s", currentFunction );
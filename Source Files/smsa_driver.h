@@ -12,14 +12,16 @@
 
 // Include Files
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
 // Project Include Files
 #include <smsa.h>
+#include <smsa_network.h>
 
 //
 // Type Definitions
-typedef uint32_t SMSA_VIRTUAL_ADDRESS; // SMSA Driver Virtual Addresses
+typedef uint64_t SMSA_VIRTUAL_ADDRESS; // SMSA Driver Virtual Addresses
 typedef uint32_t SMSA_OPCODE;
 typedef uint32_t SMSA_RESERVED;
 
@@ -54,11 +56,62 @@ typedef struct {
 } diskHead; 
 
 
+//snapshots taken by saveDiskToFile start with this header. In the file each
+//field is in network byte order, one after the other in the order below with
+//nothing between them, SMSA_SNAPSHOT_HEADER_SIZE bytes in all
+#define SMSA_SNAPSHOT_MAGIC 0x534d5350		// "SMSP"
+#define SMSA_SNAPSHOT_VERSION 3
+#define SMSA_SNAPSHOT_HEADER_SIZE 16
+typedef struct {
+	uint32_t	magic;		// SMSA_SNAPSHOT_MAGIC
+	uint16_t	version;	// SMSA_SNAPSHOT_VERSION
+	uint16_t	blockSize;	// bytes in each block
+	uint32_t	drums;		// drums in the array
+	uint32_t	blocks;		// blocks in each drum
+} SMSA_SNAPSHOT_HEADER;
+
+//then each run of up to SMSA_NET_MAX_BLOCKS blocks that are not all zero is
+//this header, laid out the same way in SMSA_SNAPSHOT_RUN_SIZE bytes, followed
+//by its blocks. A run of no blocks ends the snapshot
+#define SMSA_SNAPSHOT_RUN_SIZE 16
+typedef struct {
+	uint16_t	drum;		// drum of the run
+	uint16_t	pad;		// always 0
+	uint32_t	block;		// first block of the run
+	uint32_t	count;		// blocks in the run
+	uint32_t	checksum;	// CRC32 of the blocks of the run
+} SMSA_SNAPSHOT_RUN;
+
+
+//options given to smsa_vmount_options. smsa_vmount uses the defaults
+typedef struct {
+	int		cache_size;	// number of lines in the block cache
+	char		*server_ip;	// server host name or IPv4/IPv6 address ( NULL for environment/default )
+	uint16_t	server_port;	// server port ( 0 for environment/default )
+	SMSA_TRANSPORT	transport;	// how to talk to the server ( SMSA_TRANSPORT_DEFAULT for environment/default )
+	int		connections;	// connections to spread the drums over ( 0 for environment/default )
+	int		protocol;	// highest protocol version to ask for ( 0 for environment/default )
+	int		checksums;	// true to ask for checksums on the blocks ( version 2 )
+	int		compression;	// true to ask for the blocks to be compressed ( version 2 )
+	int		coherent;	// true to have the server say when others write cached blocks ( version 2 )
+	char		*replicas;	// comma separated host:port of the replicas to read from ( NULL for environment/none )
+	SMSA_CONSISTENCY consistency;	// what a read from a replica has to see ( SMSA_CONSISTENCY_DEFAULT for environment/default )
+	char		*shards;	// shard map of the servers the drums are spread over ( NULL for environment/none )
+	uint32_t	timeout;	// msec to wait for a response from the server ( 0 for environment/default )
+	int		no_hedging;	// true to never send a slow read again over another connection
+	char		*snapshot;	// file the array is restored from on mount and saved to on unmount ( NULL for none )
+	int		export;		// true to have the server write an image of the array to its export file on unmount
+} SMSA_MOUNT_OPTIONS;
+
+
 
 // Interfaces
 int smsa_vmount( int cache_size );
 	// Mount the SMSA disk array virtual address space
 
+int smsa_vmount_options( SMSA_MOUNT_OPTIONS *options );
+	// Mount the SMSA disk array virtual address space with the given options
+
 int smsa_vunmount( void );
 	// Unmount the SMSA disk array virtual address space
 
@@ -81,36 +134,55 @@ int getDiskBlockParameters( SMSA_VIRTUAL_ADDRESS addr, uint32_t len,
 				uint32_t *byteStart, uint32_t *byteEnd );
 	//generates usable indexes to target disks and blocks
 
-int writeLowLevel ( unsigned char* buffer );
-	//writes to an already set drum head and block head the contents of buffer	
+int writeLowLevel ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char* buffer );
+	//writes count blocks of a drum from buffer in one operation
 
-int readLowLevel ( unsigned char* buffer );
-	//reads to an already set drum head and block head and puts it in buffer
-
-int seekIfNeedTo ( uint32_t currentDrum, uint32_t currentBlock );
-	//sets the drum and block head appropriately
+int readLowLevel ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char* buffer );
+	//reads count blocks of a drum into buffer in one operation
 
 int setDrumHead ( uint32_t drumID );
 	//sets the drum head to the specified drumID
 
-int setBlockHead ( uint32_t blockID );
-	//sets the block head to the specified blockID
-
 int generateOPCommand( uint32_t *command, SMSA_OPCODE opcode, SMSA_DRUM_ID drumID, 
 	       			SMSA_RESERVED reserved, SMSA_BLOCK_ID blockID );
 	//generates op parameter for smsa_util command
 
-int saveDiskToFile ( );
-	//saves all of the contents of the current memory to a text file
+int saveDiskToFile ( char *file );
+	//saves the blocks of the array that are not zero to a binary snapshot file
 
-int restoreDiskFromFile ( );
-	//loads the contents of a file into the disk memory
+int restoreDiskFromFile ( char *file );
+	//loads a snapshot file into the array, checking each run before it is written
+
+int formatArray ( void );
+	//formats every drum of the array
+
+int writeSnapshotHeader ( FILE *file, SMSA_SNAPSHOT_HEADER *header );
+	//writes the header of a snapshot file in network byte order
+
+int readSnapshotHeader ( FILE *file, SMSA_SNAPSHOT_HEADER *header );
+	//reads the header of a snapshot file
+
+int writeSnapshotRun ( FILE *file, SMSA_SNAPSHOT_RUN *run );
+	//writes the header of a run of blocks in network byte order
+
+int readSnapshotRun ( FILE *file, SMSA_SNAPSHOT_RUN *run );
+	//reads the header of a run of blocks
+
+int zeroBlock ( unsigned char *block );
+	//tells if every byte of a block is zero
 
 
 int findMemCpyBounds ( uint32_t startDrum, uint32_t startBlock, uint32_t byteStart, uint32_t currentDrum, uint32_t currentBlock, uint32_t endDrum, uint32_t endBlock, uint32_t endByte, uint32_t* lowerBound, uint32_t* upperbound );
 	//finds the upper and lower bounds of the memcpy function based on start and end parameters
 
 
+void invalidateCachedBlocks ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count );
+	//drops blocks another client wrote from the cache, when the server says so
+
+int pollInvalidations ( SMSA_DRUM_ID drum );
+	//takes the invalidations the server sent for a drum, before its blocks are looked up in the cache
+
+
 int checkForErrors ( ERROR_SOURCE err, char* currentFunction, SMSA_VIRTUAL_ADDRESS addr,  uint32_t len,  uint32_t diskStart,  
 					uint32_t blockStart,  uint32_t currentDisk,  uint32_t currentBlock, 
 					uint32_t diskEnd, uint32_t blockEnd);
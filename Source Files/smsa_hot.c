@@ -0,0 +1,403 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_hot.c
+//  Description   : This is the hot block cache of the SMSA server. Every client
+//		    has its own block cache in its driver, but blocks that many
+//		    clients read still miss in each of those once, and each miss
+//		    is a read of the array. The server keeps the blocks it reads
+//		    here, in front of the array, so only the first of those reads
+//		    goes to the array.
+//
+//		    The cache is set associative, with SMSA_HOT_WAYS lines in a
+//		    set, and the least recently used line of a set is replaced.
+//		    It stays coherent with the array because every write that
+//		    hits a cached block replaces it, a format drops the blocks of
+//		    its drum, and mounting or unmounting the array drops them all.
+//		    The workers fill and update it under the lock of the drum, so
+//		    a read that misses can not put back a block that a write has
+//		    already replaced.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+#include <smsa_hot.h>
+#include <cmpsc311_log.h>
+
+
+// Global Variables
+SMSA_HOT_LINE *hotLines = NULL;				//the lines of the cache, a set after another ( NULL if there is no cache )
+unsigned char *hotData = NULL;				//the blocks of the lines, one after another
+uint32_t hotSets = 0;					//number of sets in hotLines
+uint64_t hotTick = 0;					//counts the uses of the cache, for finding the least recently used
+SMSA_SERVER_CACHE_STATS hotStats;			//what the cache has done so far
+pthread_mutex_t hotLock = PTHREAD_MUTEX_INITIALIZER;	//held while the cache is used
+
+
+//Functional Prototypes
+SMSA_HOT_LINE *hotSet ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block );
+SMSA_HOT_LINE *hotFind ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_init
+// Description  : Sets up the hot block cache. The number of lines is rounded up
+//		  to a whole number of sets.
+//
+// Inputs       : lines - the number of blocks the cache holds
+// Outputs      : 0 if successful, 1 if failure
+
+int smsa_hot_init ( uint32_t lines ) {
+
+	uint32_t i;
+
+	hotSets = ( lines + SMSA_HOT_WAYS - 1 ) / SMSA_HOT_WAYS;
+	if ( ( hotLines = calloc ( hotSets * SMSA_HOT_WAYS, sizeof(SMSA_HOT_LINE) ) ) == NULL ||
+			( hotData = malloc ( (size_t)hotSets * SMSA_HOT_WAYS * SMSA_BLOCK_SIZE ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_hot_init:Failed to allocate [%u] lines [%s]", lines, strerror(errno) );
+		free ( hotLines );
+		hotLines = NULL;
+		hotSets = 0;
+		return 1;
+	}
+	for ( i = 0; i < hotSets * SMSA_HOT_WAYS; i++ )
+		hotLines[i].data = &hotData[(size_t)i*SMSA_BLOCK_SIZE];
+
+	memset ( &hotStats, 0, sizeof(hotStats) );
+	hotStats.lines = hotSets * SMSA_HOT_WAYS;
+	hotTick = 0;
+
+	logMessage ( LOG_INFO_LEVEL, "Hot Block Cache Initialized To a Size Of [%u]", hotSets * SMSA_HOT_WAYS );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_close
+// Description  : Frees the hot block cache
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_hot_close ( void ) {
+
+	free ( hotLines );
+	free ( hotData );
+	hotLines = NULL;
+	hotData = NULL;
+	hotSets = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_enabled
+// Description  : Tells if the hot block cache is set up
+//
+// Inputs       : none
+// Outputs      : 1 if it is, 0 if not
+
+int smsa_hot_enabled ( void ) {
+
+	return ( hotLines != NULL );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_get
+// Description  : Copies a block out of the cache, if it is there. The time it
+//		  took is added to the time spent on hits.
+//
+// Inputs       : drum - the drum of the block
+//		  block - the block
+//		  buf - will hold the block
+// Outputs      : 0 if it was there, 1 if not
+
+int smsa_hot_get ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf ) {
+
+	SMSA_HOT_LINE *line;	//the line that holds the block
+	uint64_t start;		//when the lookup started
+
+
+	if ( hotLines == NULL )
+		return 1;
+
+	start = smsa_hot_now ();
+	pthread_mutex_lock ( &hotLock );
+	hotStats.lookups++;
+	if ( ( line = hotFind ( drum, block ) ) == NULL ) {
+		pthread_mutex_unlock ( &hotLock );
+		return 1;
+	}
+	memcpy ( buf, line->data, SMSA_BLOCK_SIZE );
+	line->used = ++hotTick;
+	hotStats.hits++;
+	hotStats.hitNanos += smsa_hot_now () - start;
+	pthread_mutex_unlock ( &hotLock );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_fill
+// Description  : Puts a block that missed in the cache, once it has been read
+//		  from the array. It replaces the least recently used line of its
+//		  set, unless the block is already there ( another read of it
+//		  missed at the same time ).
+//
+// Inputs       : drum - the drum of the block
+//		  block - the block
+//		  buf - the block that was read
+//		  nanos - how long the read of the array took
+// Outputs      : none
+
+void smsa_hot_fill ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf, uint64_t nanos ) {
+
+	SMSA_HOT_LINE *set;	//the set the block goes in
+	SMSA_HOT_LINE *line;	//the line it goes in
+	int i;
+
+
+	if ( hotLines == NULL )
+		return;
+
+	pthread_mutex_lock ( &hotLock );
+	hotStats.missNanos += nanos;
+
+	if ( ( line = hotFind ( drum, block ) ) == NULL ) {
+		set = hotSet ( drum, block );
+		line = &set[0];
+		for ( i = 0; i < SMSA_HOT_WAYS && line->valid; i++ ) {
+			if ( !set[i].valid || set[i].used < line->used )
+				line = &set[i];
+		}
+		if ( line->valid )
+			hotStats.evictions++;
+		else
+			hotStats.used++;
+		line->drum = drum;
+		line->block = block;
+		line->valid = 1;
+		hotStats.fills++;
+	}
+	memcpy ( line->data, buf, SMSA_BLOCK_SIZE );
+	line->used = ++hotTick;
+	pthread_mutex_unlock ( &hotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_update
+// Description  : Replaces a cached block with what was just written over it. A
+//		  block that is not cached is left out, so writes do not push the
+//		  blocks that are being read out of the cache.
+//
+// Inputs       : drum - the drum of the block
+//		  block - the block
+//		  buf - the block that was written
+// Outputs      : none
+
+void smsa_hot_update ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf ) {
+
+	SMSA_HOT_LINE *line;	//the line that holds the block
+
+
+	if ( hotLines == NULL )
+		return;
+
+	pthread_mutex_lock ( &hotLock );
+	if ( ( line = hotFind ( drum, block ) ) != NULL ) {
+		memcpy ( line->data, buf, SMSA_BLOCK_SIZE );
+		hotStats.updates++;
+	}
+	pthread_mutex_unlock ( &hotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_invalidate_drum
+// Description  : Drops every cached block of a drum, after it was formatted
+//
+// Inputs       : drum - the drum
+// Outputs      : none
+
+void smsa_hot_invalidate_drum ( SMSA_DRUM_ID drum ) {
+
+	uint32_t i;
+
+	if ( hotLines == NULL )
+		return;
+
+	pthread_mutex_lock ( &hotLock );
+	for ( i = 0; i < hotSets * SMSA_HOT_WAYS; i++ ) {
+		if ( hotLines[i].valid && hotLines[i].drum == drum ) {
+			hotLines[i].valid = 0;
+			hotStats.used--;
+			hotStats.invalidations++;
+		}
+	}
+	pthread_mutex_unlock ( &hotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_clear
+// Description  : Drops every cached block, when the array is mounted or unmounted
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_hot_clear ( void ) {
+
+	uint32_t i;
+
+	if ( hotLines == NULL )
+		return;
+
+	pthread_mutex_lock ( &hotLock );
+	for ( i = 0; i < hotSets * SMSA_HOT_WAYS; i++ ) {
+		if ( hotLines[i].valid ) {
+			hotLines[i].valid = 0;
+			hotStats.invalidations++;
+		}
+	}
+	hotStats.used = 0;
+	pthread_mutex_unlock ( &hotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_stats
+// Description  : Gives the stats of the cache. They are all 0 if there is no cache
+//
+// Inputs       : stats - will hold the stats
+// Outputs      : none
+
+void smsa_hot_stats ( SMSA_SERVER_CACHE_STATS *stats ) {
+
+	pthread_mutex_lock ( &hotLock );
+	*stats = hotStats;
+	pthread_mutex_unlock ( &hotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_hot_stats
+// Description  : Logs the hit ratio of the cache, and how long hits and misses
+//		  took. It logs nothing if no read was ever looked up
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_log_hot_stats ( void ) {
+
+	SMSA_SERVER_CACHE_STATS stats;
+	uint64_t misses;
+
+	smsa_hot_stats ( &stats );
+	if ( stats.lookups == 0 )
+		return;
+
+	misses = stats.lookups - stats.hits;
+	logMessage ( LOG_OUTPUT_LEVEL, "Server cache hits %llu of %llu reads (%.1f%%), %.0f ns per hit, %.0f ns per miss",
+			(unsigned long long)stats.hits, (unsigned long long)stats.lookups, 100.0*stats.hits/stats.lookups,
+			( stats.hits > 0 ) ? (double)stats.hitNanos/stats.hits : 0.0,
+			( misses > 0 ) ? (double)stats.missNanos/misses : 0.0 );
+	logMessage ( LOG_OUTPUT_LEVEL, "Server cache %llu fills, %llu updates, %llu evictions, %llu invalidations, %llu of %llu lines used",
+			(unsigned long long)stats.fills, (unsigned long long)stats.updates, (unsigned long long)stats.evictions,
+			(unsigned long long)stats.invalidations, (unsigned long long)stats.used, (unsigned long long)stats.lines );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_hot_now
+// Description  : Gives the time in nanoseconds, from a clock that only moves
+//		  forward. It is only good for measuring how long things take.
+//
+// Inputs       : none
+// Outputs      : the time
+
+uint64_t smsa_hot_now ( void ) {
+
+	struct timespec now;
+
+	clock_gettime ( CLOCK_MONOTONIC, &now );
+	return ( (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hotSet
+// Description  : Gives the set a block belongs in. The drum and block are
+//		  hashed, so that the blocks at the same place on different drums
+//		  do not all land in the same set.
+//
+// Inputs       : drum - the drum of the block
+//		  block - the block
+// Outputs      : the first line of the set
+
+SMSA_HOT_LINE *hotSet ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block ) {
+
+	uint32_t key = ( (uint32_t)drum << 18 ) | block;
+
+	return ( &hotLines[ ( ( key * 2654435761u ) >> 7 ) % hotSets * SMSA_HOT_WAYS ] );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hotFind
+// Description  : Finds the line that holds a block. hotLock has to be held.
+//
+// Inputs       : drum - the drum of the block
+//		  block - the block
+// Outputs      : the line, NULL if the block is not cached
+
+SMSA_HOT_LINE *hotFind ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block ) {
+
+	SMSA_HOT_LINE *set = hotSet ( drum, block );
+	int i;
+
+	for ( i = 0; i < SMSA_HOT_WAYS; i++ ) {
+		if ( set[i].valid && set[i].drum == drum && set[i].block == block )
+			return ( &set[i] );
+	}
+
+	return ( NULL );
+}
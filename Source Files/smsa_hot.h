@@ -0,0 +1,74 @@
+#ifndef SMSA_HOT_INCLUDED
+#define SMSA_HOT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_hot.h
+//  Description    : This is the hot block cache of the SMSA server. It sits in
+//                   front of the disk array and is shared by every client, see
+//                   smsa_hot.c.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+
+// Defines
+#define SMSA_HOT_WAYS 4			// lines in each set of the cache
+
+//
+// Type Definitions
+
+// This is one line of the hot block cache
+typedef struct {
+	SMSA_DRUM_ID	drum;		// drum of the block in the line
+	SMSA_BLOCK_ID	block;		// block in the line
+	int		valid;		// true while the line holds a block
+	uint64_t	used;		// when the line was last used, in cache ticks
+	unsigned char	*data;		// the block, SMSA_BLOCK_SIZE bytes of hotData
+} SMSA_HOT_LINE;
+
+
+//
+// Funtional Prototypes
+
+// Set up the hot block cache with room for a number of blocks
+int smsa_hot_init ( uint32_t lines );
+
+// Free the hot block cache
+void smsa_hot_close ( void );
+
+// Tell if the hot block cache is set up
+int smsa_hot_enabled ( void );
+
+// Copy a block out of the cache, fails if it is not there
+int smsa_hot_get ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf );
+
+// Put a block that was just read from the array in the cache
+void smsa_hot_fill ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf, uint64_t nanos );
+
+// Replace a cached block with what was just written over it
+void smsa_hot_update ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf );
+
+// Drop every cached block of a drum
+void smsa_hot_invalidate_drum ( SMSA_DRUM_ID drum );
+
+// Drop every cached block
+void smsa_hot_clear ( void );
+
+// Get the stats of the cache
+void smsa_hot_stats ( SMSA_SERVER_CACHE_STATS *stats );
+
+// Log the stats of the cache, if it was used
+void smsa_log_hot_stats ( void );
+
+// Get the time in nanoseconds, for timing the reads of the misses
+uint64_t smsa_hot_now ( void );
+
+#endif
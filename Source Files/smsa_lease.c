@@ -0,0 +1,236 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_lease.c
+//  Description   : This is the lease directory of the SMSA server. The driver of
+//		    every client keeps its own block cache, and once more than
+//		    one client has the array mounted, a block one of them caches
+//		    can be written by another. A client that asks for
+//		    SMSA_NET_FLAG_INVALIDATE gets a lease on every block it reads
+//		    or writes, and when another connection writes the block, or
+//		    formats its drum, the lease is revoked and the server sends
+//		    the client an SMSA_NET_INVALIDATE for it.
+//
+//		    Every connection that holds leases has a slot, and the
+//		    directory keeps a mask of the slots for every block of the
+//		    array. The workers grant and revoke leases under the lock of
+//		    the drum, the same as the hot block cache, so a read that is
+//		    performed before a write always has its lease revoked by it.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_lease.h>
+#include <cmpsc311_log.h>
+
+
+// Defines
+#define LEASE(drum,block) leases[(drum)*SMSA_MAX_BLOCK_ID+(block)]
+
+
+// Global Variables
+uint64_t *leases = NULL;				//slots that hold a lease on each block, a drum after another
+uint64_t leaseSlots = 0;				//slots that are given to a connection
+uint64_t leaseGrants = 0;				//blocks leases were granted on
+uint64_t leaseRevokes = 0;				//leases that were revoked
+pthread_mutex_t leaseLock = PTHREAD_MUTEX_INITIALIZER;	//held while the directory is used
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_lease_open
+// Description  : Gives a connection a slot to hold leases in. The directory is
+//		  allocated for the geometry of the array when the first is given.
+//
+// Inputs       : none
+// Outputs      : the slot, or -1 if every slot is taken
+
+int smsa_lease_open ( void ) {
+
+	int slot;
+
+	pthread_mutex_lock ( &leaseLock );
+	for ( slot = 0; slot < SMSA_LEASE_SLOTS && ( leaseSlots & ( 1ULL << slot ) ); slot++ );
+	if ( leases == NULL && ( leases = calloc ( (size_t)SMSA_DISK_ARRAY_SIZE*SMSA_MAX_BLOCK_ID, sizeof(uint64_t) ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_lease_open:Failed to allocate the lease directory" );
+		slot = -1;
+	}
+	else if ( slot == SMSA_LEASE_SLOTS )
+		slot = -1;
+	else
+		leaseSlots |= 1ULL << slot;
+	pthread_mutex_unlock ( &leaseLock );
+
+	return slot;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_lease_close
+// Description  : Frees the slot of a connection, and drops every lease it holds,
+//		  so the next connection to get the slot starts with none
+//
+// Inputs       : slot - the slot ( -1 for none )
+// Outputs      : none
+
+void smsa_lease_close ( int slot ) {
+
+	uint64_t mask;
+	int i, j;
+
+	if ( slot < 0 )
+		return;
+
+	mask = ~( 1ULL << slot );
+	pthread_mutex_lock ( &leaseLock );
+	for ( i = 0; i < SMSA_DISK_ARRAY_SIZE; i++ ) {
+		for ( j = 0; j < SMSA_MAX_BLOCK_ID; j++ )
+			LEASE(i,j) &= mask;
+	}
+	leaseSlots &= mask;
+	pthread_mutex_unlock ( &leaseLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_lease_grant
+// Description  : Records that a connection caches some blocks of a drum. The
+//		  blocks past the end of the drum are left out.
+//
+// Inputs       : slot - the slot of the connection ( -1 for none )
+//		  drum - the drum
+//		  block - the first block
+//		  count - the number of blocks
+// Outputs      : none
+
+void smsa_lease_grant ( int slot, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count ) {
+
+	uint32_t i;
+
+	if ( slot < 0 || drum >= SMSA_DISK_ARRAY_SIZE )
+		return;
+
+	pthread_mutex_lock ( &leaseLock );
+	for ( i = block; i < block+count && i < SMSA_MAX_BLOCK_ID; i++ )
+		LEASE(drum,i) |= 1ULL << slot;
+	leaseGrants += count;
+	pthread_mutex_unlock ( &leaseLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_lease_revoke
+// Description  : Takes the leases on some blocks of a drum from every connection
+//		  but the one that changed them, which still caches them as they
+//		  are now. The caller tells the connections that held them.
+//
+// Inputs       : keep - the slot of the connection that changed the blocks ( -1 for none )
+//		  drum - the drum
+//		  block - the first block
+//		  count - the number of blocks
+// Outputs      : the mask of the slots that held a lease on any of them
+
+uint64_t smsa_lease_revoke ( int keep, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count ) {
+
+	uint64_t mask, holders = 0;
+	uint32_t i;
+
+	if ( leases == NULL || drum >= SMSA_DISK_ARRAY_SIZE )
+		return 0;
+
+	mask = ( keep < 0 ) ? 0 : 1ULL << keep;
+	pthread_mutex_lock ( &leaseLock );
+	for ( i = block; i < block+count && i < SMSA_MAX_BLOCK_ID; i++ ) {
+		if ( LEASE(drum,i) & ~mask ) {
+			holders |= LEASE(drum,i) & ~mask;
+			leaseRevokes += __builtin_popcountll ( LEASE(drum,i) & ~mask );
+			LEASE(drum,i) &= mask;
+		}
+	}
+	pthread_mutex_unlock ( &leaseLock );
+
+	return holders;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_lease_follow
+// Description  : Grants and revokes the leases an operation of a connection calls
+//		  for. A read gives it a lease on the blocks it read. A write takes
+//		  the leases on its blocks from everyone else, even if it failed
+//		  part of the way, and gives them to the connection if it worked.
+//		  A format takes the leases on the whole drum from everyone else.
+//
+// Inputs       : slot - the slot of the connection ( -1 for none )
+//		  cmd - SMSA_DISK_READ, SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+//		  drum - the drum of the operation
+//		  block - the first block of the operation ( ignored by a format )
+//		  count - the number of blocks
+//		  ret - the return of the operation
+// Outputs      : the mask of the slots whose leases were revoked
+
+uint64_t smsa_lease_follow ( int slot, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, int16_t ret ) {
+
+	uint64_t holders = 0;
+
+	switch ( cmd ) {
+
+		case SMSA_DISK_READ:
+			if ( ret == 0 )
+				smsa_lease_grant ( slot, drum, block, count );
+			break;
+
+		case SMSA_DISK_WRITE:
+			holders = smsa_lease_revoke ( slot, drum, block, count );
+			if ( ret == 0 )
+				smsa_lease_grant ( slot, drum, block, count );
+			break;
+
+		case SMSA_FORMAT_DRUM:
+			if ( ret == 0 )
+				holders = smsa_lease_revoke ( slot, drum, 0, SMSA_MAX_BLOCK_ID );
+			break;
+
+		default:
+			break;
+	}
+
+	return holders;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_lease_stats
+// Description  : Logs how many leases were granted and revoked. It logs nothing
+//		  if no client asked for them
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_log_lease_stats ( void ) {
+
+	if ( leaseGrants == 0 )
+		return;
+
+	logMessage ( LOG_OUTPUT_LEVEL, "Server granted leases on %llu blocks, revoked %llu",
+			(unsigned long long)leaseGrants, (unsigned long long)leaseRevokes );
+}
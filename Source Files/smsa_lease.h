@@ -0,0 +1,46 @@
+#ifndef SMSA_LEASE_INCLUDED
+#define SMSA_LEASE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_lease.h
+//  Description    : This is the lease directory of the SMSA server. It keeps
+//                   track of which connections cache which blocks, so that a
+//                   write can tell them to drop theirs, see smsa_lease.c.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+
+// Defines
+#define SMSA_LEASE_SLOTS 64		// most connections that can hold leases at once ( bits in a lease mask )
+
+
+//
+// Funtional Prototypes
+
+// Give a connection a slot to hold leases in ( -1 if they are all taken )
+int smsa_lease_open ( void );
+
+// Free the slot of a connection, with every lease it holds
+void smsa_lease_close ( int slot );
+
+// Record that a connection now caches some blocks of a drum
+void smsa_lease_grant ( int slot, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count );
+
+// Take the leases on some blocks of a drum from everyone but one connection, giving the slots that held them
+uint64_t smsa_lease_revoke ( int keep, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count );
+
+// Grant and revoke the leases a read, write or format of a connection calls for, giving the slots revoked
+uint64_t smsa_lease_follow ( int slot, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, int16_t ret );
+
+// Log how many leases were granted and revoked, if any were
+void smsa_log_lease_stats ( void );
+
+#endif
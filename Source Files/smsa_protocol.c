@@ -0,0 +1,345 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_protocol.c
+//  Description   : This is the framing of the SMSA protocol versions, shared by
+//		    the client and the server. Frames are put together and taken
+//		    apart in a buffer here, the client and server do the I/O.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+#include <smsa_protocol.h>
+
+
+// Global Variables
+uint32_t crcTable[256];				//CRC32 of every byte value
+pthread_once_t crcOnce = PTHREAD_ONCE_INIT;	//makes sure crcTable is built once
+
+
+//Functional Prototypes
+void buildCrcTable ( void );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_frame_header_size
+// Description  : Gives the size of a frame header in a protocol version
+//
+// Inputs       : version - the protocol version
+// Outputs      : the size of the header
+
+uint32_t smsa_frame_header_size ( int version ) {
+
+	return ( ( version >= 2 ) ? SMSA_NET_V2_HEADER_SIZE : SMSA_NET_HEADER_SIZE );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_pack_frame
+// Description  : Puts a frame header together at the start of a buffer, in network
+//		  byte order. The payload goes right after it. A version 1 frame
+//		  can only carry a single block, and has no room for the rest of
+//		  the header. A version 2 frame without a payload has no checksum,
+//		  and carries the sequence number in its place.
+//
+// Inputs       : version - the protocol version of the frame
+//		  buf - where the header goes
+//		  frame - the header
+// Outputs      : none
+
+void smsa_pack_frame ( int version, unsigned char *buf, SMSA_FRAME *frame ) {
+
+	uint16_t len16, ret, flags, blocks, reserved = 0;
+	uint32_t len, id, op, checksum;
+
+
+	op = htonl ( frame->op );
+	ret = htons ( frame->ret );
+
+	if ( version < 2 ) {
+		len16 = htons ( frame->len );
+		memcpy ( buf, &len16, sizeof(len16) );		//LENGTH
+		memcpy ( &buf[2], &op, sizeof(op) );		//OPCODE
+		memcpy ( &buf[6], &ret, sizeof(ret) );		//RETURN
+		return;
+	}
+
+	len = htonl ( frame->len );
+	id = htonl ( frame->id );
+	flags = htons ( frame->flags );
+	blocks = htons ( frame->blocks );
+	checksum = htonl ( ( frame->len == SMSA_NET_V2_HEADER_SIZE ) ? frame->seq : frame->checksum );
+	memcpy ( buf, &len, sizeof(len) );			//LENGTH
+	memcpy ( &buf[4], &id, sizeof(id) );			//REQUEST ID
+	memcpy ( &buf[8], &op, sizeof(op) );			//OPCODE
+	memcpy ( &buf[12], &ret, sizeof(ret) );			//RETURN
+	memcpy ( &buf[14], &flags, sizeof(flags) );		//FLAGS
+	memcpy ( &buf[16], &blocks, sizeof(blocks) );		//BLOCKS
+	memcpy ( &buf[18], &reserved, sizeof(reserved) );	//RESERVED
+	memcpy ( &buf[20], &checksum, sizeof(checksum) );	//CHECKSUM
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_unpack_frame
+// Description  : Takes apart the frame header at the start of a buffer, and checks
+//		  that its length makes sense. A version 1 packet is a header, or a
+//		  header and a block. A version 2 frame is a header, with a payload
+//		  of its blocks, a byte for each of them if they are uniform, or
+//		  anything shorter if they are compressed.
+//
+// Inputs       : version - the protocol version of the frame
+//		  buf - the header
+//		  frame - will hold the header in host byte order
+// Outputs      : 0 if successful, 1 if the header is bad
+
+int smsa_unpack_frame ( int version, unsigned char *buf, SMSA_FRAME *frame ) {
+
+	uint16_t len16, ret, flags, blocks;
+	uint32_t len, id, op, checksum;
+
+
+	memset ( frame, 0, sizeof(SMSA_FRAME) );
+
+	if ( version < 2 ) {
+		memcpy ( &len16, buf, sizeof(len16) );		//LENGTH
+		memcpy ( &op, &buf[2], sizeof(op) );		//OPCODE
+		memcpy ( &ret, &buf[6], sizeof(ret) );		//RETURN
+		frame->len = ntohs ( len16 );
+		frame->op = ntohl ( op );
+		frame->ret = ntohs ( ret );
+		frame->blocks = ( frame->len > SMSA_NET_HEADER_SIZE ) ? 1 : 0;
+		return ( frame->len != SMSA_NET_HEADER_SIZE && frame->len != SMSA_NET_HEADER_SIZE+SMSA_BLOCK_SIZE );
+	}
+
+	memcpy ( &len, buf, sizeof(len) );			//LENGTH
+	memcpy ( &id, &buf[4], sizeof(id) );			//REQUEST ID
+	memcpy ( &op, &buf[8], sizeof(op) );			//OPCODE
+	memcpy ( &ret, &buf[12], sizeof(ret) );			//RETURN
+	memcpy ( &flags, &buf[14], sizeof(flags) );		//FLAGS
+	memcpy ( &blocks, &buf[16], sizeof(blocks) );		//BLOCKS
+	memcpy ( &checksum, &buf[20], sizeof(checksum) );	//CHECKSUM
+	frame->len = ntohl ( len );
+	frame->id = ntohl ( id );
+	frame->op = ntohl ( op );
+	frame->ret = ntohs ( ret );
+	frame->flags = ntohs ( flags );
+	frame->blocks = ntohs ( blocks );
+	if ( frame->len == SMSA_NET_V2_HEADER_SIZE )
+		frame->seq = ntohl ( checksum );
+	else
+		frame->checksum = ntohl ( checksum );
+
+	if ( frame->blocks > SMSA_NET_MAX_BLOCKS || frame->len < SMSA_NET_V2_HEADER_SIZE || frame->len > SMSA_NET_FRAME_SIZE )
+		return 1;
+	if ( frame->flags & SMSA_NET_FLAG_COMPRESSED )
+		return 0;
+	if ( frame->flags & SMSA_NET_FLAG_UNIFORM )
+		return ( frame->len != SMSA_NET_V2_HEADER_SIZE+frame->blocks );
+	return ( frame->len != SMSA_NET_V2_HEADER_SIZE && frame->len != SMSA_NET_V2_HEADER_SIZE+frame->blocks*SMSA_BLOCK_SIZE );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_crc32
+// Description  : Computes the CRC32 ( the one zlib and ethernet use ) of a buffer
+//
+// Inputs       : buf - the buffer
+//		  len - number of bytes in it
+// Outputs      : the CRC32
+
+uint32_t smsa_crc32 ( unsigned char *buf, uint32_t len ) {
+
+	uint32_t crc = 0xffffffff;
+	uint32_t i;
+
+	pthread_once ( &crcOnce, buildCrcTable );
+
+	for ( i = 0; i < len; i++ )
+		crc = crcTable[(crc ^ buf[i]) & 0xff] ^ ( crc >> 8 );
+
+	return ( crc ^ 0xffffffff );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_parse_address
+// Description  : Splits an address given as host:port into the host and the
+//		  port. An IPv6 address has colons of its own, so it is given in
+//		  brackets, as [host]:port.
+//
+// Inputs       : spec - the address
+//		  host - will hold the host
+//		  size - the size of host
+//		  port - will hold the port
+// Outputs      : 0 if successful, 1 if the address is bad
+
+int smsa_parse_address ( char *spec, char *host, uint32_t size, uint16_t *port ) {
+
+	char *colon;		//the colon before the port
+	char *start = spec;	//the start of the host
+	uint32_t len;		//the length of the host
+	unsigned int number;	//the port
+
+
+	if ( ( colon = strrchr ( spec, ':' ) ) == NULL || sscanf ( colon+1, "%u", &number ) != 1 ||
+			number == 0 || number > 65535 )
+		return 1;
+
+	len = colon - spec;
+	if ( *spec == '[' ) {
+		if ( len < 2 || spec[len-1] != ']' )
+			return 1;
+		start++;
+		len -= 2;
+	}
+	if ( len == 0 || len >= size )
+		return 1;
+
+	memcpy ( host, start, len );
+	host[len] = '\0';
+	*port = number;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_pack_cache_stats
+// Description  : Puts the stats of the server block cache in a block, as 64 bit
+//		  numbers in network byte order, for the response to 
+//		  SMSA_NET_CACHE_STATS. The rest of the block is zero.
+//
+// Inputs       : block - where the stats go, SMSA_BLOCK_SIZE bytes
+//		  stats - the stats
+// Outputs      : none
+
+void smsa_pack_cache_stats ( unsigned char *block, SMSA_SERVER_CACHE_STATS *stats ) {
+
+	uint64_t fields[] = { stats->lines, stats->used, stats->lookups, stats->hits, stats->fills,
+			stats->updates, stats->evictions, stats->invalidations, stats->hitNanos, stats->missNanos };
+	uint32_t half;
+	int i;
+
+	memset ( block, 0, SMSA_BLOCK_SIZE );
+	for ( i = 0; i < sizeof(fields)/sizeof(fields[0]); i++ ) {
+		half = htonl ( (uint32_t)( fields[i] >> 32 ) );
+		memcpy ( &block[i*8], &half, sizeof(half) );
+		half = htonl ( (uint32_t)fields[i] );
+		memcpy ( &block[i*8+4], &half, sizeof(half) );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_unpack_cache_stats
+// Description  : Takes the stats of the server block cache out of the block
+//		  smsa_pack_cache_stats put them in
+//
+// Inputs       : block - the block
+//		  stats - will hold the stats
+// Outputs      : none
+
+void smsa_unpack_cache_stats ( unsigned char *block, SMSA_SERVER_CACHE_STATS *stats ) {
+
+	uint64_t *fields[] = { &stats->lines, &stats->used, &stats->lookups, &stats->hits, &stats->fills,
+			&stats->updates, &stats->evictions, &stats->invalidations, &stats->hitNanos, &stats->missNanos };
+	uint32_t high, low;
+	int i;
+
+	for ( i = 0; i < sizeof(fields)/sizeof(fields[0]); i++ ) {
+		memcpy ( &high, &block[i*8], sizeof(high) );
+		memcpy ( &low, &block[i*8+4], sizeof(low) );
+		*fields[i] = ( (uint64_t)ntohl ( high ) << 32 ) | ntohl ( low );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_geometry_operation
+// Description  : Gives the opcode of a response to SMSA_MOUNT, which carries the
+//		  geometry of the array, see smsa_network.h
+//
+// Inputs       : geometry - the geometry of the array
+// Outputs      : the opcode
+
+uint32_t smsa_geometry_operation ( SMSA_GEOMETRY *geometry ) {
+
+	return ( SMSA_NET_OPERATION ( SMSA_MOUNT, geometry->drums-1, SMSA_NET_GEOMETRY_FLAG |
+			( __builtin_ctz ( geometry->blockSize ) << 5 ) | __builtin_ctz ( geometry->blocks ) ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_operation_geometry
+// Description  : Takes the geometry of the array out of the opcode of a response
+//		  to SMSA_MOUNT. A response without one comes from a server with
+//		  the default geometry.
+//
+// Inputs       : op - the opcode of the response
+//		  geometry - will hold the geometry
+// Outputs      : none
+
+void smsa_operation_geometry ( uint32_t op, SMSA_GEOMETRY *geometry ) {
+
+	if ( !( SMSA_BLOCKID(op) & SMSA_NET_GEOMETRY_FLAG ) ) {
+		geometry->drums = SMSA_DEFAULT_DRUMS;
+		geometry->blocks = SMSA_DEFAULT_BLOCKS;
+		geometry->blockSize = SMSA_DEFAULT_BLOCK_SIZE;
+		return;
+	}
+	geometry->drums = SMSA_DRUMID(op) + 1;
+	geometry->blocks = (uint32_t)1 << ( SMSA_BLOCKID(op) & 0x1f );
+	geometry->blockSize = (uint32_t)1 << ( ( SMSA_BLOCKID(op) >> 5 ) & 0xf );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : buildCrcTable
+// Description  : Fills in the CRC32 of every byte value, for smsa_crc32
+//
+// Inputs       : none
+// Outputs      : none
+
+void buildCrcTable ( void ) {
+
+	uint32_t crc;
+	int i, bit;
+
+	for ( i = 0; i < 256; i++ ) {
+		crc = i;
+		for ( bit = 0; bit < 8; bit++ )
+			crc = ( crc & 1 ) ? 0xedb88320 ^ ( crc >> 1 ) : crc >> 1;
+		crcTable[i] = crc;
+	}
+}
@@ -0,0 +1,69 @@
+#ifndef SMSA_PROTOCOL_INCLUDED
+#define SMSA_PROTOCOL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_protocol.h
+//  Description    : This is the framing of the SMSA protocol versions, shared by
+//                   the client and the server. See smsa_network.h for the layout
+//                   of the frames.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+
+//
+// Type Definitions
+
+// This is the header of a frame, in host byte order. Version 1 frames only
+// have the length, opcode and return, and the rest is filled in for them
+typedef struct {
+	uint32_t	len;		// total bytes in the frame
+	uint32_t	id;		// request id ( 0 in version 1 )
+	uint32_t	op;		// opcode for the command
+	int16_t		ret;		// return code of the command
+	uint16_t	flags;		// SMSA_NET_FLAGS that apply to the payload
+	uint16_t	blocks;		// blocks the command covers
+	uint32_t	checksum;	// CRC32 of the payload, with SMSA_NET_FLAG_CHECKSUM
+	uint32_t	seq;		// sequence number, in place of the checksum when there is no payload
+} SMSA_FRAME;
+
+
+//
+// Funtional Prototypes
+
+// The size of a frame header in a protocol version
+uint32_t smsa_frame_header_size ( int version );
+
+// Put a frame header together in a buffer
+void smsa_pack_frame ( int version, unsigned char *buf, SMSA_FRAME *frame );
+
+// Take a frame header apart, fails if it can not be a frame of that version
+int smsa_unpack_frame ( int version, unsigned char *buf, SMSA_FRAME *frame );
+
+// The CRC32 of a buffer
+uint32_t smsa_crc32 ( unsigned char *buf, uint32_t len );
+
+// Split host:port ( or [host]:port ) into the host and the port
+int smsa_parse_address ( char *spec, char *host, uint32_t size, uint16_t *port );
+
+// Put the stats of the server block cache in a block
+void smsa_pack_cache_stats ( unsigned char *block, SMSA_SERVER_CACHE_STATS *stats );
+
+// Take the stats of the server block cache out of a block
+void smsa_unpack_cache_stats ( unsigned char *block, SMSA_SERVER_CACHE_STATS *stats );
+
+// The opcode of a response to SMSA_MOUNT, carrying the geometry of the array
+uint32_t smsa_geometry_operation ( SMSA_GEOMETRY *geometry );
+
+// Take the geometry of the array out of the opcode of a response to SMSA_MOUNT
+void smsa_operation_geometry ( uint32_t op, SMSA_GEOMETRY *geometry );
+
+#endif
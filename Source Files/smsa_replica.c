@@ -0,0 +1,746 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_replica.c
+//  Description   : This is the leader side of SMSA server replication. A leader
+//		    forwards every write and format it performs to its followers,
+//		    which are SMSA servers started as followers, so that they hold
+//		    the same array and clients can spread their reads over them.
+//
+//		    Every write gets the next sequence number of the leader, which
+//		    goes back to the client in its response. The leader keeps a
+//		    link to each follower, a version 2 connection that sends
+//		    SMSA_NET_FOLLOW before it mounts, and a thread of its own sends
+//		    it the writes, in sequence number order, as SMSA_NET_WRITE_AT
+//		    frames whose request id is the sequence number. The follower
+//		    performs them in that order and keeps the last one it performed,
+//		    so a client that gives it a sequence number to read at can tell
+//		    if it has caught up with its own writes ( see smsa_server.c ).
+//
+//		    When the leader mounts its array it queues what every drum
+//		    holds for the followers, a format of the drum and then its
+//		    blocks that are not zero, since a file or mapped array, or one
+//		    the write-ahead log was replayed into, does not start out zeroed.
+//
+//		    Forwarding does not wait for the followers. A follower whose
+//		    link fails, or that falls SMSA_REPLICA_QUEUE writes behind, is
+//		    dropped, and once its link is gone it stops serving reads. The
+//		    leader only links to its followers when it starts, so a dropped
+//		    follower has to be started again, along with its leader.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_internal.h>
+#include <smsa_network.h>
+#include <smsa_protocol.h>
+#include <smsa_compress.h>
+#include <smsa_replica.h>
+#include <cmpsc311_log.h>
+
+
+// Global Variables
+SMSA_FOLLOWER followers[SMSA_MAX_FOLLOWERS];		//the followers of the leader
+int followerCount = 0;					//number of followers added
+uint32_t writeSeq = 0;					//sequence number of the last write forwarded
+int stopReplicas = 0;					//true when the threads should send what is queued and exit
+pthread_mutex_t replicaLock = PTHREAD_MUTEX_INITIALIZER;	//held while the queues of the followers are used
+pthread_cond_t replicaRoom = PTHREAD_COND_INITIALIZER;	//signaled when a thread takes writes off a queue
+
+
+//Functional Prototypes
+uint32_t queueWrite ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count, unsigned char *blocks, int wait );
+int connectFollower ( SMSA_FOLLOWER *f );
+int linkRequest ( SMSA_FOLLOWER *f, int version, uint32_t op, uint32_t id, SMSA_FRAME *response );
+void *followerThread ( void *arg );
+int sendWrites ( SMSA_FOLLOWER *f, SMSA_REPLICA_WRITE *batch );
+void dropFollower ( SMSA_FOLLOWER *f );
+void freeWrites ( SMSA_REPLICA_WRITE *write );
+int sendAll ( int sock, unsigned char *buf, uint32_t len );
+int readAll ( int sock, unsigned char *buf, uint32_t len );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_replica_add
+// Description  : Adds a follower the leader forwards its writes to. It is only
+//		  linked to when the server starts.
+//
+// Inputs       : follower - the follower, as host:port ( [host]:port for IPv6 )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_replica_add ( char *follower ) {
+
+	SMSA_FOLLOWER *f;
+
+	if ( followerCount == SMSA_MAX_FOLLOWERS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_replica_add:More than %d followers", SMSA_MAX_FOLLOWERS );
+		return -1;
+	}
+
+	f = &followers[followerCount];
+	memset ( f, 0, sizeof(SMSA_FOLLOWER) );
+	if ( smsa_parse_address ( follower, f->host, sizeof(f->host), &f->port ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_replica_add:Bad follower [%s]", follower );
+		return -1;
+	}
+	f->sock = -1;
+	followerCount++;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_replica_enabled
+// Description  : Tells if the server has followers to forward its writes to
+//
+// Inputs       : none
+// Outputs      : 1 if it does, 0 if not
+
+int smsa_replica_enabled ( void ) {
+
+	return ( followerCount > 0 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_replica_start
+// Description  : Links to every follower, and starts the thread that sends it
+//		  the writes. The server does not start unless all of them are
+//		  there, since a follower that missed a write can not catch up.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int smsa_replica_start ( void ) {
+
+	SMSA_FOLLOWER *f;
+	int i, err;
+
+	stopReplicas = 0;
+	for ( i = 0; i < followerCount; i++ ) {
+
+		f = &followers[i];
+		if ( connectFollower ( f ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_replica_start:Failed to link to follower [%s/%u]", f->host, f->port );
+			smsa_replica_stop ();
+			return 1;
+		}
+
+		pthread_cond_init ( &f->ready, NULL );
+		f->live = 1;
+		if ( ( err = pthread_create ( &f->thread, NULL, followerThread, f ) ) != 0 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_replica_start:Failed to start the thread of follower [%s/%u] [%s]", f->host, f->port, strerror(err) );
+			close ( f->sock );
+			f->sock = -1;
+			f->live = 0;
+			smsa_replica_stop ();
+			return 1;
+		}
+		f->started = 1;
+
+		logMessage ( LOG_INFO_LEVEL, "Forwarding Writes To Follower [%s/%u]", f->host, f->port );
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_replica_stop
+// Description  : Lets the thread of every follower send what is queued for it,
+//		  then waits for them to close their links and exit
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_replica_stop ( void ) {
+
+	int i;
+
+	pthread_mutex_lock ( &replicaLock );
+	stopReplicas = 1;
+	for ( i = 0; i < followerCount; i++ ) {
+		if ( followers[i].started )
+			pthread_cond_signal ( &followers[i].ready );
+	}
+	pthread_mutex_unlock ( &replicaLock );
+
+	for ( i = 0; i < followerCount; i++ ) {
+		if ( followers[i].started ) {
+			pthread_join ( followers[i].thread, NULL );
+			pthread_cond_destroy ( &followers[i].ready );
+			followers[i].started = 0;
+		}
+		else if ( followers[i].sock != -1 ) {
+			close ( followers[i].sock );
+			followers[i].sock = -1;
+		}
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_replica_forward
+// Description  : Gives a write or format the next sequence number, and queues it
+//		  for every follower that is still live. The caller performed it
+//		  under the lock of its drum, so the writes to a drum are queued in
+//		  the order they changed it.
+//
+// Inputs       : cmd - SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+//		  drum - the drum
+//		  block - the first block written ( ignored by a format )
+//		  count - the number of blocks written ( ignored by a format )
+//		  blocks - the blocks written ( ignored by a format )
+// Outputs      : the sequence number, 0 if the server has no followers
+
+uint32_t smsa_replica_forward ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count, unsigned char *blocks ) {
+
+	return queueWrite ( cmd, drum, block, count, blocks, 0 );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_replica_sync
+// Description  : Queues what every drum holds for the followers, a format of
+//		  the drum and then the runs of its blocks that are not zero.
+//		  The followers keep their arrays mounted for as long as they are
+//		  linked, so this makes them start out the same as the leader,
+//		  whatever its array was loaded with. It is called on the I/O
+//		  thread right after the array is mounted, before anyone can
+//		  write to it, and waits for room in the queues rather than
+//		  dropping a follower that is busy.
+//
+// Inputs       : none
+// Outputs      : the sequence number of the last write, 0 if there are no followers
+
+uint32_t smsa_replica_sync ( void ) {
+
+	unsigned char *blocks;		//a run of blocks of a drum, in the array
+	SMSA_DRUM_ID drum;
+	SMSA_BLOCK_ID block;
+	uint32_t seq = 0, count, len;
+	uint64_t sent = 0;		//runs that were not zero
+
+
+	if ( followerCount == 0 )
+		return 0;
+
+	for ( drum = 0; drum < SMSA_DISK_ARRAY_SIZE; drum++ ) {
+		seq = queueWrite ( SMSA_FORMAT_DRUM, drum, 0, 0, NULL, 1 );
+		for ( block = 0; block < SMSA_MAX_BLOCK_ID; block += count ) {
+			count = SMSA_MAX_BLOCK_ID - block;
+			if ( count > SMSA_NET_MAX_BLOCKS )
+				count = SMSA_NET_MAX_BLOCKS;
+			len = count*SMSA_BLOCK_SIZE;
+
+			//the format already zeroed it on the followers
+			blocks = block_address ( drum, block );
+			if ( blocks[0] == 0 && memcmp ( blocks, &blocks[1], len-1 ) == 0 )
+				continue;
+			seq = queueWrite ( SMSA_DISK_WRITE, drum, block, count, blocks, 1 );
+			sent++;
+		}
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Queued %llu Runs Of Blocks For The Followers", (unsigned long long)sent );
+	return seq;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueWrite
+// Description  : Gives a write or format the next sequence number, and queues it
+//		  for every follower that is still live. A follower whose queue is
+//		  full is dropped, unless we are to wait for room in it.
+//
+// Inputs       : cmd - SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+//		  drum - the drum
+//		  block - the first block written ( ignored by a format )
+//		  count - the number of blocks written ( ignored by a format )
+//		  blocks - the blocks written ( ignored by a format )
+//		  wait - true to wait for room rather than drop a follower
+// Outputs      : the sequence number, 0 if the server has no followers
+
+uint32_t queueWrite ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count, unsigned char *blocks, int wait ) {
+
+	SMSA_REPLICA_WRITE *write;	//the write queued for a follower
+	SMSA_FOLLOWER *f;
+	uint32_t seq;
+	int i;
+
+
+	if ( followerCount == 0 )
+		return 0;
+
+	if ( cmd == SMSA_FORMAT_DRUM )
+		count = 0;
+
+	pthread_mutex_lock ( &replicaLock );
+
+	//wait until every live follower has room, before the write gets
+	//its sequence number
+	for ( i = 0; wait && i < followerCount; i++ ) {
+		while ( followers[i].live && followers[i].queued >= SMSA_REPLICA_QUEUE )
+			pthread_cond_wait ( &replicaRoom, &replicaLock );
+	}
+
+	seq = ++writeSeq;
+	for ( i = 0; i < followerCount; i++ ) {
+
+		f = &followers[i];
+		if ( !f->live )
+			continue;
+
+		if ( f->queued == SMSA_REPLICA_QUEUE ) {
+			logMessage ( LOG_ERROR_LEVEL, "_queueWrite:Follower [%s/%u] fell %u writes behind, dropping it", f->host, f->port, f->queued );
+			dropFollower ( f );
+			continue;
+		}
+		if ( ( write = malloc ( sizeof(SMSA_REPLICA_WRITE) + count*SMSA_BLOCK_SIZE ) ) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_queueWrite:Failed to queue a write for [%s/%u] [%s]", f->host, f->port, strerror(errno) );
+			dropFollower ( f );
+			continue;
+		}
+		write->seq = seq;
+		write->cmd = cmd;
+		write->drum = drum;
+		write->block = block;
+		write->count = count;
+		write->next = NULL;
+		if ( count > 0 )
+			memcpy ( write->buf, blocks, count*SMSA_BLOCK_SIZE );
+
+		if ( f->tail == NULL )
+			f->head = write;
+		else
+			f->tail->next = write;
+		f->tail = write;
+		f->queued++;
+		pthread_cond_signal ( &f->ready );
+	}
+	pthread_mutex_unlock ( &replicaLock );
+
+	return seq;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_replica_stats
+// Description  : Logs how many writes every follower performed, and how far it
+//		  got. It logs nothing if the server has no followers
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_log_replica_stats ( void ) {
+
+	int i;
+
+	for ( i = 0; i < followerCount; i++ )
+		logMessage ( LOG_OUTPUT_LEVEL, "Server forwarded %llu writes to follower [%s/%u], up to sequence number %u of %u%s",
+				(unsigned long long)followers[i].forwarded, followers[i].host, followers[i].port,
+				followers[i].acked, writeSeq, ( followers[i].live ) ? "" : ", then dropped it" );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : connectFollower
+// Description  : Connects to a follower, agrees on version 2 with it, and makes
+//		  the connection its link with SMSA_NET_FOLLOW. Then the array is
+//		  mounted over the link, which keeps it mounted on the follower,
+//		  and has to have the geometry of the array of the leader.
+//
+// Inputs       : f - the follower
+// Outputs      : 0 if successful, 1 if failure
+
+int connectFollower ( SMSA_FOLLOWER *f ) {
+
+	struct addrinfo hints;			//what kind of addresses we want back
+	struct addrinfo *results, *addr;	//list of addresses the follower resolved to
+	char portString[8];			//port as a string for getaddrinfo
+	uint16_t features;			//SMSA_NET_FLAGS we ask for
+	SMSA_FRAME response;			//response to a request on the link
+	SMSA_GEOMETRY geometry;			//geometry of the array of the follower
+	int err, one;
+
+
+	snprintf ( portString, sizeof(portString), "%u", f->port );
+	memset ( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if ( ( err = getaddrinfo ( f->host, portString, &hints, &results ) ) != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectFollower:Failed to resolve [%s] [%s]", f->host, gai_strerror(err) );
+		return 1;
+	}
+
+	//Try each of the addresses until one connects
+	f->sock = -1;
+	for ( addr = results; addr != NULL && f->sock == -1; addr = addr->ai_next ) {
+		if ( ( f->sock = socket ( addr->ai_family, addr->ai_socktype, addr->ai_protocol ) ) == -1 )
+			continue;
+		if ( connect ( f->sock, addr->ai_addr, addr->ai_addrlen ) == -1 ) {
+			close ( f->sock );
+			f->sock = -1;
+		}
+	}
+	freeaddrinfo ( results );
+	if ( f->sock == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectFollower:Could not connect to [%s/%u] [%s]", f->host, f->port, strerror(errno) );
+		return 1;
+	}
+
+	//The writes go out in batches, and the end of one must not wait on the
+	//acknowledgment of the one before it
+	one = 1;
+	setsockopt ( f->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+
+	//The blocks are checksummed on the link, and uniform blocks cost nothing
+	features = SMSA_NET_FLAG_CHECKSUM | SMSA_NET_FLAG_UNIFORM;
+	if ( linkRequest ( f, 1, SMSA_NET_OPERATION ( SMSA_NET_HELLO, features, SMSA_NET_VERSION ), 0, &response ) ||
+			response.ret != 0 || SMSA_OPCODE(response.op) != SMSA_NET_HELLO || SMSA_BLOCKID(response.op) < 2 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectFollower:[%s/%u] does not speak protocol version 2", f->host, f->port );
+		return 1;
+	}
+	f->features = SMSA_DRUMID(response.op) & features;
+
+	if ( linkRequest ( f, 2, SMSA_NET_OPERATION ( SMSA_NET_FOLLOW, 0, 0 ), 1, &response ) || response.ret != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectFollower:[%s/%u] is not a follower, or already has a leader", f->host, f->port );
+		return 1;
+	}
+
+	if ( linkRequest ( f, 2, SMSA_NET_OPERATION ( SMSA_MOUNT, 0, 0 ), 2, &response ) || response.ret != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectFollower:Failed to mount the array on [%s/%u]", f->host, f->port );
+		return 1;
+	}
+
+	//the writes are forwarded as they are, so its array has to be shaped like ours
+	smsa_operation_geometry ( response.op, &geometry );
+	if ( memcmp ( &geometry, &smsa_geometry, sizeof(geometry) ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_connectFollower:[%s/%u] has an array of [%u] drums of [%u] blocks of [%u] bytes",
+				f->host, f->port, geometry.drums, geometry.blocks, geometry.blockSize );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : linkRequest
+// Description  : Sends a request without a payload over a link and waits for the
+//		  response, which has no payload either
+//
+// Inputs       : f - the follower
+//		  version - the protocol version of the link
+//		  op - the opcode
+//		  id - the request id ( version 2 )
+//		  response - will hold the header of the response
+// Outputs      : 0 if successful, 1 if failure
+
+int linkRequest ( SMSA_FOLLOWER *f, int version, uint32_t op, uint32_t id, SMSA_FRAME *response ) {
+
+	SMSA_FRAME request;
+	uint32_t header = smsa_frame_header_size ( version );
+
+	memset ( &request, 0, sizeof(request) );
+	request.len = header;
+	request.id = id;
+	request.op = op;
+	smsa_pack_frame ( version, f->buf, &request );
+
+	if ( sendAll ( f->sock, f->buf, header ) || readAll ( f->sock, f->buf, header ) )
+		return 1;
+	if ( smsa_unpack_frame ( version, f->buf, response ) || response->len != header || response->id != id ) {
+		logMessage ( LOG_ERROR_LEVEL, "_linkRequest:Unexpected response [%x] from [%s/%u]", response->op, f->host, f->port );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : followerThread
+// Description  : The loop the thread of a follower runs. It takes the writes that
+//		  are queued for the follower, as many as fit in its buffer at a
+//		  time, and sends them. Once the leader stops it sends what is left
+//		  and closes the link. If the follower is dropped, what is left is
+//		  thrown away.
+//
+// Inputs       : arg - the follower
+// Outputs      : NULL
+
+void *followerThread ( void *arg ) {
+
+	SMSA_FOLLOWER *f = arg;
+	SMSA_REPLICA_WRITE *batch;	//the writes sent at once
+	SMSA_REPLICA_WRITE *last;	//the last of them
+	SMSA_REPLICA_WRITE *write;
+	uint32_t len;			//most bytes the frames of the batch take
+	uint64_t count;			//number of writes in the batch
+	int err;
+
+
+	pthread_mutex_lock ( &replicaLock );
+	while ( f->live ) {
+
+		//wait for writes, or to be told to stop
+		while ( f->live && f->head == NULL && !stopReplicas )
+			pthread_cond_wait ( &f->ready, &replicaLock );
+		if ( !f->live || f->head == NULL )
+			break;
+
+		//Take writes until the buffer is full. A format is two frames,
+		//a seek to its drum and the format itself
+		batch = f->head;
+		last = NULL;
+		len = 0;
+		count = 0;
+		for ( write = f->head; write != NULL; last = write, write = write->next ) {
+			if ( len + 2*SMSA_NET_V2_HEADER_SIZE + write->count*SMSA_BLOCK_SIZE > sizeof(f->buf) )
+				break;
+			len += 2*SMSA_NET_V2_HEADER_SIZE + write->count*SMSA_BLOCK_SIZE;
+			count++;
+		}
+		last->next = NULL;
+		f->head = write;
+		if ( f->head == NULL )
+			f->tail = NULL;
+		f->queued -= count;
+		pthread_cond_broadcast ( &replicaRoom );
+
+		//send them without holding the lock
+		pthread_mutex_unlock ( &replicaLock );
+		err = sendWrites ( f, batch );
+		pthread_mutex_lock ( &replicaLock );
+
+		if ( err ) {
+			if ( f->live ) {
+				logMessage ( LOG_ERROR_LEVEL, "_followerThread:Lost follower [%s/%u], dropping it", f->host, f->port );
+				dropFollower ( f );
+			}
+		}
+		else {
+			f->acked = last->seq;
+			f->forwarded += count;
+		}
+		freeWrites ( batch );
+	}
+
+	freeWrites ( f->head );
+	f->head = NULL;
+	f->tail = NULL;
+	f->queued = 0;
+	close ( f->sock );
+	f->sock = -1;
+	pthread_mutex_unlock ( &replicaLock );
+
+	return NULL;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendWrites
+// Description  : Sends a batch of writes to a follower in one send, then waits
+//		  for the responses. The follower performs them in order, and has
+//		  to perform every one of them, or it no longer holds the array
+//		  of the leader.
+//
+// Inputs       : f - the follower
+//		  batch - the writes
+// Outputs      : 0 if successful, 1 if failure
+
+int sendWrites ( SMSA_FOLLOWER *f, SMSA_REPLICA_WRITE *batch ) {
+
+	SMSA_REPLICA_WRITE *write;
+	SMSA_FRAME frame;		//header of a frame
+	uint32_t len = 0;		//bytes of frames in the buffer
+	int i;
+
+
+	for ( write = batch; write != NULL; write = write->next ) {
+
+		memset ( &frame, 0, sizeof(frame) );
+		frame.id = write->seq;
+		frame.len = SMSA_NET_V2_HEADER_SIZE;
+
+		if ( write->cmd == SMSA_FORMAT_DRUM ) {
+			//a format works where the heads of the link are
+			frame.op = SMSA_NET_OPERATION ( SMSA_SEEK_DRUM, write->drum, 0 );
+			smsa_pack_frame ( 2, &f->buf[len], &frame );
+			len += frame.len;
+			frame.op = SMSA_NET_OPERATION ( SMSA_FORMAT_DRUM, 0, 0 );
+		}
+		else {
+			frame.op = SMSA_NET_OPERATION ( SMSA_NET_WRITE_AT, write->drum, write->block );
+			frame.blocks = write->count;
+			frame.len += smsa_encode_payload ( f->features, write->buf, write->count, &f->buf[len+SMSA_NET_V2_HEADER_SIZE], &frame.flags );
+			if ( f->features & SMSA_NET_FLAG_CHECKSUM ) {
+				frame.flags |= SMSA_NET_FLAG_CHECKSUM;
+				frame.checksum = smsa_crc32 ( write->buf, write->count*SMSA_BLOCK_SIZE );
+			}
+		}
+		smsa_pack_frame ( 2, &f->buf[len], &frame );
+		len += frame.len;
+	}
+
+	if ( sendAll ( f->sock, f->buf, len ) )
+		return 1;
+
+	//Every frame gets a response with its sequence number, and none of
+	//them carry blocks
+	for ( write = batch; write != NULL; write = write->next ) {
+		for ( i = ( write->cmd == SMSA_FORMAT_DRUM ) ? 2 : 1; i > 0; i-- ) {
+			if ( readAll ( f->sock, f->buf, SMSA_NET_V2_HEADER_SIZE ) )
+				return 1;
+			if ( smsa_unpack_frame ( 2, f->buf, &frame ) || frame.len != SMSA_NET_V2_HEADER_SIZE ||
+					frame.id != write->seq || frame.ret != 0 ) {
+				logMessage ( LOG_ERROR_LEVEL, "_sendWrites:Follower [%s/%u] failed write [%u]", f->host, f->port, write->seq );
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : dropFollower
+// Description  : Stops forwarding writes to a follower. Its link is shut down,
+//		  which wakes up its thread if it is sending, and the thread then
+//		  closes it. Called with replicaLock held.
+//
+// Inputs       : f - the follower
+// Outputs      : none
+
+void dropFollower ( SMSA_FOLLOWER *f ) {
+
+	f->live = 0;
+	shutdown ( f->sock, SHUT_RDWR );
+	pthread_cond_signal ( &f->ready );
+	pthread_cond_broadcast ( &replicaRoom );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : freeWrites
+// Description  : Frees a list of writes
+//
+// Inputs       : write - the first write ( NULL for none )
+// Outputs      : none
+
+void freeWrites ( SMSA_REPLICA_WRITE *write ) {
+
+	SMSA_REPLICA_WRITE *next;
+
+	for ( ; write != NULL; write = next ) {
+		next = write->next;
+		free ( write );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendAll
+// Description  : Sends all of a buffer over a link
+//
+// Inputs       : sock - the socket
+//		  buf - the bytes
+//		  len - the number of bytes
+// Outputs      : 0 if successful, 1 if failure
+
+int sendAll ( int sock, unsigned char *buf, uint32_t len ) {
+
+	uint32_t sent = 0;
+	int sb;
+
+	while ( sent < len ) {
+		if ( ( sb = send ( sock, &buf[sent], len-sent, MSG_NOSIGNAL ) ) <= 0 ) {
+			if ( sb < 0 && errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_sendAll:Failed to send to a follower [%s]", ( sb < 0 ) ? strerror(errno) : "closed" );
+			return 1;
+		}
+		sent += sb;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readAll
+// Description  : Reads a number of bytes from a link
+//
+// Inputs       : sock - the socket
+//		  buf - where the bytes go
+//		  len - the number of bytes
+// Outputs      : 0 if successful, 1 if failure
+
+int readAll ( int sock, unsigned char *buf, uint32_t len ) {
+
+	uint32_t got = 0;
+	int rb;
+
+	while ( got < len ) {
+		if ( ( rb = read ( sock, &buf[got], len-got ) ) <= 0 ) {
+			if ( rb < 0 && errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_readAll:Failed to read from a follower [%s]", ( rb < 0 ) ? strerror(errno) : "closed" );
+			return 1;
+		}
+		got += rb;
+	}
+
+	return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef SMSA_REPLICA_INCLUDED
+#define SMSA_REPLICA_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_replica.h
+//  Description    : This is the leader side of SMSA server replication. The
+//                   leader forwards every write and format to its followers,
+//                   in the order it performed them, see smsa_replica.c.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+#include <pthread.h>
+#include <netdb.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+
+// Defines
+#define SMSA_MAX_FOLLOWERS 8					// most followers a leader forwards to
+#define SMSA_REPLICA_QUEUE 4096					// most writes waiting for a follower before it is dropped
+#define SMSA_REPLICA_BUFFER (4*SMSA_NET_MAX_FRAME_SIZE)		// most bytes of writes sent to a follower at once
+
+//
+// Type Definitions
+
+// This is one write ( or format ) waiting to be sent to a follower
+typedef struct smsa_replica_write {
+	uint32_t	seq;		// sequence number of the write
+	SMSA_DISK_COMMAND cmd;		// SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+	SMSA_DRUM_ID	drum;		// drum of the write
+	SMSA_BLOCK_ID	block;		// first block of the write ( ignored by a format )
+	uint16_t	count;		// blocks of the write ( 0 for a format )
+	struct smsa_replica_write *next;	// next write waiting for the follower
+	unsigned char	buf[];		// the blocks
+} SMSA_REPLICA_WRITE;
+
+// This is one follower of the leader. Its link is a version 2 connection that
+// a thread of its own sends the writes over, so a slow follower never holds
+// up the clients of the leader
+typedef struct {
+	char		host[NI_MAXHOST];	// address of the follower
+	uint16_t	port;		// port of the follower
+	int		sock;		// socket of the link ( -1 once it is closed )
+	uint16_t	features;	// SMSA_NET_FLAGS agreed on for the link
+	int		live;		// true while writes are forwarded to it ( false once it is dropped )
+	int		started;	// true once its thread is running
+	SMSA_REPLICA_WRITE *head;	// oldest write waiting to be sent
+	SMSA_REPLICA_WRITE *tail;	// newest write waiting to be sent
+	uint32_t	queued;		// number of writes waiting
+	uint32_t	acked;		// sequence number of the last write it performed
+	uint64_t	forwarded;	// writes it performed
+	pthread_t	thread;		// the thread that sends the writes
+	pthread_cond_t	ready;		// signaled when a write is queued for it
+	unsigned char	buf[SMSA_REPLICA_BUFFER];	// where the frames sent at once are built
+} SMSA_FOLLOWER;
+
+
+//
+// Funtional Prototypes
+
+// Add a follower the leader forwards its writes to, given as host:port
+int smsa_replica_add ( char *follower );
+
+// Tell if any followers were added
+int smsa_replica_enabled ( void );
+
+// Connect to every follower and start the threads that send them the writes
+int smsa_replica_start ( void );
+
+// Send every follower what is queued for it, then close the links
+void smsa_replica_stop ( void );
+
+// Queue a write or format for every follower, giving its sequence number
+uint32_t smsa_replica_forward ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count, unsigned char *blocks );
+
+// Queue what every drum holds for every follower, after the array is mounted
+uint32_t smsa_replica_sync ( void );
+
+// Log how far every follower got
+void smsa_log_replica_stats ( void );
+
+#endif
@@ -11,7 +11,15 @@
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
@@ -19,7 +27,18 @@
 
 // Project Include Files
 #include <smsa.h>
+#include <smsa_internal.h>
 #include <smsa_network.h>
+#include <smsa_server.h>
+#include <smsa_worker.h>
+#include <smsa_protocol.h>
+#include <smsa_compress.h>
+#include <smsa_hot.h>
+#include <smsa_lease.h>
+#include <smsa_replica.h>
+#include <smsa_wal.h>
+#include <smsa_snapshot.h>
+#include <smsa_uring.h>
 #include <cmpsc311_log.h>
 
 /* DEBUG */
@@ -28,108 +47,277 @@
 
 // Global Variables
 int serverShutdown;
+int mountCount = 0;              //number of connections that have the array mounted
+SMSA_HEAD arrayHead;             //where the heads of the array itself are
+char *listenIP = NULL;           //address to listen on set by smsa_server_set_address ( NULL if not set )
+uint16_t listenPort = 0;         //port to listen on set by smsa_server_set_address ( 0 if not set )
+int serverWorkers = 0;           //worker threads set by smsa_server_set_workers ( 0 for none )
+int workEvent = -1;              //eventfd that is readable when the workers finish operations
+SMSA_TRANSPORT serverTransport = SMSA_TRANSPORT_DEFAULT;  //transport set by smsa_server_set_transport
+int serverProtocol = 0;          //highest protocol version set by smsa_server_set_protocol ( 0 if not set )
+uint32_t serverCacheLines = 0;   //blocks cached in front of the array set by smsa_server_set_cache ( 0 for none )
+SMSA_URING serverRing;           //ring the io_uring loop uses
+int serverUring = 0;             //true while the io_uring loop is running
+uint64_t workCount;              //where the io_uring loop reads the workers' eventfd into
+SMSA_CONNECTION *flushList = NULL;  //connections to flush at the end of the loop iteration
+uint64_t responseCount = 0;      //responses queued on every connection
+uint64_t writeCount = 0;         //writes ( or io_uring sends ) they went out in
+uint64_t holdCount = 0;          //times a connection held its output back
+uint64_t invalidationCount = 0;  //SMSA_NET_INVALIDATE frames sent to the connections holding leases
+SMSA_CONNECTION *leaseHolders[SMSA_LEASE_SLOTS];  //the connection with each lease slot ( NULL if free )
+int followerMode = 0;            //true if the server is a follower, set by smsa_server_set_follower
+SMSA_CONNECTION *leaderLink = NULL;  //the link of the leader while a follower has one
+uint32_t appliedSeq = 0;         //sequence number of the last write of the leader a follower performed
+uint64_t staleReads = 0;         //reads a follower failed because it was behind the client
+SMSA_CONNECTION *snapshotOwner = NULL;  //connection that took the image of the array ( NULL if none )
+int exporting = 0;               //true while the workers write an image to the export file
+char *drumHome[SMSA_MAX_DISK_ARRAY_SIZE];  //host:port each drum was moved to ( NULL while it is here )
+SMSA_CONNECTION *drumMover[SMSA_MAX_DISK_ARRAY_SIZE];  //connection that fenced each drum to move it ( NULL if none )
+uint64_t movedOperations = 0;    //operations failed because their drum was moved, or being moved, away
+unsigned char *packetBlocks = NULL;  //blocks of the packet being processed, SMSA_NET_MAX_BLOCKS of them
 
 
 //Functional Prototypes
-int setupServer ( int *server ); 
-int recievePacket ( int server, uint32_t *op, int16_t *ret, int *blkSize, unsigned char *block );
-int readBytes ( int server, uint32_t len, unsigned char *block );
-int sendPacket ( int server, uint32_t op, int16_t ret, unsigned char *block );
-int sendBytes ( int server, uint32_t len, unsigned char *block );
-int selectData ( int sock );
+int getListenAddress ( char **ip, uint16_t *port );
+SMSA_TRANSPORT getServerTransport ( void );
+int getServerProtocol ( void );
+int bindServer ( int *server, char *ip, uint16_t port );
+int setNonBlocking ( int sock );
 void signalHandler ( int signal );
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : smsa_server
-// Description  : The main function SMSA server processing loop.
+// Description  : The main function SMSA server processing loop. The server runs
+//		  a single event loop that multiplexes the listening socket and 
+//		  every client connection, so any number of clients can share the
+//		  array at the same time. The loop is built on epoll, or on io_uring
+//		  when that transport is asked for and the kernel supports it.
+//
+//		  Without workers, operations are applied to the array one at a
+//		  time, in the order the loop completes their packets. With workers,
+//		  the loop only does the I/O, and the operations that touch a drum
+//		  are performed by the workers, in parallel for different drums.
+//		  Either way, packets from one connection are always applied in the
+//		  order that client sent them. A server that exports images of the
+//		  array has a worker to write them even without the others.
+//
+//		  With a hot block cache ( see smsa_hot.c ), reads of blocks that
+//		  any client read before are answered from the cache, without the
+//		  array or the workers.
+//
+//		  Clients that ask for SMSA_NET_FLAG_INVALIDATE are told when the
+//		  blocks they cache are written by someone else ( see smsa_lease.c ).
+//
+//		  A server with followers forwards its writes to them ( see
+//		  smsa_replica.c ), and a follower only serves the reads that its
+//		  leader has caught it up for.
+//
+//		  A server with a write-ahead log logs its writes, and syncs the
+//		  log before it acknowledges them ( see smsa_wal.c ).
+//
+//		  A client of a cluster that moves a drum to another server fences
+//		  it here first, and once it is moved the operations on it are
+//		  failed, so the clients look for it where it went ( see moveDrum ).
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
 int smsa_server ( void ) {
 
-
-	
-	struct sockaddr_in clientAddress;  //holds client address
-	int server;			   //file handle for the socket
-	int client;			   //file handle for the client
-	unsigned int inet_len;		
-	
-	int blkSize = SMSA_BLOCK_SIZE;     //number of bytes ia block
-	int recieving = 1;		   //true if were still recieving data
-	unsigned char block[SMSA_BLOCK_SIZE];
-	uint32_t op;				   //opcode for the smsa_operatoin_t
-	int16_t ret;			   //
+	int server;					//file handle for the socket
+	int ret;
 
 	if ( setupServer ( &server ) ) {
 		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to properly set up the server" );
 		return 1;
 	}
 
+	//Start the workers. The loop waits on their eventfd along with the sockets.
+	//Without workers, one is still started to write the exports, so that the
+	//loop goes on serving the clients while it does
+	if ( ( serverWorkers > 0 || smsa_snapshot_exports () ) &&
+			( workEvent = smsa_start_workers ( ( serverWorkers > 0 ) ? serverWorkers : 1 ) ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to start the workers" );
+		close ( server );
+		return 1;
+	}
+
+	if ( serverCacheLines > 0 && smsa_hot_init ( serverCacheLines ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to set up the hot block cache" );
+		if ( workEvent != -1 )
+			smsa_stop_workers ();
+		close ( server );
+		return 1;
+	}
+
+	//Link to the followers before any client can write
+	if ( smsa_replica_enabled () && ( followerMode || smsa_replica_start () ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to link to the followers%s", ( followerMode ) ? ", a follower can not have followers" : "" );
+		if ( workEvent != -1 )
+			smsa_stop_workers ();
+		smsa_hot_close ();
+		close ( server );
+		return 1;
+	}
+
+	//Packets are only processed on this thread, one at a time, so they
+	//all take their blocks apart in the same buffer
+	if ( ( packetBlocks = malloc ( SMSA_NET_MAX_BLOCKS*SMSA_BLOCK_SIZE ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to allocate the packet buffer [%s]", strerror(errno) );
+		if ( workEvent != -1 )
+			smsa_stop_workers ();
+		smsa_replica_stop ();
+		smsa_hot_close ();
+		close ( server );
+		return 1;
+	}
+
+	//Use io_uring if we were asked to, and go back to epoll if the kernel
+	//does not have what we need
+	serverShutdown = 0;
+	if ( getServerTransport () == SMSA_TRANSPORT_URING && setupUring () == 0 ) {
+		logMessage ( LOG_INFO_LEVEL, "Serving Clients With io_uring" );
+		ret = uringLoop ( server );
+		smsa_uring_close ( &serverRing );
+		serverUring = 0;
+	}
+	else {
+		if ( getServerTransport () == SMSA_TRANSPORT_URING )
+			logMessage ( LOG_WARNING_LEVEL, "io_uring is not supported, serving clients with epoll" );
+		ret = epollLoop ( server );
+	}
+
+	//Shutting down the server
+	logMessage ( LOG_INFO_LEVEL, "Shutting Down the Server..." );
+	smsa_log_compress_stats ( "Server" );
+	if ( responseCount > 0 )
+		logMessage ( LOG_OUTPUT_LEVEL, "Server sent %llu responses in %llu writes, held output back %llu times",
+				(unsigned long long)responseCount, (unsigned long long)writeCount, (unsigned long long)holdCount );
+	if ( invalidationCount > 0 )
+		logMessage ( LOG_OUTPUT_LEVEL, "Server sent %llu invalidations", (unsigned long long)invalidationCount );
+	if ( movedOperations > 0 )
+		logMessage ( LOG_OUTPUT_LEVEL, "Server failed %llu operations on drums that were moved away", (unsigned long long)movedOperations );
+	smsa_log_lease_stats ();
+	if ( workEvent != -1 )
+		smsa_stop_workers ();
+	smsa_replica_stop ();
+	smsa_log_replica_stats ();
+	smsa_log_wal_stats ();
+	smsa_log_snapshot_stats ();
+	if ( followerMode )
+		logMessage ( LOG_OUTPUT_LEVEL, "Follower performed the writes of its leader up to sequence number %u, failed %llu reads that were ahead of it",
+				appliedSeq, (unsigned long long)staleReads );
+	smsa_log_hot_stats ();
+	smsa_hot_close ();
+	free ( packetBlocks );
+	packetBlocks = NULL;
+	close ( server );
+	return ret;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : epollLoop
+// Description  : The epoll event loop. It waits for the sockets to be ready,
+//		  then does the reads and writes they are ready for itself. The
+//		  responses to everything handled in one iteration are sent at
+//		  the end of it, in one write per connection.
+//
+// Inputs       : server - listening socket file handle
+// Outputs      : 0 if successful, 1 if failure
+
+int epollLoop ( int server ) {
+
+	struct epoll_event event;			//used to register a socket with epoll
+	struct epoll_event events[SMSA_MAX_EVENTS];	//events returned by epoll_wait
+	SMSA_CONNECTION *conn;				//connection an event belongs to
+	int epoll;					//file handle for the epoll instance
+	int finished;					//true if the workers finished operations
+	int ready, i;
+
+	//Create the epoll instance and add the listening socket to it. The
+	//listening socket is the only one registered with a NULL data pointer
+	if ( ( epoll = epoll_create1 ( 0 ) ) == -1 || setNonBlocking ( server ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_epollLoop:Failed to set up epoll [%s]", strerror(errno) );
+		return 1;
+	}
+	event.events = EPOLLIN;
+	event.data.ptr = NULL;
+	if ( epoll_ctl ( epoll, EPOLL_CTL_ADD, server, &event ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_epollLoop:Failed to add the server to epoll [%s]", strerror(errno) );
+		close ( epoll );
+		return 1;
+	}
+
+	//Have epoll tell us when the workers finish something. Their eventfd is
+	//registered with a pointer to workEvent, so that it can be told apart
+	//from the listening socket and the connections
+	if ( workEvent != -1 ) {
+		event.events = EPOLLIN;
+		event.data.ptr = &workEvent;
+		if ( epoll_ctl ( epoll, EPOLL_CTL_ADD, workEvent, &event ) == -1 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_epollLoop:Failed to add the workers to epoll [%s]", strerror(errno) );
+			close ( epoll );
+			return 1;
+		}
+	}
 
 	
 	//Loop until server needs to shutdown
-	serverShutdown = 0;
 	while ( !serverShutdown ) {
 	
-		logMessage ( LOG_INFO_LEVEL, "Now Waiting for Data to Come In..." );
+		if ( DEBUG )
+			logMessage ( LOG_INFO_LEVEL, "Now Waiting for Data to Come In..." );
 		
-		//Wait for data to come in
-		if ( selectData ( server ) ) {
-			logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to select data [%s]", strerror(errno) );
-			return 1;
+		//Wait for something to happen on any of the sockets
+		if ( ( ready = epoll_wait ( epoll, events, SMSA_MAX_EVENTS, -1 ) ) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_epollLoop:Failed to wait for events [%s]", strerror(errno) );
+			break;
 		}
 
-		logMessage ( LOG_INFO_LEVEL, "Selected Data. Connecting to the Client..." );
-		
-		//Accept the connection
-		inet_len = sizeof( clientAddress );
-		if ( (client = accept ( server, (struct sockaddr*)&clientAddress, &inet_len)) == -1 ) {
-			logMessage( LOG_ERROR_LEVEL, "_smsa_server:Failed to accept connection [%s]", strerror(errno) );
-			return 1;
-		}
+		finished = 0;
+		for ( i = 0; i < ready; i++ ) {
 
-		logMessage ( LOG_INFO_LEVEL, "New Client Connection Recieved [%s/%d]", inet_ntoa(clientAddress.sin_addr), clientAddress.sin_port ); 
-		
-		recieving = 1;
-		//Read until all data has been processed
-		while ( recieving && !serverShutdown ) {
+			conn = events[i].data.ptr;
 
-			//recieve data and process the packet
-			if ( recievePacket( client, &op, &ret, &blkSize, block ) == 1 ) {
-				logMessage( LOG_ERROR_LEVEL, "_smsa_server:Failed to properly recieve a packet" );
-				return 1;
+			//New connections are waiting on the listening socket
+			if ( conn == NULL ) {
+				acceptConnections ( epoll, server );
+				continue;
 			}
-	
-			logMessage ( LOG_INFO_LEVEL, "Processed Incoming Packet. Now Sending Response Packet...");
-				
-			//call the neccessary function
-			ret = smsa_operation ( op, block );
-			
-			//send a response
-			if ( sendPacket( client, op, ret, (SMSA_OPCODE(op) == SMSA_DISK_READ) ? block: NULL ) == -1) {
-				logMessage ( LOG_ERROR_LEVEL, "_smsa_server:Failed to properly send a response" );
-				return 1;
+
+			//The workers have finished operations. These are handled after
+			//the other events, since they can close connections that 
+			//still have events waiting further down the list
+			if ( events[i].data.ptr == &workEvent ) {
+				finished = 1;
+				continue;
+			}
+
+			//Send any output the socket now has room for, then take in 
+			//whatever the client has sent. Either can close the connection
+			if ( ( events[i].events & EPOLLOUT ) && flushConnection ( epoll, conn ) ) {
+				closeConnection ( conn );
+				continue;
+			}
+			if ( ( events[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) && readConnection ( conn ) ) {
+				closeConnection ( conn );
+				continue;
 			}
-			
-			//If an UNMOUNT command has been recieved, it is now ok to close down the connection 
-			//with the client and wait for other connections to come in
-			if ( SMSA_OPCODE(op) == SMSA_UNMOUNT)
-				recieving = 0;
-			
 		}
-		
-		//Done with connection, now close it
-		logMessage( LOG_INFO_LEVEL, "Closing client connection [%s/%d]", inet_ntoa(clientAddress.sin_addr), clientAddress.sin_port );
-        	close( client );
 
+		if ( finished )
+			finishOperations ();
+		flushPending ( epoll );
 	}
 
-	//Shutting down the server
-	logMessage ( LOG_INFO_LEVEL, "Shutting Down the Server..." );
-	close ( server );
+	close ( epoll );
 	return 0;
 }
 
@@ -137,364 +325,2331 @@ int smsa_server ( void ) {
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : recievePacket
-// Description  : Recieve a packet from the client
+// Function     : setupUring
+// Description  : Sets up the ring for the io_uring loop, with a ring of provided
+//		  buffers for the multishot receives. The provided buffers are
+//		  registered with the kernel once, so the blocks that come in are
+//		  received straight into them. This fails on kernels that can not
+//		  do multishot receives, and the server then uses epoll.
 //
-// Inputs       : server - socket file handle
-//		  op - opcode for smsa_operation
-//		  ret - return of smsa_operation
-// 		  blkSize - num of bytes to read into the block
-//		  block - the read of the block
-// Outputs      : 0 if successful, -1 if failure
-
-int recievePacket ( int server, uint32_t *op, int16_t *ret, int *blkSize, unsigned char *block ) {
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
 
-	uint32_t len;
-	uint32_t headerIndex = 0;
-	int twoBytes = sizeof ( uint16_t );
-	unsigned char header[SMSA_NET_HEADER_SIZE];
+int setupUring ( void ) {
 
-    // SMSA Packet definition
-    //
-    //  Bytes 0-1   : length - how many total bytes in packet
-    //  Bytes 2-6   : opcode - the opcode for the command
-    //  Bytes 7-8   : return - return code of comamnd 
-    //  Bytes 6-261 : block - as needed, SMSA_BLOCK
-    //
+	if ( smsa_uring_init ( &serverRing, SMSA_URING_ENTRIES ) )
+		return 1;
 
-    ///Read the packet into header
-    if ( readBytes ( server, SMSA_NET_HEADER_SIZE, header ) == 1 ) {
-		logMessage( LOG_ERROR_LEVEL, "_recievePacket:Failure to read bytes properly" );
+	if ( smsa_uring_provide_buffers ( &serverRing, SMSA_URING_GROUP, SMSA_URING_BUFFERS, SMSA_URING_BUFFER_SIZE ) ) {
+		smsa_uring_close ( &serverRing );
 		return 1;
-    }
-
- 
-    //Put data into host byte order
-    //The first two bytes that have been placed in header is the length
-    //of the entire packet. The next 4 bytes is the opcode of the command
-    //to be used on the smsa_operation function ( size of uint32_t ). The
-    //following two bytes hold the return of the command. All of the remaining
-    //bytes ( len - index ), are the block ( 255 bytes ), and will be read into the block
-    memcpy( &len, header, twoBytes );   	//LENGTH
-    headerIndex += twoBytes;
-
-    len = ntohs ( len );  //host byte order
-
-    memcpy( op, &header[headerIndex], 2*twoBytes );	  //OPCODE
-    headerIndex += 2*twoBytes;
- 
-    *op = ntohl ( *op ); //host byte order
- 
-    memcpy( ret, &header[headerIndex], twoBytes );  	 //RETURN
-    headerIndex += twoBytes;
-
-    *ret = ntohs ( *ret ); //host byte order
+	}
 
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Packet Head Processed. length [%d], op [%d], return [%d]", len, *op, *ret );
+	serverUring = 1;
+	return 0;
+}
 
-    //check to see if there is more data to read
-    if ( len > SMSA_NET_HEADER_SIZE ) {
-	
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Packet has Block to be Read. Reading Now" );
 
-	//Call readBytes to read the Length of the packet ( len ) minus the 
-	//size of the packet header ( SMSA_NET_HEADER_SIZE ), which is in fact
-	//reading the block portion of the packet 
-	if ( readBytes( server, len-SMSA_NET_HEADER_SIZE, block ) == -1 ) {
-		logMessage( LOG_ERROR_LEVEL, "_recievePacket:Failed to read bytes");
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uringLoop
+// Description  : The io_uring event loop. Instead of waiting for the sockets to
+//		  be ready, the loop keeps a multishot accept posted on the 
+//		  listening socket and a multishot receive posted on every client,
+//		  and only handles what they complete. Everything the loop posts
+//		  while handling one batch of completions is submitted with the
+//		  wait for the next batch, in one system call.
+//
+//		  Every entry carries the connection it is for, with the kind of
+//		  operation in the low bits of the pointer ( see SMSA_URING_OP ).
+//
+// Inputs       : server - listening socket file handle
+// Outputs      : 0 if successful, 1 if failure
+
+int uringLoop ( int server ) {
+
+	struct io_uring_cqe *cqe;	//a completion
+	SMSA_CONNECTION *conn;		//connection the completion is for
+	uint64_t data;			//user data of the completion
+	int32_t res;			//result of the completion
+	uint32_t flags;			//flags of the completion
+
+
+	if ( postAccept ( server ) || ( workEvent != -1 && postWorkRead () ) )
 		return 1;
-	}
-	//Adjust the blkSize for the use of other functions. The blockSize, in bytes, 
-	//is the length of the packet minus the packet header. The only reason that we 
-	//are not hard coding 255 here is because we might in the future want to use a 
-	//different SMSA_BLOCK_SIZE
-	*blkSize = len-SMSA_NET_HEADER_SIZE;
-    }
-    else 
- 	*blkSize = 0;  //No block in this packet.
 
+	//Loop until server needs to shutdown
+	while ( !serverShutdown ) {
+
+		if ( DEBUG )
+			logMessage ( LOG_INFO_LEVEL, "Now Waiting for Data to Come In..." );
+
+		//Post sends of the responses to the last batch, then submit what 
+		//we posted, and wait for something to complete
+		flushPending ( -1 );
+		if ( smsa_uring_submit ( &serverRing, 1 ) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_uringLoop:Failed to wait for completions [%s]", strerror(errno) );
+			return 1;
+		}
+
+		while ( ( cqe = smsa_uring_peek ( &serverRing ) ) != NULL ) {
+
+			data = cqe->user_data;
+			res = cqe->res;
+			flags = cqe->flags;
+			smsa_uring_seen ( &serverRing );
+			conn = (SMSA_CONNECTION *)(uintptr_t)( data & ~(uint64_t)SMSA_URING_OP_MASK );
+
+			switch ( data & SMSA_URING_OP_MASK ) {
+
+				case SMSA_URING_ACCEPT:
+					if ( res >= 0 && ( conn = newConnection ( res ) ) != NULL ) {
+						logMessage ( LOG_INFO_LEVEL, "New Client Connection Recieved [%s/%s]", conn->host, conn->port );
+						if ( postReceive ( conn ) )
+							closeConnection ( conn );
+					}
+					else if ( res >= 0 )
+						close ( res );
+					else
+						logMessage ( LOG_ERROR_LEVEL, "_uringLoop:Failed to accept connection [%s]", strerror(-res) );
+
+					//the accept stays posted until the kernel says otherwise
+					if ( !( flags & IORING_CQE_F_MORE ) && postAccept ( server ) )
+						return 1;
+					break;
+
+				case SMSA_URING_RECEIVE:
+					uringReceive ( conn, res, flags );
+					break;
+
+				case SMSA_URING_SEND:
+					conn->sending = 0;
+					if ( conn->dead )
+						releaseConnection ( conn );
+					else if ( res < 0 ) {
+						logMessage( LOG_ERROR_LEVEL, "_uringLoop:Failed to write to [%s/%s] [%s]", conn->host, conn->port, strerror(-res) );
+						closeConnection ( conn );
+					}
+					else {
+						conn->sendSent += res;
+						queueFlush ( conn );
+					}
+					break;
+
+				case SMSA_URING_WORK:
+					finishOperations ();
+					if ( postWorkRead () )
+						return 1;
+					break;
+			}
+		}
+	}
 
-    logMessage( LOG_INFO_LEVEL, "Received %d bytes on handle %d", len, server );
-    return 0;
- 	
+	return 0;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : readBytes
-// Description  : Read a certain amount of bytes from the client
+// Function     : uringReceive
+// Description  : Handles a completion of the multishot receive of a connection.
+//		  The data is in one of the provided buffers. It is copied into 
+//		  the input of the connection, or its spill when that is full, and
+//		  the buffer is given straight back to the kernel.
 //
-// Inputs       : server - socket file handle
-//		  len - amount of bytes to read
-//		  block - the read of the block
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : conn - the connection
+//		  res - result of the receive
+//		  flags - flags of the completion
+// Outputs      : none
 
-int readBytes ( int server, uint32_t len, unsigned char *block ) {
+void uringReceive ( SMSA_CONNECTION *conn, int32_t res, uint32_t flags ) {
 
-	int readBytes = 0;     //how many bytes have been read
-	int rb;		       //current byte that has been read
+	unsigned char *buf;	//provided buffer the data is in
+	uint16_t bid;		//id of that buffer
 
-	//Run until all bytes have been read which is when the amount
-	//of bytes that have been read ( readBytes ) is no longer less then
-	//the amount of bytes total that need to be read ( len ).
-	while ( readBytes < len ) {
 
-		//Read byte into "block", at the index of readBytes, from the socket ( server ). 
-		//The readBytes allows us to move across the "block" so that we don't read over stuff
-		//on the "block". rb will contain the amount of bytes that were able to be read. We wish for
-		//this to be the entire len variable, but it might not be ready for us to read the first time.
-		//This loop will allow us to continue reading until we have read the amount of bytes in len.
-		if ( (rb = read( server, &block[readBytes], len-readBytes )) < 0 ) {
-			logMessage( LOG_ERROR_LEVEL, "_readBytes:Failed to read a byte [%s]", strerror(errno) );
-			return 1;
+	//the receive is no longer posted once the kernel stops saying there is more
+	if ( !( flags & IORING_CQE_F_MORE ) )
+		conn->receiving = 0;
+
+	if ( flags & IORING_CQE_F_BUFFER ) {
+		bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		buf = smsa_uring_buffer ( &serverRing, bid );
+		if ( res > 0 && !conn->dead && takeInput ( conn, buf, res ) ) {
+			smsa_uring_recycle ( &serverRing, bid );
+			closeConnection ( conn );
+			return;
 		}
-		else if ( rb == 0 ) {
-			//This means the file was closed
-			logMessage( LOG_ERROR_LEVEL, "_readBytes:File was closed" );
+		smsa_uring_recycle ( &serverRing, bid );
+	}
+
+	if ( conn->dead ) {
+		releaseConnection ( conn );
+		return;
+	}
+
+	if ( res == 0 ) {
+		//This means the client closed the connection
+		logMessage( LOG_INFO_LEVEL, "Client [%s/%s] Closed the Connection", conn->host, conn->port );
+		closeConnection ( conn );
+		return;
+	}
+	if ( res < 0 && res != -ENOBUFS ) {
+		logMessage( LOG_ERROR_LEVEL, "_uringReceive:Failed to read from [%s/%s] [%s]", conn->host, conn->port, strerror(-res) );
+		closeConnection ( conn );
+		return;
+	}
+
+	//Process what came in, the responses are sent at the end of the batch.
+	//A receive that ran out of buffers is posted again, now that we have 
+	//given them back
+	if ( ( res > 0 && processInput ( conn ) ) ||
+			( !conn->receiving && !conn->closing && postReceive ( conn ) ) ) {
+		closeConnection ( conn );
+		return;
+	}
+	queueFlush ( conn );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : takeInput
+// Description  : Adds received bytes to the input of a connection. Whatever does 
+//		  not fit, because a worker still has one of its operations, goes 
+//		  in the spill, which processInput empties as it makes room.
+//
+// Inputs       : conn - the connection
+//		  buf - the bytes
+//		  len - number of bytes
+// Outputs      : 0 if successful, 1 if failure
+
+int takeInput ( SMSA_CONNECTION *conn, unsigned char *buf, uint32_t len ) {
+
+	unsigned char *spill;	//the grown spill
+	uint32_t size;		//size the spill grows to
+	uint32_t fit = 0;	//bytes that fit in the input
+
+
+	//bytes can only go straight to the input if nothing is waiting ahead of them
+	if ( conn->spillBytes == 0 ) {
+		fit = SMSA_INPUT_SIZE-conn->inBytes;
+		if ( fit > len )
+			fit = len;
+		memcpy ( &conn->in[conn->inBytes], buf, fit );
+		conn->inBytes += fit;
+	}
+	if ( fit == len )
+		return 0;
+
+	if ( conn->spillBytes+len-fit > conn->spillSize ) {
+		for ( size = ( conn->spillSize == 0 ) ? SMSA_INPUT_SIZE : conn->spillSize; size < conn->spillBytes+len-fit; size *= 2 );
+		if ( ( spill = realloc ( conn->spill, size ) ) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_takeInput:Failed to grow the spill [%s]", strerror(errno) );
 			return 1;
 		}
+		conn->spill = spill;
+		conn->spillSize = size;
+	}
+	memcpy ( &conn->spill[conn->spillBytes], &buf[fit], len-fit );
+	conn->spillBytes += len-fit;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : uringSend
+// Description  : Sends the queued output of a connection by posting a send to the
+//		  ring. The kernel reads from the buffer until the send completes,
+//		  so the output is swapped into sendBuf first, and new responses 
+//		  queue up in out while it is sent. Only one send is posted on a
+//		  connection at a time, so the responses go out in order.
+//
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, 1 if the connection should be closed
 
-		//Increment the amount of Bytes that have been read ( readBytes ), by the amount
-		//of bytes that were just read in this iteration of the loop.
-		readBytes =+ rb;
+int uringSend ( SMSA_CONNECTION *conn ) {
+
+	struct io_uring_sqe *sqe;	//entry for the send
+	unsigned char *buf;		//used to swap the buffers
+	uint32_t size;
+
+
+	//the posted send will call us again when it finishes
+	if ( conn->sending )
+		return 0;
+
+	//Everything in sendBuf is sent, so swap in whatever has been queued since
+	if ( conn->sendSent == conn->sendBytes ) {
+		if ( conn->outBytes == 0 ) {
+			conn->sendBytes = 0;
+			conn->sendSent = 0;
+			if ( conn->closing ) {
+				logMessage( LOG_INFO_LEVEL, "Closing client connection [%s/%s]", conn->host, conn->port );
+				return 1;
+			}
+			return 0;
+		}
+		buf = conn->sendBuf;
+		size = conn->sendSize;
+		conn->sendBuf = conn->out;
+		conn->sendSize = conn->outSize;
+		conn->sendBytes = conn->outBytes;
+		conn->sendSent = 0;
+		conn->out = buf;
+		conn->outSize = size;
+		conn->outBytes = 0;
+		conn->queued = 0;
+		conn->pushed = 0;
 	}
-		
+
+	if ( ( sqe = smsa_uring_sqe ( &serverRing ) ) == NULL )
+		return 1;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = conn->sock;
+	sqe->addr = (uint64_t)(uintptr_t)&conn->sendBuf[conn->sendSent];
+	sqe->len = conn->sendBytes-conn->sendSent;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uint64_t)(uintptr_t)conn | SMSA_URING_SEND;
+	conn->sending = 1;
+	writeCount++;
+
 	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : postAccept
+// Description  : Posts a multishot accept on the listening socket, which
+//		  completes once for every client that connects
+//
+// Inputs       : server - listening socket file handle
+// Outputs      : 0 if successful, 1 if failure
+
+int postAccept ( int server ) {
+
+	struct io_uring_sqe *sqe;
 
+	if ( ( sqe = smsa_uring_sqe ( &serverRing ) ) == NULL )
+		return 1;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = server;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = SMSA_URING_ACCEPT;
+
+	return 0;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sendPacket
-// Description  : Send a packet to the client
+// Function     : postReceive
+// Description  : Posts a multishot receive on a connection. It completes every
+//		  time data comes in, with the data in one of the provided buffers
 //
-// Inputs       : server - socket file handle
-//		  op - opcode for smsa_operation
-//		  ret - return of smsa_operation
-// 		  blkSize - num of bytes to read into the block
-//		  block - the read of the block
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : conn - the connection
+// Outputs      : 0 if successful, 1 if failure
 
-int sendPacket ( int server, uint32_t op, int16_t ret, unsigned char *block ) {
-
-	uint32_t len;
-	uint32_t bufIndex = 0;
-	int twoBytes = sizeof ( uint16_t );
-	unsigned char buf[SMSA_NET_HEADER_SIZE+SMSA_BLOCK_SIZE];
-
-    // SMSA Packet definition
-    //
-    //  Bytes 0-1   : length - how many total bytes in packet
-    //  Bytes 2-6   : opcode - the opcode for the command
-    //  Bytes 7-8   : return - return code of comamnd 
-    //  Bytes 6-261 : block - as needed, SMSA_BLOCK
-    //
-
-    //Set the size of the packet. Which is the size of the packet header. Unless
-    //there is a block to be read, then it is the size of a packet header plus
-    //size of the block.
-    len = SMSA_NET_HEADER_SIZE;
-    if ( block != NULL ) {
-	len += SMSA_BLOCK_SIZE;
-    }
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Putting Together a Packet to Send of [%d] Bytes", len );
-
-    //Put in network byte config
-    len = htons(len);
-    op = htonl(op);
-    ret = htons(ret);
-
- 
-    //Put together a packet
-    memcpy( &buf[bufIndex], &len, sizeof( len ) );	//LENGTH
-    bufIndex += twoBytes;
-
-    memcpy( &buf[bufIndex], &op, sizeof( op ) ); 	//OPCODE	
-    bufIndex += 2*twoBytes;
- 
-    memcpy( &buf[bufIndex], &ret, sizeof( ret) );       //RETURN
-    bufIndex += twoBytes;
-
-    //If this is a read, add the block to the packet
-    if ( block != NULL ) {
-	memcpy( &buf[bufIndex], block, SMSA_BLOCK_SIZE );
-	bufIndex += SMSA_BLOCK_SIZE; 	//incrememnt the index the size of the block we just added to the packet
-    }
-	
+int postReceive ( SMSA_CONNECTION *conn ) {
+
+	struct io_uring_sqe *sqe;
+
+	if ( ( sqe = smsa_uring_sqe ( &serverRing ) ) == NULL )
+		return 1;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->sock;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = SMSA_URING_GROUP;
+	sqe->user_data = (uint64_t)(uintptr_t)conn | SMSA_URING_RECEIVE;
+	conn->receiving = 1;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : postWorkRead
+// Description  : Posts a read of the workers' eventfd, which completes when they
+//		  finish operations
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int postWorkRead ( void ) {
 
-    //call sendBytes to send the packet we have just constructed to the 
-    //client over our socket ( server ).
-    logMessage( LOG_INFO_LEVEL, "Sending %d bytes on handle %d", bufIndex, server );
-    return( sendBytes( server, bufIndex, buf) );
+	struct io_uring_sqe *sqe;
+
+	if ( ( sqe = smsa_uring_sqe ( &serverRing ) ) == NULL )
+		return 1;
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = workEvent;
+	sqe->addr = (uint64_t)(uintptr_t)&workCount;
+	sqe->len = sizeof(workCount);
+	sqe->user_data = SMSA_URING_WORK;
 
- 	
+	return 0;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sendBytes
-// Description  : Read a certain amount of bytes from the client
+// Function     : acceptConnections
+// Description  : Accepts every connection waiting on the listening socket, and
+//		  registers each of them with epoll
 //
-// Inputs       : server - socket file handle
-//		  len - amount of bytes to read
-//		  block - the read of the block
+// Inputs       : epoll - epoll file handle
+//		  server - listening socket file handle
 // Outputs      : 0 if successful, -1 if failure
 
-int sendBytes ( int server, uint32_t len, unsigned char *buf ) {
+int acceptConnections ( int epoll, int server ) {
 
-	int sentBytes = 0;   	//Amount of bytes that have been sent
-	int sb;
-	
-	//Run until all bytes ( len ) have been sent which is when the 
-	//amount of sentBytes no longer less than len
-	while ( sentBytes < len ) {
-
-		//Write bytes from buf onto the socket ( server ). It will attempt to write all 
-		//bytes ( len ), but might not be able to. So it will store the amount of bytes that
-		//were able to be sent into sb.
-		if ( (sb = write( server, &buf[sentBytes], len-sentBytes )) < 0 ) {
-			logMessage( LOG_ERROR_LEVEL, "_sendBytes:Failed to write a byte [%s]", strerror(errno) );
+	struct epoll_event event;		//used to register the client with epoll
+	SMSA_CONNECTION *conn;			//state for the new connection
+	int client;			        //file handle for the client
+
+
+	//The listening socket is non-blocking, so keep accepting until
+	//there are no connections left in the queue
+	while ( 1 ) {
+
+		if ( (client = accept ( server, NULL, NULL )) == -1 ) {
+			if ( errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR )
+				return 0;
+			logMessage( LOG_ERROR_LEVEL, "_acceptConnections:Failed to accept connection [%s]", strerror(errno) );
 			return 1;
 		}
-		else if ( sb == 0 ) {
-			//This means the file was closed
-			logMessage( LOG_ERROR_LEVEL, "_sendBytes:File was closed" );
-			return 1;
+
+		//Set up the state of the connection
+		if ( setNonBlocking ( client ) || ( conn = newConnection ( client ) ) == NULL ) {
+			close ( client );
+			continue;
+		}
+		conn->events = EPOLLIN;
+
+		//Have epoll tell us when the client sends something
+		event.events = EPOLLIN;
+		event.data.ptr = conn;
+		if ( epoll_ctl ( epoll, EPOLL_CTL_ADD, client, &event ) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "_acceptConnections:Failed to add the connection to epoll [%s]", strerror(errno) );
+			closeConnection ( conn );
+			continue;
 		}
 
-		//Increment the amount of Bytes that have been sent ( sentBytes ), by the amount of
-		//bytes that were able to be sent during this iteration of the loop ( sb ). 
-		sentBytes =+ sb;
+		logMessage ( LOG_INFO_LEVEL, "New Client Connection Recieved [%s/%s]", conn->host, conn->port ); 
 	}
-
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Successfully Sent [%d] Bytes", sentBytes );
-		
-	return 0;
-
 }
 
 
+
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : selectData
-// Description  : Waits for data and then selects of it to be processed
+// Function     : newConnection
+// Description  : Sets up the state of a connection that was just accepted
 //
-// Inputs       : int - server file handler
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : client - file handle for the client
+// Outputs      : the connection if successful, NULL if failure
 
-int selectData ( int sock ) {
+SMSA_CONNECTION *newConnection ( int client ) {
 
-	fd_set readEvent;
-	int maxSocketChecks = sock + 1;
+	struct sockaddr_storage clientAddress;  //holds client address ( IPv4 or IPv6 )
+	SMSA_CONNECTION *conn;			//state for the new connection
+	socklen_t inet_len;
 
-	//Initialize and set the file descriptors
-	FD_ZERO( &readEvent );
-	FD_SET( sock, &readEvent );
 
-	//select and wait
-	if ( select( maxSocketChecks, &readEvent, NULL, NULL, NULL ) == -1 ) {
-		logMessage( LOG_ERROR_LEVEL, "_selectData:Failure to wait and select data" );
-		return 1;
+	//the input holds a whole frame in the geometry the server was started with
+	if ( ( conn = calloc ( 1, sizeof(SMSA_CONNECTION) ) ) == NULL || ( conn->in = malloc ( SMSA_INPUT_SIZE ) ) == NULL ) {
+		logMessage( LOG_ERROR_LEVEL, "_newConnection:Failed to set up the connection [%s]", strerror(errno) );
+		free ( conn );
+		return NULL;
 	}
+	conn->sock = client;
+	conn->version = 1;
+	conn->lease = -1;
 
-	//make sure we are selected on the read
-	if ( FD_ISSET ( sock, &readEvent ) == 0 ) {
-		logMessage( LOG_ERROR_LEVEL, "_selectData:Failure to select on the read");
-		return 1;
-	}
-	
-	return 0;
+	//find out who the client is for the log
+	inet_len = sizeof( clientAddress );
+	if ( getpeername ( client, (struct sockaddr*)&clientAddress, &inet_len ) == 0 )
+		getnameinfo ( (struct sockaddr*)&clientAddress, inet_len, conn->host, sizeof(conn->host), 
+				conn->port, sizeof(conn->port), NI_NUMERICHOST | NI_NUMERICSERV );
 
+	return conn;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : setUpServer
-// Description  : Sets up the server by creating the socket, binding it to the right addresss
-//		  and starts the server listening. It then sets the server input equal to the
-//		  socket file handler.
+// Function     : readConnection
+// Description  : Reads everything that is available on a connection, and processes
+//		  each complete packet in the order it was sent. Bytes of a packet
+//		  that has not completely arrived are kept until the next call.
+//		  The responses are sent at the end of the loop iteration.
 //
-// Inputs       : int - server file handler
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : conn - the connection to read from
+// Outputs      : 0 if successful, 1 if the connection should be closed
 
-int setupServer ( int *server ) {
+int readConnection ( SMSA_CONNECTION *conn ) {
 
+	int rb;			//number of bytes that were read
 
-	struct sigaction sigINT;   	   //holds the sigINT signal handler
-	struct sockaddr_in serverAddress;  //holds server addres
-	int optionValue = 1;		   //holds the value for setsocketopt function call
 
+	while ( !conn->closing ) {
 
-	//Set signal handler
-	//This sets changes the current SIGINT signal handler to operate in the way
-	//that we would like by having our smsa_signal_handler be called on reception
-	//of a SIGINT from the OS, rather than the default handler
-	sigINT.sa_handler = signalHandler;
-	sigINT.sa_flags = SA_NODEFER | SA_ONSTACK;
-	sigaction ( SIGINT, &sigINT, NULL );
+		//While one of its operations is with the workers, the packets of a 
+		//connection wait in its input. Once that is full, stop reading until
+		//the operation finishes ( see watchConnection )
+		if ( conn->inBytes == SMSA_INPUT_SIZE )
+			break;
 
+		//Read as much as will fit behind the bytes we already have
+		if ( (rb = read( conn->sock, &conn->in[conn->inBytes], SMSA_INPUT_SIZE-conn->inBytes )) < 0 ) {
+			if ( errno == EAGAIN || errno == EWOULDBLOCK )
+				break;
+			if ( errno == EINTR )
+				continue;
+			logMessage( LOG_ERROR_LEVEL, "_readConnection:Failed to read from [%s/%s] [%s]", conn->host, conn->port, strerror(errno) );
+			return 1;
+		}
+		else if ( rb == 0 ) {
+			//This means the client closed the connection
+			logMessage( LOG_INFO_LEVEL, "Client [%s/%s] Closed the Connection", conn->host, conn->port );
+			return 1;
+		}
+		conn->inBytes += rb;
 
-	//Create the socket
-	//Set up a socket using TCP protocol ( SOCK_STREAM ), and the address family 
-	//version of inet, while setting the server variable to the file handle
-	if ( ( *server = socket ( AF_INET, SOCK_STREAM, 0 ) ) == -1 ) {
-		logMessage( LOG_ERROR_LEVEL, "_setUpServer:Failed to set up the socket [%s]", strerror(errno) );
-		return 1;
+		if ( processInput ( conn ) )
+			return 1;
 	}
 
-	logMessage( LOG_INFO_LEVEL, "Socket Successfully Initialized. Socket File Handle = %d", *server );
-	
-	//Set the socket to be reusable. 
-	//The setsockopt will allow us to change options of our socket which is 
-	//specified with our file handle, server.
-	if ( setsockopt ( *server, SOL_SOCKET, SO_REUSEADDR, &optionValue, sizeof(optionValue) ) != 0 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:setsockopt failed to make the local address reusable [%s]", strerror(errno) );
-		return 1;
-	}
+	//Send the responses to everything we just processed
+	queueFlush ( conn );
+	return 0;
+}
 
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Socket Set Up To Reuse Addresses" );
 
-	//Set up server address
-	serverAddress.sin_family = AF_INET;
-	serverAddress.sin_port = htons( SMSA_DEFAULT_PORT );
-	serverAddress.sin_addr.s_addr = htonl( INADDR_ANY );
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : processInput
+// Description  : Processes every complete packet in the input of a connection,
+//		  stopping early if one of them is handed to the workers, since
+//		  the packets after it must wait for it to finish. Bytes that were
+//		  received while the input was full ( io_uring only ) are taken
+//		  from the spill as room is made. Packets are framed in the protocol
+//		  version of the connection, which changes after a hello.
+//
+// Inputs       : conn - the connection to process
+// Outputs      : 0 if successful, 1 if the connection should be closed
+
+int processInput ( SMSA_CONNECTION *conn ) {
+
+	uint32_t index;		//start of the packet being processed in conn->in
+	uint32_t header;	//size of a packet header in the version of the connection
+	SMSA_FRAME frame;	//header of the packet being processed
+	uint32_t moved;		//bytes moved from the spill into the input
+
+
+	//Every version starts a packet with its length, see smsa_network.h for
+	//the packet definitions
+	index = 0;
+	while ( !conn->closing && !conn->busy ) {
+
+		//Refill the input from the spill once it might not hold a whole packet
+		if ( conn->inBytes-index < SMSA_NET_FRAME_SIZE && conn->spillBytes > 0 ) {
+			memmove ( conn->in, &conn->in[index], conn->inBytes-index );
+			conn->inBytes -= index;
+			index = 0;
+			moved = SMSA_INPUT_SIZE-conn->inBytes;
+			if ( moved > conn->spillBytes )
+				moved = conn->spillBytes;
+			memcpy ( &conn->in[conn->inBytes], conn->spill, moved );
+			memmove ( conn->spill, &conn->spill[moved], conn->spillBytes-moved );
+			conn->inBytes += moved;
+			conn->spillBytes -= moved;
+		}
+		header = smsa_frame_header_size ( conn->version );
+		if ( conn->inBytes-index < header )
+			break;
+
+		if ( smsa_unpack_frame ( conn->version, &conn->in[index], &frame ) ) {
+			logMessage( LOG_ERROR_LEVEL, "_processInput:Bad packet length [%u] from [%s/%s]", frame.len, conn->host, conn->port );
+			return 1;
+		}
 
-	//bind the server to the socket. bind the server file handle to 
-	//the address we have initialized
-	if ( bind ( *server, (struct sockaddr*)&serverAddress, sizeof( struct sockaddr) ) == -1 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failure to bind the server to the socket [%s]", strerror(errno) );
-		return 1;
-	}
-	
-	if ( DEBUG )
-		logMessage ( LOG_INFO_LEVEL, "Socket Is Now Bound To Any Address");
+		//wait for the rest of the packet
+		if ( conn->inBytes-index < frame.len )
+			break;
 
-	//listen for connections
-	if ( listen ( *server, SMSA_MAX_BACKLOG ) == -1 ) {
-		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failure to properly listen [%s]", strerror(errno) );
-		return 1;
+		if ( processPacket ( conn, &frame, &conn->in[index+header] ) )
+			return 1;
+		index += frame.len;
 	}
-	
-	logMessage ( LOG_INFO_LEVEL, "Socket Is Now Listening Queueing %d Connections", SMSA_MAX_BACKLOG );
 
+	//Move the partial packet, if any, to the front of the buffer
+	memmove ( conn->in, &conn->in[index], conn->inBytes-index );
+	conn->inBytes -= index;
 
-	logMessage ( LOG_INFO_LEVEL, "Server Has Now Been Successfully Setup" );
 	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : processPacket
+// Description  : Performs the operation in one packet and queues the response.
+//
+//		  Mounting is shared by all of the connections. The array is only
+//		  mounted when the first client mounts it, and only unmounted when
+//		  the last client that mounted it unmounts, so that one client
+//		  unmounting does not take the array away from everyone else.
+//
+//		  Seeks only move the virtual heads of the connection. The heads
+//		  of the array are moved to match by operationAt, right before an
+//		  operation that uses them, so clients can seek and read in any
+//		  interleaving without changing what the others read. With workers,
+//		  the array heads are not used at all, see submitOperation.
+//
+//		  In version 2, SMSA_NET_READ_AT and SMSA_NET_WRITE_AT can cover
+//		  more than one block. Every other command covers at most one.
+//
+// Inputs       : conn - the connection the packet came from
+//		  frame - the header of the packet
+//		  payload - the payload of the packet, right after its header
+// Outputs      : 0 if successful, 1 if the connection should be closed
+
+int processPacket ( SMSA_CONNECTION *conn, SMSA_FRAME *frame, unsigned char *payload ) {
+
+	unsigned char *blocks = packetBlocks;	//blocks sent with, or read for, the operation
+	uint32_t op = frame->op;		//opcode for the smsa_operation
+	uint32_t cmd = SMSA_OPCODE(op);		//command in the opcode
+	uint32_t size;				//size of the payload
+	uint16_t count;				//blocks the operation covers
+	int16_t ret;				//return of the smsa_operation
+	SMSA_SERVER_CACHE_STATS stats;		//stats of the hot block cache
+	SMSA_DRUM_ID drum;			//drum a read, write or format is at
+	SMSA_BLOCK_ID block;			//block a read or write starts at
+	uint16_t written = 0;			//blocks a write changed
+	int i;
+
+
+	//The response carries the request id back to the client, and the
+	//sequence number of a write, if the server has followers
+	conn->requestId = frame->id;
+	conn->seq = 0;
+
+	//Take the blocks out of the payload, and check them against the checksum
+	size = frame->len - smsa_frame_header_size ( conn->version );
+	if ( size > 0 ) {
+		if ( ( frame->flags & ( SMSA_NET_FLAG_UNIFORM|SMSA_NET_FLAG_COMPRESSED ) & ~conn->features ) ||
+				smsa_decode_payload ( frame->flags, payload, size, blocks, frame->blocks ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_processPacket:Bad payload from [%s/%s]", conn->host, conn->port );
+			return 1;
+		}
+		size = frame->blocks*SMSA_BLOCK_SIZE;
+		if ( ( frame->flags & SMSA_NET_FLAG_CHECKSUM ) && smsa_crc32 ( blocks, size ) != frame->checksum ) {
+			logMessage ( LOG_ERROR_LEVEL, "_processPacket:Bad checksum from [%s/%s]", conn->host, conn->port );
+			return 1;
+		}
+	}
+
+	count = ( frame->blocks > 1 ) ? frame->blocks : 1;
+	if ( count > 1 && cmd != SMSA_NET_READ_AT && cmd != SMSA_NET_WRITE_AT && cmd != SMSA_NET_SNAPSHOT_READ ) {
+		logMessage ( LOG_ERROR_LEVEL, "_processPacket:Command [%u] can not cover [%u] blocks", cmd, count );
+		smsa_error_number = SMSA_BAD_OPCODE;
+		return ( queueResponse ( conn, op, -1, NULL, 0 ) );
+	}
+
+	//A write has to carry every block it covers
+	if ( ( cmd == SMSA_DISK_WRITE || cmd == SMSA_NET_WRITE_AT ) && size != count*SMSA_BLOCK_SIZE ) {
+		logMessage ( LOG_ERROR_LEVEL, "_processPacket:Write of [%u] blocks carries [%u] bytes", count, size );
+		smsa_error_number = SMSA_BAD_WRITE;
+		return ( queueResponse ( conn, op, -1, NULL, 0 ) );
+	}
+
+	if ( DEBUG )
+		logMessage ( LOG_INFO_LEVEL, "Processing op [%x] from [%s/%s]", op, conn->host, conn->port );
+
+	//A follower only takes writes from its leader, and only serves reads
+	//while it has one, once it has the write the client asks it to have
+	if ( followerMode && !conn->leader ) {
+		if ( cmd == SMSA_DISK_WRITE || cmd == SMSA_NET_WRITE_AT || cmd == SMSA_FORMAT_DRUM ) {
+			smsa_error_number = SMSA_BAD_WRITE;
+			return ( queueResponse ( conn, op, -1, NULL, 0 ) );
+		}
+		if ( ( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT ) && ( leaderLink == NULL || frame->seq > appliedSeq ) ) {
+			staleReads++;
+			conn->seq = appliedSeq;
+			smsa_error_number = SMSA_BAD_READ;
+			return ( queueResponse ( conn, op, -1, NULL, 0 ) );
+		}
+	}
+
+	//A drum another client moved away, or is moving, is not touched for
+	//anyone else, and the client asks where it went
+	if ( drumMoved ( conn, op ) ) {
+		movedOperations++;
+		return ( queueResponse ( conn, op, SMSA_NET_MOVED, NULL, 0 ) );
+	}
+
+	//Blocks that are in the hot block cache are read without the workers
+	if ( serverWorkers > 0 && ( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT ) && cachedRead ( conn, op, blocks, count ) == 0 ) {
+		if ( cmd == SMSA_DISK_READ )
+			conn->head.block++;
+		return ( queueResponse ( conn, op, 0, blocks, count ) );
+	}
+
+	//With workers, the operations that touch the contents of a drum are
+	//handed to them, and the response is queued when they finish
+	if ( serverWorkers > 0 && ( cmd == SMSA_DISK_READ || cmd == SMSA_DISK_WRITE || cmd == SMSA_FORMAT_DRUM ||
+			cmd == SMSA_BLOCK_SIGN || cmd == SMSA_NET_READ_AT || cmd == SMSA_NET_WRITE_AT ) )
+		return ( submitOperation ( conn, op, blocks, count ) );
+
+	//Where a read, write or format is, for the leases, before it moves the heads
+	if ( cmd == SMSA_NET_READ_AT || cmd == SMSA_NET_WRITE_AT ) {
+		drum = SMSA_DRUMID(op);
+		block = SMSA_BLOCKID(op);
+	}
+	else {
+		drum = conn->head.drum;
+		block = conn->head.block;
+	}
+
+	switch ( cmd ) {
+
+		case SMSA_NET_HELLO:
+			return ( helloConnection ( conn, op ) );
+
+		case SMSA_NET_CACHE_STATS:
+			smsa_hot_stats ( &stats );
+			smsa_pack_cache_stats ( blocks, &stats );
+			return ( queueResponse ( conn, op, 0, blocks, 1 ) );
+
+		case SMSA_NET_FOLLOW:
+			//a follower has one leader at a time
+			ret = -1;
+			if ( followerMode && leaderLink == NULL && conn->version >= 2 ) {
+				logMessage ( LOG_INFO_LEVEL, "Following the Leader at [%s/%s]", conn->host, conn->port );
+				conn->leader = 1;
+				leaderLink = conn;
+				ret = 0;
+
+				//the responses to a batch of writes go out as the writes
+				//finish, and must not wait on each other
+				i = 1;
+				setsockopt ( conn->sock, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i) );
+			}
+			break;
+
+		case SMSA_MOUNT:
+			//only the first client to mount actually mounts the array
+			ret = 0;
+			if ( !conn->mounted ) {
+				if ( mountCount == 0 ) {
+					ret = arrayOperation ( op, NULL );
+					arrayHead.drum = 0;
+					arrayHead.block = 0;
+
+					//writes a crash left in the log go back
+					//into the array before anyone can read it
+					if ( ret == 0 && smsa_wal_recover () ) {
+						smsa_operation ( encode_SMSA_operation ( SMSA_UNMOUNT, 0, 0 ), NULL );
+						smsa_wal_close ( 0 );
+						ret = -1;
+					}
+					if ( ret == 0 )
+						conn->seq = smsa_replica_sync ();
+				}
+				if ( ret == 0 ) {
+					conn->mounted = 1;
+					mountCount++;
+				}
+			}
+			conn->head.drum = 0;
+			conn->head.block = 0;
+
+			//the response tells the client the geometry of the array
+			if ( ret == 0 )
+				op = smsa_geometry_operation ( &smsa_geometry );
+			break;
+
+		case SMSA_UNMOUNT:
+			//only the last client to unmount actually unmounts the array. 
+			//After the response is sent the connection is closed
+			ret = 0;
+			if ( conn->mounted ) {
+				conn->mounted = 0;
+				if ( --mountCount == 0 )
+					ret = unmountArray ();
+			}
+			conn->closing = 1;
+			break;
+
+		case SMSA_SEEK_DRUM:
+			//seeking a drum puts the block head back at the start of it
+			ret = ( mountCount == 0 ) ? -1 : 0;
+			if ( ret == 0 ) {
+				conn->head.drum = SMSA_DRUMID(op);
+				conn->head.block = 0;
+			}
+			break;
+
+		case SMSA_SEEK_BLOCK:
+			ret = ( mountCount == 0 ) ? -1 : 0;
+			if ( ret == 0 )
+				conn->head.block = SMSA_BLOCKID(op);
+			break;
+
+		case SMSA_DISK_READ:
+		case SMSA_DISK_WRITE:
+			//reads and writes move the block head on to the next block
+			ret = operationAt ( cmd, conn->head.drum, conn->head.block, blocks );
+			if ( ret == 0 )
+				conn->head.block++;
+			if ( ret == 0 && cmd == SMSA_DISK_WRITE )
+				written = 1;
+			break;
+
+		case SMSA_FORMAT_DRUM:
+			//formatting puts the heads back at the first drum
+			ret = operationAt ( cmd, conn->head.drum, 0, NULL );
+			if ( ret == 0 ) {
+				conn->head.drum = 0;
+				conn->head.block = 0;
+			}
+			break;
+
+		case SMSA_NET_READ_AT:
+			ret = 0;
+			for ( i = 0; i < count && ret == 0; i++ )
+				ret = operationAt ( SMSA_DISK_READ, SMSA_DRUMID(op), SMSA_BLOCKID(op)+i, &blocks[i*SMSA_BLOCK_SIZE] );
+			break;
+
+		case SMSA_NET_SNAPSHOT:
+			//the image is the array once every write that came before
+			//it is done. The ones after it copy their drum into it first
+			ret = -1;
+			if ( mountCount > 0 && snapshotOwner == NULL && !exporting ) {
+				if ( workEvent != -1 )
+					smsa_drain_workers ();
+				if ( smsa_snapshot_take () == 0 ) {
+					snapshotOwner = conn;
+					ret = 0;
+				}
+			}
+			break;
+
+		case SMSA_NET_SNAPSHOT_READ:
+			ret = ( snapshotOwner != NULL ) ? smsa_snapshot_read ( SMSA_DRUMID(op), SMSA_BLOCKID(op), count, blocks ) : -1;
+			break;
+
+		case SMSA_NET_SNAPSHOT_DROP:
+			ret = ( snapshotOwner == conn ) ? 0 : -1;
+			if ( ret == 0 ) {
+				smsa_snapshot_drop ();
+				snapshotOwner = NULL;
+			}
+			break;
+
+		case SMSA_NET_EXPORT:
+			//a worker writes the file while the loop goes on, and the
+			//response is queued when it is done
+			ret = -1;
+			if ( mountCount > 0 && snapshotOwner == NULL && !exporting && smsa_snapshot_exports () && workEvent != -1 ) {
+				smsa_drain_workers ();
+				if ( smsa_snapshot_take () == 0 ) {
+					exporting = 1;
+					return ( submitOperation ( conn, op, blocks, 1 ) );
+				}
+			}
+			break;
+
+		case SMSA_NET_MOVE_DRUM:
+			ret = moveDrum ( conn, op, blocks, size );
+			break;
+
+		case SMSA_NET_DRUM_HOME:
+			//nothing while the drum is being moved, or is here
+			memset ( blocks, 0, SMSA_BLOCK_SIZE );
+			ret = ( SMSA_DRUMID(op) < SMSA_DISK_ARRAY_SIZE ) ? 0 : -1;
+			if ( ret == 0 && drumMover[SMSA_DRUMID(op)] == NULL && drumHome[SMSA_DRUMID(op)] != NULL )
+				strncpy ( (char *)blocks, drumHome[SMSA_DRUMID(op)], SMSA_BLOCK_SIZE-1 );
+			return ( queueResponse ( conn, op, ret, blocks, 1 ) );
+
+		case SMSA_NET_WRITE_AT:
+			ret = 0;
+			for ( i = 0; i < count && ret == 0; i++ )
+				ret = operationAt ( SMSA_DISK_WRITE, SMSA_DRUMID(op), SMSA_BLOCKID(op)+i, &blocks[i*SMSA_BLOCK_SIZE] );
+			written = ( ret == 0 ) ? i : i-1;
+			break;
+
+		default:
+			ret = arrayOperation ( op, blocks );
+			break;
+	}
+
+	//Follow what a read, write or format did in the leases, and tell the
+	//connections that cache the blocks it changed
+	if ( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT )
+		smsa_lease_follow ( conn->lease, SMSA_DISK_READ, drum, block, count, ret );
+	else if ( cmd == SMSA_DISK_WRITE || cmd == SMSA_NET_WRITE_AT )
+		sendInvalidations ( smsa_lease_follow ( conn->lease, SMSA_DISK_WRITE, drum, block, count, ret ), SMSA_DISK_WRITE, drum, block, count );
+	else if ( cmd == SMSA_FORMAT_DRUM )
+		sendInvalidations ( smsa_lease_follow ( conn->lease, SMSA_FORMAT_DRUM, drum, 0, 0, ret ), SMSA_FORMAT_DRUM, drum, 0, 0 );
+
+	//Log and forward what a write or format changed to the followers, even
+	//if it failed part of the way
+	if ( written > 0 ) {
+		smsa_wal_append ( SMSA_DISK_WRITE, drum, block, written, blocks );
+		conn->seq = smsa_replica_forward ( SMSA_DISK_WRITE, drum, block, written, blocks );
+	}
+	else if ( cmd == SMSA_FORMAT_DRUM && ret == 0 ) {
+		smsa_wal_append ( SMSA_FORMAT_DRUM, drum, 0, 0, NULL );
+		conn->seq = smsa_replica_forward ( SMSA_FORMAT_DRUM, drum, 0, 0, NULL );
+	}
+	followLeader ( conn, cmd, ret );
+
+	//Queue the response. Reads are the only operation that sends blocks back
+	if ( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT || cmd == SMSA_NET_SNAPSHOT_READ )
+		return ( queueResponse ( conn, op, ret, blocks, count ) );
+	return ( queueResponse ( conn, op, ret, NULL, 0 ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : helloConnection
+// Description  : Agrees on a protocol version with a client, see smsa_network.h.
+//		  The version is the highest one we both speak, and the features
+//		  are the ones the client asked for that the server has. The
+//		  response goes out in the version the hello came in, and the
+//		  packets after it are framed in the new one. A hello the server
+//		  can not agree to fails like it would on a version 1 server. A
+//		  client that gets invalidations is given a slot for its leases.
+//
+// Inputs       : conn - the connection the hello came from
+//		  op - the opcode of the hello
+// Outputs      : 0 if successful, 1 if the connection should be closed
+
+int helloConnection ( SMSA_CONNECTION *conn, uint32_t op ) {
+
+	int version;		//version we agree on
+	uint16_t features;	//features we agree on
+	int one = 1;
+
+
+	version = getServerProtocol ();
+	if ( SMSA_BLOCKID(op) < version )
+		version = SMSA_BLOCKID(op);
+	features = SMSA_DRUMID(op) & SMSA_SERVER_FEATURES;
+
+	if ( version < 2 || conn->version != 1 ) {
+		smsa_error_number = SMSA_BAD_OPCODE;
+		return ( queueResponse ( conn, op, -1, NULL, 0 ) );
+	}
+
+	//Invalidations need a slot in the lease directory. Once they are all
+	//taken, clients go without them
+	if ( features & SMSA_NET_FLAG_INVALIDATE ) {
+		if ( ( conn->lease = smsa_lease_open () ) == -1 ) {
+			logMessage ( LOG_WARNING_LEVEL, "No lease slots left for [%s/%s], it will not get invalidations", conn->host, conn->port );
+			features &= ~SMSA_NET_FLAG_INVALIDATE;
+		}
+		else {
+			leaseHolders[conn->lease] = conn;
+
+			//an invalidation goes out on its own, and the response
+			//behind it must not wait for the client to acknowledge it
+			setsockopt ( conn->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+		}
+	}
+
+	if ( queueResponse ( conn, SMSA_NET_OPERATION ( SMSA_NET_HELLO, features, version ), 0, NULL, 0 ) )
+		return 1;
+	conn->version = version;
+	conn->features = features;
+
+	logMessage ( LOG_INFO_LEVEL, "Client [%s/%s] speaks protocol version %d, features [%x]", conn->host, conn->port, version, features );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : operationAt
+// Description  : Performs a read, write or format at the given drum and block.
+//		  The server keeps track of where the heads of the array are in
+//		  arrayHead, and only seeks when they are somewhere else, so a
+//		  single client seeking the way it always has costs nothing extra.
+//		  A read of a block in the hot block cache does not use the array
+//		  at all, and the cache follows what the operation does to it.
+//
+// Inputs       : cmd - SMSA_DISK_READ, SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+//		  drum - the drum to operate on
+//		  block - the block to operate on ( ignored by a format )
+//		  buf - the block to read into or write from
+// Outputs      : 0 if successful, -1 if failure
+
+int operationAt ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf ) {
+
+	uint64_t start = 0;	//when the operation started, for timing the misses of the cache
+
+
+	//A client that reads or writes past the last block of a drum has a 
+	//head that the array can not seek to
+	if ( block >= SMSA_MAX_BLOCK_ID ) {
+		logMessage ( LOG_ERROR_LEVEL, "_operationAt:Illegal drum/block [%u/%u]", drum, block );
+		smsa_error_number = ( cmd == SMSA_DISK_READ ) ? SMSA_BAD_READ : SMSA_BAD_WRITE;
+		return -1;
+	}
+
+	//A write or format keeps what it changes in the image of the array
+	if ( cmd != SMSA_DISK_READ )
+		smsa_snapshot_preserve ( drum );
+
+	if ( cmd == SMSA_DISK_READ && smsa_hot_enabled () ) {
+		if ( smsa_hot_get ( drum, block, buf ) == 0 )
+			return 0;
+		start = smsa_hot_now ();
+	}
+
+	//Move the array heads to where the operation needs them
+	if ( arrayHead.drum != drum ) {
+		if ( smsa_operation ( encode_SMSA_operation ( SMSA_SEEK_DRUM, drum, 0 ), NULL ) )
+			return -1;
+		arrayHead.drum = drum;
+		arrayHead.block = 0;
+	}
+	if ( cmd != SMSA_FORMAT_DRUM && arrayHead.block != block ) {
+		if ( smsa_operation ( encode_SMSA_operation ( SMSA_SEEK_BLOCK, 0, block ), NULL ) )
+			return -1;
+		arrayHead.block = block;
+	}
+
+	//Do the operation, then follow what it did to the array heads
+	if ( smsa_operation ( encode_SMSA_operation ( cmd, 0, 0 ), buf ) )
+		return -1;
+	if ( cmd == SMSA_FORMAT_DRUM ) {
+		smsa_hot_invalidate_drum ( drum );
+		arrayHead.drum = 0;
+		arrayHead.block = 0;
+	}
+	else
+		arrayHead.block++;
+
+	if ( cmd == SMSA_DISK_READ )
+		smsa_hot_fill ( drum, block, buf, smsa_hot_now () - start );
+	else if ( cmd == SMSA_DISK_WRITE )
+		smsa_hot_update ( drum, block, buf );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : submitOperation
+// Description  : Hands the operation in one packet to the workers. The drum and
+//		  block come from the virtual heads of the connection for reads,
+//		  writes and formats, and from the opcode for everything else. The
+//		  connection is busy until the operation finishes, so the packets 
+//		  after it wait in its input.
+//
+// Inputs       : conn - the connection the packet came from
+//		  op - opcode for the smsa_operation
+//		  blocks - the blocks sent with the operation
+//		  count - the number of blocks the operation covers
+// Outputs      : 0 if successful, 1 if the connection should be closed
+
+int submitOperation ( SMSA_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count ) {
+
+	SMSA_WORK *work;	//the operation for the workers
+	uint32_t cmd;		//command in the opcode
+
+
+	//Nothing can be done to the drums while the array is not mounted
+	if ( mountCount == 0 ) {
+		smsa_error_number = SMSA_UNMOUNTED_DISK;
+		return ( queueResponse ( conn, op, -1, NULL, 0 ) );
+	}
+
+	if ( ( work = malloc ( sizeof(SMSA_WORK) + count*SMSA_BLOCK_SIZE ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_submitOperation:Failed to allocate the operation [%s]", strerror(errno) );
+		return 1;
+	}
+	work->conn = conn;
+	work->op = op;
+	work->count = count;
+	work->lease = conn->lease;
+	work->revoked = 0;
+	work->seq = 0;
+	memcpy ( work->buf, blocks, count*SMSA_BLOCK_SIZE );
+
+	cmd = SMSA_OPCODE(op);
+	switch ( cmd ) {
+
+		case SMSA_DISK_READ:
+		case SMSA_DISK_WRITE:
+		case SMSA_FORMAT_DRUM:
+			work->cmd = cmd;
+			work->drum = conn->head.drum;
+			work->block = conn->head.block;
+			break;
+
+		case SMSA_NET_READ_AT:
+			work->cmd = SMSA_DISK_READ;
+			work->drum = SMSA_DRUMID(op);
+			work->block = SMSA_BLOCKID(op);
+			break;
+
+		case SMSA_NET_WRITE_AT:
+			work->cmd = SMSA_DISK_WRITE;
+			work->drum = SMSA_DRUMID(op);
+			work->block = SMSA_BLOCKID(op);
+			break;
+
+		default:
+			work->cmd = cmd;
+			work->drum = SMSA_DRUMID(op);
+			work->block = SMSA_BLOCKID(op);
+			break;
+	}
+
+	conn->busy = 1;
+	smsa_submit_work ( work );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cachedRead
+// Description  : Reads the blocks of a read from the hot block cache, if all of
+//		  them are there, so that the read does not have to wait for the
+//		  workers. A write the workers have not finished yet may still be
+//		  replacing one of them, and the read then sees the block from
+//		  before it, as it would if it had been performed first. Its
+//		  lease is then revoked by the write, like any other.
+//
+// Inputs       : conn - the connection the read came from
+//		  op - opcode of the read
+//		  blocks - will hold the blocks
+//		  count - the number of blocks
+// Outputs      : 0 if every block was in the cache, 1 if not
+
+int cachedRead ( SMSA_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count ) {
+
+	SMSA_DRUM_ID drum;	//drum of the read
+	SMSA_BLOCK_ID block;	//first block of the read
+	int i;
+
+
+	if ( !smsa_hot_enabled () )
+		return 1;
+
+	if ( SMSA_OPCODE(op) == SMSA_DISK_READ ) {
+		drum = conn->head.drum;
+		block = conn->head.block;
+	}
+	else {
+		drum = SMSA_DRUMID(op);
+		block = SMSA_BLOCKID(op);
+	}
+
+	//The lease goes first, so a write that replaces a block after we read
+	//it always revokes the lease. If the read misses, the lease costs no
+	//more than an invalidation the client did not need
+	smsa_lease_grant ( conn->lease, drum, block, count );
+
+	for ( i = 0; i < count; i++ ) {
+		if ( smsa_hot_get ( drum, block+i, &blocks[i*SMSA_BLOCK_SIZE] ) )
+			return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : finishOperations
+// Description  : Takes every operation the workers have finished, moves the
+//		  virtual heads of its connection the way the operation would have
+//		  moved the array heads, and queues its response. Then the packets
+//		  that were waiting behind it are processed.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int finishOperations ( void ) {
+
+	SMSA_WORK *work;	//an operation the workers finished
+	SMSA_CONNECTION *conn;	//the connection it came from
+	uint32_t cmd;		//command in the opcode
+
+
+	while ( ( work = smsa_finished_work () ) != NULL ) {
+
+		conn = work->conn;
+		conn->busy = 0;
+
+		//An export is done with its image, even if its client went away
+		if ( SMSA_OPCODE(work->op) == SMSA_NET_EXPORT ) {
+			smsa_snapshot_drop ();
+			exporting = 0;
+		}
+
+		//Tell the connections that cached what the operation changed, even
+		//if the client that asked for it went away
+		sendInvalidations ( work->revoked, work->cmd, work->drum, work->block, work->count );
+
+		//The client went away while the operation was with the workers
+		if ( conn->dead ) {
+			releaseConnection ( conn );
+			free ( work );
+			continue;
+		}
+
+		cmd = SMSA_OPCODE(work->op);
+		if ( work->ret == 0 && ( cmd == SMSA_DISK_READ || cmd == SMSA_DISK_WRITE ) )
+			conn->head.block++;
+		if ( work->ret == 0 && cmd == SMSA_FORMAT_DRUM ) {
+			conn->head.drum = 0;
+			conn->head.block = 0;
+		}
+		conn->seq = work->seq;
+		followLeader ( conn, cmd, work->ret );
+
+		//Reads are the only operation that sends blocks back
+		if ( queueResponse ( conn, work->op, work->ret, work->buf, ( work->ret == 0 && 
+				( cmd == SMSA_DISK_READ || cmd == SMSA_NET_READ_AT ) ) ? work->count : 0 ) ||
+				processInput ( conn ) )
+			closeConnection ( conn );
+		else
+			queueFlush ( conn );
+		free ( work );
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arrayOperation
+// Description  : Performs an smsa_operation from the I/O thread. The workers are
+//		  drained first, so that the library is never used by the I/O
+//		  thread and a worker at the same time.
+//
+// Inputs       : op - opcode for the smsa_operation
+//		  block - the block for the operation
+// Outputs      : 0 if successful, -1 if failure
+
+int arrayOperation ( uint32_t op, unsigned char *block ) {
+
+	if ( workEvent != -1 )
+		smsa_drain_workers ();
+
+	//Mounting or unmounting the array changes every block on it, and the
+	//image of it goes with it
+	if ( SMSA_OPCODE(op) == SMSA_MOUNT || SMSA_OPCODE(op) == SMSA_UNMOUNT ) {
+		smsa_hot_clear ();
+		smsa_snapshot_drop ();
+		snapshotOwner = NULL;
+	}
+
+	return ( smsa_operation ( op, block ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unmountArray
+// Description  : Unmounts the array once the last client that mounted it is
+//		  done with it, whether it unmounted or went away. The log is
+//		  emptied if the array was stored, and the drums that were moved
+//		  away are back here for the next mount.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int unmountArray ( void ) {
+
+	int ret;	//return of the unmount
+
+
+	ret = arrayOperation ( encode_SMSA_operation ( SMSA_UNMOUNT, 0, 0 ), NULL );
+	smsa_wal_close ( ret == 0 );
+	forgetMoves ( NULL );
+
+	return ret;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueResponse
+// Description  : Builds a response packet and adds it to the output of the
+//		  connection. It is sent by flushConnection. The packet is framed
+//		  in the protocol version of the connection, and with the checksum
+//		  feature its blocks are covered by a checksum. With the compression
+//		  feature the blocks are compressed, if that makes them smaller.
+//
+// Inputs       : conn - the connection to respond on
+//		  op - opcode for smsa_operation
+//		  ret - return of smsa_operation
+//		  blocks - the blocks that were read ( NULL if there are none )
+//		  count - the number of blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int queueResponse ( SMSA_CONNECTION *conn, uint32_t op, int16_t ret, unsigned char *blocks, uint16_t count ) {
+
+	unsigned char *buf;	//where the packet is built
+	uint32_t header;	//size of the packet header
+	SMSA_FRAME frame;	//header of the packet
+
+
+	if ( blocks == NULL )
+		count = 0;
+	header = smsa_frame_header_size ( conn->version );
+	memset ( &frame, 0, sizeof(frame) );
+	frame.len = header + count*SMSA_BLOCK_SIZE;
+	frame.id = conn->requestId;
+	frame.op = op;
+	frame.ret = ret;
+	frame.blocks = count;
+	frame.seq = conn->seq;
+
+	//Make sure there is room for the packet
+	if ( ( buf = outputRoom ( conn, frame.len ) ) == NULL )
+		return 1;
+
+	//If this is a read, add the blocks to the packet. The checksum covers
+	//the blocks themselves, not how they were encoded
+	if ( count > 0 ) {
+		frame.len = header + smsa_encode_payload ( conn->features, blocks, count, &buf[header], &frame.flags );
+		if ( conn->features & SMSA_NET_FLAG_CHECKSUM ) {
+			frame.flags |= SMSA_NET_FLAG_CHECKSUM;
+			frame.checksum = smsa_crc32 ( blocks, count*SMSA_BLOCK_SIZE );
+		}
+	}
+
+	smsa_pack_frame ( conn->version, buf, &frame );
+	conn->outBytes += frame.len;
+	conn->queued++;
+	responseCount++;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : outputRoom
+// Description  : Makes room for a frame at the end of the output of a connection,
+//		  growing it if it has to. The frame is only part of the output
+//		  once outBytes is moved past it.
+//
+// Inputs       : conn - the connection
+//		  len - the length of the frame
+// Outputs      : where the frame goes, NULL if failure
+
+unsigned char *outputRoom ( SMSA_CONNECTION *conn, uint32_t len ) {
+
+	unsigned char *buf;	//the grown output buffer
+	uint32_t newSize;	//size the output buffer grows to
+
+
+	if ( conn->outBytes + len > conn->outSize ) {
+		for ( newSize = ( conn->outSize == 0 ) ? SMSA_MAX_PACKET_SIZE*SMSA_INPUT_PACKETS : conn->outSize*2;
+				newSize < conn->outBytes + len; newSize *= 2 );
+		if ( ( buf = realloc ( conn->out, newSize ) ) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_outputRoom:Failed to grow the output buffer [%s]", strerror(errno) );
+			return NULL;
+		}
+		conn->out = buf;
+		conn->outSize = newSize;
+	}
+
+	return ( &conn->out[conn->outBytes] );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : moveDrum
+// Description  : Performs an SMSA_NET_MOVE_DRUM for a client that moves a drum to
+//		  or from this server ( see smsa_network.h ). The fence waits
+//		  until the workers have performed every operation taken before
+//		  it, so a write that was in flight is either in the copy the
+//		  client makes, or failed with SMSA_NET_MOVED and sent again to
+//		  where the drum goes. Only one connection fences a drum at a time.
+//
+// Inputs       : conn - the connection moving the drum
+//		  op - the opcode, with the drum and the SMSA_NET_MOVE_PHASE
+//		  blocks - the payload, the host:port the drum moves to ( OUT )
+//		  size - the size of the payload
+// Outputs      : 0 if successful, -1 if failure
+
+int moveDrum ( SMSA_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint32_t size ) {
+
+	SMSA_DRUM_ID drum = SMSA_DRUMID(op);	//drum being moved
+	char *home;				//where it is moved to
+
+
+	if ( !conn->mounted || drum >= SMSA_DISK_ARRAY_SIZE || ( drumMover[drum] != NULL && drumMover[drum] != conn ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_moveDrum:Can not move drum [%u] for [%s/%s]", drum, conn->host, conn->port );
+		return -1;
+	}
+
+	switch ( SMSA_BLOCKID(op) ) {
+
+		case SMSA_NET_MOVE_FENCE:
+			if ( workEvent != -1 )
+				smsa_drain_workers ();
+			drumMover[drum] = conn;
+			return 0;
+
+		case SMSA_NET_MOVE_IN:
+			if ( drumMover[drum] != conn )
+				return -1;
+			free ( drumHome[drum] );
+			drumHome[drum] = NULL;
+			drumMover[drum] = NULL;
+			logMessage ( LOG_INFO_LEVEL, "Drum [%u] Moved In From [%s/%s]", drum, conn->host, conn->port );
+			return 0;
+
+		case SMSA_NET_MOVE_OUT:
+			if ( drumMover[drum] != conn || size == 0 || blocks[0] == '\0' || memchr ( blocks, '\0', size ) == NULL )
+				return -1;
+			if ( ( home = strdup ( (char *)blocks ) ) == NULL ) {
+				logMessage ( LOG_ERROR_LEVEL, "_moveDrum:Failed to keep where drum [%u] went [%s]", drum, strerror(errno) );
+				return -1;
+			}
+			free ( drumHome[drum] );
+			drumHome[drum] = home;
+			drumMover[drum] = NULL;
+			logMessage ( LOG_INFO_LEVEL, "Drum [%u] Moved Out To [%s]", drum, home );
+			return 0;
+
+		case SMSA_NET_MOVE_ABORT:
+			if ( drumMover[drum] == conn )
+				drumMover[drum] = NULL;
+			return 0;
+	}
+
+	return -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : drumMoved
+// Description  : Decides if an operation is on a drum that was moved away, or is
+//		  being moved by another connection
+//
+// Inputs       : conn - the connection the operation came in on
+//		  op - the opcode
+// Outputs      : 1 if it is, 0 if not
+
+int drumMoved ( SMSA_CONNECTION *conn, uint32_t op ) {
+
+	uint32_t cmd = SMSA_OPCODE(op);
+	SMSA_DRUM_ID drum;
+
+	if ( cmd == SMSA_NET_READ_AT || cmd == SMSA_NET_WRITE_AT )
+		drum = SMSA_DRUMID(op);
+	else if ( cmd == SMSA_DISK_READ || cmd == SMSA_DISK_WRITE || cmd == SMSA_FORMAT_DRUM || cmd == SMSA_BLOCK_SIGN )
+		drum = conn->head.drum;
+	else
+		return 0;
+
+	if ( drum >= SMSA_MAX_DISK_ARRAY_SIZE )
+		return 0;
+	if ( drumMover[drum] != NULL )
+		return ( drumMover[drum] != conn );
+	return ( drumHome[drum] != NULL );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : forgetMoves
+// Description  : Drops the fences a connection holds, leaving its drums where
+//		  they were, or every move once the array is unmounted
+//
+// Inputs       : conn - the connection, NULL for every move
+// Outputs      : none
+
+void forgetMoves ( SMSA_CONNECTION *conn ) {
+
+	int i;
+
+	for ( i = 0; i < SMSA_MAX_DISK_ARRAY_SIZE; i++ ) {
+		if ( conn == NULL ) {
+			free ( drumHome[i] );
+			drumHome[i] = NULL;
+			drumMover[i] = NULL;
+		}
+		else if ( drumMover[i] == conn )
+			drumMover[i] = NULL;
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : followLeader
+// Description  : Moves a follower up to a write or format of its leader once it
+//		  is performed. The leader sends each one with its sequence number
+//		  as the request id, and waits for the response before it sends
+//		  a later one that depends on it.
+//
+// Inputs       : conn - the connection that asked for the operation
+//		  cmd - the command of the operation
+//		  ret - the return of the operation
+// Outputs      : none
+
+void followLeader ( SMSA_CONNECTION *conn, uint32_t cmd, int16_t ret ) {
+
+	if ( conn->leader && ret == 0 && ( cmd == SMSA_DISK_WRITE || cmd == SMSA_NET_WRITE_AT || cmd == SMSA_FORMAT_DRUM ) )
+		appliedSeq = conn->requestId;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sendInvalidations
+// Description  : Tells every connection whose lease an operation revoked to drop
+//		  the blocks it changed, a write its own blocks and a format the
+//		  whole drum. The invalidations go out at the end of the loop 
+//		  iteration, with the response to the operation. A connection
+//		  whose invalidation can not be queued is closed once its output
+//		  is sent, which makes its client drop the blocks when it
+//		  reconnects.
+//
+// Inputs       : holders - the lease slots that were revoked
+//		  cmd - SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+//		  drum - the drum of the operation
+//		  block - the first block of the operation ( ignored by a format )
+//		  count - the number of blocks ( ignored by a format )
+// Outputs      : none
+
+void sendInvalidations ( uint64_t holders, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count ) {
+
+	SMSA_CONNECTION *conn;	//a connection that held a lease
+	int slot;
+
+
+	//a drum can have more blocks than a frame can count, so a format
+	//covers none of them, which stands for the whole drum
+	if ( cmd == SMSA_FORMAT_DRUM ) {
+		block = 0;
+		count = 0;
+	}
+
+	for ( slot = 0; holders != 0; slot++, holders >>= 1 ) {
+
+		if ( !( holders & 1 ) )
+			continue;
+
+		conn = leaseHolders[slot];
+		if ( conn == NULL || conn->dead || conn->closing )
+			continue;
+
+		if ( queueInvalidation ( conn, drum, block, count ) )
+			conn->closing = 1;
+		queueFlush ( conn );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueInvalidation
+// Description  : Adds an SMSA_NET_INVALIDATE frame to the output of a connection,
+//		  see smsa_network.h. It is not a response, so it has request id 0
+//		  and does not count as one.
+//
+// Inputs       : conn - the connection to send it on
+//		  drum - the drum of the blocks
+//		  block - the first block
+//		  count - the number of blocks
+// Outputs      : 0 if successful, 1 if failure
+
+int queueInvalidation ( SMSA_CONNECTION *conn, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count ) {
+
+	unsigned char *buf;	//where the frame is built
+	SMSA_FRAME frame;	//header of the frame
+
+
+	memset ( &frame, 0, sizeof(frame) );
+	frame.len = smsa_frame_header_size ( conn->version );
+	frame.op = SMSA_NET_OPERATION ( SMSA_NET_INVALIDATE, drum, block );
+	frame.blocks = count;
+
+	if ( ( buf = outputRoom ( conn, frame.len ) ) == NULL )
+		return 1;
+
+	smsa_pack_frame ( conn->version, buf, &frame );
+	conn->outBytes += frame.len;
+	conn->pushed++;
+	invalidationCount++;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : queueFlush
+// Description  : Puts a connection on the list of connections to flush at the end
+//		  of the loop iteration. Everything the loop handles for the
+//		  connection until then, every packet it read and every operation
+//		  the workers finished, adds its response to the same output, so
+//		  they all go out together instead of a write for each of them.
+//
+// Inputs       : conn - the connection
+// Outputs      : none
+
+void queueFlush ( SMSA_CONNECTION *conn ) {
+
+	if ( conn->flushing )
+		return;
+
+	conn->flushing = 1;
+	conn->nextFlush = flushList;
+	flushList = conn;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushPending
+// Description  : Flushes every connection on the list, at the end of a loop 
+//		  iteration. A connection that holds its output back ( see 
+//		  holdOutput ) is only watched, and comes back on the list when
+//		  its operation finishes. Connections that were closed while they
+//		  were on the list are released.
+//
+//		  With a write-ahead log, the writes of the iteration are committed
+//		  first, in one sync, so nothing is acknowledged before it is 
+//		  durable. A server that can not commit shuts down without sending
+//		  anything. Once the log is big enough, it is checkpointed.
+//
+// Inputs       : epoll - epoll file handle ( -1 with io_uring )
+// Outputs      : none
+
+void flushPending ( int epoll ) {
+
+	SMSA_CONNECTION *conn;	//the connection being flushed
+
+
+	if ( smsa_wal_commit () ) {
+		logMessage ( LOG_ERROR_LEVEL, "_flushPending:Failed to commit the log, shutting down" );
+		serverShutdown = 1;
+		return;
+	}
+	if ( smsa_wal_checkpoint_due () ) {
+		if ( workEvent != -1 )
+			smsa_drain_workers ();
+		smsa_wal_checkpoint ();
+	}
+
+	while ( ( conn = flushList ) != NULL ) {
+
+		flushList = conn->nextFlush;
+		conn->nextFlush = NULL;
+		conn->flushing = 0;
+
+		if ( conn->dead ) {
+			releaseConnection ( conn );
+			continue;
+		}
+
+		if ( holdOutput ( conn ) ) {
+			holdCount++;
+			if ( !serverUring && watchConnection ( epoll, conn ) )
+				closeConnection ( conn );
+			continue;
+		}
+
+		if ( flushConnection ( epoll, conn ) )
+			closeConnection ( conn );
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : holdOutput
+// Description  : Decides if a connection should hold its output back for now.
+//		  When a client pipelines, a packet that goes to the workers stops
+//		  the packets behind it, and the responses ahead of it ( mostly
+//		  the 8 byte acknowledgments of seeks and writes ) would go out
+//		  in a write of their own. They are held until the operation
+//		  finishes, and then sent with its response.
+//
+//		  This only happens while the client has more packets waiting
+//		  behind the operation, so a client that is waiting for the
+//		  responses before it sends more always gets them right away. So
+//		  that a deep pipeline does not hold too much, the output is sent
+//		  anyway once it reaches SMSA_HOLD_RESPONSES or SMSA_HOLD_BYTES.
+//		  Output with an invalidation in it is never held, so the client
+//		  hears about the writes of other clients as soon as it can.
+//
+// Inputs       : conn - the connection
+// Outputs      : 1 if the output should be held, 0 if it should be sent
+
+int holdOutput ( SMSA_CONNECTION *conn ) {
+
+	if ( !conn->busy || conn->closing || conn->pushed > 0 )
+		return 0;
+
+	if ( conn->inBytes == 0 && conn->spillBytes == 0 )
+		return 0;
+
+	return ( conn->queued < SMSA_HOLD_RESPONSES && conn->outBytes < SMSA_HOLD_BYTES );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushConnection
+// Description  : Sends as much of the queued output as the socket will take. If
+//		  the socket fills up, epoll is asked to tell us when it drains, and
+//		  the rest is sent then.
+//
+// Inputs       : epoll - epoll file handle
+//		  conn - the connection to send on
+// Outputs      : 0 if successful, 1 if the connection should be closed
+
+int flushConnection ( int epoll, SMSA_CONNECTION *conn ) {
+
+	int sb;				//number of bytes that were sent
+	int blocked = 0;		//true if the socket could not take everything
+
+
+	//With io_uring, the output is sent by posting sends to the ring
+	if ( serverUring )
+		return ( uringSend ( conn ) );
+
+	//Write until all of the output is sent, or the socket is full
+	while ( conn->outSent < conn->outBytes ) {
+		if ( (sb = write( conn->sock, &conn->out[conn->outSent], conn->outBytes-conn->outSent )) < 0 ) {
+			if ( errno == EINTR )
+				continue;
+			if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+				blocked = 1;
+				break;
+			}
+			logMessage( LOG_ERROR_LEVEL, "_flushConnection:Failed to write to [%s/%s] [%s]", conn->host, conn->port, strerror(errno) );
+			return 1;
+		}
+		conn->outSent += sb;
+		writeCount++;
+	}
+
+	//Everything was sent, so the buffer can be reused from the start
+	if ( !blocked ) {
+		conn->outBytes = 0;
+		conn->outSent = 0;
+		conn->queued = 0;
+		conn->pushed = 0;
+		if ( conn->closing ) {
+			logMessage( LOG_INFO_LEVEL, "Closing client connection [%s/%s]", conn->host, conn->port );
+			return 1;
+		}
+	}
+
+	return ( watchConnection ( epoll, conn ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : watchConnection
+// Description  : Changes the events epoll watches for on a connection. It is only
+//		  asked about room to write while there is output that did not fit
+//		  in the socket, and about input while there is room to take it.
+//
+// Inputs       : epoll - epoll file handle
+//		  conn - the connection to watch
+// Outputs      : 0 if successful, 1 if the connection should be closed
+
+int watchConnection ( int epoll, SMSA_CONNECTION *conn ) {
+
+	struct epoll_event event;	//used to change what epoll tells us about
+
+
+	event.events = 0;
+	if ( conn->outSent < conn->outBytes )
+		event.events |= EPOLLOUT;
+	if ( !conn->closing && conn->inBytes < SMSA_INPUT_SIZE )
+		event.events |= EPOLLIN;
+
+	if ( event.events != conn->events ) {
+		event.data.ptr = conn;
+		if ( epoll_ctl ( epoll, EPOLL_CTL_MOD, conn->sock, &event ) == -1 ) {
+			logMessage( LOG_ERROR_LEVEL, "_watchConnection:Failed to change epoll events [%s]", strerror(errno) );
+			return 1;
+		}
+		conn->events = event.events;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeConnection
+// Description  : Closes a connection and releases its state. If the client still
+//		  had the array mounted, its mount is released as if it had sent
+//		  an unmount, so a client that dies does not keep the array mounted.
+//
+// Inputs       : conn - the connection to close
+// Outputs      : none
+
+void closeConnection ( SMSA_CONNECTION *conn ) {
+
+	if ( conn->mounted && --mountCount == 0 ) {
+		logMessage ( LOG_INFO_LEVEL, "Client [%s/%s] Left Without Unmounting. Unmounting the Array", conn->host, conn->port );
+		unmountArray ();
+	}
+
+	//A drum the client was moving stays where it was
+	forgetMoves ( conn );
+
+	//The image the client took goes with it
+	if ( conn == snapshotOwner ) {
+		smsa_snapshot_drop ();
+		snapshotOwner = NULL;
+	}
+
+	//Without its leader a follower falls behind, so it stops serving reads
+	if ( conn == leaderLink ) {
+		logMessage ( LOG_WARNING_LEVEL, "Lost the leader at [%s/%s], no longer serving reads", conn->host, conn->port );
+		leaderLink = NULL;
+	}
+
+	//closing the socket also removes it from epoll. With io_uring the socket
+	//is only shut down, which finishes the receive and send posted on it, and
+	//it is closed once they are done
+	if ( serverUring )
+		shutdown ( conn->sock, SHUT_RDWR );
+	else {
+		close ( conn->sock );
+		conn->sock = -1;
+	}
+	conn->dead = 1;
+
+	releaseConnection ( conn );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : releaseConnection
+// Description  : Frees the state of a closed connection, once nothing refers to 
+//		  it anymore. An operation that is still with the workers, a
+//		  receive or send still posted to the ring, or the list of 
+//		  connections to flush, points at the connection, so it is released
+//		  again when they are done with it.
+//
+// Inputs       : conn - the closed connection
+// Outputs      : none
+
+void releaseConnection ( SMSA_CONNECTION *conn ) {
+
+	if ( conn->busy || conn->receiving || conn->sending || conn->flushing )
+		return;
+
+	if ( conn->lease != -1 ) {
+		smsa_lease_close ( conn->lease );
+		leaseHolders[conn->lease] = NULL;
+	}
+	if ( conn->sock != -1 )
+		close ( conn->sock );
+	free ( conn->in );
+	free ( conn->out );
+	free ( conn->sendBuf );
+	free ( conn->spill );
+	free ( conn );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setNonBlocking
+// Description  : Puts a socket in non-blocking mode, so that the event loop is
+//		  never stuck on one client
+//
+// Inputs       : sock - the socket file handle
+// Outputs      : 0 if successful, 1 if failure
+
+int setNonBlocking ( int sock ) {
+
+	int flags;
+
+	if ( ( flags = fcntl ( sock, F_GETFL, 0 ) ) == -1 || fcntl ( sock, F_SETFL, flags | O_NONBLOCK ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setNonBlocking:Failed to set the socket non-blocking [%s]", strerror(errno) );
+		return 1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setUpServer
+// Description  : Sets up the server by creating the socket, binding it to the right addresss
+//		  and starts the server listening. It then sets the server input equal to the
+//		  socket file handler.
+//
+// Inputs       : int - server file handler
+// Outputs      : 0 if successful, -1 if failure
+
+int setupServer ( int *server ) {
+
+
+	struct sigaction sigINT;   	   //holds the sigINT signal handler
+	char *ip;			   //address to listen on ( NULL for any )
+	uint16_t port;			   //port to listen on
+
+
+	//Set signal handler
+	//This sets changes the current SIGINT signal handler to operate in the way
+	//that we would like by having our smsa_signal_handler be called on reception
+	//of a SIGINT from the OS, rather than the default handler
+	sigINT.sa_handler = signalHandler;
+	sigINT.sa_flags = SA_NODEFER | SA_ONSTACK;
+	sigaction ( SIGINT, &sigINT, NULL );
+
+	//A client that goes away while we are writing to it should only
+	//close its own connection, not take down the whole server
+	signal ( SIGPIPE, SIG_IGN );
+
+
+	//find out where to listen, then create the socket and bind it there
+	if ( getListenAddress ( &ip, &port ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failed to get the listen address" );
+		return 1;
+	}
+	if ( bindServer ( server, ip, port ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failure to bind the server to [%s/%d]", ( ip == NULL ) ? "any" : ip, port );
+		return 1;
+	}
+	
+	logMessage ( LOG_INFO_LEVEL, "Socket Is Now Bound To [%s/%d]", ( ip == NULL ) ? "any" : ip, port );
+
+	//listen for connections
+	if ( listen ( *server, SMSA_MAX_BACKLOG ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_setUpServer:Failure to properly listen [%s]", strerror(errno) );
+		return 1;
+	}
+	
+	logMessage ( LOG_INFO_LEVEL, "Socket Is Now Listening Queueing %d Connections", SMSA_MAX_BACKLOG );
+
+
+	logMessage ( LOG_INFO_LEVEL, "Server Has Now Been Successfully Setup" );
+	return 0;
+
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_address
+// Description  : Sets the address and port that the server will listen on. Passing
+//                NULL or 0 leaves that value to the environment ( SMSA_ADDRESS_ENV /
+//                SMSA_PORT_ENV ), or to any address on SMSA_DEFAULT_PORT otherwise.
+//
+// Inputs       : ip - host name or IPv4/IPv6 address to listen on
+//                port - port number to listen on
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_address ( char *ip, uint16_t port ) {
+
+	//free any address that was set by a previous call
+	free ( listenIP );
+	listenIP = NULL;
+
+	//keep our own copy, since the caller might reuse its buffer
+	if ( ip != NULL && ( listenIP = strdup ( ip ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server_set_address:Failed to copy the address [%s]", strerror(errno) );
+		return -1;
+	}
+	listenPort = port;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_workers
+// Description  : Sets the number of worker threads the server performs drum 
+//                operations with. With 0 workers every operation is performed
+//                by the event loop itself.
+//
+// Inputs       : workers - number of worker threads ( 0 for none )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_workers ( int workers ) {
+
+	if ( workers < 0 || workers > SMSA_MAX_WORKERS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server_set_workers:Bad number of workers [%d]", workers );
+		return -1;
+	}
+	serverWorkers = workers;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_cache
+// Description  : Sets the number of blocks the server keeps in its hot block
+//                cache, in front of the array ( see smsa_hot.c ).
+//
+// Inputs       : lines - number of blocks ( 0 for no cache )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_cache ( uint32_t lines ) {
+
+	serverCacheLines = lines;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_add_follower
+// Description  : Adds a follower the server forwards its writes to ( see
+//                smsa_replica.c ). The server links to every follower when
+//                it starts, and will not start if one can not be reached.
+//
+// Inputs       : follower - the follower, as host:port
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_add_follower ( char *follower ) {
+
+	return ( smsa_replica_add ( follower ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_log
+// Description  : Sets the file the server logs its writes to ( see
+//                smsa_wal.c ). The log is replayed into the array when it is
+//                mounted, so it should be kept in the disk file.
+//
+// Inputs       : file - the log file ( NULL for no log )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_log ( char *file ) {
+
+	return ( smsa_wal_set_file ( file ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_export
+// Description  : Sets the file the server writes images of the array to when
+//                a client asks for an export ( see smsa_snapshot.c ). It holds
+//                a raw image, which file storage can mount.
+//
+// Inputs       : file - the export file ( NULL for none )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_export ( char *file ) {
+
+	return ( smsa_snapshot_set_file ( file ) );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_follower
+// Description  : Makes the server a follower. It takes writes only from the
+//                leader that links to it, and fails the reads of a client
+//                that has seen a later write than it has performed.
+//
+// Inputs       : follower - true to be a follower
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_follower ( int follower ) {
+
+	followerMode = follower;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_transport
+// Description  : Sets how the server does its network I/O. SMSA_TRANSPORT_DEFAULT
+//                leaves it to the environment ( SMSA_TRANSPORT_ENV ).
+//
+// Inputs       : transport - the transport to use
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_transport ( SMSA_TRANSPORT transport ) {
+
+	serverTransport = transport;
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getServerTransport
+// Description  : Decides which transport to use. A transport set through
+//                smsa_server_set_transport wins, then the environment, and
+//                otherwise plain sockets
+//
+// Inputs       : none
+// Outputs      : the transport
+
+SMSA_TRANSPORT getServerTransport ( void ) {
+
+	char *env;	//value of the environment variable
+
+	if ( serverTransport != SMSA_TRANSPORT_DEFAULT )
+		return serverTransport;
+	if ( ( env = getenv ( SMSA_TRANSPORT_ENV ) ) != NULL && strcmp ( env, "uring" ) == 0 )
+		return SMSA_TRANSPORT_URING;
+
+	return SMSA_TRANSPORT_SOCKETS;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_server_set_protocol
+// Description  : Sets the highest protocol version the server agrees to with a
+//                client. 0 leaves it to the environment ( SMSA_PROTOCOL_ENV ).
+//
+// Inputs       : version - the highest version, up to SMSA_NET_VERSION
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_server_set_protocol ( int version ) {
+
+	if ( version < 0 || version > SMSA_NET_VERSION ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_server_set_protocol:Bad protocol version [%d]", version );
+		return -1;
+	}
+	serverProtocol = version;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getServerProtocol
+// Description  : Decides the highest protocol version to agree to. A version set
+//                through smsa_server_set_protocol wins, then the environment, and
+//                otherwise SMSA_NET_VERSION
+//
+// Inputs       : none
+// Outputs      : the version
+
+int getServerProtocol ( void ) {
+
+	char *env;	//value of the environment variable
+	int version;
+
+	if ( serverProtocol != 0 )
+		return serverProtocol;
+	if ( ( env = getenv ( SMSA_PROTOCOL_ENV ) ) != NULL && sscanf ( env, "%d", &version ) == 1 &&
+			version >= 1 && version <= SMSA_NET_VERSION )
+		return version;
+
+	return SMSA_NET_VERSION;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getListenAddress
+// Description  : Decides which address and port to listen on. An address set
+//                through smsa_server_set_address wins, then the environment. If 
+//                neither sets an address, ip is set to NULL meaning any address.
+//
+// Inputs       : ip - will point to the address to listen on ( NULL for any )
+//                port - will hold the port to listen on
+// Outputs      : 0 if successful, -1 if failure
+
+int getListenAddress ( char **ip, uint16_t *port ) {
+
+	char *env;               //value of an environment variable
+	unsigned int envPort;    //port parsed out of the environment
+
+
+	//find the address
+	if ( listenIP != NULL )
+		*ip = listenIP;
+	else if ( ( env = getenv ( SMSA_ADDRESS_ENV ) ) != NULL && *env != '\0' )
+		*ip = env;
+	else
+		*ip = NULL;
+
+	//find the port, making sure that a port from the environment is sane
+	if ( listenPort != 0 )
+		*port = listenPort;
+	else if ( ( env = getenv ( SMSA_PORT_ENV ) ) != NULL && *env != '\0' ) {
+		if ( sscanf ( env, "%u", &envPort ) != 1 || envPort == 0 || envPort > 65535 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_getListenAddress:Bad port in %s [%s]", SMSA_PORT_ENV, env );
+			return -1;
+		}
+		*port = envPort;
+	}
+	else
+		*port = SMSA_DEFAULT_PORT;
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : bindServer
+// Description  : Resolves the listen address, then creates a socket and binds it
+//		  to the first address that works. When no address is given, the
+//		  IPv6 wildcard is tried first with IPV6_V6ONLY turned off, so that
+//		  both IPv4 and IPv6 clients can connect. On hosts without IPv6 the
+//		  IPv4 wildcard is used instead.
+//
+// Inputs       : server - will hold the socket file handle
+//		  ip - address to listen on ( NULL for any )
+//		  port - port to listen on
+// Outputs      : 0 if successful, -1 if failure
+
+int bindServer ( int *server, char *ip, uint16_t port ) {
+
+	struct addrinfo hints;             //what kind of addresses we want back
+	struct addrinfo *results, *addr;   //list of addresses to try
+	char portString[8];                //port as a string for getaddrinfo
+	int optionValue = 1;		   //holds the value for setsocketopt function call
+	int v6Only = 0;			   //accept IPv4 clients on an IPv6 socket
+	int pass, err;
+
+
+	//Resolve the address. With AI_PASSIVE and no address we get the wildcards
+	snprintf ( portString, sizeof(portString), "%u", port );
+	memset ( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ( ( err = getaddrinfo ( ip, portString, &hints, &results ) ) != 0 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_bindServer:Failed to resolve the listen address [%s]", gai_strerror(err) );
+		return 1;
+	}
+
+	//Walk the list twice, IPv6 addresses on the first pass and everything
+	//else on the second, so that the dual stack socket is preferred
+	*server = -1;
+	for ( pass = 0; pass < 2 && *server == -1; pass++ ) {
+		for ( addr = results; addr != NULL; addr = addr->ai_next ) {
+
+			if ( ( addr->ai_family == AF_INET6 ) != ( pass == 0 ) )
+				continue;
+
+			//Create the socket
+			//Set up a socket using TCP protocol ( SOCK_STREAM ), and the address family 
+			//of this address, while setting the server variable to the file handle
+			if ( ( *server = socket ( addr->ai_family, addr->ai_socktype, addr->ai_protocol ) ) == -1 ) {
+				logMessage( LOG_ERROR_LEVEL, "_bindServer:Failed to set up the socket [%s]", strerror(errno) );
+				continue;
+			}
+
+			logMessage( LOG_INFO_LEVEL, "Socket Successfully Initialized. Socket File Handle = %d", *server );
+	
+			//Set the socket to be reusable. 
+			//The setsockopt will allow us to change options of our socket which is 
+			//specified with our file handle, server.
+			if ( setsockopt ( *server, SOL_SOCKET, SO_REUSEADDR, &optionValue, sizeof(optionValue) ) != 0 ) {
+				logMessage ( LOG_ERROR_LEVEL, "_bindServer:setsockopt failed to make the local address reusable [%s]", strerror(errno) );
+			}
+
+			//Let the IPv6 wildcard take IPv4 clients as well
+			if ( addr->ai_family == AF_INET6 && ip == NULL )
+				setsockopt ( *server, IPPROTO_IPV6, IPV6_V6ONLY, &v6Only, sizeof(v6Only) );
+
+			//bind the server to the socket. bind the server file handle to 
+			//the address we have resolved
+			if ( bind ( *server, addr->ai_addr, addr->ai_addrlen ) == -1 ) {
+				logMessage ( LOG_ERROR_LEVEL, "_bindServer:Failure to bind the server to the socket [%s]", strerror(errno) );
+				close ( *server );
+				*server = -1;
+				continue;
+			}
+
+			break;
+		}
+	}
+	freeaddrinfo ( results );
 
+	return ( *server == -1 ) ? 1 : 0;
 }
 
 
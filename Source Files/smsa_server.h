@@ -0,0 +1,204 @@
+#ifndef SMSA_SERVER_INCLUDED
+#define SMSA_SERVER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_server.h
+//  Description    : This is the server side of the SMSA communication protocol.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+#include <netdb.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+#include <smsa_protocol.h>
+
+// Defines
+#define SMSA_MAX_EVENTS 64					// most epoll events handled per loop iteration
+#define SMSA_MAX_PACKET_SIZE (SMSA_NET_HEADER_SIZE+SMSA_MAX_BLOCK_SIZE)	// largest packet on the wire
+#define SMSA_INPUT_PACKETS 16					// version 1 packets that fit in a connection input buffer, after a whole frame
+#define SMSA_INPUT_SIZE (SMSA_NET_FRAME_SIZE+(SMSA_NET_HEADER_SIZE+SMSA_BLOCK_SIZE)*SMSA_INPUT_PACKETS)	// size of a connection input buffer, in the geometry of the array
+#define SMSA_SERVER_FEATURES (SMSA_NET_FLAG_CHECKSUM|SMSA_NET_FLAG_COMPRESSED|SMSA_NET_FLAG_UNIFORM|SMSA_NET_FLAG_INVALIDATE)	// SMSA_NET_FLAGS the server agrees to
+#define SMSA_URING_GROUP 0					// buffer group of the io_uring receive buffers
+#define SMSA_URING_BUFFERS 256					// number of io_uring receive buffers ( a power of 2 )
+#define SMSA_URING_BUFFER_SIZE 4096				// size of each io_uring receive buffer
+#define SMSA_HOLD_RESPONSES 32					// most responses a pipelining connection holds back
+#define SMSA_HOLD_BYTES 16384					// most output a pipelining connection holds back
+
+//
+// Type Definitions
+
+// This is the kind of operation an io_uring completion is for. It is kept
+// in the low bits of the user data, under the connection pointer
+typedef enum {
+	SMSA_URING_ACCEPT	= 0,	// multishot accept on the listening socket
+	SMSA_URING_RECEIVE	= 1,	// multishot receive on a connection
+	SMSA_URING_SEND		= 2,	// send on a connection
+	SMSA_URING_WORK		= 3,	// read of the workers' eventfd
+	SMSA_URING_OP_MASK	= 3,
+} SMSA_URING_OP;
+
+// This is the state of one client connection. Every connection keeps its
+// own framing state, so a packet that arrives in pieces on one connection
+// does not hold up packets that are complete on the others. It also keeps
+// its own virtual heads, so that the seeks of one client never move the
+// heads out from under another
+typedef struct smsa_connection {
+	int		sock;		// socket file handle of the client
+	int		version;	// protocol version the connection speaks
+	uint16_t	features;	// SMSA_NET_FLAGS agreed on for the connection
+	uint32_t	requestId;	// request id of the packet being performed
+	int		mounted;	// true if this client has the array mounted
+	SMSA_HEAD	head;		// where this client's seeks have put its heads
+	int		closing;	// true if the connection closes once its output is sent
+	int		busy;		// true while one of its operations is with the workers
+	int		dead;		// true once closed, it is freed when nothing refers to it
+	uint32_t	events;		// events epoll is watching for on this connection
+	unsigned char	*in;		// bytes received but not yet processed ( SMSA_INPUT_SIZE of them )
+	uint32_t	inBytes;	// number of bytes in in
+	unsigned char	*out;		// responses waiting to be sent
+	uint32_t	outBytes;	// number of bytes in out
+	uint32_t	outSent;	// number of bytes of out already sent
+	uint32_t	outSize;	// allocated size of out
+	uint32_t	queued;		// number of responses in out
+	uint32_t	pushed;		// number of SMSA_NET_INVALIDATE frames in out
+	int		lease;		// slot in the lease directory ( -1 if none, see smsa_lease.c )
+	int		leader;		// true if this is the link of the leader of a follower
+	uint32_t	seq;		// sequence number the response being queued carries
+	int		flushing;	// true while on the list of connections to flush
+	struct smsa_connection *nextFlush;	// next connection on that list
+	int		receiving;	// io_uring: true while a multishot receive is posted
+	int		sending;	// io_uring: true while a send of sendBuf is posted
+	unsigned char	*spill;		// io_uring: bytes received while in was full
+	uint32_t	spillBytes;	// number of bytes in spill
+	uint32_t	spillSize;	// allocated size of spill
+	unsigned char	*sendBuf;	// io_uring: output the posted send is sending
+	uint32_t	sendBytes;	// number of bytes in sendBuf
+	uint32_t	sendSent;	// number of bytes of sendBuf already sent
+	uint32_t	sendSize;	// allocated size of sendBuf
+	char		host[NI_MAXHOST];	// printable client address
+	char		port[NI_MAXSERV];	// printable client port
+} SMSA_CONNECTION;
+
+
+//
+// Funtional Prototypes
+
+// Set up the listening socket
+int setupServer ( int *server );
+
+// The event loop built on epoll
+int epollLoop ( int server );
+
+// Set up the ring for the io_uring event loop
+int setupUring ( void );
+
+// The event loop built on io_uring
+int uringLoop ( int server );
+
+// Handle a completion of the multishot receive of a connection
+void uringReceive ( SMSA_CONNECTION *conn, int32_t res, uint32_t flags );
+
+// Add received bytes to the input of a connection
+int takeInput ( SMSA_CONNECTION *conn, unsigned char *buf, uint32_t len );
+
+// Post a send of the queued output of a connection to the ring
+int uringSend ( SMSA_CONNECTION *conn );
+
+// Post a multishot accept on the listening socket to the ring
+int postAccept ( int server );
+
+// Post a multishot receive on a connection to the ring
+int postReceive ( SMSA_CONNECTION *conn );
+
+// Post a read of the workers' eventfd to the ring
+int postWorkRead ( void );
+
+// Accept every connection waiting on the listening socket
+int acceptConnections ( int epoll, int server );
+
+// Set up the state of a connection that was just accepted
+SMSA_CONNECTION *newConnection ( int client );
+
+// Read what is available on a connection and process every complete packet
+int readConnection ( SMSA_CONNECTION *conn );
+
+// Process the complete packets in the input of a connection
+int processInput ( SMSA_CONNECTION *conn );
+
+// Perform the operation in one packet and queue the response
+int processPacket ( SMSA_CONNECTION *conn, SMSA_FRAME *frame, unsigned char *payload );
+
+// Agree on a protocol version with a client
+int helloConnection ( SMSA_CONNECTION *conn, uint32_t op );
+
+// Hand the operation in one packet to the workers
+int submitOperation ( SMSA_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count );
+
+// Read the blocks of a read from the hot block cache, if they are all there
+int cachedRead ( SMSA_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint16_t count );
+
+// Send the responses for every operation the workers have finished
+int finishOperations ( void );
+
+// Perform an operation on the whole array from the I/O thread
+int arrayOperation ( uint32_t op, unsigned char *block );
+
+// Unmount the array once the last client that mounted it is done with it
+int unmountArray ( void );
+
+// Perform a read, write or format at a drum/block, moving the array heads there first
+int operationAt ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, unsigned char *buf );
+
+// Add a response packet to the output of a connection
+int queueResponse ( SMSA_CONNECTION *conn, uint32_t op, int16_t ret, unsigned char *blocks, uint16_t count );
+
+// Make room for a frame at the end of the output of a connection
+unsigned char *outputRoom ( SMSA_CONNECTION *conn, uint32_t len );
+
+// Fence a drum for a client moving it, or move it in or out
+int moveDrum ( SMSA_CONNECTION *conn, uint32_t op, unsigned char *blocks, uint32_t size );
+
+// Decide if an operation is on a drum that was moved away from the connection
+int drumMoved ( SMSA_CONNECTION *conn, uint32_t op );
+
+// Drop the fences of a connection, or forget every move ( NULL )
+void forgetMoves ( SMSA_CONNECTION *conn );
+
+// Move a follower up to a write of its leader that was performed
+void followLeader ( SMSA_CONNECTION *conn, uint32_t cmd, int16_t ret );
+
+// Tell the connections whose leases an operation revoked to drop the blocks
+void sendInvalidations ( uint64_t holders, SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count );
+
+// Add an SMSA_NET_INVALIDATE frame to the output of a connection
+int queueInvalidation ( SMSA_CONNECTION *conn, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count );
+
+// Put a connection on the list to flush at the end of the loop iteration
+void queueFlush ( SMSA_CONNECTION *conn );
+
+// Flush every connection on the list
+void flushPending ( int epoll );
+
+// Decide if a connection should hold its output back for now
+int holdOutput ( SMSA_CONNECTION *conn );
+
+// Send as much queued output as the socket will take
+int flushConnection ( int epoll, SMSA_CONNECTION *conn );
+
+// Have epoll watch for the events the connection is ready to handle
+int watchConnection ( int epoll, SMSA_CONNECTION *conn );
+
+// Close a connection, releasing its mount of the array
+void closeConnection ( SMSA_CONNECTION *conn );
+
+// Free a closed connection once nothing refers to it
+void releaseConnection ( SMSA_CONNECTION *conn );
+
+#endif
@@ -0,0 +1,352 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_snapshot.c
+//  Description   : This is the point-in-time image of the array the server
+//		    keeps for a backup. Taking one copies nothing. The image is
+//		    the array as it was when it was taken, and a drum is only
+//		    copied into it the first time a write or format changes the
+//		    drum after that ( copy-on-write ). Every other drum of the
+//		    image is read straight from the array, so backing up the
+//		    array costs at most one copy of each drum, and the clients
+//		    keep writing while the image is read or exported.
+//
+//		    A write or format copies its drum while it has the drum to
+//		    itself ( the drum lock of the workers, or the I/O thread ),
+//		    and before it changes anything. The image is read under
+//		    snapshotLock, so a drum that has not been copied can not be
+//		    copied, or written, while it is read from the array.
+//
+//		    The server keeps one image at a time. It belongs to the
+//		    connection that took it, or to an export, which writes the
+//		    whole image to the export file as a raw image of the array,
+//		    like the disk file of file storage.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_internal.h>
+#include <smsa_snapshot.h>
+#include <cmpsc311_log.h>
+
+
+// Global Variables
+char *exportFile = NULL;				//file set by smsa_snapshot_set_file ( NULL for none )
+int snapshotActive = 0;					//true while an image is kept
+int snapshotBroken = 0;					//true once a drum could not be copied into the image
+unsigned char *snapshotDrums[SMSA_MAX_DISK_ARRAY_SIZE];	//drums copied into the image ( NULL if it reads the array )
+uint64_t snapshotsTaken = 0;				//images taken
+uint64_t snapshotCopies = 0;				//drums copied into them
+uint64_t snapshotExports = 0;				//images written to the export file
+pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;	//held while the image is used
+
+
+//Functional Prototypes
+int readImage ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char *blocks );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_set_file
+// Description  : Sets the file the server exports images of the array to.
+//
+// Inputs       : file - the export file ( NULL for none )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_snapshot_set_file ( char *file ) {
+
+	free ( exportFile );
+	exportFile = NULL;
+	if ( file != NULL && ( exportFile = strdup ( file ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_set_file:Failed to save the export file [%s]", strerror(errno) );
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_exports
+// Description  : Tells if the server has a file to export images to
+//
+// Inputs       : none
+// Outputs      : 1 if it does, 0 if not
+
+int smsa_snapshot_exports ( void ) {
+
+	return ( exportFile != NULL );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_take
+// Description  : Takes an image of the array as it is now. The array has to be
+//		  mounted, and no write or format can be in progress ( the I/O
+//		  thread drains the workers first ), or the image could hold part
+//		  of one.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if there already is an image
+
+int smsa_snapshot_take ( void ) {
+
+	pthread_mutex_lock ( &snapshotLock );
+	if ( snapshotActive ) {
+		pthread_mutex_unlock ( &snapshotLock );
+		return -1;
+	}
+	memset ( snapshotDrums, 0, sizeof(snapshotDrums) );
+	snapshotBroken = 0;
+	snapshotActive = 1;
+	snapshotsTaken++;
+	pthread_mutex_unlock ( &snapshotLock );
+
+	logMessage ( LOG_INFO_LEVEL, "Took an image of the array" );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_preserve
+// Description  : Copies a drum into the image before a write or format changes
+//		  it, unless it was copied already. The caller has to have the
+//		  drum to itself. Without an image this only looks at a flag, so
+//		  writes cost nothing extra. The flag is only set while the
+//		  workers are drained, and a stale one is looked at again under
+//		  the lock.
+//
+// Inputs       : drum - the drum about to be changed
+// Outputs      : none
+
+void smsa_snapshot_preserve ( SMSA_DRUM_ID drum ) {
+
+	if ( !snapshotActive || drum >= SMSA_DISK_ARRAY_SIZE )
+		return;
+
+	pthread_mutex_lock ( &snapshotLock );
+	if ( snapshotActive && !snapshotBroken && snapshotDrums[drum] == NULL ) {
+
+		if ( ( snapshotDrums[drum] = malloc ( SMSA_DISK_SIZE ) ) == NULL ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_preserve:Failed to copy drum [%u], the image is lost", drum );
+			snapshotBroken = 1;
+		}
+		else if ( SMSAReadBlocksAt ( drum, 0, SMSA_MAX_BLOCK_ID, snapshotDrums[drum] ) ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_preserve:Failed to copy drum [%u], the image is lost", drum );
+			snapshotBroken = 1;
+		}
+		if ( !snapshotBroken )
+			snapshotCopies++;
+	}
+	pthread_mutex_unlock ( &snapshotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_read
+// Description  : Reads blocks of a drum from the image. They come from the copy
+//		  of the drum if it was changed since the image was taken, and
+//		  from the array if not.
+//
+// Inputs       : drum - the drum
+//		  block - the first block
+//		  count - the number of blocks
+//		  blocks - will hold the blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_snapshot_read ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char *blocks ) {
+
+	int ret;
+
+	if ( drum >= SMSA_DISK_ARRAY_SIZE || block+count > SMSA_MAX_BLOCK_ID ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_read:Illegal drum/block [%u/%u] of [%u] blocks", drum, block, count );
+		return -1;
+	}
+
+	pthread_mutex_lock ( &snapshotLock );
+	ret = readImage ( drum, block, count, blocks );
+	pthread_mutex_unlock ( &snapshotLock );
+
+	return ret;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_export
+// Description  : Writes the whole image to the export file, a drum at a time.
+//		  It is written to a file next to it first, then synced and
+//		  renamed over it, so the export file always holds a whole image.
+//		  The image does not change while it is written, and writes go
+//		  on meanwhile.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_snapshot_export ( void ) {
+
+	char temp[PATH_MAX];		//file the image is written to first
+	unsigned char *drum;		//the blocks of the drum being written
+	uint32_t currentDisk, sent;
+	ssize_t sb;
+	int handle, err = 0;
+
+
+	if ( exportFile == NULL )
+		return -1;
+	if ( snprintf ( temp, sizeof(temp), "%s.tmp", exportFile ) >= sizeof(temp) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_export:Export file name [%s] is too long", exportFile );
+		return -1;
+	}
+	if ( ( drum = malloc ( SMSA_DISK_SIZE ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_export:Failed to allocate the drum buffer" );
+		return -1;
+	}
+	if ( ( handle = open ( temp, O_WRONLY|O_CREAT|O_TRUNC, S_IRUSR|S_IWUSR ) ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_export:Failed to open [%s] [%s]", temp, strerror(errno) );
+		free ( drum );
+		return -1;
+	}
+
+	for ( currentDisk = 0; currentDisk < SMSA_DISK_ARRAY_SIZE && !err; currentDisk++ ) {
+
+		//the lock is only held for a drum at a time, so writes that copy
+		//their drum wait for no more than that
+		if ( smsa_snapshot_read ( currentDisk, 0, SMSA_MAX_BLOCK_ID, drum ) ) {
+			err = 1;
+			break;
+		}
+		for ( sent = 0; sent < SMSA_DISK_SIZE && !err; sent += sb ) {
+			if ( ( sb = write ( handle, &drum[sent], SMSA_DISK_SIZE-sent ) ) < 0 ) {
+				if ( errno == EINTR ) {
+					sb = 0;
+					continue;
+				}
+				logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_export:Failed to write [%s] [%s]", temp, strerror(errno) );
+				err = 1;
+			}
+		}
+	}
+	free ( drum );
+
+	if ( !err && fdatasync ( handle ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_export:Failed to sync [%s] [%s]", temp, strerror(errno) );
+		err = 1;
+	}
+	if ( close ( handle ) )
+		err = 1;
+	if ( !err && rename ( temp, exportFile ) ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_snapshot_export:Failed to rename [%s] to [%s] [%s]", temp, exportFile, strerror(errno) );
+		err = 1;
+	}
+	if ( err ) {
+		unlink ( temp );
+		return -1;
+	}
+
+	pthread_mutex_lock ( &snapshotLock );
+	snapshotExports++;
+	pthread_mutex_unlock ( &snapshotLock );
+
+	logMessage ( LOG_INFO_LEVEL, "Exported an image of the array to [%s]", exportFile );
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_snapshot_drop
+// Description  : Drops the image, and frees the drums that were copied for it.
+//		  Dropping it when there is none does nothing.
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_snapshot_drop ( void ) {
+
+	int i;
+
+	pthread_mutex_lock ( &snapshotLock );
+	for ( i = 0; i < SMSA_DISK_ARRAY_SIZE; i++ ) {
+		free ( snapshotDrums[i] );
+		snapshotDrums[i] = NULL;
+	}
+	snapshotActive = 0;
+	snapshotBroken = 0;
+	pthread_mutex_unlock ( &snapshotLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_snapshot_stats
+// Description  : Logs how many images were taken and exported, and how many
+//		  drums writes copied for them
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_log_snapshot_stats ( void ) {
+
+	if ( snapshotsTaken == 0 )
+		return;
+
+	logMessage ( LOG_OUTPUT_LEVEL, "Server took %llu images of the array, exported %llu, writes copied %llu drums for them",
+			(unsigned long long)snapshotsTaken, (unsigned long long)snapshotExports, (unsigned long long)snapshotCopies );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readImage
+// Description  : Reads blocks of a drum from the image, see smsa_snapshot_read.
+//		  It is called with snapshotLock held.
+//
+// Inputs       : drum - the drum
+//		  block - the first block
+//		  count - the number of blocks
+//		  blocks - will hold the blocks
+// Outputs      : 0 if successful, -1 if failure
+
+int readImage ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char *blocks ) {
+
+	if ( !snapshotActive || snapshotBroken )
+		return -1;
+
+	if ( snapshotDrums[drum] != NULL ) {
+		memcpy ( blocks, &snapshotDrums[drum][block*SMSA_BLOCK_SIZE], count*SMSA_BLOCK_SIZE );
+		return 0;
+	}
+
+	//the drum has not changed since the image was taken, and can not
+	//while we hold the lock
+	return SMSAReadBlocksAt ( drum, block, count, blocks );
+}
@@ -0,0 +1,48 @@
+#ifndef SMSA_SNAPSHOT_INCLUDED
+#define SMSA_SNAPSHOT_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_snapshot.h
+//  Description    : This is the point-in-time image of the array the server
+//                   keeps for a backup, see smsa_snapshot.c.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+
+
+//
+// Funtional Prototypes
+
+// Set the file the server exports images to ( NULL for none )
+int smsa_snapshot_set_file ( char *file );
+
+// Tell if the server has a file to export images to
+int smsa_snapshot_exports ( void );
+
+// Take an image of the array as it is now, with no writes in progress
+int smsa_snapshot_take ( void );
+
+// Copy a drum into the image before a write or format changes it, with the drum to ourselves
+void smsa_snapshot_preserve ( SMSA_DRUM_ID drum );
+
+// Read blocks of a drum from the image
+int smsa_snapshot_read ( SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint32_t count, unsigned char *blocks );
+
+// Write the whole image to the export file
+int smsa_snapshot_export ( void );
+
+// Drop the image, and the drums copied for it
+void smsa_snapshot_drop ( void );
+
+// Log how many images were taken and exported, and the drums copied for them
+void smsa_log_snapshot_stats ( void );
+
+#endif
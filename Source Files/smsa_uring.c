@@ -0,0 +1,340 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_uring.c
+//  Description   : This is a small io_uring wrapper for the SMSA network code.
+//		    It sets the rings up with io_uring_setup and mmap, and keeps
+//		    the head/tail handshake with the kernel, so that the client
+//		    and server only deal with submission and completion entries.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Project Include Files
+#include <smsa_uring.h>
+#include <cmpsc311_log.h>
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_init
+// Description  : Sets up a ring and maps its queues. This fails on kernels that
+//		  do not have io_uring, or where it has been turned off, and the
+//		  caller should then go back to plain system calls.
+//
+// Inputs       : ring - the ring to set up
+//		  entries - number of submission queue entries
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_uring_init ( SMSA_URING *ring, unsigned entries ) {
+
+	struct io_uring_params params;
+
+
+	memset ( ring, 0, sizeof(SMSA_URING) );
+	memset ( &params, 0, sizeof(params) );
+	if ( ( ring->fd = syscall ( __NR_io_uring_setup, entries, &params ) ) == -1 ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_uring_init:io_uring is not available [%s]", strerror(errno) );
+		return -1;
+	}
+
+	//Map the submission and completion rings. Newer kernels put both in
+	//one mapping
+	ring->sqRingSize = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe);
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ) {
+		if ( ring->cqRingSize > ring->sqRingSize )
+			ring->sqRingSize = ring->cqRingSize;
+		ring->cqRingSize = ring->sqRingSize;
+	}
+	ring->sqRing = mmap ( NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQ_RING );
+	if ( ring->sqRing == MAP_FAILED ) {
+		ring->sqRing = NULL;
+		goto failed;
+	}
+	if ( params.features & IORING_FEAT_SINGLE_MMAP )
+		ring->cqRing = ring->sqRing;
+	else if ( ( ring->cqRing = mmap ( NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_CQ_RING ) ) == MAP_FAILED ) {
+		ring->cqRing = NULL;
+		goto failed;
+	}
+	ring->sqesSize = params.sq_entries*sizeof(struct io_uring_sqe);
+	if ( ( ring->sqes = mmap ( NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring->fd, IORING_OFF_SQES ) ) == MAP_FAILED ) {
+		ring->sqes = NULL;
+		goto failed;
+	}
+
+	ring->sqHead = (unsigned *)((char *)ring->sqRing + params.sq_off.head);
+	ring->sqTail = (unsigned *)((char *)ring->sqRing + params.sq_off.tail);
+	ring->sqMask = *(unsigned *)((char *)ring->sqRing + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *)((char *)ring->sqRing + params.sq_off.array);
+	ring->sqEntries = params.sq_entries;
+	ring->cqHead = (unsigned *)((char *)ring->cqRing + params.cq_off.head);
+	ring->cqTail = (unsigned *)((char *)ring->cqRing + params.cq_off.tail);
+	ring->cqMask = *(unsigned *)((char *)ring->cqRing + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cqRing + params.cq_off.cqes);
+
+	return 0;
+
+failed:
+	logMessage ( LOG_ERROR_LEVEL, "_smsa_uring_init:Failed to map the rings [%s]", strerror(errno) );
+	smsa_uring_close ( ring );
+	return -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_close
+// Description  : Unmaps the rings and closes the ring, which also releases the
+//		  buffers registered with it
+//
+// Inputs       : ring - the ring to tear down
+// Outputs      : none
+
+void smsa_uring_close ( SMSA_URING *ring ) {
+
+	if ( ring->sqes != NULL )
+		munmap ( ring->sqes, ring->sqesSize );
+	if ( ring->cqRing != NULL && ring->cqRing != ring->sqRing )
+		munmap ( ring->cqRing, ring->cqRingSize );
+	if ( ring->sqRing != NULL )
+		munmap ( ring->sqRing, ring->sqRingSize );
+	if ( ring->fd != -1 )
+		close ( ring->fd );
+	free ( ring->bufRing );
+	free ( ring->bufs );
+
+	memset ( ring, 0, sizeof(SMSA_URING) );
+	ring->fd = -1;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_sqe
+// Description  : Gets the next submission queue entry, cleared. The entry is
+//		  not seen by the kernel until smsa_uring_submit, so any number of
+//		  them can be filled in and submitted with one system call.
+//
+// Inputs       : ring - the ring
+// Outputs      : the entry, or NULL if the queue is full and can not be submitted
+
+struct io_uring_sqe *smsa_uring_sqe ( SMSA_URING *ring ) {
+
+	struct io_uring_sqe *sqe;
+	unsigned tail;
+
+
+	//the queue is full, so hand what we have to the kernel first
+	tail = *ring->sqTail;
+	if ( tail - __atomic_load_n ( ring->sqHead, __ATOMIC_ACQUIRE ) >= ring->sqEntries ) {
+		if ( smsa_uring_submit ( ring, 0 ) == -1 )
+			return NULL;
+		tail = *ring->sqTail;
+	}
+
+	sqe = &ring->sqes[tail & ring->sqMask];
+	memset ( sqe, 0, sizeof(struct io_uring_sqe) );
+	ring->sqArray[tail & ring->sqMask] = tail & ring->sqMask;
+	__atomic_store_n ( ring->sqTail, tail+1, __ATOMIC_RELEASE );
+	ring->pending++;
+
+	return sqe;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_submit
+// Description  : Submits every entry queued since the last submit, and waits
+//		  for completions, in one system call
+//
+// Inputs       : ring - the ring
+//		  wait - number of completions to wait for ( 0 to not wait )
+// Outputs      : number of entries submitted if successful, -1 if failure
+//		  ( errno is EINTR if a signal came in while waiting )
+
+int smsa_uring_submit ( SMSA_URING *ring, unsigned wait ) {
+
+	int ret;
+
+
+	//the kernel can take fewer entries than we give it, keep going until
+	//it has all of them, only waiting on the first call
+	do {
+		ret = syscall ( __NR_io_uring_enter, ring->fd, ring->pending, wait,
+				wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0 );
+		if ( ret > 0 )
+			ring->pending -= ret;
+		wait = 0;
+	} while ( ret > 0 && ring->pending > 0 );
+
+	if ( ret == -1 && errno != EINTR )
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_uring_submit:Failed to submit [%s]", strerror(errno) );
+
+	return ret;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_peek
+// Description  : Gets the oldest completion without waiting. It stays in the
+//		  queue until smsa_uring_seen is called.
+//
+// Inputs       : ring - the ring
+// Outputs      : the completion, or NULL if there is none
+
+struct io_uring_cqe *smsa_uring_peek ( SMSA_URING *ring ) {
+
+	unsigned head = *ring->cqHead;
+
+	if ( head == __atomic_load_n ( ring->cqTail, __ATOMIC_ACQUIRE ) )
+		return NULL;
+
+	return &ring->cqes[head & ring->cqMask];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_seen
+// Description  : Hands the completion returned by smsa_uring_peek back to the kernel
+//
+// Inputs       : ring - the ring
+// Outputs      : none
+
+void smsa_uring_seen ( SMSA_URING *ring ) {
+
+	__atomic_store_n ( ring->cqHead, *ring->cqHead+1, __ATOMIC_RELEASE );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_register_buffers
+// Description  : Registers fixed buffers with the ring. The kernel pins them once
+//		  here, instead of mapping them on every read and write.
+//
+// Inputs       : ring - the ring
+//		  iov - the buffers
+//		  count - number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_uring_register_buffers ( SMSA_URING *ring, struct iovec *iov, unsigned count ) {
+
+	if ( syscall ( __NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, count ) == -1 ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_uring_register_buffers:Failed to register buffers [%s]", strerror(errno) );
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_provide_buffers
+// Description  : Sets up a ring of buffers that the kernel picks from when a
+//		  receive with IOSQE_BUFFER_SELECT completes. This is what lets one
+//		  multishot receive stay posted on a socket for its whole life.
+//
+// Inputs       : ring - the ring
+//		  group - buffer group id the receives will name
+//		  count - number of buffers ( a power of 2 )
+//		  size - size of each buffer
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_uring_provide_buffers ( SMSA_URING *ring, uint16_t group, unsigned count, unsigned size ) {
+
+	struct io_uring_buf_reg reg;
+	unsigned i;
+
+
+	if ( posix_memalign ( (void **)&ring->bufRing, sysconf(_SC_PAGESIZE), count*sizeof(struct io_uring_buf) ) ||
+			( ring->bufs = malloc ( count*size ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_uring_provide_buffers:Failed to allocate the buffers" );
+		return -1;
+	}
+	memset ( ring->bufRing, 0, count*sizeof(struct io_uring_buf) );
+	ring->bufCount = count;
+	ring->bufSize = size;
+	ring->bufGroup = group;
+
+	memset ( &reg, 0, sizeof(reg) );
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+	reg.ring_entries = count;
+	reg.bgid = group;
+	if ( syscall ( __NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) == -1 ) {
+		logMessage ( LOG_INFO_LEVEL, "_smsa_uring_provide_buffers:Failed to register the buffer ring [%s]", strerror(errno) );
+		return -1;
+	}
+
+	for ( i = 0; i < count; i++ )
+		smsa_uring_recycle ( ring, i );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_buffer
+// Description  : Gets the memory of a provided buffer. The id comes from the
+//		  flags of the completion, shifted by IORING_CQE_BUFFER_SHIFT.
+//
+// Inputs       : ring - the ring
+//		  bid - the buffer id
+// Outputs      : the buffer
+
+unsigned char *smsa_uring_buffer ( SMSA_URING *ring, uint16_t bid ) {
+
+	return &ring->bufs[bid*ring->bufSize];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_uring_recycle
+// Description  : Adds a provided buffer back to the end of the buffer ring, so
+//		  that the kernel can fill it again
+//
+// Inputs       : ring - the ring
+//		  bid - the buffer id
+// Outputs      : none
+
+void smsa_uring_recycle ( SMSA_URING *ring, uint16_t bid ) {
+
+	struct io_uring_buf *buf;
+	uint16_t tail = ring->bufRing->tail;
+
+
+	buf = &ring->bufRing->bufs[tail & (ring->bufCount-1)];
+	buf->addr = (uint64_t)(uintptr_t)smsa_uring_buffer ( ring, bid );
+	buf->len = ring->bufSize;
+	buf->bid = bid;
+	__atomic_store_n ( &ring->bufRing->tail, tail+1, __ATOMIC_RELEASE );
+}
@@ -0,0 +1,87 @@
+#ifndef SMSA_URING_INCLUDED
+#define SMSA_URING_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_uring.h
+//  Description    : This is a small io_uring wrapper for the SMSA network code.
+//                   It talks to the kernel with the raw system calls, so it does
+//                   not need liburing.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+// Defines
+#define SMSA_URING_ENTRIES 256		// submission queue entries in a ring
+
+//
+// Type Definitions
+
+// This is one io_uring instance, along with the buffers registered with it
+typedef struct {
+	int		fd;		// ring file handle ( -1 if not set up )
+	unsigned	*sqHead;	// kernel's submission queue head
+	unsigned	*sqTail;	// our submission queue tail
+	unsigned	sqMask;		// mask for submission queue indexes
+	unsigned	*sqArray;	// submission queue index array
+	unsigned	sqEntries;	// size of the submission queue
+	struct io_uring_sqe *sqes;	// submission queue entries
+	unsigned	*cqHead;	// our completion queue head
+	unsigned	*cqTail;	// kernel's completion queue tail
+	unsigned	cqMask;		// mask for completion queue indexes
+	struct io_uring_cqe *cqes;	// completion queue entries
+	void		*sqRing;	// mmapped submission ring
+	size_t		sqRingSize;	// size of sqRing
+	void		*cqRing;	// mmapped completion ring ( may be sqRing )
+	size_t		cqRingSize;	// size of cqRing
+	size_t		sqesSize;	// size of sqes
+	unsigned	pending;	// entries filled in but not yet submitted
+	struct io_uring_buf_ring *bufRing;	// provided receive buffers ( NULL if none )
+	unsigned char	*bufs;		// memory behind the provided buffers
+	unsigned	bufCount;	// number of provided buffers
+	unsigned	bufSize;	// size of each provided buffer
+	uint16_t	bufGroup;	// buffer group id of the provided buffers
+} SMSA_URING;
+
+
+//
+// Funtional Prototypes
+
+// Set up a ring, fails if the kernel does not support io_uring
+int smsa_uring_init ( SMSA_URING *ring, unsigned entries );
+
+// Tear down a ring and everything registered with it
+void smsa_uring_close ( SMSA_URING *ring );
+
+// Get a cleared submission queue entry, submitting the queue first if it is full
+struct io_uring_sqe *smsa_uring_sqe ( SMSA_URING *ring );
+
+// Submit everything queued, and wait for at least wait completions
+int smsa_uring_submit ( SMSA_URING *ring, unsigned wait );
+
+// Look at the next completion ( NULL if there are none )
+struct io_uring_cqe *smsa_uring_peek ( SMSA_URING *ring );
+
+// Tell the kernel we are done with the completion from smsa_uring_peek
+void smsa_uring_seen ( SMSA_URING *ring );
+
+// Register fixed buffers for IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED
+int smsa_uring_register_buffers ( SMSA_URING *ring, struct iovec *iov, unsigned count );
+
+// Set up a ring of provided buffers for receives with IOSQE_BUFFER_SELECT
+int smsa_uring_provide_buffers ( SMSA_URING *ring, uint16_t group, unsigned count, unsigned size );
+
+// Get a provided buffer by its id
+unsigned char *smsa_uring_buffer ( SMSA_URING *ring, uint16_t bid );
+
+// Give a provided buffer back to the kernel
+void smsa_uring_recycle ( SMSA_URING *ring, uint16_t bid );
+
+#endif
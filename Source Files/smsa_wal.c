@@ -0,0 +1,476 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_wal.c
+//  Description   : This is the write-ahead log of the SMSA server. With file
+//		    storage the array only reaches the disk file when it is
+//		    unmounted, so a crash would lose every write since the mount.
+//		    The server adds every write and format it performs to the log,
+//		    as a record of its drum, blocks and a CRC32, in the order the
+//		    drum lock puts them in ( like the writes forwarded to the
+//		    followers, see smsa_replica.c ).
+//
+//		    Records are only kept in memory until the end of the loop
+//		    iteration, when they are written and synced with one
+//		    fdatasync before any response goes out ( see flushPending ).
+//		    Every write acknowledged in an iteration shares that sync,
+//		    so the cost of making them durable is spread over the batch.
+//
+//		    Once the log holds SMSA_WAL_CHECKPOINT bytes, the server stops
+//		    the workers and checkpoints: the blocks changed since the last
+//		    store are written to the disk file and synced, and the log is
+//		    emptied. When the array is mounted, whatever the log still
+//		    holds is replayed into it, up to the first record that is torn
+//		    or does not match its checksum, and then checkpointed.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_internal.h>
+#include <smsa_protocol.h>
+#include <smsa_wal.h>
+#include <cmpsc311_log.h>
+
+
+// Global Variables
+char *walFile = NULL;				//file of the log set by smsa_wal_set_file ( NULL for no log )
+int walHandle = -1;				//file handle of the log while the array is mounted
+unsigned char walBuffer[SMSA_WAL_BUFFER];	//records added since they were last written
+uint32_t walBuffered = 0;			//bytes of records in walBuffer
+uint64_t walUnsynced = 0;			//bytes written to the log since it was last synced
+uint64_t walSize = 0;				//bytes written to the log since the last checkpoint
+int walFailed = 0;				//true once a record could not be written
+uint64_t walRecords = 0;			//records added to the log
+uint64_t walCommits = 0;			//syncs that made them durable
+uint64_t walCheckpoints = 0;			//times the log was folded into the disk file
+uint64_t walReplayed = 0;			//records replayed into the array when it was mounted
+pthread_mutex_t walLock = PTHREAD_MUTEX_INITIALIZER;	//held while the buffer and the log are used
+
+
+//Functional Prototypes
+int writeLog ( void );
+int replayLog ( void );
+int readRecord ( unsigned char *buf, uint32_t len );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_set_file
+// Description  : Sets the file the server logs its writes to. It is opened when
+//		  the array is mounted.
+//
+// Inputs       : file - the log file ( NULL for no log )
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_wal_set_file ( char *file ) {
+
+	free ( walFile );
+	walFile = NULL;
+	if ( file != NULL && ( walFile = strdup ( file ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_set_file:Failed to save the log file [%s]", strerror(errno) );
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_enabled
+// Description  : Tells if the server logs its writes
+//
+// Inputs       : none
+// Outputs      : 1 if it does, 0 if not
+
+int smsa_wal_enabled ( void ) {
+
+	return ( walFile != NULL );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_recover
+// Description  : Opens the log once the array has been mounted ( and loaded
+//		  from the disk file ). The writes a crash left in it are replayed
+//		  into the array, which is then checkpointed, so the log starts
+//		  out empty.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_wal_recover ( void ) {
+
+	if ( walFile == NULL || walHandle != -1 )
+		return 0;
+
+	if ( ( walHandle = open ( walFile, O_RDWR|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR ) ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_recover:Failed to open the log [%s] [%s]", walFile, strerror(errno) );
+		return -1;
+	}
+	walBuffered = 0;
+	walUnsynced = 0;
+	walSize = 0;
+	walFailed = 0;
+
+	if ( replayLog () || smsa_wal_checkpoint () ) {
+		close ( walHandle );
+		walHandle = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_append
+// Description  : Adds a write or format to the log. It is in memory until the
+//		  log is committed, which the server does before it acknowledges
+//		  it. A buffer that fills up is written out first, but not synced.
+//
+// Inputs       : cmd - SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+//		  drum - the drum of the write
+//		  block - the first block of the write ( ignored by a format )
+//		  count - the number of blocks ( ignored by a format )
+//		  blocks - the blocks written ( ignored by a format )
+// Outputs      : none
+
+void smsa_wal_append ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count, unsigned char *blocks ) {
+
+	SMSA_WAL_RECORD record;		//header of the record
+	unsigned char *buf;		//where the record goes in the buffer
+	uint32_t len;			//length of the record
+	uint32_t checksum;
+
+
+	if ( walHandle == -1 )
+		return;
+
+	if ( cmd == SMSA_FORMAT_DRUM ) {
+		block = 0;
+		count = 0;
+	}
+	len = sizeof(SMSA_WAL_RECORD) + count*SMSA_BLOCK_SIZE;
+
+	memset ( &record, 0, sizeof(record) );
+	record.magic = SMSA_WAL_MAGIC;
+	record.cmd = cmd;
+	record.drum = drum;
+	record.block = block;
+	record.count = count;
+
+	pthread_mutex_lock ( &walLock );
+	if ( walBuffered + len > SMSA_WAL_BUFFER && writeLog () )
+		walFailed = 1;
+
+	//the checksum is taken over the record in the buffer, then put in it
+	buf = &walBuffer[walBuffered];
+	memcpy ( buf, &record, sizeof(record) );
+	if ( count > 0 )
+		memcpy ( &buf[sizeof(record)], blocks, count*SMSA_BLOCK_SIZE );
+	checksum = smsa_crc32 ( &buf[offsetof(SMSA_WAL_RECORD, cmd)], len - offsetof(SMSA_WAL_RECORD, cmd) );
+	memcpy ( &buf[offsetof(SMSA_WAL_RECORD, checksum)], &checksum, sizeof(checksum) );
+	walBuffered += len;
+	walRecords++;
+	pthread_mutex_unlock ( &walLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_commit
+// Description  : Writes the records added since the last commit, and syncs the
+//		  log, so every write they cover survives a crash. Once a record
+//		  could not be written, no commit succeeds again.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_wal_commit ( void ) {
+
+	int ret;
+
+	if ( walHandle == -1 )
+		return 0;
+
+	pthread_mutex_lock ( &walLock );
+	if ( walBuffered > 0 && writeLog () )
+		walFailed = 1;
+	if ( !walFailed && walUnsynced > 0 ) {
+		if ( fdatasync ( walHandle ) == -1 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_commit:Failed to sync the log [%s]", strerror(errno) );
+			walFailed = 1;
+		}
+		else {
+			walUnsynced = 0;
+			walCommits++;
+		}
+	}
+	ret = ( walFailed ) ? -1 : 0;
+	pthread_mutex_unlock ( &walLock );
+
+	return ret;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_checkpoint_due
+// Description  : Tells if the log has grown to SMSA_WAL_CHECKPOINT bytes. The
+//		  workers may be logging writes meanwhile, so it takes walLock
+//
+// Inputs       : none
+// Outputs      : 1 if a checkpoint is due, 0 if not
+
+int smsa_wal_checkpoint_due ( void ) {
+
+	int due;	//true if the log has grown enough
+
+	pthread_mutex_lock ( &walLock );
+	due = ( walHandle != -1 && walSize + walBuffered >= SMSA_WAL_CHECKPOINT );
+	pthread_mutex_unlock ( &walLock );
+
+	return due;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_checkpoint
+// Description  : Folds the log into the disk file. The log is committed, then
+//		  the blocks changed since the last store are written to the disk
+//		  file and synced, and only then is the log emptied. A crash in
+//		  between replays writes the file already has, which leaves it
+//		  the same. Nothing may write to the array while this runs.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int smsa_wal_checkpoint ( void ) {
+
+	if ( walHandle == -1 )
+		return 0;
+
+	if ( smsa_wal_commit () )
+		return -1;
+
+	if ( SMSAStoreArray () ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_checkpoint:Failed to store the array, keeping the log" );
+		return -1;
+	}
+
+	pthread_mutex_lock ( &walLock );
+	if ( ftruncate ( walHandle, 0 ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_checkpoint:Failed to empty the log [%s]", strerror(errno) );
+		pthread_mutex_unlock ( &walLock );
+		return -1;
+	}
+	walSize = 0;
+	walCheckpoints++;
+	pthread_mutex_unlock ( &walLock );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_wal_close
+// Description  : Closes the log once the array is unmounted. If the array was
+//		  stored, the log is emptied, and otherwise whatever is left in
+//		  the buffer is committed, so the next mount can replay it.
+//
+// Inputs       : stored - true if the array was stored to the disk file
+// Outputs      : none
+
+void smsa_wal_close ( int stored ) {
+
+	if ( walHandle == -1 )
+		return;
+
+	if ( stored && ftruncate ( walHandle, 0 ) == -1 )
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_close:Failed to empty the log [%s]", strerror(errno) );
+	if ( !stored && smsa_wal_commit () )
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_wal_close:Failed to commit the log, the last writes are lost" );
+
+	close ( walHandle );
+	walHandle = -1;
+	walBuffered = 0;
+	walSize = 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_log_wal_stats
+// Description  : Logs how many writes were logged, how many syncs they took,
+//		  and how often the log was checkpointed. It logs nothing if the
+//		  server has no log
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_log_wal_stats ( void ) {
+
+	if ( walFile == NULL )
+		return;
+
+	logMessage ( LOG_OUTPUT_LEVEL, "Server logged %llu writes in %llu commits, checkpointed %llu times, replayed %llu writes when mounting",
+			(unsigned long long)walRecords, (unsigned long long)walCommits,
+			(unsigned long long)walCheckpoints, (unsigned long long)walReplayed );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeLog
+// Description  : Writes the buffered records to the end of the log. It is
+//		  called with walLock held.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int writeLog ( void ) {
+
+	uint32_t sent = 0;	//bytes written so far
+	ssize_t sb;
+
+
+	while ( sent < walBuffered ) {
+		if ( ( sb = write ( walHandle, &walBuffer[sent], walBuffered - sent ) ) == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			logMessage ( LOG_ERROR_LEVEL, "_writeLog:Failed to write the log [%s]", strerror(errno) );
+			walBuffered = 0;
+			return 1;
+		}
+		sent += sb;
+	}
+
+	walUnsynced += walBuffered;
+	walSize += walBuffered;
+	walBuffered = 0;
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replayLog
+// Description  : Performs every record in the log on the array, in order. The
+//		  replay stops at the end of the log, or at a record that was only
+//		  partly written, is not one, or does not match its checksum,
+//		  since nothing after it was acknowledged.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, 1 if failure
+
+int replayLog ( void ) {
+
+	SMSA_WAL_RECORD record;		//header of a record
+	unsigned char *buf;		//the record, blocks included
+	uint32_t len;			//length of the record
+	uint32_t checksum;
+	off_t offset = 0;		//where the record is in the log
+	uint64_t replayed = 0;		//records replayed from the log
+	int ret = 0;
+
+
+	if ( lseek ( walHandle, 0, SEEK_SET ) == -1 ||
+			( buf = malloc ( sizeof(SMSA_WAL_RECORD) + SMSA_NET_MAX_PAYLOAD ) ) == NULL ) {
+		logMessage ( LOG_ERROR_LEVEL, "_replayLog:Failed to set up the replay [%s]", strerror(errno) );
+		return 1;
+	}
+
+	while ( ret == 0 && readRecord ( buf, sizeof(record) ) == 0 ) {
+
+		memcpy ( &record, buf, sizeof(record) );
+		if ( record.magic != SMSA_WAL_MAGIC || record.drum >= SMSA_DISK_ARRAY_SIZE ||
+				( record.cmd != SMSA_DISK_WRITE && record.cmd != SMSA_FORMAT_DRUM ) ||
+				record.count > SMSA_NET_MAX_BLOCKS || record.block + record.count > SMSA_MAX_BLOCK_ID )
+			break;
+
+		len = sizeof(record) + record.count*SMSA_BLOCK_SIZE;
+		if ( readRecord ( &buf[sizeof(record)], len - sizeof(record) ) )
+			break;
+		checksum = smsa_crc32 ( &buf[offsetof(SMSA_WAL_RECORD, cmd)], len - offsetof(SMSA_WAL_RECORD, cmd) );
+		if ( checksum != record.checksum )
+			break;
+
+		if ( record.cmd == SMSA_FORMAT_DRUM )
+			ret = SMSAFormatDrumAt ( record.drum );
+		else if ( record.count > 0 )
+			ret = SMSAWriteBlocksAt ( record.drum, record.block, record.count, &buf[sizeof(record)] );
+		offset += len;
+		replayed++;
+	}
+	free ( buf );
+	walReplayed += replayed;
+
+	if ( ret ) {
+		logMessage ( LOG_ERROR_LEVEL, "_replayLog:Failed to replay the log at byte %lld", (long long)offset );
+		return 1;
+	}
+	if ( lseek ( walHandle, 0, SEEK_END ) > offset )
+		logMessage ( LOG_WARNING_LEVEL, "Log [%s] ends with a torn record at byte %lld, dropping it", walFile, (long long)offset );
+	if ( replayed > 0 )
+		logMessage ( LOG_INFO_LEVEL, "Replayed %llu writes from the log [%s]", (unsigned long long)replayed, walFile );
+
+	return 0;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readRecord
+// Description  : Reads the next len bytes of the log
+//
+// Inputs       : buf - where the bytes go
+//		  len - the number of bytes
+// Outputs      : 0 if successful, 1 if the log ended first or failed
+
+int readRecord ( unsigned char *buf, uint32_t len ) {
+
+	uint32_t got = 0;	//bytes read so far
+	ssize_t rb;
+
+
+	while ( got < len ) {
+		if ( ( rb = read ( walHandle, &buf[got], len - got ) ) == -1 && errno == EINTR )
+			continue;
+		if ( rb <= 0 )
+			return 1;
+		got += rb;
+	}
+
+	return 0;
+}
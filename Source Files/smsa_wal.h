@@ -0,0 +1,72 @@
+#ifndef SMSA_WAL_INCLUDED
+#define SMSA_WAL_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_wal.h
+//  Description    : This is the write-ahead log of the SMSA server. Every write
+//                   and format is logged before it is acknowledged, and the log
+//                   is folded into the disk file at checkpoints, see smsa_wal.c.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_network.h>
+
+// Defines
+#define SMSA_WAL_MAGIC 0x534d4c32				// "SML2", starts every record of the log
+#define SMSA_WAL_BUFFER (4*SMSA_NET_MAX_FRAME_SIZE)		// most bytes of records kept before they are written
+#define SMSA_WAL_CHECKPOINT (4*MAX_SMSA_VIRTUAL_ADDRESS)	// bytes of log that make a checkpoint due
+
+//
+// Type Definitions
+
+// This is the header of one record of the log. The blocks of a write follow
+// it, and the checksum covers everything after itself, the blocks included
+typedef struct {
+	uint32_t	magic;		// SMSA_WAL_MAGIC
+	uint32_t	checksum;	// CRC32 of the rest of the record
+	uint8_t		cmd;		// SMSA_DISK_WRITE or SMSA_FORMAT_DRUM
+	uint8_t		drum;		// drum of the write
+	uint16_t	count;		// blocks that follow ( 0 for a format )
+	uint32_t	block;		// first block of the write ( 0 for a format )
+} SMSA_WAL_RECORD;
+
+
+//
+// Funtional Prototypes
+
+// Set the file the server logs its writes to ( NULL for no log )
+int smsa_wal_set_file ( char *file );
+
+// Tell if the server logs its writes
+int smsa_wal_enabled ( void );
+
+// Open the log once the array is mounted, replaying what it holds into the array
+int smsa_wal_recover ( void );
+
+// Add a write or format to the log, it is durable once the log is committed
+void smsa_wal_append ( SMSA_DISK_COMMAND cmd, SMSA_DRUM_ID drum, SMSA_BLOCK_ID block, uint16_t count, unsigned char *blocks );
+
+// Write and sync everything added to the log since the last commit
+int smsa_wal_commit ( void );
+
+// Tell if the log has grown enough for a checkpoint
+int smsa_wal_checkpoint_due ( void );
+
+// Fold the log into the disk file and empty it, with no writes in progress
+int smsa_wal_checkpoint ( void );
+
+// Close the log once the array is unmounted, emptying it if the array was stored
+void smsa_wal_close ( int stored );
+
+// Log how many writes were logged, committed and checkpointed
+void smsa_log_wal_stats ( void );
+
+#endif
@@ -0,0 +1,351 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File          : smsa_worker.c
+//  Description   : This is the worker pool the server hands drum operations to.
+//		    The I/O thread queues operations with smsa_submit_work, and the
+//		    workers perform them under a reader/writer lock on the drum they
+//		    touch, so operations on different drums ( and reads of the same
+//		    drum ) run at the same time on different cores.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_internal.h>
+#include <smsa_worker.h>
+#include <smsa_hot.h>
+#include <smsa_lease.h>
+#include <smsa_replica.h>
+#include <smsa_wal.h>
+#include <smsa_snapshot.h>
+#include <cmpsc311_log.h>
+
+
+// Global Variables
+pthread_mutex_t workLock = PTHREAD_MUTEX_INITIALIZER;	//protects everything below it
+pthread_cond_t workReady = PTHREAD_COND_INITIALIZER;	//signaled when work is queued
+pthread_cond_t workDrained = PTHREAD_COND_INITIALIZER;	//signaled when pendingWork reaches 0
+SMSA_WORK *workHead = NULL, *workTail = NULL;		//operations waiting for a worker
+SMSA_WORK *doneHead = NULL, *doneTail = NULL;		//operations waiting for the I/O thread
+int pendingWork = 0;					//operations submitted but not yet performed
+int stopWorkers = 0;					//true when the workers should exit
+pthread_t workerThreads[SMSA_MAX_WORKERS];		//the worker threads
+int workerCount = 0;					//number of worker threads running
+int doneEvent = -1;					//eventfd the I/O thread waits on
+
+pthread_rwlock_t drumLocks[SMSA_MAX_DISK_ARRAY_SIZE];	//one reader/writer lock per drum
+
+
+//Functional Prototypes
+void *workerThread ( void *arg );
+void performWork ( SMSA_WORK *work );
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_start_workers
+// Description  : Sets up the drum locks and starts the worker threads. The I/O
+//		  thread should wait on the returned eventfd along with its sockets,
+//		  and call smsa_finished_work whenever it is readable.
+//
+// Inputs       : workers - number of worker threads to start
+// Outputs      : the eventfd if successful, -1 if failure
+
+int smsa_start_workers ( int workers ) {
+
+	int i, err;
+
+	if ( workers < 1 || workers > SMSA_MAX_WORKERS ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_start_workers:Bad number of workers [%d]", workers );
+		return -1;
+	}
+
+	if ( ( doneEvent = eventfd ( 0, EFD_NONBLOCK ) ) == -1 ) {
+		logMessage ( LOG_ERROR_LEVEL, "_smsa_start_workers:Failed to create the eventfd [%s]", strerror(errno) );
+		return -1;
+	}
+
+	for ( i = 0; i < SMSA_MAX_DISK_ARRAY_SIZE; i++ )
+		pthread_rwlock_init ( &drumLocks[i], NULL );
+
+	stopWorkers = 0;
+	for ( workerCount = 0; workerCount < workers; workerCount++ ) {
+		if ( ( err = pthread_create ( &workerThreads[workerCount], NULL, workerThread, NULL ) ) != 0 ) {
+			logMessage ( LOG_ERROR_LEVEL, "_smsa_start_workers:Failed to start a worker [%s]", strerror(err) );
+			smsa_stop_workers ();
+			return -1;
+		}
+	}
+
+	logMessage ( LOG_INFO_LEVEL, "Started %d Worker Threads", workerCount );
+	return doneEvent;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_stop_workers
+// Description  : Lets the workers finish what has been queued, then waits for
+//		  all of them to exit.
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_stop_workers ( void ) {
+
+	int i;
+
+	pthread_mutex_lock ( &workLock );
+	stopWorkers = 1;
+	pthread_cond_broadcast ( &workReady );
+	pthread_mutex_unlock ( &workLock );
+
+	for ( i = 0; i < workerCount; i++ )
+		pthread_join ( workerThreads[i], NULL );
+	workerCount = 0;
+
+	if ( doneEvent != -1 ) {
+		close ( doneEvent );
+		doneEvent = -1;
+	}
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_submit_work
+// Description  : Adds an operation to the end of the work queue and wakes up a
+//		  worker to perform it
+//
+// Inputs       : work - the operation
+// Outputs      : none
+
+void smsa_submit_work ( SMSA_WORK *work ) {
+
+	work->next = NULL;
+
+	pthread_mutex_lock ( &workLock );
+	if ( workTail == NULL )
+		workHead = work;
+	else
+		workTail->next = work;
+	workTail = work;
+	pendingWork++;
+	pthread_cond_signal ( &workReady );
+	pthread_mutex_unlock ( &workLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_finished_work
+// Description  : Takes the oldest operation the workers have finished. Each
+//		  finished operation is handed back exactly once, and the caller
+//		  is then responsible for it.
+//
+// Inputs       : none
+// Outputs      : the operation, or NULL if none have finished
+
+SMSA_WORK *smsa_finished_work ( void ) {
+
+	SMSA_WORK *work;
+	uint64_t count;
+
+	//reset the eventfd before looking, so work finished after we look
+	//makes it readable again
+	read ( doneEvent, &count, sizeof(count) );
+
+	pthread_mutex_lock ( &workLock );
+	if ( ( work = doneHead ) != NULL ) {
+		doneHead = work->next;
+		if ( doneHead == NULL )
+			doneTail = NULL;
+	}
+	pthread_mutex_unlock ( &workLock );
+
+	return work;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : smsa_drain_workers
+// Description  : Waits until every operation that was submitted has been performed.
+//		  The I/O thread calls this before it calls into the library itself
+//		  ( mounting, unmounting ), so that the library is never used from the
+//		  I/O thread and a worker at the same time.
+//
+// Inputs       : none
+// Outputs      : none
+
+void smsa_drain_workers ( void ) {
+
+	pthread_mutex_lock ( &workLock );
+	while ( pendingWork > 0 )
+		pthread_cond_wait ( &workDrained, &workLock );
+	pthread_mutex_unlock ( &workLock );
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : workerThread
+// Description  : The loop each worker runs. It takes operations off the front of
+//		  the work queue, performs them, and puts them on the finished queue
+//		  for the I/O thread.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *workerThread ( void *arg ) {
+
+	SMSA_WORK *work;
+	uint64_t one = 1;
+
+	pthread_mutex_lock ( &workLock );
+	while ( 1 ) {
+
+		//wait for work, or to be told to stop
+		while ( workHead == NULL && !stopWorkers )
+			pthread_cond_wait ( &workReady, &workLock );
+		if ( workHead == NULL )
+			break;
+
+		work = workHead;
+		workHead = work->next;
+		if ( workHead == NULL )
+			workTail = NULL;
+
+		//do the operation without holding the queue lock
+		pthread_mutex_unlock ( &workLock );
+		performWork ( work );
+		pthread_mutex_lock ( &workLock );
+
+		//hand it back to the I/O thread
+		work->next = NULL;
+		if ( doneTail == NULL )
+			doneHead = work;
+		else
+			doneTail->next = work;
+		doneTail = work;
+		if ( --pendingWork == 0 )
+			pthread_cond_broadcast ( &workDrained );
+		write ( doneEvent, &one, sizeof(one) );
+	}
+	pthread_mutex_unlock ( &workLock );
+
+	return NULL;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : performWork
+// Description  : Performs one operation at its drum and block with
+//		  smsa_operation_at. Reads and signatures only share the drum with
+//		  each other, while writes and formats need the drum to themselves.
+//		  A read or write of more than one block is one operation, so it
+//		  does all of the blocks or none of them. The drum lock here is held
+//		  around the library's own, since everything below changes with
+//		  the drum. The hot block cache is filled and updated 
+//		  under the drum lock too, so it changes in the same order as the
+//		  drum, and so do the leases of the connection ( see smsa_lease.c ).
+//		  A write or format copies its drum into the image of the array
+//		  first, if there is one, and an export writes the image without
+//		  any drum lock, since the image does not change.
+//
+// Inputs       : work - the operation
+// Outputs      : none
+
+void performWork ( SMSA_WORK *work ) {
+
+	uint64_t start;		//when the read started, for timing the misses of the cache
+	uint64_t nanos;		//time the read took for each block
+	int i;
+
+	if ( work->drum >= SMSA_DISK_ARRAY_SIZE ) {
+		logMessage ( LOG_ERROR_LEVEL, "_performWork:Illegal drum [%u]", work->drum );
+		work->ret = -1;
+		return;
+	}
+
+	switch ( (uint32_t)work->cmd ) {
+
+		case SMSA_NET_EXPORT:
+			work->ret = smsa_snapshot_export ();
+			return;
+
+		case SMSA_DISK_READ:
+			pthread_rwlock_rdlock ( &drumLocks[work->drum] );
+			start = smsa_hot_now ();
+			work->ret = smsa_operation_at ( work->cmd, work->drum, work->block, work->count, work->buf );
+			if ( work->ret == 0 ) {
+				//each block took its share of the time the read took
+				nanos = ( smsa_hot_now () - start ) / work->count;
+				for ( i = 0; i < work->count; i++ )
+					smsa_hot_fill ( work->drum, work->block+i, &work->buf[i*SMSA_BLOCK_SIZE], nanos );
+			}
+			smsa_lease_follow ( work->lease, work->cmd, work->drum, work->block, work->count, work->ret );
+			break;
+
+		case SMSA_BLOCK_SIGN:
+			pthread_rwlock_rdlock ( &drumLocks[work->drum] );
+			work->ret = smsa_operation_at ( work->cmd, work->drum, work->block, 1, NULL );
+			break;
+
+		case SMSA_DISK_WRITE:
+			pthread_rwlock_wrlock ( &drumLocks[work->drum] );
+			smsa_snapshot_preserve ( work->drum );
+			work->ret = smsa_operation_at ( work->cmd, work->drum, work->block, work->count, work->buf );
+			if ( work->ret == 0 ) {
+				for ( i = 0; i < work->count; i++ )
+					smsa_hot_update ( work->drum, work->block+i, &work->buf[i*SMSA_BLOCK_SIZE] );
+			}
+			work->revoked = smsa_lease_follow ( work->lease, work->cmd, work->drum, work->block, work->count, work->ret );
+			//the log and the followers get the blocks that were written in
+			//the order the drum lock puts them in
+			if ( work->ret == 0 ) {
+				smsa_wal_append ( work->cmd, work->drum, work->block, work->count, work->buf );
+				work->seq = smsa_replica_forward ( work->cmd, work->drum, work->block, work->count, work->buf );
+			}
+			break;
+
+		case SMSA_FORMAT_DRUM:
+			pthread_rwlock_wrlock ( &drumLocks[work->drum] );
+			smsa_snapshot_preserve ( work->drum );
+			work->ret = smsa_operation_at ( work->cmd, work->drum, 0, 0, NULL );
+			if ( work->ret == 0 )
+				smsa_hot_invalidate_drum ( work->drum );
+			work->revoked = smsa_lease_follow ( work->lease, work->cmd, work->drum, 0, 0, work->ret );
+			if ( work->ret == 0 ) {
+				smsa_wal_append ( work->cmd, work->drum, 0, 0, NULL );
+				work->seq = smsa_replica_forward ( work->cmd, work->drum, 0, 0, NULL );
+			}
+			break;
+
+		default:
+			logMessage ( LOG_ERROR_LEVEL, "_performWork:Bad command [%d]", work->cmd );
+			work->ret = -1;
+			return;
+	}
+
+	pthread_rwlock_unlock ( &drumLocks[work->drum] );
+}
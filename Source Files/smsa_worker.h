@@ -0,0 +1,64 @@
+#ifndef SMSA_WORKER_INCLUDED
+#define SMSA_WORKER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : smsa_worker.h
+//  Description    : This is the worker pool the server hands drum operations to.
+//
+//   Author        : Gabe Harms
+//   Last Modified : Mon Oct 28 06:58:31 EDT 2013
+//
+
+// Include Files
+#include <stdint.h>
+
+// Project Include Files
+#include <smsa.h>
+#include <smsa_server.h>
+
+// Defines
+#define SMSA_MAX_WORKERS 64		// most worker threads the server will start
+
+//
+// Type Definitions
+
+// This is one operation handed to the workers. The I/O thread fills in
+// everything but ret, revoked and seq, a worker performs it and fills them in ( and
+// buf for a read ), then the I/O thread sends the response. A read or write covers
+// count blocks of the drum, and buf is allocated with room for all of them
+typedef struct smsa_work {
+	SMSA_CONNECTION	*conn;		// connection the operation came from
+	uint32_t	op;		// opcode the client sent, returned in the response
+	SMSA_DISK_COMMAND cmd;		// SMSA_DISK_READ, SMSA_DISK_WRITE, SMSA_FORMAT_DRUM, SMSA_BLOCK_SIGN or SMSA_NET_EXPORT
+	SMSA_DRUM_ID	drum;		// drum to operate on
+	SMSA_BLOCK_ID	block;		// block to operate on ( ignored by a format )
+	uint16_t	count;		// blocks to read or write, starting at block
+	int16_t		ret;		// return of the operation
+	int		lease;		// lease slot of the connection ( -1 if none )
+	uint64_t	revoked;	// lease slots the operation revoked, see smsa_lease.c
+	uint32_t	seq;		// sequence number the followers got a write under ( 0 if none )
+	struct smsa_work *next;		// next operation in the queue it is on
+	unsigned char	buf[];		// blocks to write, or the blocks that were read
+} SMSA_WORK;
+
+
+//
+// Funtional Prototypes
+
+// Start the worker threads, returns an eventfd that is readable when work finishes
+int smsa_start_workers ( int workers );
+
+// Stop the worker threads once they finish the work they have been given
+void smsa_stop_workers ( void );
+
+// Hand an operation to the workers
+void smsa_submit_work ( SMSA_WORK *work );
+
+// Take the next operation the workers have finished ( NULL if there are none )
+SMSA_WORK *smsa_finished_work ( void );
+
+// Wait until the workers have performed everything they were given
+void smsa_drain_workers ( void );
+
+#endif